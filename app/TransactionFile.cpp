@@ -108,6 +108,10 @@ void TransactionFile::addTransaction(const QSharedPointer<ama::Transaction> &tx)
         return;
     }
 
+    // One consistent copy of each, however far the exchange has got.
+    auto request = tx->request();
+    auto response = tx->response();
+
     QSqlQuery q(db_);
     if (!q.prepare("INSERT INTO tx (id) VALUES (?)"))
     {
@@ -133,11 +137,11 @@ void TransactionFile::addTransaction(const QSharedPointer<ama::Transaction> &tx)
     }
 
     q.bindValue(0, tx->id());
-    q.bindValue(1, tx->request().method());
-    q.bindValue(2, tx->request().uri());
-    q.bindValue(3, tx->request().major_version());
-    q.bindValue(4, tx->request().minor_version());
-    q.bindValue(5, tx->request().body());
+    q.bindValue(1, request.method());
+    q.bindValue(2, request.uri());
+    q.bindValue(3, request.major_version());
+    q.bindValue(4, request.minor_version());
+    q.bindValue(5, request.body());
 
     if (!q.exec())
     {
@@ -158,14 +162,11 @@ void TransactionFile::addTransaction(const QSharedPointer<ama::Transaction> &tx)
     QVariantList messageIds;
     QVariantList names;
     QVariantList values;
-    for (const auto& name : tx->request().headers().names())
+    for (const auto& field : request.headers())
     {
-        for (const auto& value : tx->request().headers().find_by_name(name))
-        {
-            messageIds << requestId;
-            names << name;
-            values << value;
-        }
+        messageIds << requestId;
+        names << field.name_string();
+        values << field.value_string();
     }
 
     q = QSqlQuery(db_);
@@ -196,11 +197,11 @@ void TransactionFile::addTransaction(const QSharedPointer<ama::Transaction> &tx)
     }
 
     q.bindValue(0, tx->id());
-    q.bindValue(1, tx->response().status_code());
-    q.bindValue(2, tx->response().status_message());
-    q.bindValue(3, tx->response().major_version());
-    q.bindValue(4, tx->response().minor_version());
-    q.bindValue(5, tx->response().body());
+    q.bindValue(1, response.status_code());
+    q.bindValue(2, response.status_message());
+    q.bindValue(3, response.major_version());
+    q.bindValue(4, response.minor_version());
+    q.bindValue(5, response.body());
 
     if (!q.exec())
     {
@@ -221,14 +222,11 @@ void TransactionFile::addTransaction(const QSharedPointer<ama::Transaction> &tx)
     messageIds.clear();
     names.clear();
     values.clear();
-    for (const auto& name : tx->response().headers().names())
+    for (const auto& field : response.headers())
     {
-        for (const auto& value : tx->response().headers().find_by_name(name))
-        {
-            messageIds << responseId;
-            names << name;
-            values << value;
-        }
+        messageIds << responseId;
+        names << field.name_string();
+        values << field.value_string();
     }
 
     q = QSqlQuery(db_);
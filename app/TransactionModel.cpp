@@ -17,6 +17,7 @@
 
 #include "TransactionModel.h"
 
+#include <QLocale>
 #include <QTextStream>
 
 #include <algorithm>
@@ -100,9 +101,20 @@ QVariant TransactionModel::data(const QModelIndex &index, int role) const
     case 0:
         return tx->request().method();
     case 1:
-        return QStringLiteral("%1 %2")
-                .arg(tx->response().status_code())
-                .arg(tx->response().status_message());
+        if (tlsTransactionIds_.contains(tx->id()))
+        {
+            QLocale locale;
+            return QStringLiteral("Tunnel: %1 sent, %2 received")
+                    .arg(locale.formattedDataSize(tx->tunnel_bytes_to_remote()))
+                    .arg(locale.formattedDataSize(tx->tunnel_bytes_to_client()));
+        }
+        else
+        {
+            auto response = tx->response();
+            return QStringLiteral("%1 %2")
+                    .arg(response.status_code())
+                    .arg(response.status_message());
+        }
     case 2:
         return tx->request().uri();
     default:
@@ -136,6 +148,7 @@ void TransactionModel::transactionStarted(const QSharedPointer<ama::Transaction>
     connect(tx.get(), &ama::Transaction::on_response_read, this, &TransactionModel::transactionUpdated);
     connect(tx.get(), &ama::Transaction::on_transaction_failed, this, &TransactionModel::transactionUpdated);
     connect(tx.get(), &ama::Transaction::on_transaction_complete, this, &TransactionModel::transactionUpdated);
+    connect(tx.get(), &ama::Transaction::on_tunnel_progress, this, &TransactionModel::transactionUpdated);
 
     endInsertRows();
 }
@@ -0,0 +1,26 @@
+# Option parsing, filtering, timing and reporting, shared by every
+# benchmark; see benchmark/BenchmarkHarness.h.
+add_library(benchmark_harness STATIC "${CMAKE_CURRENT_LIST_DIR}/benchmark/BenchmarkHarness.cpp")
+target_include_directories(benchmark_harness PUBLIC "${CMAKE_CURRENT_LIST_DIR}/benchmark")
+set_target_properties(benchmark_harness PROPERTIES FOLDER benchmarks)
+
+macro(add_benchmark SUBJECT BENCHNAME)
+    set(_BENCH_EXE "${SUBJECT}_bench_${BENCHNAME}")
+    add_executable(${_BENCH_EXE} ${ARGN})
+    target_link_libraries(${_BENCH_EXE} ${SUBJECT} benchmark_harness)
+    set_target_properties(${_BENCH_EXE} PROPERTIES
+        CMAKE_INCLUDE_CURRENT_DIR ON
+        FOLDER benchmarks
+    )
+
+    if(WIN32)
+        target_compile_definitions(${_BENCH_EXE} PRIVATE -D_WIN32_WINNT=${MIN_WINNT_VER})
+    endif(WIN32)
+
+    # A single pass over every case is enough to catch a benchmark that no
+    # longer runs; the numbers themselves are only meaningful from a
+    # release build, run by hand.
+    if(BUILD_TESTS)
+        add_test(NAME bench_${BENCHNAME} COMMAND ${_BENCH_EXE} --min-time 0)
+    endif()
+endmacro()
@@ -0,0 +1,295 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "BenchmarkHarness.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+namespace ama
+{
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Past this many iterations, a batch is reported however short it was.
+constexpr uint64_t kMaxIterations = uint64_t{1} << 40;
+
+} // namespace
+
+BenchmarkValue::BenchmarkValue(const char* name)
+    : BenchmarkValue(std::string(name))
+{}
+
+BenchmarkValue::BenchmarkValue(std::string name)
+    : kind_(Kind::Name)
+    , text_(std::move(name))
+    , rate_(0)
+{}
+
+BenchmarkValue::BenchmarkValue(double rate)
+    : kind_(Kind::Rate)
+    , text_()
+    , rate_(rate)
+{}
+
+BenchmarkHarness::BenchmarkHarness(std::string name)
+    : name_(std::move(name))
+    , json_(false)
+    , filter_()
+    , min_time_(0.5)
+{}
+
+void BenchmarkHarness::add_option(const char* flag, const char* value_name, std::function<bool(const char*)> parse)
+{
+    options_.push_back({ flag, value_name, std::move(parse) });
+}
+
+void BenchmarkHarness::set_columns(std::vector<BenchmarkColumn> columns)
+{
+    columns_ = std::move(columns);
+}
+
+bool BenchmarkHarness::parse_args(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (std::strcmp(arg, "--json") == 0)
+        {
+            json_ = true;
+            continue;
+        }
+
+        if (!has_value)
+        {
+            print_usage();
+            return false;
+        }
+
+        if (std::strcmp(arg, "--filter") == 0)
+        {
+            filter_ = argv[++i];
+            continue;
+        }
+
+        if (std::strcmp(arg, "--min-time") == 0)
+        {
+            min_time_ = std::strtod(argv[++i], nullptr);
+            continue;
+        }
+
+        bool parsed = false;
+        for (const auto& option : options_)
+        {
+            if (std::strcmp(arg, option.flag) == 0)
+            {
+                parsed = option.parse(argv[++i]);
+                break;
+            }
+        }
+
+        if (!parsed)
+        {
+            print_usage();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool BenchmarkHarness::json() const
+{
+    return json_;
+}
+
+double BenchmarkHarness::min_time() const
+{
+    return min_time_;
+}
+
+bool BenchmarkHarness::selected(const std::string& name) const
+{
+    return filter_.empty() || name.find(filter_) != std::string::npos;
+}
+
+BenchmarkHarness::Measurement BenchmarkHarness::measure(const std::function<void(uint64_t)>& batch) const
+{
+    uint64_t iterations = 1;
+    double seconds = 0;
+    for (;;)
+    {
+        auto start = Clock::now();
+        batch(iterations);
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        if (seconds >= min_time_ || iterations >= kMaxIterations)
+        {
+            break;
+        }
+        iterations *= 2;
+    }
+    return { iterations, seconds };
+}
+
+void BenchmarkHarness::add_property(std::string key, BenchmarkValue value)
+{
+    properties_.emplace_back(std::move(key), std::move(value));
+}
+
+void BenchmarkHarness::add_result(std::vector<BenchmarkValue> values)
+{
+    if (values.size() != columns_.size())
+    {
+        std::cerr << name_ << ": a result has " << values.size() << " values for " << columns_.size() << " columns" << std::endl;
+        std::abort();
+    }
+    results_.push_back(std::move(values));
+}
+
+void BenchmarkHarness::report() const
+{
+    if (json_)
+    {
+        print_json();
+    }
+    else
+    {
+        print_table();
+    }
+}
+
+void BenchmarkHarness::print_usage() const
+{
+    std::cerr << "usage: " << name_ << " [--json] [--filter TEXT] [--min-time SECONDS]";
+    for (const auto& option : options_)
+    {
+        std::cerr << " [" << option.flag << " " << option.value_name << "]";
+    }
+    std::cerr << std::endl;
+}
+
+void BenchmarkHarness::print_value(const BenchmarkValue& value)
+{
+    if (value.kind_ == BenchmarkValue::Kind::Rate)
+    {
+        std::cout << value.rate_;
+    }
+    else
+    {
+        std::cout << value.text_;
+    }
+}
+
+void BenchmarkHarness::print_json_value(const BenchmarkValue& value)
+{
+    if (value.kind_ == BenchmarkValue::Kind::Name)
+    {
+        std::cout << '"' << value.text_ << '"';
+    }
+    else
+    {
+        print_value(value);
+    }
+}
+
+void BenchmarkHarness::print_table() const
+{
+    for (const auto& [key, value] : properties_)
+    {
+        std::cout << key << ": ";
+        print_value(value);
+        std::cout << '\n';
+    }
+
+    for (const auto& column : columns_)
+    {
+        if (column.heading != nullptr)
+        {
+            std::cout << (column.left ? std::left : std::right) << std::setw(column.width) << column.heading;
+        }
+    }
+    std::cout << '\n';
+
+    std::cout << std::fixed;
+    for (const auto& result : results_)
+    {
+        for (size_t i = 0; i < columns_.size(); ++i)
+        {
+            const auto& column = columns_[i];
+            const auto& value = result[i];
+            if (column.heading == nullptr)
+            {
+                continue;
+            }
+
+            std::cout << (column.left ? std::left : std::right) << std::setw(column.width) << std::setprecision(column.precision);
+            print_value(value);
+        }
+        std::cout << '\n';
+    }
+}
+
+void BenchmarkHarness::print_json() const
+{
+    std::cout << "{\n"
+              << "  \"benchmark\": \"" << name_ << "\",\n";
+
+    for (const auto& [key, value] : properties_)
+    {
+        std::cout << "  \"" << key << "\": ";
+        print_json_value(value);
+        std::cout << ",\n";
+    }
+
+    std::cout << "  \"min_time\": " << min_time_ << ",\n"
+              << "  \"results\": [";
+
+    std::cout << std::setprecision(17);
+    for (size_t i = 0; i < results_.size(); ++i)
+    {
+        std::cout << (i == 0 ? "\n" : ",\n") << "    {";
+
+        const char* separator = "";
+        for (size_t j = 0; j < columns_.size(); ++j)
+        {
+            const auto& column = columns_[j];
+            const auto& value = results_[i][j];
+            if (column.key == nullptr)
+            {
+                continue;
+            }
+
+            std::cout << separator << "\"" << column.key << "\": ";
+            print_json_value(value);
+            separator = ", ";
+        }
+
+        std::cout << "}";
+    }
+
+    std::cout << "\n  ]\n}\n";
+}
+
+} // namespace ama
@@ -0,0 +1,176 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ama
+{
+
+/**
+ * @brief One cell of a benchmark result: a name, a count, or a rate.
+ *
+ * Names are printed quoted in JSON, and must be plain identifiers, as
+ * nothing is escaped.  Rates are printed in the table to their column's
+ * precision, and in JSON to full precision.
+ */
+class BenchmarkValue
+{
+public:
+    BenchmarkValue(const char* name);
+    BenchmarkValue(std::string name);
+    BenchmarkValue(double rate);
+
+    template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+    BenchmarkValue(T count)
+        : kind_(Kind::Count)
+        , text_(std::to_string(count))
+        , rate_(0)
+    {}
+
+private:
+    friend class BenchmarkHarness;
+
+    enum class Kind { Name, Count, Rate };
+
+    Kind kind_;
+    std::string text_;
+    double rate_;
+};
+
+/**
+ * @brief How one field of a benchmark's results is reported.
+ *
+ * A field with no key is left out of the JSON document, and one with no
+ * heading is left out of the table.
+ */
+struct BenchmarkColumn
+{
+    const char* key;
+    const char* heading;
+    int width;
+    int precision = 0;
+    bool left = false;
+};
+
+/**
+ * @brief The command line and the report that every benchmark shares.
+ *
+ * Every benchmark takes --json, --filter TEXT and --min-time SECONDS, and
+ * may add options of its own.  It runs each case that @ref selected
+ * admits for at least @ref min_time seconds, hands the harness one row of
+ * values per case, and ends with @ref report, which prints either a table
+ * or a single JSON document suitable for comparing one build against
+ * another.
+ */
+class BenchmarkHarness
+{
+public:
+    /**
+     * @brief The outcome of @ref measure.
+     */
+    struct Measurement
+    {
+        uint64_t iterations;
+        double seconds;
+    };
+
+    explicit BenchmarkHarness(std::string name);
+
+    /**
+     * @brief Accepts a further option, taking one value.
+     *
+     * @param flag the option, e.g. "--seed".
+     * @param value_name how the value is shown in the usage message.
+     * @param parse called with the value; returns false if it is invalid.
+     */
+    void add_option(const char* flag, const char* value_name, std::function<bool(const char*)> parse);
+
+    /**
+     * @brief Sets the fields that make up each result, in order.
+     */
+    void set_columns(std::vector<BenchmarkColumn> columns);
+
+    /**
+     * @brief Parses the command line, printing the usage message if it
+     *        can't be.
+     */
+    bool parse_args(int argc, char* argv[]);
+
+    bool json() const;
+    double min_time() const;
+
+    /**
+     * @brief Whether the case with the given name passes --filter.
+     */
+    bool selected(const std::string& name) const;
+
+    /**
+     * @brief Calls batch(n) with ever-doubling n until one call takes at
+     *        least min_time seconds, and returns that last call.
+     */
+    Measurement measure(const std::function<void(uint64_t)>& batch) const;
+
+    /**
+     * @brief Adds a detail of the run as a whole, e.g. the random seed,
+     *        reported before the results.
+     */
+    void add_property(std::string key, BenchmarkValue value);
+
+    /**
+     * @brief Adds one result, with a value for each column.
+     */
+    void add_result(std::vector<BenchmarkValue> values);
+
+    /**
+     * @brief Prints every property and result, as a table or as JSON.
+     */
+    void report() const;
+
+private:
+    struct Option
+    {
+        const char* flag;
+        const char* value_name;
+        std::function<bool(const char*)> parse;
+    };
+
+    static void print_value(const BenchmarkValue& value);
+    static void print_json_value(const BenchmarkValue& value);
+
+    void print_usage() const;
+    void print_table() const;
+    void print_json() const;
+
+    std::string name_;
+    bool json_;
+    std::string filter_;
+    double min_time_;
+    std::vector<Option> options_;
+    std::vector<BenchmarkColumn> columns_;
+    std::vector<std::pair<std::string, BenchmarkValue>> properties_;
+    std::vector<std::vector<BenchmarkValue>> results_;
+};
+
+} // namespace ama
@@ -0,0 +1,221 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include "core/global.h"
+
+#include <cstdint>
+#include <memory>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QCryptographicHash>
+#include <QString>
+
+class QTemporaryFile;
+
+namespace ama
+{
+
+/**
+ * @brief Receives the entity of an HTTP message as HttpMessageParser
+ *        decodes it.
+ *
+ * @par A parser with a sink installed hands every run of entity bytes to
+ * the sink instead of accumulating them in the message, so what becomes of
+ * a body - kept, counted, hashed or written to disk - is up to the sink.
+ * Bytes arrive with any chunked transfer coding removed; the chunk
+ * boundaries and trailer fields are reported separately.
+ */
+class A_EXPORT BodySink
+{
+public:
+    virtual ~BodySink() = default;
+
+    /**
+     * @brief Receives the next run of entity bytes.
+     *
+     * The bytes are only valid for the duration of the call.
+     */
+    virtual void write(const char* data, size_t length) = 0;
+
+    /**
+     * @brief Called as each chunk of a chunked entity begins, with its
+     *        declared size; the last chunk has size zero.
+     */
+    virtual void begin_chunk(uint64_t size);
+
+    /**
+     * @brief Receives a trailer field that followed a chunked entity.
+     *
+     * By default, trailers are kept and can be retrieved with trailers().
+     */
+    virtual void trailer(QByteArrayView name, QByteArrayView value);
+
+    /**
+     * @brief Called once the message is complete.
+     */
+    virtual void end();
+
+    const std::vector<std::pair<QByteArray, QByteArray>>& trailers() const;
+
+private:
+    std::vector<std::pair<QByteArray, QByteArray>> trailers_;
+};
+
+/**
+ * @brief Keeps the entity in memory.
+ */
+class A_EXPORT MemoryBodySink : public BodySink
+{
+public:
+    void write(const char* data, size_t length) override;
+
+    const QByteArray& body() const;
+
+private:
+    QByteArray body_;
+};
+
+/**
+ * @brief Discards the entity, keeping only its size.
+ */
+class A_EXPORT CountingBodySink : public BodySink
+{
+public:
+    void write(const char* data, size_t length) override;
+
+    uint64_t size() const;
+
+private:
+    uint64_t size_ = 0;
+};
+
+/**
+ * @brief Discards the entity, keeping its size and a digest of its contents.
+ */
+class A_EXPORT HashingBodySink : public BodySink
+{
+public:
+    explicit HashingBodySink(QCryptographicHash::Algorithm algorithm = QCryptographicHash::Sha256);
+
+    void write(const char* data, size_t length) override;
+
+    uint64_t size() const;
+
+    /**
+     * @brief The digest of everything written so far.
+     */
+    QByteArray digest() const;
+
+private:
+    QCryptographicHash hash_;
+    uint64_t size_;
+};
+
+/**
+ * @brief Keeps the entity in memory until it outgrows a threshold, and in
+ *        a temporary file from then on.
+ *
+ * If the temporary file can't be created or written, the rest of the
+ * entity is only counted.
+ */
+class A_EXPORT SpillingBodySink : public BodySink
+{
+public:
+    explicit SpillingBodySink(qint64 threshold);
+    ~SpillingBodySink() override;
+
+    void write(const char* data, size_t length) override;
+
+    /**
+     * @brief Flushes the file, if the entity was moved to one, so that it
+     *        can be read back by name.
+     */
+    void end() override;
+
+    uint64_t size() const;
+
+    /**
+     * @brief Whether the entity was moved to a file.
+     */
+    bool spilled() const;
+
+    /**
+     * @brief The entity, if it has not been moved to a file.
+     */
+    const QByteArray& memory() const;
+
+    /**
+     * @brief The name of the file holding the entity, if it was spilled.
+     */
+    QString file_name() const;
+
+    /**
+     * @brief Reports any error writing the file.
+     */
+    std::error_code error() const;
+
+private:
+    void spill();
+
+    qint64 threshold_;
+    uint64_t size_;
+    QByteArray memory_;
+    std::unique_ptr<QTemporaryFile> file_;
+    std::error_code error_;
+};
+
+/**
+ * @brief Chooses what becomes of the bodies of captured messages.
+ */
+struct A_EXPORT CapturePolicy
+{
+    enum class Mode
+    {
+        // Bodies are kept with their messages.
+        Memory,
+
+        // Bodies are relayed and counted, but not kept.
+        Count,
+
+        // Bodies are relayed, counted and hashed, but not kept.
+        Hash,
+
+        // Bodies are kept, but in temporary files once they outgrow
+        // spill_threshold.
+        Spill,
+    };
+
+    Mode mode = Mode::Memory;
+    qint64 spill_threshold = 1024 * 1024;
+};
+
+/**
+ * @brief Creates a sink for one message body according to @p policy.
+ *
+ * Returns null for CapturePolicy::Mode::Memory, in which case bodies
+ * are simply left to accumulate in their messages.
+ */
+A_EXPORT std::shared_ptr<BodySink> make_body_sink(const CapturePolicy& policy);
+
+} // namespace ama
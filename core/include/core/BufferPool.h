@@ -0,0 +1,179 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "core/global.h"
+#include "core/ObjectPool.h"
+
+#include <array>
+#include <cstddef>
+
+#include <QtGlobal>
+
+namespace ama {
+
+class BufferPool;
+
+namespace details {
+
+void* allocate_buffer_block(std::size_t size);
+void free_buffer_block(void* block, std::size_t size) noexcept;
+
+// The unit an ObjectPool keeps for one size class.  Its memory comes from
+// the heap, or from huge-page slabs when BufferPool::set_huge_pages() is on.
+template <std::size_t Size>
+struct BufferBlock
+{
+    BufferBlock()
+    {}
+
+    static void* operator new(std::size_t size)
+    {
+        return allocate_buffer_block(size);
+    }
+
+    static void operator delete(void* block, std::size_t size) noexcept
+    {
+        free_buffer_block(block, size);
+    }
+
+    char bytes[Size];
+};
+
+} // namespace details
+
+/**
+ * @brief A buffer leased from a BufferPool for the length of some I/O.
+ *
+ * The buffer goes back to its pool when the lease is reset or destroyed,
+ * so a lease must not outlive its pool.  Leases can be moved but not
+ * copied.
+ */
+class A_EXPORT IoBuffer
+{
+public:
+    IoBuffer() noexcept = default;
+    IoBuffer(IoBuffer&& other) noexcept;
+    IoBuffer(const IoBuffer&) = delete;
+    ~IoBuffer();
+
+    IoBuffer& operator=(IoBuffer&& other) noexcept;
+    IoBuffer& operator=(const IoBuffer&) = delete;
+
+    char* data() const noexcept
+    {
+        return data_;
+    }
+
+    qsizetype size() const noexcept
+    {
+        return size_;
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return data_ != nullptr;
+    }
+
+    /**
+     * @brief Returns the buffer to its pool, leaving the lease empty.
+     */
+    void reset() noexcept;
+
+private:
+    friend class BufferPool;
+
+    IoBuffer(BufferPool* pool, void* block, char* data, qsizetype size) noexcept;
+
+    // A pooled buffer holds its block as a detached ObjectPool handle; an
+    // oversized one has no pool or block, and owns its data outright.
+    BufferPool* pool_ = nullptr;
+    void* block_ = nullptr;
+    char* data_ = nullptr;
+    qsizetype size_ = 0;
+};
+
+/**
+ * @brief Leases I/O buffers in a few fixed sizes, and keeps them for
+ *        reuse once they are returned.
+ *
+ * A request is rounded up to the smallest size class that holds it:
+ * 4, 16 or 64 KiB.  Anything larger is allocated for the one lease and
+ * freed with it.
+ *
+ * Each class is an ObjectPool, so a thread that reads and writes in a
+ * loop reuses the same few buffers from its own magazine.
+ */
+class A_EXPORT BufferPool
+{
+public:
+    static constexpr std::size_t kSmallSize = 4 * 1024;
+    static constexpr std::size_t kMediumSize = 16 * 1024;
+    static constexpr std::size_t kLargeSize = 64 * 1024;
+
+    BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    /**
+     * @brief The pool that transactions lease their buffers from.
+     */
+    static BufferPool& shared();
+
+    /**
+     * @brief Backs buffers allocated from now on with huge pages, where
+     *        the platform supports them, or stops doing so.
+     *
+     * On Linux, buffers are carved out of 2 MiB slabs that the kernel is
+     * advised to map with transparent huge pages; elsewhere this has no
+     * effect.  Buffers already allocated keep their backing.
+     */
+    static void set_huge_pages(bool enabled);
+    static bool huge_pages();
+
+    /**
+     * @brief Leases a buffer of at least @p min_size bytes.
+     */
+    IoBuffer acquire(std::size_t min_size);
+
+    /**
+     * @brief The number of buffers of the class holding @p size_class bytes
+     *        that are waiting in the pool, or are out on lease.
+     */
+    std::size_t num_idle(std::size_t size_class) const;
+    std::size_t num_borrowed(std::size_t size_class) const;
+
+private:
+    friend class IoBuffer;
+
+    static constexpr std::size_t kNumSizeClasses = 3;
+    static constexpr std::array<std::size_t, kNumSizeClasses> kSizes = { kSmallSize, kMediumSize, kLargeSize };
+
+    // The index of the smallest class holding @p size bytes, or
+    // kNumSizeClasses if none does.
+    static std::size_t size_class_index(std::size_t size);
+
+    void recycle(void* block, qsizetype size) noexcept;
+
+    ObjectPool<details::BufferBlock<kSmallSize>> small_;
+    ObjectPool<details::BufferBlock<kMediumSize>> medium_;
+    ObjectPool<details::BufferBlock<kLargeSize>> large_;
+};
+
+} // namespace ama
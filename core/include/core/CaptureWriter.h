@@ -0,0 +1,169 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "core/global.h"
+#include "core/Request.h"
+#include "core/Response.h"
+
+#include <QString>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace ama
+{
+
+class BodySink;
+class SpillingBodySink;
+class Transaction;
+
+/**
+ * @brief The parts of a finished transaction that CaptureWriter records.
+ *
+ * A body sink is null when its body was kept with its message.
+ */
+struct A_EXPORT CaptureRecord
+{
+    int id = 0;
+    Request request;
+    Response response;
+    std::shared_ptr<const BodySink> request_body;
+    std::shared_ptr<const BodySink> response_body;
+    std::error_code error;
+    uint64_t tunnel_bytes_to_remote = 0;
+    uint64_t tunnel_bytes_to_client = 0;
+
+    /**
+     * @brief Copies the messages of @p tx, and shares its body sinks.
+     */
+    static CaptureRecord of(Transaction& tx);
+};
+
+namespace details {
+
+// A record formatted as far as it can be without reading spill files back.
+// The base64 of each spilled body belongs at its offset in the text.
+struct FormattedCapture
+{
+    std::string text;
+    std::vector<std::pair<size_t, std::shared_ptr<const SpillingBodySink>>> spilled;
+};
+
+} // namespace details
+
+/**
+ * @brief Streams a record of each finished transaction to a file, as one
+ *        JSON object per line.
+ *
+ * @par Each record is formatted on the thread that calls write(), and
+ * handed to a thread of the writer's own, which appends it to the file.  A
+ * slow disk only holds callers up once more than max_backlog bytes of
+ * records are waiting to be written.  Spilled bodies don't count towards
+ * that: the writer's thread reads them back and encodes them a piece at a
+ * time, as it writes them out, and the record keeps their files until
+ * then.
+ *
+ * @par Names, values, methods and URIs are written as the bytes they were
+ * on the wire, each read as Latin-1, as the QString accessors of Headers
+ * and HttpMessage read them.  Bodies that were kept, in memory or in a
+ * spill file, are written in base64; bodies that were only counted or
+ * hashed are written as their size and digest.  A spill file that can't be
+ * read back gets an error in place of, or after, its base64.
+ */
+class A_EXPORT CaptureWriter
+{
+public:
+    static constexpr size_t kDefaultMaxBacklog = 64 * 1024 * 1024;
+
+    explicit CaptureWriter(size_t max_backlog = kDefaultMaxBacklog);
+    ~CaptureWriter();
+
+    CaptureWriter(const CaptureWriter&) = delete;
+    CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+    /**
+     * @brief Creates or truncates the file at @p path, and starts writing
+     *        to it.
+     */
+    std::error_code open(const QString& path);
+
+    /**
+     * @brief Formats @p record and queues it to be written.
+     *
+     * Safe to call from any thread; records are dropped unless the writer
+     * is open.
+     */
+    void write(const CaptureRecord& record);
+
+    /**
+     * @brief Writes everything queued so far, and closes the file.
+     */
+    void close();
+
+    bool is_open() const;
+
+    /**
+     * @brief The number of records queued since the writer was opened.
+     */
+    uint64_t records() const;
+
+    /**
+     * @brief Reports the error that stopped the writer writing, if any.
+     */
+    std::error_code error() const;
+
+    /**
+     * @brief Formats one record as a line of JSON, newline included,
+     *        spilled bodies and all.
+     */
+    static std::string format(const CaptureRecord& record);
+
+private:
+    void run();
+    std::error_code write_capture(const details::FormattedCapture& capture);
+
+    const size_t max_backlog_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable has_backlog_;
+    std::condition_variable has_room_;
+    std::deque<details::FormattedCapture> backlog_;
+
+    // The bytes of text in the backlog.
+    size_t backlog_size_;
+    bool open_;
+    bool closing_;
+    uint64_t records_;
+    std::error_code error_;
+
+    std::FILE* file_;
+    std::thread thread_;
+};
+
+} // namespace ama
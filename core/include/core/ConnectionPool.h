@@ -19,47 +19,142 @@
 
 #include "core/global.h"
 #include "core/IConnection.h"
+#include "core/InplaceFunction.h"
 
 #include <QObject>
 
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <system_error>
+#include <tuple>
+#include <vector>
 
 #include <asio.hpp>
 
 namespace ama
 {
 
+class IoUring;
+
 class ConnectionPool : public QObject
 {
     Q_OBJECT
 
 public:
-    using OpenCallback = std::function<void(std::shared_ptr<IConnection>, std::error_code)>;
+    using OpenCallback = InplaceFunction<void(std::shared_ptr<IConnection>, std::error_code)>;
 
     ConnectionPool(asio::io_context& context, QObject* parent = nullptr);
     ~ConnectionPool();
 
     std::shared_ptr<IConnection> make_connection(asio::ip::tcp::socket&& socket);
 
+    /**
+     * @brief Takes ownership of a socket accepted through io_uring.
+     */
+    std::shared_ptr<IConnection> make_connection(asio::ip::tcp::socket::native_handle_type socket);
+
+    /**
+     * @brief Drives the connections made from now on with @p ring, rather
+     *        than with the context's reactor.
+     *
+     * The ring must outlive the pool's connections; call this before the
+     * context starts running.
+     */
+    void set_io_uring(IoUring* ring);
+
+    /**
+     * @brief The context that the pool's connections do their work on.
+     */
+    asio::io_context& context() const;
+
     /**
      * @brief Find any open (and unused) connection to the given endpoint.
+     *
+     * The returned connection is removed from the pool; callers hand it
+     * back with release_connection() once it is safe to reuse.
+     *
      * @param host the remote endpoint's hostname
      * @param port the remote enpoint's TCP port
+     * @param scheme the protocol spoken on the connection
      * @return Returns a pointer to an open Conn, or @code nullptr if none exists.
      */
-    std::shared_ptr<IConnection> find_open_connection(const std::string& host, int port);
+    std::shared_ptr<IConnection> find_open_connection(const std::string& host, int port, const std::string& scheme = "http");
+
+    /**
+     * @brief Return a connection whose last exchange left it reusable.
+     *
+     * If the pool is already holding as many idle connections as it is
+     * allowed to, the connection (or the longest-idle one) is closed.  Idle
+     * connections are closed once they pass the idle timeout, whether or
+     * not the pool is used in the meantime.
+     */
+    void release_connection(const std::string& host, int port, const std::string& scheme, std::shared_ptr<IConnection> connection);
 
     void try_open(const std::string& host, const std::string& port, OpenCallback&& callback);
 
+    /**
+     * @brief Close every idle connection and stop resolving hosts.
+     *
+     * Call this once the context has stopped running and before it is
+     * destroyed; the pool's sockets and resolver belong to it.
+     */
+    void shutdown();
+
+    void set_max_idle_per_host(size_t max_idle);
+    void set_max_idle(size_t max_idle);
+    void set_idle_timeout(std::chrono::steady_clock::duration timeout);
+
+    size_t num_idle() const;
+    size_t num_hits() const;
+    size_t num_misses() const;
+
 signals:
     void client_connected(const std::shared_ptr<IConnection>& connection);
 
+private:
+    using Key = std::tuple<std::string, int, std::string>;
+    using Clock = std::chrono::steady_clock;
+
+    struct IdleConnection
+    {
+        std::shared_ptr<IConnection> connection;
+        Clock::time_point idle_since;
+    };
+
+    using Evicted = std::vector<std::shared_ptr<IConnection>>;
+
+    // These must be called with mutex_ held; evicted connections are to be
+    // closed once it is released.
+    void evict_expired(Clock::time_point now, Evicted& evicted);
+    void evict_oldest(Evicted& evicted);
+    void schedule_sweep();
+    void sweep();
+
 private:
     asio::io_context& context_;
     asio::ip::tcp::resolver resolver_;
+    IoUring* io_uring_;
+
+    mutable std::mutex mutex_;
+    std::map<Key, std::deque<IdleConnection>> idle_;
+    size_t num_idle_;
+
+    // Closes idle connections as they expire; armed while any are idle.
+    asio::steady_timer sweep_timer_;
+    bool sweep_scheduled_;
+
+    size_t max_idle_per_host_;
+    size_t max_idle_;
+    Clock::duration idle_timeout_;
+
+    std::atomic<size_t> num_hits_;
+    std::atomic<size_t> num_misses_;
 };
 
 } // namespace ama
@@ -19,16 +19,50 @@
 
 #include "core/global.h"
 
+#include "core/KnownHeader.h"
+
 #include <QList>
-#include <QMultiHash>
 #include <QString>
+#include <QStringView>
+#include <QVarLengthArray>
+
+#include <string>
+#include <string_view>
 
 namespace ama
 {
 
+/**
+ * @brief The header fields of a message, in the order they were inserted.
+ *
+ * @par Fields are kept in a flat array, with room for a typical message's
+ * worth of them before anything is allocated; looking one up is a short
+ * linear scan.  Names are canonicalized as they are inserted, so that
+ * "content-type" and "CONTENT-TYPE" are both listed as "Content-Type".
+ *
+ * @par Names and values are kept as the 8-bit strings they were on the
+ * wire, so that proxying a message never converts it to UTF-16.  The
+ * QString-typed accessors are adapters for code that displays headers,
+ * and decode Latin-1 each time they are called.
+ */
 class A_EXPORT Headers
 {
 public:
+    struct Field
+    {
+        KnownHeader id;
+        std::string name;
+        std::string value;
+
+        /**
+         * @brief Decodes the name or value as Latin-1, for display.
+         */
+        QString name_string() const;
+        QString value_string() const;
+    };
+
+    using const_iterator = const Field*;
+
     Headers();
     Headers(const Headers &headers) = default;
     Headers(Headers&&) = default;
@@ -37,21 +71,78 @@ public:
     Headers& operator=(const Headers&) = default;
     Headers& operator=(Headers&&) = default;
 
+    /**
+     * @brief Iterates over every field, in insertion order.
+     */
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    /**
+     * @brief Copies out the values of every header with the given name,
+     *        compared case-insensitively, in insertion order.
+     */
     QList<QString> find_by_name(const QString& name) const;
+    QList<QString> find_by_name(KnownHeader header) const;
+
+    /**
+     * @brief Returns the first value of a standard header, or a null
+     *        string if there is none.
+     */
+    QString value(KnownHeader header) const;
+
+    /**
+     * @brief Returns the first value of a standard header as it was
+     *        inserted, or an empty view if there is none.
+     */
+    std::string_view value_bytes(KnownHeader header) const;
+
+    bool contains(KnownHeader header) const;
+
+    /**
+     * @brief Checks whether any value of a standard header has @p token in
+     *        its comma-separated list, ignoring case.
+     */
+    bool has_token(KnownHeader header, std::string_view token) const;
+    bool has_token(KnownHeader header, QStringView token) const;
 
     bool empty() const;
     size_t size() const;
 
+    /**
+     * @brief Lists each distinct name once, in the order it first appeared.
+     */
     QList<QString> names() const;
 
-    void insert(const QString& name, const QString& value);
+    void insert(std::string_view name, std::string_view value);
 
-private:
-    QString canonicalize(const QString& name) const;
+    /**
+     * @brief Adds a value of a standard header; @p header must not be
+     *        KnownHeader::Unknown.
+     */
+    void insert(KnownHeader header, std::string_view value);
+
+    /**
+     * @brief Removes every value of the named header.
+     *
+     * @return the number of values removed.
+     */
+    size_t remove(std::string_view name);
 
 private:
-    QMultiHash<QString, QString> values_;
-    QList<QString> insertion_order_;
+    std::string canonicalize(std::string_view name) const;
+
+    // The index of the first field at or after @p from that is the given
+    // standard header, or that has the given name; -1 if there is none.
+    qsizetype index_of(KnownHeader header, qsizetype from = 0) const;
+    qsizetype index_of(std::string_view name, qsizetype from = 0) const;
+
+    // Enough for nearly every real message, which carries 10-30 headers.
+    static constexpr qsizetype kInlineFields = 24;
+
+    // ids_[i] is fields_[i].id, kept apart so that finding a standard
+    // header is a memchr() over a few dozen bytes.
+    QVarLengthArray<quint8, kInlineFields> ids_;
+    QVarLengthArray<Field, kInlineFields> fields_;
 };
 
 } // namespace ama
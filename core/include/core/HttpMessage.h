@@ -23,9 +23,21 @@
 #include <QByteArray>
 #include <QString>
 
+#include <string>
+#include <string_view>
+
 namespace ama
 {
 
+/**
+ * @brief A complete request or response, as observers see it.
+ *
+ * @par The request line, status line and headers are kept as the 8-bit
+ * strings they were on the wire.  The QString-typed accessors decode them
+ * on each call, for code that displays a message; the _bytes() accessors
+ * return them as they are.  The body stays a QByteArray, which is
+ * already 8-bit and is handed to observers without copying.
+ */
 class A_EXPORT HttpMessage
 {
 public:
@@ -41,8 +53,16 @@ public:
     const QString method() const;
     const QString uri() const;
 
+    std::string_view method_bytes() const noexcept;
+    std::string_view uri_bytes() const noexcept;
+
     int status_code() const;
+
+    /**
+     * @brief Returns the reason phrase, decoded as UTF-8.
+     */
     const QString status_message() const;
+    std::string_view status_message_bytes() const noexcept;
 
     int major_version() const noexcept;
     int minor_version() const noexcept;
@@ -50,17 +70,17 @@ public:
     Headers& headers();
     const Headers& headers() const;
 
-    void set_method(const QString& method);
-    void set_uri(const QString& uri);
+    void set_method(std::string_view method);
+    void set_uri(std::string_view uri);
     void set_major_version(int major_version);
     void set_minor_version(int minor_version);
     void set_body(const QByteArray& body);
     void set_body(QByteArray&& body);
 
     void set_status_code(int status_code);
-    void set_status_message(const QString& message);
+    void set_status_message(std::string_view message);
 
-    void add_header(const QString& name, const QString& value);
+    void add_header(std::string_view name, std::string_view value);
 
     // Return the body as a string, using any specified Content-Encoding
     // if present.
@@ -70,12 +90,12 @@ public:
     const QByteArray body() const;
 private:
     // Request-specific data
-    QString method_;
-    QString uri_;
+    std::string method_;
+    std::string uri_;
 
     // Response-specific data
     int status_code_;
-    QString status_message_;
+    std::string status_message_;
 
     int major_version_;
     int minor_version_;
@@ -21,12 +21,20 @@
 
 #include "core/global.h"
 
+#include "core/BodySink.h"
 #include "core/Headers.h"
+#include "core/HttpMessageView.h"
 #include "core/Request.h"
 #include "core/Response.h"
 
 #include <cstdint>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 #include <QString>
 #include <QByteArray>
@@ -38,6 +46,30 @@ namespace ama
 
 class HttpMessage;
 
+namespace details {
+
+/**
+ * True for iterators known to point into contiguous storage of bytes,
+ * which HttpMessageParser can scan in bulk rather than one at a time.
+ */
+template <typename It, typename = void>
+struct is_contiguous_byte_iterator : std::false_type {};
+
+template <typename It>
+struct is_contiguous_byte_iterator<It, std::enable_if_t<
+        sizeof(typename std::iterator_traits<It>::value_type) == 1
+        && std::is_integral_v<typename std::iterator_traits<It>::value_type>
+        && !std::is_same_v<typename std::iterator_traits<It>::value_type, bool>>>
+    : std::bool_constant<
+        std::is_pointer_v<It>
+        || std::is_same_v<It, typename std::vector<typename std::iterator_traits<It>::value_type>::iterator>
+        || std::is_same_v<It, typename std::vector<typename std::iterator_traits<It>::value_type>::const_iterator>
+        || std::is_same_v<It, std::string::iterator>
+        || std::is_same_v<It, std::string::const_iterator>>
+{};
+
+} // namespace details
+
 /**
  * Enumerates the various phases of incremental HTTP message parsing.
  *
@@ -61,7 +93,11 @@ class A_EXPORT HttpMessageParser
 {
 
 public:
-    HttpMessageParser();
+    /**
+     * @param resource where the parser's scratch buffers for header names
+     *        and values are allocated; see MessageArena.
+     */
+    explicit HttpMessageParser(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
     ~HttpMessageParser();
 
     enum State {
@@ -73,6 +109,39 @@ public:
     void resetForRequest();
     void resetForResponse();
 
+    /**
+     * @brief Prepares to parse the response to the given request.
+     *
+     * Responses to HEAD requests never carry a body, regardless of what
+     * their headers advertise, so the parser needs to know about them.
+     */
+    void resetForResponse(const Request& request);
+    void resetForResponse(const HttpMessageView& request);
+
+    /**
+     * @brief Signals that the peer has closed the connection.
+     *
+     * Responses that have neither a Content-Length nor a chunked
+     * Transfer-Encoding are delimited by the connection closing; such
+     * a response is complete once this is called.  For any other message,
+     * reaching the end of the stream means the message was truncated.
+     */
+    State finish();
+
+    /**
+     * @brief Sends the body of the message being parsed to the given
+     *        sink, instead of accumulating it in the message.
+     *
+     * Contiguous input is handed over a whole run at a time - as much
+     * of a chunk or fixed-length entity as the input holds.  Trailer
+     * fields of chunked entities go to the sink too; without one, they
+     * are discarded.
+     *
+     * Must be called after resetting the parser, which removes any
+     * previously-installed sink.
+     */
+    void set_body_sink(std::shared_ptr<BodySink> sink);
+
     template <typename InputIterator>
     State parse(Request &request, InputIterator &begin, InputIterator end)
     {
@@ -109,14 +178,71 @@ public:
         return parse(message, begin, end, &phase);
     }
 
+    /**
+     * @brief Parses the committed, not-yet-parsed bytes of the view's
+     *        receive buffer, recording the message in place.
+     *
+     * Stops early, as the iterator overloads do, when @p phase changes;
+     * the view's parsed_size() tells how far parsing got.
+     */
+    State parse(HttpMessageView &view, ParsePhase& phase);
+
+    /**
+     * @brief Parses bytes [@p offset, @p end) of @p buffer, which arrived
+     *        after the view's head.
+     *
+     * Entity bytes are recorded as ranges of @p buffer, which the view
+     * then shares.  On return @p offset is the first byte not parsed.
+     */
+    State parse(HttpMessageView &view, const QByteArray& buffer, qsizetype& offset, qsizetype end, ParsePhase& phase);
+
 private:
     friend QDebug operator<<(QDebug, const HttpMessageParser &parser);
 
+    // Adapters through which consume_impl() records what it parses, either
+    // into an HttpMessage or into an HttpMessageView.
+    class MessageTarget;
+    class ViewTarget;
+
+    // Transitions for the states of the request line, status line and
+    // headers; see consume_impl().
+    class HeadTable;
+
+    enum class ContentLength
+    {
+        Absent,
+        Present,
+        Invalid
+    };
+
     template <typename InputIterator>
     State parse(HttpMessage &message, InputIterator &begin, InputIterator end, ParsePhase* phase);
 
     State consume(HttpMessage &message, char input, ParsePhase* phase);
 
+    template <typename Target>
+    State consume_impl(Target& target, const char* input, ParsePhase* phase);
+
+    // Decides, once the blank line after the headers has been read, how
+    // the entity is framed - or that there is none.
+    template <typename Target>
+    State end_of_head(Target& target, ParsePhase* phase);
+
+    // Consumes, in one go, the longest prefix of [begin, end) that consume()
+    // would simply have appended to the current method, URI, header,
+    // reason phrase or body, and returns its length.  Returns zero in every other
+    // state; the byte that ends a run is always left for consume().
+    size_t consume_run(HttpMessage &message, const char* begin, const char* end);
+
+    template <typename Target>
+    size_t consume_run_impl(Target& target, const char* begin, const char* end);
+
+    template <typename Target>
+    void append_body(Target& target, const char* data, size_t length);
+
+    template <typename Target>
+    State parse_contiguous(Target& target, const char*& begin, const char* end, ParsePhase* phase);
+
 private:
     enum ParserState {
         // Request status line
@@ -169,11 +295,13 @@ private:
 
         // Entities
         //
+        // HeadTable handles every state up to newline_3, so all of these
+        // must come after it.
 
         // Chunked entities
         chunk_length_start               = 200,
         chunk_length                     = 201,
-        chunk_extension                  = 202, // unsure of the format, TODO
+        chunk_extension                  = 202, // ignored
         chunk_length_newline             = 203,
 
         chunk                            = 204,
@@ -184,9 +312,11 @@ private:
         chunk_trailing_header_space      = 209,
         chunk_trailing_header_value      = 210,
         chunk_terminating_newline        = 211,
+        chunk_trailing_header_newline    = 212,
 
         // Non-chunked entities
         fixed_length_entity              = 300,
+        close_delimited_entity           = 301,
     } state_;
 
     void transition_to_state(ParserState newState);
@@ -198,12 +328,19 @@ private:
     // chunks as well as fixed-length entities.
     uint64_t remaining_;
 
-    // A general-purpose string buffer, used for header names.
-    QByteArray buffer_;
+    // Whether we're parsing a response, and if so, whether it answers
+    // a HEAD request (and so has no entity).
+    bool is_response_;
+    bool is_head_response_;
+
+    std::shared_ptr<BodySink> body_sink_;
+
+    // A general-purpose string buffer, used for header and trailer names.
+    std::pmr::string buffer_;
 
     // A special string buffer used for header values, so that
     // we keep the current header name at the same time.
-    QByteArray value_buffer_;
+    std::pmr::string value_buffer_;
 };
 
 template <typename InputIterator>
@@ -217,12 +354,29 @@ HttpMessageParser::State HttpMessageParser::parse(HttpMessage &message, InputIte
 
     while (begin != end)
     {
+        if constexpr (details::is_contiguous_byte_iterator<InputIterator>::value)
+        {
+            const char* data = reinterpret_cast<const char*>(&*begin);
+            begin += consume_run(message, data, data + (end - begin));
+            if (begin == end)
+            {
+                break;
+            }
+        }
+
         auto state = consume(message, *begin++, phase);
         if (state != State::Incomplete)
         {
-            if (state == State::Valid && phase != nullptr)
+            if (state == State::Valid)
             {
-                *phase = ParsePhase::ReceivedFullMessage;
+                if (body_sink_ != nullptr)
+                {
+                    body_sink_->end();
+                }
+                if (phase != nullptr)
+                {
+                    *phase = ParsePhase::ReceivedFullMessage;
+                }
             }
             return state;
         }
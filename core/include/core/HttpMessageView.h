@@ -0,0 +1,223 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include "core/global.h"
+
+#include "core/HttpMessage.h"
+#include "core/KnownHeader.h"
+
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+#include <QByteArray>
+#include <QByteArrayView>
+
+namespace ama
+{
+
+/**
+ * @brief An HTTP message parsed in place, as offsets into the buffers its
+ *        bytes were received in.
+ *
+ * @par The view owns a growable receive buffer for the message head: read
+ * into prepare(), commit() what arrived, and hand the view to
+ * HttpMessageParser.  The request or status line and every header are
+ * recorded as offsets into that buffer rather than copied out, so parsing
+ * a head allocates nothing per header.  Body bytes are recorded as ranges
+ * of the (implicitly shared) QByteArrays they arrived in, which are kept
+ * alive without being copied.
+ *
+ * @par Nothing is copied out until materialize() is called, which builds
+ * an ordinary HttpMessage for display or storage; that, too, keeps the
+ * bytes as they are, and only decodes them if something asks for text.
+ *
+ * @par The lists of header fields and body segments are allocated from the
+ * memory resource the view is constructed with, typically a transaction's
+ * MessageArena.  The receive buffer and the body buffers are not.
+ */
+class A_EXPORT HttpMessageView
+{
+public:
+    friend class HttpMessageParser;
+
+    explicit HttpMessageView(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+    /**
+     * @brief Forgets the current message, keeping allocated capacity for
+     *        the next one.
+     */
+    void clear();
+
+    /**
+     * @brief Forgets the parsed message, but keeps whatever was received
+     *        after it as the start of the next one.
+     */
+    void next_message();
+
+    /**
+     * @brief Returns room for at least @p size more bytes at the end of the
+     *        receive buffer.
+     *
+     * Only the bytes subsequently passed to commit() become part of the
+     * message.
+     */
+    QByteArrayView prepare(qsizetype size);
+    void commit(qsizetype size);
+
+    /**
+     * @brief The receive buffer, up to the last committed byte.
+     */
+    QByteArrayView data() const;
+
+    /**
+     * @brief The offset, in data(), of the first byte not yet parsed.
+     */
+    qsizetype parsed_size() const;
+
+    /**
+     * @brief The bytes received after the parsed part of data().
+     *
+     * Once a message is complete, these belong to whatever follows it on
+     * the connection, such as a pipelined request.
+     */
+    QByteArrayView unparsed() const;
+
+    QByteArrayView method() const;
+    QByteArrayView uri() const;
+
+    int status_code() const;
+    QByteArrayView reason_phrase() const;
+
+    int major_version() const;
+    int minor_version() const;
+
+    qsizetype header_count() const;
+    QByteArrayView header_name(qsizetype index) const;
+    QByteArrayView header_value(qsizetype index) const;
+
+    /**
+     * @brief Returns the value of the first header with the given name,
+     *        compared case-insensitively, or a null view if there is none.
+     */
+    QByteArrayView header(QByteArrayView name) const;
+    QByteArrayView header(KnownHeader header) const;
+
+    /**
+     * @brief Checks whether any header with the given name has @p token in
+     *        its comma-separated list of values, ignoring case.
+     */
+    bool header_has_token(QByteArrayView name, QByteArrayView token) const;
+    bool header_has_token(KnownHeader header, QByteArrayView token) const;
+
+    /**
+     * @brief Drops every header with the given name from the message.
+     */
+    void remove_header(QByteArrayView name);
+    void remove_header(KnownHeader header);
+
+    /**
+     * @brief Appends a range of @p buffer to the body, sharing rather than
+     *        copying its contents.
+     */
+    void append_body(const QByteArray& buffer, qsizetype offset, qsizetype length);
+    qsizetype body_size() const;
+
+    /**
+     * @brief Formats the request line and headers, as they are to be sent
+     *        upstream.
+     *
+     * The head is copied byte for byte as it was received, less removed
+     * headers and the hop-by-hop ones a proxy must not forward: Connection,
+     * Keep-Alive, Proxy-Connection, TE, Upgrade and any that Connection
+     * names.  Only a complete head can be formatted.
+     */
+    QByteArray format_request_head() const;
+
+    /**
+     * @brief Returns the request head as format_request_head() would,
+     *        but as runs of the receive buffer rather than a copy.
+     *
+     * The views are valid until the view's buffer next changes; they are
+     * meant to be handed straight to IConnection::async_writev().
+     */
+    std::vector<QByteArrayView> request_head_segments() const;
+
+    /**
+     * @brief Copies the message into an HttpMessage.
+     */
+    HttpMessage materialize() const;
+
+private:
+    struct Span
+    {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    struct Field
+    {
+        Span name;
+        Span value;
+        // Looked up once, as the field is parsed, so that finding a
+        // standard header later is a comparison of ids.
+        KnownHeader id;
+        bool removed;
+    };
+
+    struct BodySegment
+    {
+        QByteArray buffer;
+        qsizetype offset;
+        qsizetype length;
+    };
+
+    QByteArrayView view_of(Span span) const;
+
+    // Whether a field belongs only to the connection it arrived on.  Such
+    // fields can still be looked up; they are just not forwarded.
+    bool is_hop_by_hop(const Field& field) const;
+
+    QByteArray buffer_;
+    qsizetype size_;
+    qsizetype parsed_;
+
+    Span method_;
+    Span uri_;
+    Span reason_phrase_;
+
+    int status_code_;
+    int major_version_;
+    int minor_version_;
+
+    std::pmr::vector<Field> fields_;
+
+    // The offset just past the blank line that ends the head, or zero
+    // until it has been parsed.
+    qsizetype head_end_;
+
+    // The header currently being parsed.
+    Field pending_field_;
+
+    std::pmr::vector<BodySegment> body_;
+    qsizetype body_size_;
+};
+
+} // namespace ama
@@ -18,9 +18,10 @@
 #pragma once
 
 #include "core/global.h"
+#include "core/InplaceFunction.h"
 
-#include <functional>
 #include <system_error>
+#include <vector>
 
 #include <QByteArray>
 #include <QByteArrayView>
@@ -30,12 +31,45 @@ namespace ama {
 class A_EXPORT IConnection
 {
 public:
-    using Callback = std::function<void(std::error_code, std::size_t)>;
+    /**
+     * @brief Reports how an operation ended, and how many bytes it moved.
+     *
+     * Callbacks are move-only, and are held without allocating as long as
+     * their captures fit in a few pointers' worth of space.
+     */
+    using Callback = InplaceFunction<void(std::error_code, std::size_t)>;
 
     virtual ~IConnection() noexcept = default;
 
     virtual void async_write(const QByteArrayView data, Callback&& callback) = 0;
+
+    /**
+     * @brief Writes each of @p buffers in turn, as a single gathered write.
+     *
+     * The buffers' contents must outlive the operation, though the vector
+     * itself need not.  The callback receives the total number of bytes
+     * written.
+     */
+    virtual void async_writev(const std::vector<QByteArrayView>& buffers, Callback&& callback) = 0;
     virtual void async_read(QByteArrayView buffer, Callback&&) = 0;
+
+    /**
+     * @brief Waits until the connection has data to read, without consuming any.
+     *
+     * The callback receives the number of bytes immediately available; zero
+     * bytes with no error means that the peer has closed the connection.
+     */
+    virtual void async_wait_readable(Callback&& callback) = 0;
+
+    /**
+     * @brief Checks, without blocking, whether an idle connection can still
+     *        be used for a new exchange.
+     *
+     * A connection that the peer has closed, or that has unsolicited data
+     * waiting to be read, is not reusable.
+     */
+    virtual bool is_reusable() = 0;
+
     virtual void close(std::error_code& ec) = 0;
 };
 
@@ -0,0 +1,214 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace ama {
+
+template <typename Signature, std::size_t Capacity = 64>
+class InplaceFunction;
+
+/**
+ * @brief A move-only callable wrapper, like std::function, that keeps its
+ *        target inline when it fits.
+ *
+ * A target of up to @p Capacity bytes, which can be moved without throwing,
+ * is stored inside the wrapper itself; only a larger one is put on the heap.
+ * Completion callbacks rarely capture more than a couple of pointers, so
+ * handing one to an I/O operation doesn't allocate.
+ *
+ * Unlike std::function, the target needn't be copyable, and the wrapper
+ * can't be copied either.  Calling an empty wrapper throws
+ * std::bad_function_call.
+ */
+template <typename R, typename ...Args, std::size_t Capacity>
+class InplaceFunction<R(Args...), Capacity>
+{
+    struct Ops
+    {
+        R (*invoke)(void* storage, Args&&... args);
+        void (*move)(void* from, void* to) noexcept;
+        void (*destroy)(void* storage) noexcept;
+    };
+
+    template <typename F>
+    static constexpr bool fits_inline = sizeof(F) <= Capacity
+                                     && alignof(F) <= alignof(std::max_align_t)
+                                     && std::is_nothrow_move_constructible_v<F>;
+
+    template <typename F>
+    struct Inline
+    {
+        static R invoke(void* storage, Args&&... args)
+        {
+            return std::invoke(*std::launder(static_cast<F*>(storage)), std::forward<Args>(args)...);
+        }
+
+        static void move(void* from, void* to) noexcept
+        {
+            F* source = std::launder(static_cast<F*>(from));
+            ::new (to) F(std::move(*source));
+            source->~F();
+        }
+
+        static void destroy(void* storage) noexcept
+        {
+            std::launder(static_cast<F*>(storage))->~F();
+        }
+
+        static constexpr Ops ops{ &invoke, &move, &destroy };
+    };
+
+    template <typename F>
+    struct Heap
+    {
+        static F*& target(void* storage)
+        {
+            return *std::launder(static_cast<F**>(storage));
+        }
+
+        static R invoke(void* storage, Args&&... args)
+        {
+            return std::invoke(*target(storage), std::forward<Args>(args)...);
+        }
+
+        static void move(void* from, void* to) noexcept
+        {
+            ::new (to) F*(target(from));
+        }
+
+        static void destroy(void* storage) noexcept
+        {
+            delete target(storage);
+        }
+
+        static constexpr Ops ops{ &invoke, &move, &destroy };
+    };
+
+public:
+    InplaceFunction() noexcept = default;
+
+    InplaceFunction(std::nullptr_t) noexcept
+    {}
+
+    template <typename F,
+              typename Target = std::decay_t<F>,
+              typename = std::enable_if_t<!std::is_same_v<Target, InplaceFunction>
+                                          && std::is_invocable_r_v<R, Target&, Args...>>>
+    InplaceFunction(F&& f)
+    {
+        if constexpr(fits_inline<Target>)
+        {
+            ::new (static_cast<void*>(storage_)) Target(std::forward<F>(f));
+            ops_ = &Inline<Target>::ops;
+        }
+        else
+        {
+            ::new (static_cast<void*>(storage_)) Target*(new Target(std::forward<F>(f)));
+            ops_ = &Heap<Target>::ops;
+        }
+    }
+
+    InplaceFunction(InplaceFunction&& other) noexcept
+        : ops_(other.ops_)
+    {
+        if (ops_ != nullptr)
+        {
+            ops_->move(other.storage_, storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    InplaceFunction(const InplaceFunction&) = delete;
+
+    ~InplaceFunction()
+    {
+        reset();
+    }
+
+    InplaceFunction& operator=(InplaceFunction&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            if (other.ops_ != nullptr)
+            {
+                other.ops_->move(other.storage_, storage_);
+                ops_ = std::exchange(other.ops_, nullptr);
+            }
+        }
+        return *this;
+    }
+
+    InplaceFunction& operator=(const InplaceFunction&) = delete;
+
+    InplaceFunction& operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return ops_ != nullptr;
+    }
+
+    /**
+     * @brief Calls the target.
+     *
+     * As with std::function, the target is called as a non-const object
+     * even through a const wrapper.
+     */
+    R operator()(Args... args) const
+    {
+        if (ops_ == nullptr)
+        {
+            throw std::bad_function_call();
+        }
+        return ops_->invoke(storage_, std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Returns true if a callable of type @p F would be stored inline.
+     */
+    template <typename F>
+    static constexpr bool stores_inline() noexcept
+    {
+        return fits_inline<std::decay_t<F>>;
+    }
+
+private:
+    void reset() noexcept
+    {
+        if (ops_ != nullptr)
+        {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) mutable unsigned char storage_[Capacity];
+    const Ops* ops_ = nullptr;
+};
+
+} // ama
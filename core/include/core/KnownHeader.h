@@ -0,0 +1,145 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "core/global.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <QByteArrayView>
+#include <QStringView>
+
+namespace ama
+{
+
+/**
+ * @brief The standard header fields, which Headers, HttpMessageView and
+ *        HttpMessageParser identify by number instead of by name.
+ *
+ * @par Looking a name up with known_header() hashes it once, without
+ * allocating; anything that is not listed here is KnownHeader::Unknown,
+ * and is handled by name as before.
+ */
+enum class KnownHeader : uint8_t
+{
+    Unknown = 0,
+
+    Accept,
+    AcceptCharset,
+    AcceptEncoding,
+    AcceptLanguage,
+    AcceptPatch,
+    AcceptRanges,
+    AccessControlAllowCredentials,
+    AccessControlAllowHeaders,
+    AccessControlAllowMethods,
+    AccessControlAllowOrigin,
+    AccessControlExposeHeaders,
+    AccessControlMaxAge,
+    AccessControlRequestHeaders,
+    AccessControlRequestMethod,
+    Age,
+    Allow,
+    AltSvc,
+    Authorization,
+    CacheControl,
+    Connection,
+    ContentDisposition,
+    ContentEncoding,
+    ContentLanguage,
+    ContentLength,
+    ContentLocation,
+    ContentRange,
+    ContentSecurityPolicy,
+    ContentType,
+    Cookie,
+    Date,
+    Dnt,
+    Etag,
+    Expect,
+    Expires,
+    Forwarded,
+    From,
+    Host,
+    IfMatch,
+    IfModifiedSince,
+    IfNoneMatch,
+    IfRange,
+    IfUnmodifiedSince,
+    KeepAlive,
+    LastModified,
+    Link,
+    Location,
+    MaxForwards,
+    Origin,
+    Pragma,
+    ProxyAuthenticate,
+    ProxyAuthorization,
+    ProxyConnection,
+    Range,
+    Referer,
+    ReferrerPolicy,
+    Refresh,
+    RetryAfter,
+    SecFetchDest,
+    SecFetchMode,
+    SecFetchSite,
+    SecFetchUser,
+    Server,
+    SetCookie,
+    StrictTransportSecurity,
+    Te,
+    Trailer,
+    TransferEncoding,
+    Upgrade,
+    UpgradeInsecureRequests,
+    UserAgent,
+    Vary,
+    Via,
+    Warning,
+    WwwAuthenticate,
+    XContentTypeOptions,
+    XForwardedFor,
+    XForwardedHost,
+    XForwardedProto,
+    XFrameOptions,
+    XRequestedWith,
+    XXssProtection,
+};
+
+/**
+ * @brief The number of KnownHeader values, Unknown included.
+ */
+constexpr size_t kKnownHeaderCount = static_cast<size_t>(KnownHeader::XXssProtection) + 1;
+
+/**
+ * @brief Identifies a header by name, ignoring case.
+ *
+ * @return KnownHeader::Unknown if @p name is not a standard header.
+ */
+A_EXPORT KnownHeader known_header(QByteArrayView name);
+A_EXPORT KnownHeader known_header(QStringView name);
+
+/**
+ * @brief Returns the name of a standard header, spelled as Headers
+ *        canonicalizes it, or an empty view for KnownHeader::Unknown.
+ */
+A_EXPORT QByteArrayView known_header_name(KnownHeader header);
+
+} // namespace ama
@@ -0,0 +1,79 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "core/global.h"
+
+#include <cstddef>
+#include <memory_resource>
+
+namespace ama {
+
+/**
+ * @brief Memory for the bookkeeping of one transaction - the field and
+ *        body-segment lists of its messages and its parser's scratch
+ *        buffers - which is all freed at once.
+ *
+ * Allocations are carved, in order, out of a buffer inside the arena and
+ * then out of blocks drawn from an upstream resource; deallocating does
+ * nothing.  By default the blocks come from a pool shared by every
+ * arena, so that once a few transactions have come and gone, new ones
+ * find blocks waiting for them rather than going to the heap.
+ *
+ * Arenas are not thread-safe; a transaction only uses its own from its
+ * strand.
+ */
+class A_EXPORT MessageArena
+{
+public:
+    /**
+     * @brief The size of the buffer inside the arena, enough for the
+     *        bookkeeping of a typical small exchange.
+     */
+    static constexpr std::size_t kInlineSize = 2048;
+
+    explicit MessageArena(std::pmr::memory_resource* upstream = pooled_upstream());
+    ~MessageArena();
+
+    MessageArena(const MessageArena&) = delete;
+    MessageArena& operator=(const MessageArena&) = delete;
+
+    std::pmr::memory_resource* resource() noexcept;
+
+    /**
+     * @brief Frees everything allocated from the arena, returning its
+     *        blocks upstream.
+     *
+     * Nothing allocated from the arena may be used afterwards, or
+     * destroyed if doing so would deallocate.
+     */
+    void release();
+
+    /**
+     * @brief The pool that arenas draw their blocks from by default.
+     *
+     * It is shared by every thread, and never destroyed.
+     */
+    static std::pmr::memory_resource* pooled_upstream();
+
+private:
+    alignas(std::max_align_t) std::byte inline_[kInlineSize];
+    std::pmr::monotonic_buffer_resource resource_;
+};
+
+} // namespace ama
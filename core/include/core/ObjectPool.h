@@ -17,11 +17,12 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <cstdint>
 #include <iostream>
-#include <memory>
-#include <mutex>
-#include <stack>
+#include <utility>
 
 namespace ama
 {
@@ -29,9 +30,10 @@ namespace ama
 /**
  * @brief An object that owns a pool of resources, for example buffers of memory.
  *
- * Consumers can acquire a shared pointer to a resource; when the pointer
- * goes out of scope, the resource is returned to the pool rather than being
- * deallocated.
+ * Consumers acquire a handle to a resource; when the handle goes out of
+ * scope, the resource is returned to the pool rather than being
+ * deallocated.  Handles can be moved but not copied, and are not
+ * themselves allocated.
  *
  * Resource types must have a public default constructor.
  *
@@ -40,96 +42,209 @@ namespace ama
  * over that number will be allocated as needed.  The Max value indicates the
  * largest number of resources to keep in the pool at a given time; objects
  * returned over that number will be deallocated instead of being pooled.
+ *
+ * Each thread keeps a small magazine of the resources it has returned, and
+ * acquires from it first; past that, idle resources wait on a lock-free
+ * stack shared by all threads.  Resources in magazines count as idle.
+ *
+ * Handles may outlive their pool.  Resources returned after the pool is
+ * destroyed are deallocated, as are those left in a thread's magazine,
+ * the next time that thread uses a pool of the same type or when it exits.
  */
 template <typename T>
 class ObjectPool
 {
 private:
-    class Deleter
+    struct Depot;
+
+    struct Node
+    {
+        Node(T *object, Depot *depot) :
+            object(object),
+            next(nullptr),
+            depot(depot)
+        {
+        }
+
+        T *object;
+        std::atomic<Node *> next;
+        Depot *depot;
+    };
+
+public:
+    /**
+     * @brief A borrowed resource, returned to its pool when the handle is
+     *        reset or destroyed.
+     */
+    class Handle
     {
     public:
-        Deleter(std::weak_ptr<ObjectPool<T> *> pool) :
-            pool_(pool)
+        Handle() noexcept = default;
+
+        Handle(Handle &&other) noexcept :
+            node_(std::exchange(other.node_, nullptr))
+        {
+        }
+
+        Handle(const Handle&) = delete;
+
+        ~Handle()
         {
+            reset();
         }
 
-        void operator()(T *pointer)
+        Handle& operator=(Handle &&other) noexcept
         {
-            if (auto pool = pool_.lock())
+            if (this != &other)
             {
-                (*pool.get())->release(std::unique_ptr<T> { pointer });
+                reset();
+                node_ = std::exchange(other.node_, nullptr);
             }
-            else
+            return *this;
+        }
+
+        Handle& operator=(const Handle&) = delete;
+
+        T* get() const noexcept
+        {
+            return node_ != nullptr ? node_->object : nullptr;
+        }
+
+        T& operator*() const noexcept
+        {
+            return *node_->object;
+        }
+
+        T* operator->() const noexcept
+        {
+            return node_->object;
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return node_ != nullptr;
+        }
+
+        void reset() noexcept
+        {
+            if (node_ != nullptr)
             {
-                std::default_delete<T>{}(pointer);
+                ObjectPool<T>::release(std::exchange(node_, nullptr));
             }
         }
 
+        /**
+         * @brief Gives up the handle's resource without returning it, as
+         *        an opaque token that attach() turns back into a handle.
+         */
+        void* detach() noexcept
+        {
+            return std::exchange(node_, nullptr);
+        }
+
+        static Handle attach(void *token) noexcept
+        {
+            return Handle(static_cast<Node *>(token));
+        }
+
     private:
-        std::weak_ptr<ObjectPool<T> *> pool_;
+        friend class ObjectPool<T>;
+
+        explicit Handle(Node *node) noexcept :
+            node_(node)
+        {
+        }
+
+        Node *node_ = nullptr;
     };
 
-public:
     const static size_t default_pool_min = 0;
     const static size_t default_pool_max = SIZE_MAX;
+    static constexpr size_t default_magazine_size = 8;
+    static constexpr size_t max_magazine_size = 16;
 
-    typedef std::shared_ptr<T> pool_ptr;
+    typedef Handle pool_ptr;
 
+    /**
+     * @param magazine_size how many returned resources each thread keeps
+     *        for itself, up to max_magazine_size; zero sends every one
+     *        straight back to the shared stack.
+     */
     ObjectPool(size_t min_pool_size = default_pool_min,
-               size_t max_pool_size = default_pool_max) :
+               size_t max_pool_size = default_pool_max,
+               size_t magazine_size = default_magazine_size) :
         min_pool_size_(min_pool_size),
         max_pool_size_(max_pool_size),
-        self_(new ObjectPool<T>*(this)),
-        pool_(),
-        mutex_()
+        depot_(new Depot(max_pool_size, std::min(magazine_size, max_magazine_size)))
     {
         for (size_t i = 0; i < min_pool_size_; ++i)
         {
-            pool_.push(std::make_unique<T>());
+            push(depot_, create(depot_));
+            depot_->num_idle.fetch_add(1, std::memory_order_relaxed);
         }
     }
 
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
     virtual ~ObjectPool()
     {
+        depot_->closed.store(true);
+
+        if (auto magazine = find_magazine(depot_, false))
+        {
+            flush(*magazine);
+        }
+
+        drain(depot_);
+        unref(depot_);
     }
 
     pool_ptr acquire()
     {
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
+        Node *node = nullptr;
 
-            // Regardless of whether the pool has anything in it,
-            // by the time we return we'll have borrowed an object.
-            num_borrowed_++;
+        Magazine *magazine = nullptr;
+        if (depot_->magazine_size > 0)
+        {
+            magazine = find_magazine(depot_, true);
+        }
 
-            if (!pool_.empty())
-            {
-                pool_ptr result(pool_.top().release(), Deleter(std::weak_ptr<ObjectPool<T> *>(self_)));
-                num_idle_--;
-                pool_.pop();
+        if (magazine != nullptr && magazine->count > 0)
+        {
+            node = magazine->nodes[--magazine->count];
+        }
+        else
+        {
+            node = pop(depot_);
+        }
 
-                return std::move(result);
-            }
+        if (node != nullptr)
+        {
+            depot_->num_idle.fetch_sub(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            // Empty pool, time to make more things!
+            node = create(depot_);
         }
 
-        // Empty pool, time to make more things!
-        pool_ptr result(new T(), Deleter(std::weak_ptr<ObjectPool<T> *>(self_)));
-        return std::move(result);
+        depot_->num_borrowed.fetch_add(1, std::memory_order_relaxed);
+        return pool_ptr(node);
     }
 
     size_t num_idle() const
     {
-        return num_idle_.load(std::memory_order_relaxed);
+        return depot_->num_idle.load(std::memory_order_relaxed);
     }
 
     size_t num_borrowed() const
     {
-        return num_borrowed_.load(std::memory_order_relaxed);
+        return depot_->num_borrowed.load(std::memory_order_relaxed);
     }
 
     friend std::ostream& operator <<(std::ostream &o, const ObjectPool<T> &pool)
     {
-        std::lock_guard<std::mutex> lock(pool.mutex_);
         return o << "ObjectPool{min=" << pool.min_pool_size_
                  << " max=" << pool.max_pool_size_
                  << " idle=" << pool.num_idle()
@@ -138,30 +253,325 @@ public:
     }
 
 private:
-    void release(std::unique_ptr<T> object)
+    // The state shared by a pool, its resources and the magazines holding
+    // them.  It is referenced by the pool, by every resource it has
+    // allocated and by every magazine claimed for it; the last of these
+    // to let go deletes it.
+    struct Depot
+    {
+        Depot(size_t max_idle, size_t magazine_size) :
+            max_idle(max_idle),
+            magazine_size(magazine_size)
+        {
+        }
+
+        // The top of the stack of idle nodes.  The upper 16 bits count
+        // changes to it, so that a node popped and pushed back between
+        // one thread's load and its compare-exchange isn't taken for an
+        // unchanged stack.
+        std::atomic<std::uint64_t> head { 0 };
+
+        // A thread in pop() may read the next pointer of a node that
+        // another thread has since taken.  Nodes are only freed while no
+        // thread is in pop(); until then they wait on the doomed list.
+        std::atomic<size_t> poppers { 0 };
+        std::atomic<Node *> doomed { nullptr };
+
+        std::atomic<size_t> refs { 1 };
+        std::atomic<bool> closed { false };
+
+        std::atomic<size_t> num_borrowed { 0 };
+        std::atomic<size_t> num_idle     { 0 };
+
+        const size_t max_idle;
+        const size_t magazine_size;
+    };
+
+    struct Magazine
+    {
+        Depot *depot = nullptr;
+        size_t count = 0;
+        std::array<Node *, max_magazine_size> nodes {};
+    };
+
+    // A thread has magazines for the first few pools of this type that it
+    // uses at a time; any others go straight to their shared stacks.
+    struct ThreadMagazines
+    {
+        ~ThreadMagazines()
+        {
+            // Resources freed from here on may hold handles of their own.
+            magazines_gone() = true;
+
+            for (auto &magazine : magazines)
+            {
+                if (magazine.depot != nullptr)
+                {
+                    flush(magazine);
+                }
+            }
+        }
+
+        std::array<Magazine, 4> magazines;
+    };
+
+    static_assert(sizeof(void *) == sizeof(std::uint64_t), "the shared stack packs a tag into unused pointer bits");
+
+    static constexpr std::uint64_t pointer_mask = (std::uint64_t(1) << 48) - 1;
+
+    static Node* untag(std::uint64_t head)
+    {
+        return reinterpret_cast<Node *>(static_cast<std::uintptr_t>(head & pointer_mask));
+    }
+
+    static std::uint64_t retag(Node *node, std::uint64_t previous)
+    {
+        return (((previous >> 48) + 1) << 48) | reinterpret_cast<std::uintptr_t>(node);
+    }
+
+    // Trivially destructible, so it can still be read once this thread's
+    // magazines are gone.
+    static bool& magazines_gone()
+    {
+        thread_local bool gone = false;
+        return gone;
+    }
+
+    // This thread's magazine for the given depot.  If there is none and
+    // claim is set, an unused one is claimed for it; failing that, null.
+    static Magazine* find_magazine(Depot *depot, bool claim)
+    {
+        if (magazines_gone())
+        {
+            return nullptr;
+        }
+
+        thread_local ThreadMagazines thread_magazines;
+
+        Magazine *unused = nullptr;
+        for (auto &magazine : thread_magazines.magazines)
+        {
+            if (magazine.depot == depot)
+            {
+                return &magazine;
+            }
+
+            if (magazine.depot != nullptr && magazine.depot->closed.load(std::memory_order_relaxed))
+            {
+                flush(magazine);
+            }
+
+            if (magazine.depot == nullptr && unused == nullptr)
+            {
+                unused = &magazine;
+            }
+        }
+
+        if (!claim || unused == nullptr)
+        {
+            return nullptr;
+        }
+
+        depot->refs.fetch_add(1, std::memory_order_relaxed);
+        unused->depot = depot;
+        return unused;
+    }
+
+    // Returns a magazine's resources to its depot, and gives the
+    // magazine up.
+    static void flush(Magazine &magazine)
+    {
+        auto depot = std::exchange(magazine.depot, nullptr);
+        for (size_t i = 0; i < magazine.count; ++i)
+        {
+            push(depot, magazine.nodes[i]);
+        }
+        magazine.count = 0;
+
+        if (depot->closed.load())
+        {
+            drain(depot);
+        }
+        unref(depot);
+    }
+
+    static void release(Node *node) noexcept
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        num_borrowed_--;
+        auto depot = node->depot;
+        depot->num_borrowed.fetch_sub(1, std::memory_order_relaxed);
+
+        if (depot->closed.load())
+        {
+            destroy(node);
+            return;
+        }
 
         // If we have fewer than the max allowed objects pooled,
-        // put this one back in.  Otherwise, let the unique_ptr go
-        // out of scope and delete the object.
-        if (pool_.size() < max_pool_size_)
+        // put this one back in.  Otherwise, delete it.
+        if (depot->num_idle.fetch_add(1, std::memory_order_relaxed) >= depot->max_idle)
+        {
+            depot->num_idle.fetch_sub(1, std::memory_order_relaxed);
+            discard(depot, node);
+            return;
+        }
+
+        if (depot->magazine_size > 0)
+        {
+            if (auto magazine = find_magazine(depot, true))
+            {
+                if (magazine->count == depot->magazine_size)
+                {
+                    // Full; the older half goes to the shared stack.
+                    size_t half = (magazine->count + 1) / 2;
+                    for (size_t i = 0; i < half; ++i)
+                    {
+                        push(depot, magazine->nodes[i]);
+                    }
+                    std::move(magazine->nodes.begin() + half, magazine->nodes.begin() + magazine->count, magazine->nodes.begin());
+                    magazine->count -= half;
+                }
+
+                magazine->nodes[magazine->count++] = node;
+                return;
+            }
+        }
+
+        // The pool may be destroyed by another thread at any point from
+        // here on; hold the depot until done with it.
+        depot->refs.fetch_add(1, std::memory_order_relaxed);
+        push(depot, node);
+        if (depot->closed.load())
+        {
+            drain(depot);
+        }
+        unref(depot);
+    }
+
+    static Node* create(Depot *depot)
+    {
+        auto node = new Node(new T(), depot);
+        depot->refs.fetch_add(1, std::memory_order_relaxed);
+        return node;
+    }
+
+    static void destroy(Node *node) noexcept
+    {
+        auto depot = node->depot;
+        delete node->object;
+        delete node;
+        unref(depot);
+    }
+
+    static void unref(Depot *depot) noexcept
+    {
+        if (depot->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            delete depot;
+        }
+    }
+
+    static void push(Depot *depot, Node *node) noexcept
+    {
+        auto head = depot->head.load(std::memory_order_relaxed);
+        do
+        {
+            node->next.store(untag(head), std::memory_order_relaxed);
+        }
+        while (!depot->head.compare_exchange_weak(head, retag(node, head), std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    static Node* pop(Depot *depot) noexcept
+    {
+        depot->poppers.fetch_add(1);
+
+        auto head = depot->head.load(std::memory_order_acquire);
+        Node *node;
+        while ((node = untag(head)) != nullptr)
+        {
+            auto next = node->next.load(std::memory_order_relaxed);
+            if (depot->head.compare_exchange_weak(head, retag(next, head), std::memory_order_acquire, std::memory_order_acquire))
+            {
+                break;
+            }
+        }
+
+        if (depot->poppers.fetch_sub(1) == 1 && depot->doomed.load(std::memory_order_relaxed) != nullptr)
+        {
+            reclaim(depot);
+        }
+        return node;
+    }
+
+    // Frees a node that is not on the stack, once no thread in pop() can
+    // still be looking at it.
+    static void discard(Depot *depot, Node *node) noexcept
+    {
+        if (depot->doomed.load(std::memory_order_relaxed) != nullptr)
+        {
+            reclaim(depot);
+        }
+
+        // Freed last; the node's reference keeps the depot alive until then.
+        if (depot->poppers.load() == 0)
+        {
+            destroy(node);
+        }
+        else
+        {
+            doom(depot, node);
+        }
+    }
+
+    static void doom(Depot *depot, Node *node) noexcept
+    {
+        auto head = depot->doomed.load(std::memory_order_relaxed);
+        do
+        {
+            node->next.store(head, std::memory_order_relaxed);
+        }
+        while (!depot->doomed.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // Everything doomed before the list is taken left the stack earlier
+    // still, so if no thread is in pop() after taking it, none can have
+    // seen any of it.  Callers hold a reference to the depot.
+    static void reclaim(Depot *depot) noexcept
+    {
+        auto node = depot->doomed.exchange(nullptr, std::memory_order_acquire);
+        bool safe = depot->poppers.load() == 0;
+        while (node != nullptr)
+        {
+            auto next = node->next.load(std::memory_order_relaxed);
+            if (safe)
+            {
+                destroy(node);
+            }
+            else
+            {
+                doom(depot, node);
+            }
+            node = next;
+        }
+    }
+
+    // Frees everything on a closed depot's stack.  Callers hold a
+    // reference to the depot.  Several threads can drain at once, and
+    // each may still be reading a node that another has popped, so the
+    // nodes go through discard() like any other.
+    static void drain(Depot *depot) noexcept
+    {
+        while (auto node = pop(depot))
         {
-            pool_.push(std::move(object));
-            num_idle_++;
+            depot->num_idle.fetch_sub(1, std::memory_order_relaxed);
+            discard(depot, node);
         }
+        reclaim(depot);
     }
 
     const size_t min_pool_size_;
     const size_t max_pool_size_;
 
-    std::shared_ptr<ObjectPool<T> *> self_;
-    std::stack<std::unique_ptr<T>> pool_;
-    std::mutex mutex_;
-
-    std::atomic<size_t> num_borrowed_ = ATOMIC_VAR_INIT(0);
-    std::atomic<size_t> num_idle_     = ATOMIC_VAR_INIT(0);
+    Depot *depot_;
 };
 
 } // namespace ama
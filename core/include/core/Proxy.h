@@ -19,12 +19,15 @@
 
 #include "core/global.h"
 
+#include <QByteArray>
 #include <QObject>
 #include <QSharedPointer>
 
 #include <atomic>
 #include <memory>
+#include <mutex>
 
+#include "core/BodySink.h"
 #include "core/ConnectionPool.h"
 #include "core/Server.h"
 #include "core/Transaction.h"
@@ -39,23 +42,70 @@ class A_EXPORT Proxy : public QObject
     Q_OBJECT
 
 public:
+    /**
+     * @brief Where new transactions are started.
+     */
+    enum class Dispatch
+    {
+        // On the thread the proxy lives on, which must run an event loop.
+        // Subscribers to transactionStarted() may then touch the UI.
+        OwnerThread,
+
+        // On the I/O thread that accepted the connection, or that finished
+        // the transaction before it on the same connection.  Nothing waits
+        // on an event loop, but every subscriber must be thread-safe.
+        IoThread,
+    };
+
     Proxy(const int port = 9999, QObject* parent = nullptr);
+
+    /**
+     * @brief Listens on @p port, running I/O on @p num_threads threads, or
+     *        on as many as the hardware suggests if it is zero.
+     */
+    Proxy(const int port, const int num_threads, QObject* parent = nullptr);
+
+    /**
+     * @brief As above, driving sockets with @p backend rather than with
+     *        the reactor.
+     */
+    Proxy(const int port, const int num_threads, IoBackend backend, QObject* parent = nullptr);
     virtual ~Proxy() = default;
 
     int port() const;
 
+    /**
+     * @brief Whether the server ended up driving sockets with io_uring.
+     */
+    bool uses_io_uring() const;
+
     virtual void enable();
     virtual void disable();
 
     void init();
     void deinit();
 
+    /**
+     * @brief Chooses where transactions are started; must be called before
+     *        init().  The default is Dispatch::OwnerThread.
+     */
+    void set_dispatch(Dispatch dispatch);
+    Dispatch dispatch() const;
+
+    /**
+     * @brief Chooses what becomes of the bodies of transactions started
+     *        from now on.
+     */
+    void set_capture_policy(const CapturePolicy& policy);
+    CapturePolicy capture_policy() const;
+
 signals:
     /**
      * @brief Emitted when a client transaction is about to begin.
      *
-     * Subscribers should note that this signal is always emitted on a
-     * background thread.  They should not do anything _except_ register
+     * Subscribers should note that this signal is emitted on the thread
+     * that starts the transaction, which is an I/O thread with
+     * Dispatch::IoThread.  They should not do anything _except_ register
      * themselves as a listener on the new transaction!
      *
      * Connections _should not_ be QUEUED; when this method completes,
@@ -68,11 +118,18 @@ signals:
 
 private slots:
     void on_client_connected(const std::shared_ptr<IConnection>& conn);
+    void on_next_request_pending(const std::shared_ptr<IConnection>& conn, const QByteArray& pipelined);
 
 private:
+    void start_transaction(const std::shared_ptr<IConnection>& conn, const QByteArray& pipelined);
+
     int port_;
     Server* server_;
     std::atomic_int next_id_;
+    Dispatch dispatch_;
+
+    mutable std::mutex capture_policy_mutex_;
+    CapturePolicy capture_policy_;
 };
 
 } // namespace ama
@@ -25,6 +25,8 @@
 #include <QString>
 #include <QByteArray>
 
+#include <string_view>
+
 namespace ama
 {
 
@@ -51,10 +53,12 @@ public:
     int minor_version() const noexcept { return message_.minor_version(); }
 
     const QString method() const { return message_.method(); }
-    void set_method(const QString& method) { message_.set_method(method); }
+    std::string_view method_bytes() const noexcept { return message_.method_bytes(); }
+    void set_method(std::string_view method) { message_.set_method(method); }
 
     const QString uri() const { return message_.uri(); }
-    void set_uri(const QString& uri) { message_.set_uri(uri); }
+    std::string_view uri_bytes() const noexcept { return message_.uri_bytes(); }
+    void set_uri(std::string_view uri) { message_.set_uri(uri); }
 
     Headers& headers() { return message_.headers(); }
     const Headers& headers() const { return message_.headers(); }
@@ -71,6 +75,17 @@ public:
 
     const QByteArray format() const noexcept;
 
+    /**
+     * @brief Formats the request line and headers, without the body.
+     */
+    const QByteArray format_head() const noexcept;
+
+    /**
+     * @brief Whether the client has asked to be told to go ahead before
+     *        sending its request body.
+     */
+    bool expects_continue() const;
+
     bool can_persist() const;
 
     friend class HttpMessageParser;
@@ -33,6 +33,8 @@ class A_EXPORT Response
 {
 public:
     Response();
+    Response(const HttpMessage& message);
+    Response(HttpMessage&& message);
     Response(const Response&) = default;
     Response(Response&&) = default;
     virtual ~Response() = default;
@@ -41,15 +43,23 @@ public:
     Response& operator=(Response&&) = default;
 
     int major_version() const noexcept { return message_.major_version(); }
-    int minor_version() const noexcept { return message_.major_version(); }
+    int minor_version() const noexcept { return message_.minor_version(); }
 
     Headers& headers() { return message_.headers(); }
     const Headers& headers() const { return message_.headers(); }
 
     int status_code() const { return message_.status_code(); }
     const QString status_message() const { return message_.status_message(); }
+    std::string_view status_message_bytes() const noexcept { return message_.status_message_bytes(); }
 
     QByteArray body() { return message_.body(); }
+    const QByteArray body() const { return message_.body(); }
+
+    /**
+     * @brief Determines whether the connection this response arrived on may
+     *        carry another exchange once the response has been relayed.
+     */
+    bool can_persist() const;
 
     friend class HttpMessageParser;
 
@@ -34,6 +34,21 @@ namespace ama
 
 class ConnectionPool;
 class Conn;
+class IoUring;
+class IoUringAcceptor;
+
+/**
+ * @brief How a Server drives its sockets.
+ */
+enum class IoBackend
+{
+    // With asio's reactor: epoll, on Linux.
+    Reactor,
+
+    // With io_uring where the kernel supports everything it needs, and
+    // with asio's reactor otherwise.
+    IoUring,
+};
 
 class A_EXPORT Server : public QObject
 {
@@ -41,11 +56,32 @@ class A_EXPORT Server : public QObject
 
 public:
     Server(const int port = 9999, QObject* parent = nullptr);
+
+    /**
+     * @brief Listens on @p port, running I/O on @p num_threads threads, or
+     *        on as many as the hardware suggests if it is zero.
+     */
+    Server(const int port, const int num_threads, QObject* parent = nullptr);
+
+    /**
+     * @brief As above, driving sockets with @p backend rather than with
+     *        the reactor.
+     */
+    Server(const int port, const int num_threads, IoBackend backend, QObject* parent = nullptr);
     ~Server();
 
     ConnectionPool* connection_pool() const;
 
+    /**
+     * @brief Whether sockets are driven with io_uring, which depends on the
+     *        kernel as well as on the backend asked for.
+     */
+    bool uses_io_uring() const;
+
 signals:
+    /**
+     * @brief Emitted on the I/O thread that accepted a new client.
+     */
     void connection_established(const std::shared_ptr<IConnection>& conn);
 
 private:
@@ -54,6 +90,8 @@ private:
 private:
     int port_;
     asio::io_context io_context_;
+    std::unique_ptr<IoUring> io_uring_;
+    std::shared_ptr<IoUringAcceptor> io_uring_acceptor_;
     asio::signal_set signals_;
     asio::ip::tcp::acceptor acceptor_;
     asio::ip::tcp::socket socket_;
@@ -18,8 +18,12 @@
 #pragma once
 
 #include "core/global.h"
+#include "core/BodySink.h"
+#include "core/BufferPool.h"
 #include "core/ConnectionPool.h"
 #include "core/HttpMessageParser.h"
+#include "core/HttpMessageView.h"
+#include "core/MessageArena.h"
 #include "core/Request.h"
 #include "core/Response.h"
 
@@ -32,8 +36,8 @@
 #include <atomic>
 #include <cstdint>
 #include <memory>
+#include <mutex>
 #include <system_error>
-#include <vector>
 
 namespace ama {
 
@@ -63,11 +67,55 @@ public:
 
     int id() const;
     NotificationState state() const;
-    Request& request();
-    Response& response();
+
+    /**
+     * @brief Copies of the messages as far as they have been received.
+     *
+     * Safe to call from any thread, at any time.
+     */
+    Request request();
+    Response response();
     std::error_code error() const;
 
+    /**
+     * @brief Chooses what becomes of the request and response bodies.
+     *
+     * Must be called before the transaction begins.
+     */
+    void set_capture_policy(const CapturePolicy& policy);
+
+    /**
+     * @brief Supplies the start of the request, which was read from the
+     *        client along with the previous one on the same connection.
+     *
+     * Those bytes are parsed before anything more is read.  Must be called
+     * before the transaction begins.
+     */
+    void set_pipelined_input(const QByteArray& input);
+
+    /**
+     * @brief The sinks the bodies went to, or null if they were kept with
+     *        their messages.
+     *
+     * A sink is only safe to inspect once its message is complete.
+     */
+    std::shared_ptr<BodySink> request_body_sink() const;
+    std::shared_ptr<BodySink> response_body_sink() const;
+
+    /**
+     * @brief How many bytes a CONNECT tunnel has relayed so far, from the
+     *        client to the server and from the server to the client.
+     *
+     * Safe to call from any thread; see on_tunnel_progress.
+     */
+    uint64_t tunnel_bytes_to_remote() const;
+    uint64_t tunnel_bytes_to_client() const;
+
 public slots:
+    /**
+     * @brief Starts the exchange on the transaction's strand.  May be
+     *        called from any thread.
+     */
     void begin();
 
 signals:
@@ -75,20 +123,77 @@ signals:
     void on_request_read(const QSharedPointer<ama::Transaction>& tx);
     void on_response_headers_read(const QSharedPointer<ama::Transaction>& tx);
     void on_response_read(const QSharedPointer<ama::Transaction>& tx);
+
+    /**
+     * @brief Emitted exactly once, when the transaction has finished with
+     *        its connections; after on_transaction_failed if it failed.
+     */
     void on_transaction_complete(const QSharedPointer<ama::Transaction>& tx);
     void on_transaction_failed(const QSharedPointer<ama::Transaction>& tx);
 
+    /**
+     * @brief Emitted when a CONNECT tunnel opens, and then at most every
+     *        half second for as long as bytes are moving through it.
+     */
+    void on_tunnel_progress(const QSharedPointer<ama::Transaction>& tx);
+
+    /**
+     * @brief Emitted when the client connection outlives this transaction
+     *        and has sent the first bytes of its next request.
+     *
+     * If the client pipelined its next request, some or all of it may
+     * already have been read; those bytes are given in @p pipelined, and
+     * are to be passed to the next transaction's set_pipelined_input().
+     *
+     * The transaction no longer refers to the connection once this is
+     * emitted; whoever receives it is responsible for starting the next
+     * exchange on it.
+     */
+    void on_next_request_pending(const std::shared_ptr<ama::IConnection>& client, const QByteArray& pipelined);
+
 private:
+    // The steps of the exchange, each started by the one before it from
+    // the completion handler of its I/O.
     void read_client_request();
+    void parse_client_request();
     void open_remote_connection();
+    void connect_to_remote();
     void send_client_request_to_remote();
+    void send_request_body_to_remote();
+    void request_body_sent();
+    void read_request_body();
+    bool retry_with_new_connection(bool request_written);
 
     void read_remote_response();
-    void send_remote_response_to_client();
+    void relay_response_to_client(QByteArrayView data, HttpMessageParser::State state);
 
     void establish_tls_tunnel();
-    void send_client_request_via_tunnel();
-    void send_server_response_via_tunnel();
+
+    // The same exchange, written as coroutines, in builds configured
+    // with USE_COROUTINES; see Transaction.cpp.
+    friend class CoroutineFlow;
+
+    // What happens between the I/O, whichever way the exchange is driven.
+    bool take_pipelined_input();
+    HttpMessageParser::State parse_request_head();
+    void request_complete();
+    bool choose_remote_origin();
+    bool lease_pooled_connection();
+    bool discard_stale_connection(bool request_written);
+    HttpMessageParser::State parse_request_body(size_t num_read);
+    void begin_response();
+    QByteArrayView prepare_response_buffer(bool reading_head);
+    HttpMessageParser::State parse_response(bool reading_head, size_t num_bytes_read, QByteArrayView& consumed);
+    void parse_tunnel_origin(std::string& host, std::string& port);
+
+    QByteArrayView prepare_body_buffer(const std::shared_ptr<BodySink>& sink);
+    void release_body_buffer();
+
+    void relay_tunnel();
+    void send_client_request_via_tunnel(const std::shared_ptr<IConnection>& client, const std::shared_ptr<IConnection>& remote);
+    void send_server_response_via_tunnel(const std::shared_ptr<IConnection>& remote, const std::shared_ptr<IConnection>& client);
+    void report_tunnel_progress();
+    void end_tunnel(std::error_code ec);
 
     void notify_phase_change(ParsePhase phase);
     void do_notification(NotificationState ns);
@@ -96,8 +201,22 @@ private:
 
     void complete_transaction();
 
+    bool can_persist() const;
+    void wait_for_next_request(const std::shared_ptr<IConnection>& client);
+
     void release_connections();
 
+    // Wraps a completion handler so that it runs on the transaction's
+    // strand, whichever worker thread its operation completes on.
+    template <typename Handler>
+    auto on_strand(Handler&& handler);
+
+    // Runs a change to request_view_ or response_view_ under
+    // message_mutex_, so that request() and response() never copy one as
+    // it changes.  Never held while signals are emitted.
+    template <typename Change>
+    auto change_messages(Change&& change);
+
 private:
     int id_;
     std::error_code error_;
@@ -105,33 +224,103 @@ private:
     std::shared_ptr<IConnection> client_;
     std::shared_ptr<IConnection> remote_;
 
+    // The origin we're talking to, so that a reusable remote connection
+    // can be returned to the pool under the right key.
+    std::string remote_host_;
+    std::string remote_port_;
+
+    // Set when remote_ was leased from the pool rather than freshly opened;
+    // such connections may have been closed by the server while idle.
+    bool remote_is_pooled_;
+
     ConnectionPool* connection_pool_;
 
+    // Backs the parser's scratch buffers and the views' field and body
+    // segment lists, and so must outlive them; it all goes at once with
+    // the transaction.
+    MessageArena arena_;
+
     HttpMessageParser parser_;
 
-    std::array<uint8_t, 8192> read_buffer_;
-    std::unique_ptr<std::array<uint8_t, 8192>> remote_buffer_;
+    // Buffers for the two directions of a buffered TLS tunnel, each
+    // leased for one read and the write that relays it.
+    IoBuffer to_remote_buffer_;
+    IoBuffer to_client_buffer_;
 
-    // Records the exact bytes received from client/server, so that
-    // they can be relayed as-is.
-    std::vector<uint8_t> raw_input_;
+    // Bytes relayed through a TLS tunnel, whichever way it is relayed.
+    std::atomic<uint64_t> tunnel_bytes_to_remote_;
+    std::atomic<uint64_t> tunnel_bytes_to_client_;
 
-    ParsePhase request_parse_phase_;
-    Request request_;
+    // Message heads are read into, and parsed in place in, their views.
+    // Body bytes are read into body_buffer_ - a fresh one for each read
+    // when bodies are kept, since the view then keeps every buffer its
+    // message's body lies in.  When a sink keeps them instead, body_buffer_
+    // wraps body_lease_, which is held only until the bytes are relayed.
+    HttpMessageView request_view_;
+    HttpMessageView response_view_;
+    QByteArray body_buffer_;
+    IoBuffer body_lease_;
+
+    CapturePolicy capture_policy_;
+    std::shared_ptr<BodySink> request_sink_;
+    std::shared_ptr<BodySink> response_sink_;
+
+    // Bytes of the request read before the transaction began, and bytes
+    // read past the end of it, which belong to the next one.  Requests on
+    // a connection are still handled one at a time, so responses go back
+    // in the order the requests came in.
+    QByteArray pipelined_input_;
+    QByteArray next_request_input_;
+
+    // Request body bytes that have been parsed but not yet relayed to the
+    // server; these lie in one of the buffers above.
+    QByteArrayView request_body_;
+
+    // Set once any of the request body has been read past the buffer
+    // holding the request head, after which the request can no longer be
+    // replayed.
+    bool request_body_streamed_;
 
+    // Set when the client sent "Expect: 100-continue" and has yet to be
+    // told to go ahead.
+    bool continue_pending_;
+
+    // How much of the response has arrived from the server so far.
+    // Response bytes are relayed to the client as soon as they are read,
+    // so once this is non-zero the exchange can no longer be retried.
+    uint64_t response_bytes_received_;
+
+    ParsePhase request_parse_phase_;
     ParsePhase response_parse_phase_;
+
+    // Copies of the messages in their views, built on demand for observers
+    // of the transaction.  Once a message is complete its copy is kept.
+    // The strand takes message_mutex_ to change the views, and observers
+    // take it to copy them.
+    Request request_;
     Response response_;
+    bool request_materialized_;
+    bool response_materialized_;
+    std::mutex message_mutex_;
 
     NotificationState notification_state_;
 
-    // Used to guard against double-releasing connections, which is
-    // possible in TLS tunneling.  There's a race condition when one end
-    // closes the connection - two threads might both try to delete
-    // connections, which (at least on MSVC in debug builds) can cause
-    // a segfault.
+    // Set by complete_transaction(), which is the only place that emits
+    // on_transaction_complete, so that it is emitted exactly once however
+    // the transaction ends - with a response, an error or a closed tunnel.
+    bool complete_;
+
+    // Every step of the transaction runs on this strand, so no two of them
+    // ever run at once and the state above needs no lock.  Only the two
+    // directions of a buffered TLS tunnel run off it; they come back to it
+    // to end the tunnel, so the connections are released exactly once.
     //
-    // See https://github.com/benjamin-bader/amanuensis/issues/45 for deets.
-    std::mutex mutex_;
+    // See https://github.com/benjamin-bader/amanuensis/issues/45 for why
+    // that matters.
+    asio::strand<asio::io_context::executor_type> strand_;
+
+    // Paces on_tunnel_progress while a tunnel is open.
+    asio::steady_timer tunnel_progress_timer_;
 };
 
 } // namespace ama
@@ -22,9 +22,14 @@
 #include <asio.hpp>
 #include <asio/ssl.hpp>
 
+#include <array>
 #include <atomic>
+#include <cstddef>
 #include <memory>
+#include <new>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace ama {
 
@@ -36,12 +41,183 @@ using ssl_socket = asio::ssl::stream<tcp_socket>;
 template <typename ...Ts>
 inline constexpr bool always_false_v = false;
 
+/**
+ * @brief A block of memory for one asynchronous operation at a time.
+ *
+ * A connection has at most one read and one write in flight, and asio
+ * releases an operation's memory before calling its handler; so the next
+ * operation, started from that handler, finds the block free again.  An
+ * operation that doesn't fit, or that overlaps another, falls back to the
+ * heap.
+ */
+class HandlerMemory
+{
+public:
+    HandlerMemory() = default;
+
+    HandlerMemory(const HandlerMemory&) = delete;
+    HandlerMemory& operator=(const HandlerMemory&) = delete;
+
+    void* allocate(std::size_t size)
+    {
+        if (size <= sizeof(storage_) && !in_use_.exchange(true, std::memory_order_acquire))
+        {
+            return storage_;
+        }
+        return ::operator new(size);
+    }
+
+    void deallocate(void* pointer)
+    {
+        if (pointer == storage_)
+        {
+            in_use_.store(false, std::memory_order_release);
+        }
+        else
+        {
+            ::operator delete(pointer);
+        }
+    }
+
+private:
+    alignas(std::max_align_t) unsigned char storage_[1024];
+    std::atomic_bool in_use_ = false;
+};
+
+/**
+ * @brief The allocator that asio finds associated with a handler, which
+ *        hands out a HandlerMemory block.
+ */
+template <typename T>
+class HandlerAllocator
+{
+public:
+    using value_type = T;
+
+    explicit HandlerAllocator(HandlerMemory& memory) noexcept
+        : memory_(&memory)
+    {}
+
+    template <typename U>
+    HandlerAllocator(const HandlerAllocator<U>& other) noexcept
+        : memory_(other.memory_)
+    {}
+
+    T* allocate(std::size_t n) const
+    {
+        return static_cast<T*>(memory_->allocate(sizeof(T) * n));
+    }
+
+    void deallocate(T* pointer, std::size_t /* n */) const
+    {
+        memory_->deallocate(pointer);
+    }
+
+    template <typename U>
+    bool operator==(const HandlerAllocator<U>& other) const noexcept
+    {
+        return memory_ == other.memory_;
+    }
+
+    template <typename U>
+    bool operator!=(const HandlerAllocator<U>& other) const noexcept
+    {
+        return memory_ != other.memory_;
+    }
+
+private:
+    template <typename> friend class HandlerAllocator;
+
+    HandlerMemory* memory_;
+};
+
+/**
+ * @brief Wraps a handler so that asio allocates its operation from the
+ *        given memory.
+ *
+ * The handler must keep the memory's owner alive until it runs.
+ */
+template <typename Handler>
+class AllocatingHandler
+{
+public:
+    using allocator_type = HandlerAllocator<void>;
+
+    AllocatingHandler(HandlerMemory& memory, Handler&& handler)
+        : memory_(&memory)
+        , handler_(std::move(handler))
+    {}
+
+    allocator_type get_allocator() const noexcept
+    {
+        return allocator_type(*memory_);
+    }
+
+    template <typename ...Args>
+    void operator()(Args&&... args)
+    {
+        handler_(std::forward<Args>(args)...);
+    }
+
+private:
+    HandlerMemory* memory_;
+    Handler handler_;
+};
+
+template <typename Handler>
+AllocatingHandler<std::decay_t<Handler>> make_allocating_handler(HandlerMemory& memory, Handler&& handler)
+{
+    return { memory, std::forward<Handler>(handler) };
+}
+
+/**
+ * @brief A buffer sequence for a gathered write that holds a few buffers
+ *        in place.
+ *
+ * asio keeps its own copy of the sequence for the length of the write;
+ * a forwarded request head is a handful of runs and perhaps a body, which
+ * fit here without allocating.
+ */
+class GatheredBuffers
+{
+public:
+    static constexpr std::size_t kCapacity = 8;
+
+    using value_type = asio::const_buffer;
+    using const_iterator = const asio::const_buffer*;
+
+    static bool fits(std::size_t count) noexcept
+    {
+        return count <= kCapacity;
+    }
+
+    void push_back(asio::const_buffer buffer) noexcept
+    {
+        buffers_[size_++] = buffer;
+    }
+
+    const_iterator begin() const noexcept
+    {
+        return buffers_.data();
+    }
+
+    const_iterator end() const noexcept
+    {
+        return buffers_.data() + size_;
+    }
+
+private:
+    std::array<asio::const_buffer, kCapacity> buffers_;
+    std::size_t size_ = 0;
+};
+
 template <typename Socket>
 class BaseConnection : public IConnection, public std::enable_shared_from_this<BaseConnection<Socket>>
 {
 public:
     explicit BaseConnection(Socket&& socket)
-        : socket_(std::move(socket))
+        : open_(true)
+        , socket_(std::move(socket))
     {}
 
     virtual ~BaseConnection() noexcept = default;
@@ -54,13 +230,83 @@ public:
     void async_write(const QByteArrayView data, Callback&& callback) override
     {
         auto buf = asio::buffer(data.data(), data.size());
-        asio::async_write(socket_, buf, std::move(callback));
+        asio::async_write(socket_, buf, write_handler(std::move(callback)));
+    }
+
+    void async_writev(const std::vector<QByteArrayView>& buffers, Callback&& callback) override
+    {
+        // asio keeps its own copy of the sequence, and hands it to the
+        // socket as one writev where it can.
+        if (GatheredBuffers::fits(buffers.size()))
+        {
+            GatheredBuffers sequence;
+            for (const auto& buffer : buffers)
+            {
+                sequence.push_back(asio::const_buffer(buffer.data(), static_cast<std::size_t>(buffer.size())));
+            }
+            asio::async_write(socket_, sequence, write_handler(std::move(callback)));
+            return;
+        }
+
+        std::vector<asio::const_buffer> sequence;
+        sequence.reserve(buffers.size());
+        for (const auto& buffer : buffers)
+        {
+            sequence.emplace_back(buffer.data(), static_cast<std::size_t>(buffer.size()));
+        }
+        asio::async_write(socket_, std::move(sequence), write_handler(std::move(callback)));
     }
 
     void async_read(QByteArrayView buffer, Callback&& callback) override
     {
         asio::mutable_buffer mb{const_cast<char*>(buffer.data()), static_cast<std::size_t>(buffer.size())};
-        asio::async_read(socket_, std::move(mb), asio::transfer_at_least(1), std::move(callback));
+        asio::async_read(socket_, std::move(mb), asio::transfer_at_least(1), read_handler(std::move(callback)));
+    }
+
+    void async_wait_readable(Callback&& callback) override
+    {
+        auto self = this->shared_from_this();
+        auto on_readable = [self, callback = std::move(callback)](std::error_code ec) mutable
+        {
+            std::size_t num_available = 0;
+            if (!ec)
+            {
+                num_available = self->socket_.lowest_layer().available(ec);
+            }
+
+            // The reactor can report readiness when there is nothing to
+            // read after all; only a closed connection is readable and
+            // empty, so anything else means waiting some more.
+            if (!ec && num_available == 0 && self->peek_would_block())
+            {
+                self->async_wait_readable(std::move(callback));
+                return;
+            }
+
+            callback(ec, num_available);
+        };
+
+        // Waiting takes the place of a read, so it borrows the read memory.
+        socket_.lowest_layer().async_wait(asio::socket_base::wait_read, make_allocating_handler(read_memory_, std::move(on_readable)));
+    }
+
+    bool is_reusable() override
+    {
+        if (!open_)
+        {
+            return false;
+        }
+
+        auto& socket = tcp();
+        if (!socket.is_open())
+        {
+            return false;
+        }
+
+        // An idle connection should have nothing to say; if it is readable,
+        // the peer either closed it or sent something that no request of
+        // ours asked for.
+        return peek_would_block();
     }
 
     void close(std::error_code& ec) override
@@ -84,9 +330,69 @@ public:
         }
     }
 
+private:
+    // Each operation holds on to the connection, as the memory it was
+    // allocated from belongs to the connection.
+    auto read_handler(Callback&& callback)
+    {
+        return make_allocating_handler(read_memory_, [self = this->shared_from_this(), callback = std::move(callback)](std::error_code ec, std::size_t num_bytes) mutable
+        {
+            callback(ec, num_bytes);
+        });
+    }
+
+    auto write_handler(Callback&& callback)
+    {
+        return make_allocating_handler(write_memory_, [self = this->shared_from_this(), callback = std::move(callback)](std::error_code ec, std::size_t num_bytes) mutable
+        {
+            callback(ec, num_bytes);
+        });
+    }
+
+    // Peeks at the socket without blocking, and reports whether there was
+    // nothing to read - neither data nor the end of the stream.
+    bool peek_would_block()
+    {
+        auto& socket = tcp();
+
+        std::error_code ec;
+        socket.non_blocking(true, ec);
+        if (ec)
+        {
+            return false;
+        }
+
+        char probe;
+        socket.receive(asio::buffer(&probe, 1), asio::socket_base::message_peek, ec);
+        bool would_block = ec == asio::error::would_block;
+
+        socket.non_blocking(false, ec);
+        return would_block && !ec;
+    }
+
+    tcp_socket& tcp()
+    {
+        if constexpr(std::is_same_v<Socket, tcp_socket>)
+        {
+            return socket_;
+        }
+        else if constexpr(std::is_same_v<Socket, ssl_socket>)
+        {
+            return socket_.next_layer();
+        }
+        else
+        {
+            static_assert(always_false_v<Socket>);
+        }
+    }
+
 private:
     std::atomic_bool open_;
     Socket socket_;
+
+    // Reads and writes may be in flight at once, so each has its own block.
+    HandlerMemory read_memory_;
+    HandlerMemory write_memory_;
 };
 
 } // details
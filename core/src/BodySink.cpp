@@ -0,0 +1,187 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "core/BodySink.h"
+
+#include <QTemporaryFile>
+
+#include "log/Log.h"
+
+namespace ama {
+
+void BodySink::begin_chunk(uint64_t)
+{
+}
+
+void BodySink::trailer(QByteArrayView name, QByteArrayView value)
+{
+    trailers_.emplace_back(name.toByteArray(), value.toByteArray());
+}
+
+void BodySink::end()
+{
+}
+
+const std::vector<std::pair<QByteArray, QByteArray>>& BodySink::trailers() const
+{
+    return trailers_;
+}
+
+void MemoryBodySink::write(const char* data, size_t length)
+{
+    body_.append(data, static_cast<qsizetype>(length));
+}
+
+const QByteArray& MemoryBodySink::body() const
+{
+    return body_;
+}
+
+void CountingBodySink::write(const char*, size_t length)
+{
+    size_ += length;
+}
+
+uint64_t CountingBodySink::size() const
+{
+    return size_;
+}
+
+HashingBodySink::HashingBodySink(QCryptographicHash::Algorithm algorithm)
+    : hash_(algorithm)
+    , size_(0)
+{}
+
+void HashingBodySink::write(const char* data, size_t length)
+{
+    hash_.addData(QByteArrayView(data, static_cast<qsizetype>(length)));
+    size_ += length;
+}
+
+uint64_t HashingBodySink::size() const
+{
+    return size_;
+}
+
+QByteArray HashingBodySink::digest() const
+{
+    return hash_.result();
+}
+
+SpillingBodySink::SpillingBodySink(qint64 threshold)
+    : threshold_(threshold)
+    , size_(0)
+    , memory_()
+    , file_()
+    , error_()
+{}
+
+SpillingBodySink::~SpillingBodySink() = default;
+
+void SpillingBodySink::write(const char* data, size_t length)
+{
+    size_ += length;
+    if (error_)
+    {
+        return;
+    }
+
+    if (file_ == nullptr)
+    {
+        memory_.append(data, static_cast<qsizetype>(length));
+        if (memory_.size() > threshold_)
+        {
+            spill();
+        }
+        return;
+    }
+
+    if (file_->write(data, static_cast<qint64>(length)) != static_cast<qint64>(length))
+    {
+        log::warn("SpillingBodySink: failed to write body to disk", log::StringValue("file", file_->fileName().toStdString()));
+        error_ = std::make_error_code(std::errc::io_error);
+    }
+}
+
+void SpillingBodySink::end()
+{
+    if (file_ != nullptr && !error_ && !file_->flush())
+    {
+        log::warn("SpillingBodySink: failed to flush temporary file for body");
+        error_ = std::make_error_code(std::errc::io_error);
+    }
+}
+
+void SpillingBodySink::spill()
+{
+    file_ = std::make_unique<QTemporaryFile>();
+    if (!file_->open() || file_->write(memory_) != memory_.size())
+    {
+        log::warn("SpillingBodySink: failed to create temporary file for body");
+        error_ = std::make_error_code(std::errc::io_error);
+    }
+
+    memory_.clear();
+    memory_.squeeze();
+}
+
+uint64_t SpillingBodySink::size() const
+{
+    return size_;
+}
+
+bool SpillingBodySink::spilled() const
+{
+    return file_ != nullptr;
+}
+
+const QByteArray& SpillingBodySink::memory() const
+{
+    return memory_;
+}
+
+QString SpillingBodySink::file_name() const
+{
+    return file_ != nullptr ? file_->fileName() : QString();
+}
+
+std::error_code SpillingBodySink::error() const
+{
+    return error_;
+}
+
+std::shared_ptr<BodySink> make_body_sink(const CapturePolicy& policy)
+{
+    switch (policy.mode)
+    {
+    case CapturePolicy::Mode::Memory:
+        return nullptr;
+
+    case CapturePolicy::Mode::Count:
+        return std::make_shared<CountingBodySink>();
+
+    case CapturePolicy::Mode::Hash:
+        return std::make_shared<HashingBodySink>();
+
+    case CapturePolicy::Mode::Spill:
+        return std::make_shared<SpillingBodySink>(policy.spill_threshold);
+    }
+
+    return nullptr;
+}
+
+} // namespace ama
@@ -0,0 +1,113 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "BodySinkTest.h"
+
+#include <memory>
+#include <string>
+
+#include <QFile>
+#include <QtTest>
+
+#include "core/BodySink.h"
+
+using namespace ama;
+
+namespace {
+
+void write(BodySink& sink, const std::string& text)
+{
+    sink.write(text.data(), text.size());
+}
+
+} // namespace
+
+void BodySinkTest::memory_sink_keeps_body()
+{
+    MemoryBodySink sink;
+    write(sink, "hello");
+    write(sink, ", world");
+    sink.trailer("X-Checksum", "1234");
+    sink.end();
+
+    QCOMPARE(sink.body(), QByteArray("hello, world"));
+    QCOMPARE(sink.trailers().size(), size_t{1});
+    QCOMPARE(sink.trailers()[0].first, QByteArray("X-Checksum"));
+    QCOMPARE(sink.trailers()[0].second, QByteArray("1234"));
+}
+
+void BodySinkTest::counting_sink_counts()
+{
+    CountingBodySink sink;
+    write(sink, "hello");
+    write(sink, std::string(10000, 'x'));
+
+    QCOMPARE(sink.size(), uint64_t{10005});
+}
+
+void BodySinkTest::hashing_sink_digests()
+{
+    HashingBodySink sink;
+    write(sink, "a");
+    write(sink, "bc");
+
+    QCOMPARE(sink.size(), uint64_t{3});
+    QCOMPARE(sink.digest().toHex(), QByteArray("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"));
+}
+
+void BodySinkTest::spilling_sink_moves_large_bodies_to_disk()
+{
+    SpillingBodySink small(16);
+    write(small, "tiny");
+    QVERIFY(!small.spilled());
+    QCOMPARE(small.memory(), QByteArray("tiny"));
+
+    SpillingBodySink large(16);
+    write(large, "0123456789");
+    write(large, "abcdefghij");
+    write(large, "KLMNOPQRST");
+    large.end();
+    QVERIFY(large.spilled());
+    QVERIFY(!large.error());
+    QVERIFY(large.memory().isEmpty());
+    QCOMPARE(large.size(), uint64_t{30});
+
+    QFile file(large.file_name());
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.readAll(), QByteArray("0123456789abcdefghijKLMNOPQRST"));
+}
+
+void BodySinkTest::policy_chooses_sink()
+{
+    CapturePolicy policy;
+    QVERIFY(make_body_sink(policy) == nullptr);
+
+    policy.mode = CapturePolicy::Mode::Count;
+    QVERIFY(std::dynamic_pointer_cast<CountingBodySink>(make_body_sink(policy)) != nullptr);
+
+    policy.mode = CapturePolicy::Mode::Hash;
+    QVERIFY(std::dynamic_pointer_cast<HashingBodySink>(make_body_sink(policy)) != nullptr);
+
+    policy.mode = CapturePolicy::Mode::Spill;
+    policy.spill_threshold = 4;
+    auto sink = std::dynamic_pointer_cast<SpillingBodySink>(make_body_sink(policy));
+    QVERIFY(sink != nullptr);
+    write(*sink, "more than four");
+    QVERIFY(sink->spilled());
+}
+
+QTEST_GUILESS_MAIN(BodySinkTest)
@@ -0,0 +1,35 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <QObject>
+
+class BodySinkTest : public QObject
+{
+    Q_OBJECT
+
+public:
+    BodySinkTest() = default;
+
+private Q_SLOTS:
+    void memory_sink_keeps_body();
+    void counting_sink_counts();
+    void hashing_sink_digests();
+    void spilling_sink_moves_large_bodies_to_disk();
+    void policy_chooses_sink();
+};
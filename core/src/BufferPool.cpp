@@ -0,0 +1,338 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "core/BufferPool.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace ama {
+
+namespace {
+
+std::atomic_bool g_huge_pages = false;
+
+#if defined(__linux__)
+
+constexpr std::size_t kHugePageSize = 2 * 1024 * 1024;
+
+// Carves blocks out of 2 MiB slabs that the kernel is advised to back with
+// transparent huge pages.  Slabs are never given back; a block freed into
+// one waits on a free list for the next block of its size.
+class HugePageSlabs
+{
+public:
+    void* allocate(std::size_t size)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto& list = free_list(size);
+        if (list.head != nullptr)
+        {
+            auto block = list.head;
+            list.head = block->next;
+            return block;
+        }
+
+        if (size > kHugePageSize)
+        {
+            return nullptr;
+        }
+
+        if (remaining_ < size)
+        {
+            auto slab = static_cast<char*>(std::aligned_alloc(kHugePageSize, kHugePageSize));
+            if (slab == nullptr)
+            {
+                return nullptr;
+            }
+
+            // Only advice; without transparent huge pages, the slab is
+            // mapped in ordinary pages.
+            madvise(slab, kHugePageSize, MADV_HUGEPAGE);
+
+            slabs_.push_back(slab);
+            cursor_ = slab;
+            remaining_ = kHugePageSize;
+            in_use_.store(true, std::memory_order_release);
+        }
+
+        auto block = cursor_;
+        cursor_ += size;
+        remaining_ -= size;
+        return block;
+    }
+
+    bool deallocate(void* block, std::size_t size) noexcept
+    {
+        if (!in_use_.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!owns(block))
+        {
+            return false;
+        }
+
+        auto& list = free_list(size);
+        list.head = ::new (block) FreeBlock{ list.head };
+        return true;
+    }
+
+private:
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    struct FreeList
+    {
+        std::size_t size;
+        FreeBlock* head;
+    };
+
+    FreeList& free_list(std::size_t size)
+    {
+        for (auto& list : free_lists_)
+        {
+            if (list.size == size)
+            {
+                return list;
+            }
+        }
+        return free_lists_.emplace_back(FreeList{ size, nullptr });
+    }
+
+    bool owns(void* block) const noexcept
+    {
+        auto address = static_cast<char*>(block);
+        for (auto slab : slabs_)
+        {
+            if (address >= slab && address < slab + kHugePageSize)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::mutex mutex_;
+    std::atomic_bool in_use_ = false;
+    std::vector<char*> slabs_;
+    std::vector<FreeList> free_lists_;
+    char* cursor_ = nullptr;
+    std::size_t remaining_ = 0;
+};
+
+// Never destroyed, as blocks may be freed into it at any point during exit.
+HugePageSlabs& huge_page_slabs()
+{
+    static auto slabs = new HugePageSlabs;
+    return *slabs;
+}
+
+#endif // __linux__
+
+} // namespace
+
+namespace details {
+
+void* allocate_buffer_block(std::size_t size)
+{
+#if defined(__linux__)
+    if (g_huge_pages.load(std::memory_order_relaxed))
+    {
+        if (auto block = huge_page_slabs().allocate(size))
+        {
+            return block;
+        }
+    }
+#endif
+
+    return ::operator new(size);
+}
+
+void free_buffer_block(void* block, std::size_t size) noexcept
+{
+#if defined(__linux__)
+    if (huge_page_slabs().deallocate(block, size))
+    {
+        return;
+    }
+#endif
+
+    ::operator delete(block);
+}
+
+} // namespace details
+
+IoBuffer::IoBuffer(BufferPool* pool, void* block, char* data, qsizetype size) noexcept
+    : pool_(pool)
+    , block_(block)
+    , data_(data)
+    , size_(size)
+{}
+
+IoBuffer::IoBuffer(IoBuffer&& other) noexcept
+    : pool_(std::exchange(other.pool_, nullptr))
+    , block_(std::exchange(other.block_, nullptr))
+    , data_(std::exchange(other.data_, nullptr))
+    , size_(std::exchange(other.size_, 0))
+{}
+
+IoBuffer::~IoBuffer()
+{
+    reset();
+}
+
+IoBuffer& IoBuffer::operator=(IoBuffer&& other) noexcept
+{
+    if (this != &other)
+    {
+        reset();
+        pool_ = std::exchange(other.pool_, nullptr);
+        block_ = std::exchange(other.block_, nullptr);
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+}
+
+void IoBuffer::reset() noexcept
+{
+    if (pool_ != nullptr)
+    {
+        pool_->recycle(block_, size_);
+    }
+    else
+    {
+        delete[] data_;
+    }
+
+    pool_ = nullptr;
+    block_ = nullptr;
+    data_ = nullptr;
+    size_ = 0;
+}
+
+// A megabyte of each class waits in the pools at most; more than that is
+// freed as it comes back.  Each thread keeps up to 128 KiB of each class
+// in its magazines.
+BufferPool::BufferPool()
+    : small_(0, 256, 8)
+    , medium_(0, 64, 8)
+    , large_(0, 16, 2)
+{}
+
+BufferPool& BufferPool::shared()
+{
+    // Never destroyed, so that leases returned during exit find it.
+    static auto pool = new BufferPool;
+    return *pool;
+}
+
+void BufferPool::set_huge_pages(bool enabled)
+{
+    g_huge_pages.store(enabled, std::memory_order_relaxed);
+}
+
+bool BufferPool::huge_pages()
+{
+    return g_huge_pages.load(std::memory_order_relaxed);
+}
+
+std::size_t BufferPool::size_class_index(std::size_t size)
+{
+    std::size_t index = 0;
+    while (index < kNumSizeClasses && kSizes[index] < size)
+    {
+        ++index;
+    }
+    return index;
+}
+
+IoBuffer BufferPool::acquire(std::size_t min_size)
+{
+    auto index = size_class_index(min_size);
+    if (index == kNumSizeClasses)
+    {
+        // Too big for any class; it's allocated for this lease alone.
+        return IoBuffer(nullptr, nullptr, new char[min_size], static_cast<qsizetype>(min_size));
+    }
+
+    // The lease carries the block's handle, detached, and points at its
+    // bytes; recycle() attaches the handle again to return the block.
+    auto lease = [this](auto& pool)
+    {
+        auto block = pool.acquire();
+        auto data = block->bytes;
+        auto size = static_cast<qsizetype>(sizeof(block->bytes));
+        return IoBuffer(this, block.detach(), data, size);
+    };
+
+    switch (index)
+    {
+    case 0: return lease(small_);
+    case 1: return lease(medium_);
+    default: return lease(large_);
+    }
+}
+
+void BufferPool::recycle(void* block, qsizetype size) noexcept
+{
+    // The reattached handle goes out of scope at once, returning the block.
+    switch (size_class_index(static_cast<std::size_t>(size)))
+    {
+    case 0: decltype(small_)::Handle::attach(block); break;
+    case 1: decltype(medium_)::Handle::attach(block); break;
+    default: decltype(large_)::Handle::attach(block); break;
+    }
+}
+
+std::size_t BufferPool::num_idle(std::size_t size_class) const
+{
+    switch (size_class_index(size_class))
+    {
+    case 0: return small_.num_idle();
+    case 1: return medium_.num_idle();
+    case 2: return large_.num_idle();
+    default: return 0;
+    }
+}
+
+std::size_t BufferPool::num_borrowed(std::size_t size_class) const
+{
+    switch (size_class_index(size_class))
+    {
+    case 0: return small_.num_borrowed();
+    case 1: return medium_.num_borrowed();
+    case 2: return large_.num_borrowed();
+    default: return 0;
+    }
+}
+
+} // namespace ama
@@ -0,0 +1,131 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "BufferPoolTest.h"
+
+#include <cstring>
+#include <vector>
+
+#include <QtTest>
+
+#include "core/BufferPool.h"
+
+using namespace ama;
+
+void BufferPoolTest::rounds_up_to_size_classes()
+{
+    BufferPool pool;
+
+    QCOMPARE(pool.acquire(1).size(), qsizetype{4096});
+    QCOMPARE(pool.acquire(4096).size(), qsizetype{4096});
+    QCOMPARE(pool.acquire(4097).size(), qsizetype{16384});
+    QCOMPARE(pool.acquire(16384).size(), qsizetype{16384});
+    QCOMPARE(pool.acquire(20000).size(), qsizetype{65536});
+    QCOMPARE(pool.acquire(65536).size(), qsizetype{65536});
+}
+
+void BufferPoolTest::oversized_buffers_are_not_pooled()
+{
+    BufferPool pool;
+
+    auto buffer = pool.acquire(100000);
+    QCOMPARE(buffer.size(), qsizetype{100000});
+    std::memset(buffer.data(), 0xAB, buffer.size());
+
+    QCOMPARE(pool.num_borrowed(BufferPool::kLargeSize), size_t{0});
+    buffer.reset();
+    QCOMPARE(pool.num_idle(BufferPool::kLargeSize), size_t{0});
+}
+
+void BufferPoolTest::reuses_returned_buffers()
+{
+    BufferPool pool;
+
+    auto first = pool.acquire(BufferPool::kMediumSize);
+    QCOMPARE(pool.num_borrowed(BufferPool::kMediumSize), size_t{1});
+
+    char* data = first.data();
+    first.reset();
+    QVERIFY(!first);
+
+    auto second = pool.acquire(BufferPool::kMediumSize);
+    QCOMPARE(second.data(), data);
+    QCOMPARE(pool.num_borrowed(BufferPool::kMediumSize), size_t{1});
+}
+
+void BufferPoolTest::keeps_a_bounded_number_idle()
+{
+    BufferPool pool;
+
+    // The large class keeps sixteen buffers at most.
+    const size_t count = 20;
+    std::vector<IoBuffer> buffers;
+    for (size_t i = 0; i < count; ++i)
+    {
+        buffers.push_back(pool.acquire(BufferPool::kLargeSize));
+    }
+    QCOMPARE(pool.num_borrowed(BufferPool::kLargeSize), count);
+    QCOMPARE(pool.num_idle(BufferPool::kLargeSize), size_t{0});
+
+    buffers.clear();
+    QCOMPARE(pool.num_borrowed(BufferPool::kLargeSize), size_t{0});
+    QCOMPARE(pool.num_idle(BufferPool::kLargeSize), size_t{16});
+}
+
+void BufferPoolTest::moved_leases_are_empty()
+{
+    BufferPool pool;
+
+    auto first = pool.acquire(1);
+    char* data = first.data();
+
+    IoBuffer second = std::move(first);
+    QVERIFY(!first);
+    QCOMPARE(first.size(), qsizetype{0});
+    QCOMPARE(second.data(), data);
+
+    IoBuffer third;
+    third = std::move(second);
+    QVERIFY(!second);
+    QCOMPARE(third.data(), data);
+    QCOMPARE(pool.num_borrowed(BufferPool::kSmallSize), size_t{1});
+}
+
+void BufferPoolTest::huge_pages_back_new_buffers()
+{
+    BufferPool pool;
+    BufferPool::set_huge_pages(true);
+    QVERIFY(BufferPool::huge_pages());
+
+    std::vector<IoBuffer> buffers;
+    for (size_t i = 0; i < 40; ++i)
+    {
+        auto buffer = pool.acquire(BufferPool::kLargeSize);
+        std::memset(buffer.data(), static_cast<int>(i), buffer.size());
+        buffers.push_back(std::move(buffer));
+    }
+
+    for (size_t i = 0; i < buffers.size(); ++i)
+    {
+        QCOMPARE(static_cast<unsigned char>(buffers[i].data()[0]), static_cast<unsigned char>(i));
+        QCOMPARE(static_cast<unsigned char>(buffers[i].data()[BufferPool::kLargeSize - 1]), static_cast<unsigned char>(i));
+    }
+
+    BufferPool::set_huge_pages(false);
+}
+
+QTEST_GUILESS_MAIN(BufferPoolTest)
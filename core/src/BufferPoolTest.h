@@ -0,0 +1,36 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <QObject>
+
+class BufferPoolTest : public QObject
+{
+    Q_OBJECT
+
+public:
+    BufferPoolTest() = default;
+
+private Q_SLOTS:
+    void rounds_up_to_size_classes();
+    void oversized_buffers_are_not_pooled();
+    void reuses_returned_buffers();
+    void keeps_a_bounded_number_idle();
+    void moved_leases_are_empty();
+    void huge_pages_back_new_buffers();
+};
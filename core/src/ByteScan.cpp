@@ -0,0 +1,176 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "ByteScan.h"
+#include "ByteScanKernels.h"
+
+namespace ama {
+
+namespace scan {
+
+namespace {
+
+#if defined(AMA_SCAN_X86)
+
+// SSE2 is part of the x86-64 baseline, so this needs no special flags and
+// no runtime check.
+struct Sse2
+{
+    using Vec = __m128i;
+    static constexpr size_t kWidth = 16;
+
+    static Vec load(const char* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+    static Vec splat(char c) { return _mm_set1_epi8(c); }
+    static Vec eq(Vec a, Vec b) { return _mm_cmpeq_epi8(a, b); }
+    static Vec any(Vec a, Vec b) { return _mm_or_si128(a, b); }
+    static Vec at_most(Vec v, char c) { return _mm_cmpeq_epi8(_mm_min_epu8(v, splat(c)), v); }  // unsigned v <= c
+    static Vec at_least(Vec v, char c) { return _mm_cmpeq_epi8(_mm_max_epu8(v, splat(c)), v); } // unsigned v >= c
+    static uint32_t mask(Vec v) { return static_cast<uint32_t>(_mm_movemask_epi8(v)); }
+};
+
+const char* skip_token_sse2(const char* begin, const char* end)
+{
+    return skip_vector<Sse2, token_stops<Sse2>, is_token>(begin, end);
+}
+
+const char* skip_uri_sse2(const char* begin, const char* end)
+{
+    return skip_vector<Sse2, uri_stops<Sse2>, is_uri>(begin, end);
+}
+
+const char* skip_field_value_sse2(const char* begin, const char* end)
+{
+    return skip_vector<Sse2, field_value_stops<Sse2>, is_field_value>(begin, end);
+}
+
+const char* skip_reason_phrase_sse2(const char* begin, const char* end)
+{
+    return skip_vector<Sse2, reason_phrase_stops<Sse2>, is_reason_phrase>(begin, end);
+}
+
+bool cpu_has_avx2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+    {
+        return false;
+    }
+
+    // The OS must also be saving the upper halves of the YMM registers.
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+    {
+        return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#else
+
+const char* skip_token_scalar(const char* begin, const char* end)
+{
+    return skip_scalar<is_token>(begin, end);
+}
+
+const char* skip_uri_scalar(const char* begin, const char* end)
+{
+    return skip_scalar<is_uri>(begin, end);
+}
+
+const char* skip_field_value_scalar(const char* begin, const char* end)
+{
+    return skip_scalar<is_field_value>(begin, end);
+}
+
+const char* skip_reason_phrase_scalar(const char* begin, const char* end)
+{
+    return skip_scalar<is_reason_phrase>(begin, end);
+}
+
+#endif // AMA_SCAN_X86
+
+using ScanFn = const char* (*)(const char*, const char*);
+
+struct Implementation
+{
+    const char* name;
+    ScanFn token;
+    ScanFn uri;
+    ScanFn field_value;
+    ScanFn reason_phrase;
+};
+
+Implementation select_implementation()
+{
+#if defined(AMA_SCAN_X86)
+    if (cpu_has_avx2())
+    {
+        return { "avx2", avx2::skip_token, avx2::skip_uri, avx2::skip_field_value, avx2::skip_reason_phrase };
+    }
+    return { "sse2", skip_token_sse2, skip_uri_sse2, skip_field_value_sse2, skip_reason_phrase_sse2 };
+#else
+    return { "scalar", skip_token_scalar, skip_uri_scalar, skip_field_value_scalar, skip_reason_phrase_scalar };
+#endif
+}
+
+const Implementation& implementation()
+{
+    static const Implementation impl = select_implementation();
+    return impl;
+}
+
+} // namespace
+
+const char* skip_token(const char* begin, const char* end)
+{
+    return implementation().token(begin, end);
+}
+
+const char* skip_uri(const char* begin, const char* end)
+{
+    return implementation().uri(begin, end);
+}
+
+const char* skip_field_value(const char* begin, const char* end)
+{
+    return implementation().field_value(begin, end);
+}
+
+const char* skip_reason_phrase(const char* begin, const char* end)
+{
+    return implementation().reason_phrase(begin, end);
+}
+
+const char* implementation_name()
+{
+    return implementation().name;
+}
+
+} // namespace scan
+
+} // namespace ama
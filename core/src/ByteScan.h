@@ -0,0 +1,70 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstddef>
+
+namespace ama {
+
+namespace scan {
+
+// Bulk scanners for the hot loops of HttpMessageParser.
+//
+// Each function returns a pointer to the first byte in [begin, end) that
+// does NOT belong to the named character class, or end if every byte
+// does.  The classes mirror, exactly, the per-byte checks that the
+// parser makes in the corresponding states, so that a run found here can
+// be appended in one go without changing the outcome of parsing.
+//
+// The implementation is chosen once, at first use, according to what the
+// CPU supports: AVX2, then SSE2, then plain C++.
+
+/**
+ * @brief Skips token characters - those allowed in methods and header
+ *        names.  Stops at SP, ':', CR and any other delimiter.
+ */
+const char* skip_token(const char* begin, const char* end);
+
+/**
+ * @brief Skips characters allowed in a request URI; stops at SP or any
+ *        control character.
+ */
+const char* skip_uri(const char* begin, const char* end);
+
+/**
+ * @brief Skips characters allowed in a header value; stops at any control
+ *        character, including CR.
+ */
+const char* skip_field_value(const char* begin, const char* end);
+
+/**
+ * @brief Skips characters allowed in a response reason phrase; stops at
+ *        CR or any non-ASCII byte.
+ */
+const char* skip_reason_phrase(const char* begin, const char* end);
+
+/**
+ * @brief Names the implementation chosen for this CPU, for logging and
+ *        benchmarks: "avx2", "sse2" or "scalar".
+ */
+const char* implementation_name();
+
+} // namespace scan
+
+} // namespace ama
@@ -0,0 +1,78 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// This file is compiled with AVX2 enabled (see core/CMakeLists.txt) and
+// must only be called into after checking that the CPU supports it.  Keep
+// its includes to a minimum: inline functions from headers included here
+// may be compiled with AVX2 instructions.
+
+#include "ByteScanKernels.h"
+
+#if defined(AMA_SCAN_X86)
+
+namespace ama {
+
+namespace scan {
+
+namespace {
+
+struct Avx2
+{
+    using Vec = __m256i;
+    static constexpr size_t kWidth = 32;
+
+    static Vec load(const char* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    static Vec splat(char c) { return _mm256_set1_epi8(c); }
+    static Vec eq(Vec a, Vec b) { return _mm256_cmpeq_epi8(a, b); }
+    static Vec any(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+    static Vec at_most(Vec v, char c) { return _mm256_cmpeq_epi8(_mm256_min_epu8(v, splat(c)), v); }  // unsigned v <= c
+    static Vec at_least(Vec v, char c) { return _mm256_cmpeq_epi8(_mm256_max_epu8(v, splat(c)), v); } // unsigned v >= c
+    static uint32_t mask(Vec v) { return static_cast<uint32_t>(_mm256_movemask_epi8(v)); }
+};
+
+} // namespace
+
+namespace avx2 {
+
+const char* skip_token(const char* begin, const char* end)
+{
+    return skip_vector<Avx2, token_stops<Avx2>, is_token>(begin, end);
+}
+
+const char* skip_uri(const char* begin, const char* end)
+{
+    return skip_vector<Avx2, uri_stops<Avx2>, is_uri>(begin, end);
+}
+
+const char* skip_field_value(const char* begin, const char* end)
+{
+    return skip_vector<Avx2, field_value_stops<Avx2>, is_field_value>(begin, end);
+}
+
+const char* skip_reason_phrase(const char* begin, const char* end)
+{
+    return skip_vector<Avx2, reason_phrase_stops<Avx2>, is_reason_phrase>(begin, end);
+}
+
+} // namespace avx2
+
+} // namespace scan
+
+} // namespace ama
+
+#endif // AMA_SCAN_X86
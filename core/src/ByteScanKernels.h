@@ -0,0 +1,170 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+// Building blocks shared by the ByteScan implementations.  This header is
+// compiled into more than one translation unit with different instruction
+// set flags, so everything in it has internal linkage; otherwise the
+// linker could pick an AVX2-compiled copy for use on a CPU without AVX2.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "CharClass.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define AMA_SCAN_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+namespace ama {
+
+namespace scan {
+
+#if defined(AMA_SCAN_X86)
+// Entry points in ByteScanAvx2.cpp.
+namespace avx2 {
+
+const char* skip_token(const char* begin, const char* end);
+const char* skip_uri(const char* begin, const char* end);
+const char* skip_field_value(const char* begin, const char* end);
+const char* skip_reason_phrase(const char* begin, const char* end);
+
+} // namespace avx2
+#endif
+
+namespace {
+
+// Scalar versions of the character classes, from the same tables as
+// HttpMessageParser::consume() uses; the vector versions below must agree
+// with these.
+
+inline bool is_token(unsigned char c)
+{
+    return chars::is_token(static_cast<char>(c));
+}
+
+inline bool is_uri(unsigned char c)
+{
+    return c != ' ' && !chars::is_ctl(static_cast<char>(c));
+}
+
+inline bool is_field_value(unsigned char c)
+{
+    return !chars::is_ctl(static_cast<char>(c));
+}
+
+inline bool is_reason_phrase(unsigned char c)
+{
+    return c <= 127 && c != '\r';
+}
+
+template <bool (*Pred)(unsigned char)>
+inline const char* skip_scalar(const char* begin, const char* end)
+{
+    while (begin != end && Pred(static_cast<unsigned char>(*begin)))
+    {
+        ++begin;
+    }
+    return begin;
+}
+
+#if defined(AMA_SCAN_X86)
+
+inline unsigned count_trailing_zeros(uint32_t mask)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+// The vector scanners are all shaped the same: load a block, compute a
+// mask of the bytes that end the run, and stop at the lowest set bit.
+// The trailing partial block is left to the scalar loop.  V supplies the
+// vector operations for one instruction set; see Sse2 and Avx2.
+
+// Control characters: 0x00-0x1F and DEL.
+template <typename V>
+inline typename V::Vec ctl_stops(typename V::Vec v)
+{
+    return V::any(V::at_most(v, 0x1F), V::eq(v, V::splat(0x7F)));
+}
+
+template <typename V>
+inline typename V::Vec token_stops(typename V::Vec v)
+{
+    // Anything outside 0x21-0x7E (so SP, HT, controls, DEL and non-ASCII),
+    // plus the separators.
+    static constexpr char kSeparators[] = { '(', ')', '<', '@', ',', ';', ':', '\\', '"', '/', '[', ']', '?', '=', '{', '}' };
+
+    auto stops = V::any(V::at_most(v, 0x20), V::at_least(v, 0x7F));
+    for (char c : kSeparators)
+    {
+        stops = V::any(stops, V::eq(v, V::splat(c)));
+    }
+    return stops;
+}
+
+template <typename V>
+inline typename V::Vec uri_stops(typename V::Vec v)
+{
+    return V::any(ctl_stops<V>(v), V::eq(v, V::splat(' ')));
+}
+
+template <typename V>
+inline typename V::Vec field_value_stops(typename V::Vec v)
+{
+    return ctl_stops<V>(v);
+}
+
+template <typename V>
+inline typename V::Vec reason_phrase_stops(typename V::Vec v)
+{
+    return V::any(V::at_least(v, static_cast<char>(0x80)), V::eq(v, V::splat('\r')));
+}
+
+template <typename V, typename V::Vec (*Stops)(typename V::Vec), bool (*Pred)(unsigned char)>
+inline const char* skip_vector(const char* begin, const char* end)
+{
+    while (static_cast<size_t>(end - begin) >= V::kWidth)
+    {
+        uint32_t mask = V::mask(Stops(V::load(begin)));
+        if (mask != 0)
+        {
+            return begin + count_trailing_zeros(mask);
+        }
+        begin += V::kWidth;
+    }
+    return skip_scalar<Pred>(begin, end);
+}
+
+#endif // AMA_SCAN_X86
+
+} // namespace
+
+} // namespace scan
+
+} // namespace ama
@@ -0,0 +1,112 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "ByteScanTest.h"
+
+#include <string>
+
+#include <QtTest>
+
+#include "ByteScan.h"
+#include "ByteScanKernels.h"
+
+using namespace ama;
+
+namespace {
+
+using ScanFn = const char* (*)(const char*, const char*);
+using Predicate = bool (*)(unsigned char);
+
+struct Scanner
+{
+    const char* name;
+    ScanFn scan;
+    Predicate accepts;
+    char filler; // a byte in the class, used to pad inputs
+};
+
+const Scanner kScanners[] = {
+    { "token",         scan::skip_token,         scan::is_token,         'a' },
+    { "uri",           scan::skip_uri,           scan::is_uri,           '/' },
+    { "field_value",   scan::skip_field_value,   scan::is_field_value,   ' ' },
+    { "reason_phrase", scan::skip_reason_phrase, scan::is_reason_phrase, 'K' },
+};
+
+} // namespace
+
+void ByteScanTest::empty_input()
+{
+    const char* text = "";
+    for (const auto& scanner : kScanners)
+    {
+        QCOMPARE(scanner.scan(text, text), text);
+    }
+}
+
+void ByteScanTest::every_byte_value()
+{
+    // Put each byte value after a long run of filler, so that it lands in
+    // the vector loop rather than the scalar tail.
+    for (const auto& scanner : kScanners)
+    {
+        for (int value = 0; value < 256; ++value)
+        {
+            std::string input(70, scanner.filler);
+            input[40] = static_cast<char>(value);
+
+            const char* begin = input.data();
+            const char* end = begin + input.size();
+            const char* expected = scanner.accepts(static_cast<unsigned char>(value)) ? end : begin + 40;
+
+            QVERIFY2(scanner.scan(begin, end) == expected,
+                     qPrintable(QStringLiteral("%1 mishandles byte %2 (%3)")
+                                .arg(scanner.name)
+                                .arg(value)
+                                .arg(scan::implementation_name())));
+        }
+    }
+}
+
+void ByteScanTest::stops_at_first_delimiter_for_every_offset()
+{
+    // Vary the alignment of the input, its length, and the position of the
+    // delimiter, so that every split between vector blocks and the scalar
+    // tail is exercised.
+    for (const auto& scanner : kScanners)
+    {
+        std::string storage(160, scanner.filler);
+        for (size_t offset = 0; offset < 32; ++offset)
+        {
+            for (size_t length = 0; length <= 96; ++length)
+            {
+                const char* begin = storage.data() + offset;
+                const char* end = begin + length;
+                QCOMPARE(scanner.scan(begin, end), end);
+
+                for (size_t stop = 0; stop < length; ++stop)
+                {
+                    storage[offset + stop] = '\r';
+                    QCOMPARE(scanner.scan(begin, end), begin + stop);
+                    storage[offset + stop] = scanner.filler;
+                }
+            }
+        }
+    }
+}
+
+QTEST_GUILESS_MAIN(ByteScanTest)
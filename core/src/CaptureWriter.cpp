@@ -0,0 +1,568 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "core/CaptureWriter.h"
+
+#include <QByteArray>
+#include <QFile>
+
+#include <cerrno>
+#include <string_view>
+#include <utility>
+
+#include "log/Log.h"
+
+#include "core/BodySink.h"
+#include "core/Headers.h"
+#include "core/Request.h"
+#include "core/Response.h"
+#include "core/Transaction.h"
+
+namespace ama {
+
+namespace {
+
+// Spilled bodies are read back in pieces of this size, a multiple of three
+// so that only the last one needs base64 padding.
+constexpr qint64 kSpillReadSize = 48 * 1024;
+
+const char kBase64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+std::string_view bytes_of(const QByteArray& bytes)
+{
+    return std::string_view(bytes.constData(), static_cast<size_t>(bytes.size()));
+}
+
+std::error_code last_error()
+{
+    return errno != 0 ? std::error_code(errno, std::generic_category()) : std::make_error_code(std::errc::io_error);
+}
+
+// Appends @p bytes as a JSON string, reading each byte as Latin-1.
+void append_string(std::string& out, std::string_view bytes)
+{
+    static const char kHex[] = "0123456789abcdef";
+
+    out.push_back('"');
+    for (char c : bytes)
+    {
+        auto u = static_cast<unsigned char>(c);
+        switch (c)
+        {
+        case '"':  out.append("\\\""); break;
+        case '\\': out.append("\\\\"); break;
+        case '\n': out.append("\\n"); break;
+        case '\r': out.append("\\r"); break;
+        case '\t': out.append("\\t"); break;
+        default:
+            if (u < 0x20 || u >= 0x7F)
+            {
+                out.append("\\u00");
+                out.push_back(kHex[u >> 4]);
+                out.push_back(kHex[u & 0xF]);
+            }
+            else
+            {
+                out.push_back(c);
+            }
+            break;
+        }
+    }
+    out.push_back('"');
+}
+
+// Appends whole groups of three bytes as base64, and padding for the rest;
+// only the last piece of a body may have a length that isn't a multiple of
+// three.
+void append_base64(std::string& out, const char* data, size_t length)
+{
+    auto bytes = reinterpret_cast<const unsigned char*>(data);
+
+    size_t i = 0;
+    for (; i + 3 <= length; i += 3)
+    {
+        uint32_t n = (uint32_t{bytes[i]} << 16) | (uint32_t{bytes[i + 1]} << 8) | bytes[i + 2];
+        out.push_back(kBase64Alphabet[(n >> 18) & 0x3F]);
+        out.push_back(kBase64Alphabet[(n >> 12) & 0x3F]);
+        out.push_back(kBase64Alphabet[(n >> 6) & 0x3F]);
+        out.push_back(kBase64Alphabet[n & 0x3F]);
+    }
+
+    if (i < length)
+    {
+        uint32_t n = uint32_t{bytes[i]} << 16;
+        if (i + 1 < length)
+        {
+            n |= uint32_t{bytes[i + 1]} << 8;
+        }
+        out.push_back(kBase64Alphabet[(n >> 18) & 0x3F]);
+        out.push_back(kBase64Alphabet[(n >> 12) & 0x3F]);
+        out.push_back(i + 1 < length ? kBase64Alphabet[(n >> 6) & 0x3F] : '=');
+        out.push_back('=');
+    }
+}
+
+void append_version(std::string& out, int major, int minor)
+{
+    out.append(",\"version\":\"");
+    out.append(std::to_string(major));
+    out.push_back('.');
+    out.append(std::to_string(minor));
+    out.push_back('"');
+}
+
+void append_headers(std::string& out, const Headers& headers)
+{
+    out.append(",\"headers\":[");
+    bool first = true;
+    for (const auto& field : headers)
+    {
+        if (!first)
+        {
+            out.push_back(',');
+        }
+        first = false;
+
+        out.push_back('[');
+        append_string(out, field.name);
+        out.push_back(',');
+        append_string(out, field.value);
+        out.push_back(']');
+    }
+    out.push_back(']');
+}
+
+void append_kept_body(std::string& out, const QByteArray& body)
+{
+    out.append("\"size\":");
+    out.append(std::to_string(body.size()));
+    if (!body.isEmpty())
+    {
+        out.append(",\"base64\":\"");
+        append_base64(out, body.constData(), static_cast<size_t>(body.size()));
+        out.push_back('"');
+    }
+}
+
+// Hands the base64 of a spilled body to @p consume a piece at a time, so that
+// the body never has to fit in memory.  The pieces continue a JSON object
+// that already holds the body's size; @p consume returns false to stop.
+template <typename Consume>
+void encode_spilled_body(const SpillingBodySink& sink, Consume&& consume)
+{
+    std::string piece;
+
+    std::error_code ec = sink.error();
+    QFile file(sink.file_name());
+    if (!ec && !file.open(QIODevice::ReadOnly))
+    {
+        ec = std::make_error_code(std::errc::io_error);
+    }
+
+    if (!ec)
+    {
+        piece.append(",\"base64\":\"");
+
+        QByteArray bytes;
+        while (!(bytes = file.read(kSpillReadSize)).isEmpty())
+        {
+            append_base64(piece, bytes.constData(), static_cast<size_t>(bytes.size()));
+            if (!consume(piece))
+            {
+                return;
+            }
+            piece.clear();
+        }
+
+        piece.push_back('"');
+        if (file.error() == QFileDevice::NoError)
+        {
+            consume(piece);
+            return;
+        }
+
+        ec = std::make_error_code(std::errc::io_error);
+    }
+
+    log::warn("CaptureWriter: could not read spilled body", log::StringValue("file", sink.file_name().toStdString()));
+    piece.append(",\"error\":");
+    append_string(piece, ec.message());
+    consume(piece);
+}
+
+void append_body(details::FormattedCapture& capture, const QByteArray& kept, const std::shared_ptr<const BodySink>& sink)
+{
+    auto& out = capture.text;
+    out.append(",\"body\":{");
+
+    if (sink == nullptr)
+    {
+        append_kept_body(out, kept);
+    }
+    else if (auto spilling = std::dynamic_pointer_cast<const SpillingBodySink>(sink))
+    {
+        if (spilling->spilled())
+        {
+            // The writer reads the file back, not whoever formats the record.
+            out.append("\"size\":");
+            out.append(std::to_string(spilling->size()));
+            capture.spilled.emplace_back(out.size(), std::move(spilling));
+        }
+        else
+        {
+            append_kept_body(out, spilling->memory());
+        }
+    }
+    else if (auto hashing = dynamic_cast<const HashingBodySink*>(sink.get()))
+    {
+        // make_body_sink() always hashes with SHA-256.
+        out.append("\"size\":");
+        out.append(std::to_string(hashing->size()));
+        out.append(",\"sha256\":\"");
+        out.append(bytes_of(hashing->digest().toHex()));
+        out.push_back('"');
+    }
+    else if (auto counting = dynamic_cast<const CountingBodySink*>(sink.get()))
+    {
+        out.append("\"size\":");
+        out.append(std::to_string(counting->size()));
+    }
+    else if (auto memory = dynamic_cast<const MemoryBodySink*>(sink.get()))
+    {
+        append_kept_body(out, memory->body());
+    }
+
+    if (sink != nullptr && !sink->trailers().empty())
+    {
+        out.append(",\"trailers\":[");
+        bool first = true;
+        for (const auto& [name, value] : sink->trailers())
+        {
+            if (!first)
+            {
+                out.push_back(',');
+            }
+            first = false;
+
+            out.push_back('[');
+            append_string(out, bytes_of(name));
+            out.push_back(',');
+            append_string(out, bytes_of(value));
+            out.push_back(']');
+        }
+        out.push_back(']');
+    }
+
+    out.push_back('}');
+}
+
+details::FormattedCapture format_capture(const CaptureRecord& record)
+{
+    details::FormattedCapture capture;
+    auto& out = capture.text;
+    out.reserve(1024);
+
+    out.append("{\"id\":");
+    out.append(std::to_string(record.id));
+
+    if (record.error)
+    {
+        out.append(",\"error\":");
+        append_string(out, record.error.message());
+    }
+
+    out.append(",\"request\":{\"method\":");
+    append_string(out, record.request.method_bytes());
+    out.append(",\"uri\":");
+    append_string(out, record.request.uri_bytes());
+    append_version(out, record.request.major_version(), record.request.minor_version());
+    append_headers(out, record.request.headers());
+    append_body(capture, record.request.body(), record.request_body);
+    out.push_back('}');
+
+    if (record.request.method_bytes() == "CONNECT")
+    {
+        out.append(",\"tunnel\":{\"to_remote\":");
+        out.append(std::to_string(record.tunnel_bytes_to_remote));
+        out.append(",\"to_client\":");
+        out.append(std::to_string(record.tunnel_bytes_to_client));
+        out.push_back('}');
+    }
+
+    // A transaction that failed before the origin answered has no response
+    // to speak of.
+    if (record.response.status_code() != 0)
+    {
+        out.append(",\"response\":{\"status\":");
+        out.append(std::to_string(record.response.status_code()));
+        out.append(",\"reason\":");
+        append_string(out, record.response.status_message_bytes());
+        append_version(out, record.response.major_version(), record.response.minor_version());
+        append_headers(out, record.response.headers());
+        append_body(capture, record.response.body(), record.response_body);
+        out.push_back('}');
+    }
+
+    out.append("}\n");
+    return capture;
+}
+
+} // namespace
+
+CaptureRecord CaptureRecord::of(Transaction& tx)
+{
+    CaptureRecord record;
+    record.id = tx.id();
+    record.request = tx.request();
+    record.response = tx.response();
+
+    record.request_body = tx.request_body_sink();
+    record.response_body = tx.response_body_sink();
+
+    record.error = tx.error();
+    record.tunnel_bytes_to_remote = tx.tunnel_bytes_to_remote();
+    record.tunnel_bytes_to_client = tx.tunnel_bytes_to_client();
+    return record;
+}
+
+CaptureWriter::CaptureWriter(size_t max_backlog)
+    : max_backlog_(max_backlog)
+    , mutex_()
+    , has_backlog_()
+    , has_room_()
+    , backlog_()
+    , backlog_size_(0)
+    , open_(false)
+    , closing_(false)
+    , records_(0)
+    , error_()
+    , file_(nullptr)
+    , thread_()
+{
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    close();
+}
+
+std::error_code CaptureWriter::open(const QString& path)
+{
+    close();
+
+    errno = 0;
+    auto file = std::fopen(QFile::encodeName(path).constData(), "wb");
+    if (file == nullptr)
+    {
+        return last_error();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        file_ = file;
+        open_ = true;
+        closing_ = false;
+        records_ = 0;
+        error_ = std::error_code();
+    }
+
+    thread_ = std::thread([this] { run(); });
+    return std::error_code();
+}
+
+void CaptureWriter::write(const CaptureRecord& record)
+{
+    if (!is_open())
+    {
+        return;
+    }
+
+    auto capture = format_capture(record);
+
+    std::unique_lock<std::mutex> lock{mutex_};
+    has_room_.wait(lock, [this] { return backlog_size_ < max_backlog_ || !open_ || closing_; });
+    if (!open_ || closing_)
+    {
+        return;
+    }
+
+    backlog_size_ += capture.text.size();
+    backlog_.push_back(std::move(capture));
+    ++records_;
+    has_backlog_.notify_one();
+}
+
+void CaptureWriter::close()
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        if (!open_)
+        {
+            return;
+        }
+        closing_ = true;
+    }
+
+    has_backlog_.notify_one();
+    has_room_.notify_all();
+    thread_.join();
+
+    errno = 0;
+    bool closed = std::fclose(file_) == 0;
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (!closed && !error_)
+    {
+        error_ = last_error();
+    }
+    file_ = nullptr;
+    open_ = false;
+    closing_ = false;
+}
+
+bool CaptureWriter::is_open() const
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    return open_ && !closing_;
+}
+
+uint64_t CaptureWriter::records() const
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    return records_;
+}
+
+std::error_code CaptureWriter::error() const
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    return error_;
+}
+
+void CaptureWriter::run()
+{
+    std::deque<details::FormattedCapture> batch;
+
+    std::unique_lock<std::mutex> lock{mutex_};
+    while (true)
+    {
+        has_backlog_.wait(lock, [this] { return !backlog_.empty() || closing_; });
+        if (backlog_.empty())
+        {
+            // Closing, and everything has been written.
+            break;
+        }
+
+        batch.swap(backlog_);
+        backlog_size_ = 0;
+        bool failed = static_cast<bool>(error_);
+        has_room_.notify_all();
+        lock.unlock();
+
+        // Once a write has failed, records are still taken off the backlog,
+        // so that nobody waits on it forever, but they go nowhere.  Each
+        // batch is flushed, so that the file can be followed as it grows.
+        std::error_code ec;
+        if (!failed)
+        {
+            for (const auto& capture : batch)
+            {
+                ec = write_capture(capture);
+                if (ec)
+                {
+                    break;
+                }
+            }
+
+            errno = 0;
+            if (!ec && std::fflush(file_) != 0)
+            {
+                ec = last_error();
+            }
+        }
+
+        // Letting go of the records lets go of their spill files.
+        batch.clear();
+
+        lock.lock();
+        if (ec)
+        {
+            log::error("CaptureWriter: failed to write captures", log::StringValue("error", ec.message()));
+            error_ = ec;
+        }
+    }
+}
+
+std::error_code CaptureWriter::write_capture(const details::FormattedCapture& capture)
+{
+    std::error_code ec;
+    auto write_bytes = [this, &ec](std::string_view bytes)
+    {
+        errno = 0;
+        if (std::fwrite(bytes.data(), 1, bytes.size(), file_) != bytes.size())
+        {
+            ec = last_error();
+        }
+        return !ec;
+    };
+
+    std::string_view text = capture.text;
+    size_t written = 0;
+    for (const auto& [offset, sink] : capture.spilled)
+    {
+        if (!write_bytes(text.substr(written, offset - written)))
+        {
+            return ec;
+        }
+        written = offset;
+
+        encode_spilled_body(*sink, write_bytes);
+        if (ec)
+        {
+            return ec;
+        }
+    }
+
+    write_bytes(text.substr(written));
+    return ec;
+}
+
+std::string CaptureWriter::format(const CaptureRecord& record)
+{
+    auto capture = format_capture(record);
+    if (capture.spilled.empty())
+    {
+        return std::move(capture.text);
+    }
+
+    std::string out;
+    size_t written = 0;
+    for (const auto& [offset, sink] : capture.spilled)
+    {
+        out.append(capture.text, written, offset - written);
+        written = offset;
+
+        encode_spilled_body(*sink, [&out](std::string_view piece)
+        {
+            out.append(piece);
+            return true;
+        });
+    }
+    out.append(capture.text, written, std::string::npos);
+    return out;
+}
+
+} // namespace ama
@@ -0,0 +1,287 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "CaptureWriterTest.h"
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include "core/BodySink.h"
+#include "core/CaptureWriter.h"
+#include "core/Errors.h"
+#include "core/HttpMessage.h"
+#include "core/Request.h"
+#include "core/Response.h"
+
+using namespace ama;
+
+namespace {
+
+Request make_request(std::string_view method, std::string_view uri, const QByteArray& body = QByteArray())
+{
+    HttpMessage message;
+    message.set_method(method);
+    message.set_uri(uri);
+    message.set_major_version(1);
+    message.set_minor_version(1);
+    message.headers().insert("Host", "example.com");
+    message.set_body(body);
+    return Request(std::move(message));
+}
+
+Response make_response(int status, std::string_view reason, const QByteArray& body = QByteArray())
+{
+    HttpMessage message;
+    message.set_status_code(status);
+    message.set_status_message(reason);
+    message.set_major_version(1);
+    message.set_minor_version(1);
+    message.headers().insert("Content-Length", std::to_string(body.size()));
+    message.set_body(body);
+    return Response(std::move(message));
+}
+
+void write(BodySink& sink, const std::string& text)
+{
+    sink.write(text.data(), text.size());
+    sink.end();
+}
+
+} // namespace
+
+void CaptureWriterTest::formats_request_and_response()
+{
+    auto request = make_request("POST", "/upload", "hi!");
+    auto response = make_response(201, "Created", "ok");
+
+    CaptureRecord record;
+    record.id = 7;
+    record.request = request;
+    record.response = response;
+
+    QCOMPARE(CaptureWriter::format(record),
+             std::string("{\"id\":7,"
+                         "\"request\":{\"method\":\"POST\",\"uri\":\"/upload\",\"version\":\"1.1\","
+                         "\"headers\":[[\"Host\",\"example.com\"]],\"body\":{\"size\":3,\"base64\":\"aGkh\"}},"
+                         "\"response\":{\"status\":201,\"reason\":\"Created\",\"version\":\"1.1\","
+                         "\"headers\":[[\"Content-Length\",\"2\"]],\"body\":{\"size\":2,\"base64\":\"b2s=\"}}}\n"));
+}
+
+void CaptureWriterTest::escapes_bytes_as_latin1()
+{
+    auto request = make_request("GET", "/caf\xc3\xa9?q=\"a\\b\"");
+    request.headers().insert("X-Control", "tab\there\x01");
+
+    CaptureRecord record;
+    record.id = 1;
+    record.request = request;
+
+    auto line = CaptureWriter::format(record);
+    QVERIFY(line.find(R"("uri":"/caf\u00c3\u00a9?q=\"a\\b\"")") != std::string::npos);
+    QVERIFY(line.find(R"(["X-Control","tab\there\u0001"])") != std::string::npos);
+}
+
+void CaptureWriterTest::describes_bodies_by_capture_policy()
+{
+    auto request = make_request("PUT", "/");
+    auto response = make_response(200, "OK");
+
+    auto counted = std::make_shared<CountingBodySink>();
+    write(*counted, "abcd");
+
+    auto hashed = std::make_shared<HashingBodySink>();
+    hashed->trailer("X-Checksum", "1");
+    write(*hashed, "abc");
+
+    CaptureRecord record;
+    record.id = 2;
+    record.request = request;
+    record.request_body = counted;
+    record.response = response;
+    record.response_body = hashed;
+
+    auto line = CaptureWriter::format(record);
+    QVERIFY(line.find(R"("body":{"size":4}})") != std::string::npos);
+    QVERIFY(line.find(R"("body":{"size":3,"sha256":"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",)"
+                      R"("trailers":[["X-Checksum","1"]]}})") != std::string::npos);
+
+    auto spilled = std::make_shared<SpillingBodySink>(4);
+    write(*spilled, "0123456789");
+    QVERIFY(spilled->spilled());
+
+    auto kept = std::make_shared<SpillingBodySink>(64);
+    write(*kept, "tiny");
+    QVERIFY(!kept->spilled());
+
+    record.request_body = spilled;
+    record.response_body = kept;
+
+    line = CaptureWriter::format(record);
+    QVERIFY(line.find(R"("body":{"size":10,"base64":"MDEyMzQ1Njc4OQ=="}})") != std::string::npos);
+    QVERIFY(line.find(R"("body":{"size":4,"base64":"dGlueQ=="}})") != std::string::npos);
+}
+
+void CaptureWriterTest::records_errors_and_tunnels()
+{
+    auto request = make_request("CONNECT", "example.com:443");
+    Response response;
+
+    CaptureRecord record;
+    record.id = 3;
+    record.request = request;
+    record.response = response;
+    record.error = ProxyError::RemoteDisconnected;
+    record.tunnel_bytes_to_remote = 517;
+    record.tunnel_bytes_to_client = 4096;
+
+    auto line = CaptureWriter::format(record);
+    QVERIFY(line.find(R"({"id":3,"error":"remote connection unexpectedly closed",)") == 0);
+    QVERIFY(line.find(R"(,"tunnel":{"to_remote":517,"to_client":4096}})") != std::string::npos);
+    QVERIFY(line.find("\"response\"") == std::string::npos);
+}
+
+void CaptureWriterTest::streams_records_from_many_threads()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    auto path = dir.filePath("captures.jsonl");
+
+    auto request = make_request("GET", "/");
+    auto response = make_response(200, "OK", "body");
+
+    // A backlog smaller than one record makes every write wait for the
+    // one before it to reach the file.
+    CaptureWriter writer(16);
+    QVERIFY(!writer.open(path));
+    QVERIFY(writer.is_open());
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 50; ++i)
+            {
+                CaptureRecord record;
+                record.id = t * 50 + i;
+                record.request = request;
+                record.response = response;
+                writer.write(record);
+            }
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    writer.close();
+    QVERIFY(!writer.is_open());
+    QVERIFY(!writer.error());
+    QCOMPARE(writer.records(), uint64_t{200});
+
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    auto lines = file.readAll().split('\n');
+    QCOMPARE(lines.size(), 201);
+    QVERIFY(lines.last().isEmpty());
+
+    std::vector<bool> seen(200, false);
+    for (qsizetype i = 0; i < 200; ++i)
+    {
+        auto comma = lines[i].indexOf(',');
+        QVERIFY(lines[i].startsWith("{\"id\":") && comma > 6);
+        auto id = lines[i].mid(6, comma - 6).toInt();
+        QVERIFY(id >= 0 && id < 200 && !seen[id]);
+        seen[id] = true;
+    }
+}
+
+void CaptureWriterTest::streams_spilled_bodies()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    auto path = dir.filePath("captures.jsonl");
+
+    // Several read-back pieces' worth, and not a multiple of three.
+    std::string body;
+    for (int i = 0; body.size() < 200001; ++i)
+    {
+        body.append(std::to_string(i));
+    }
+    body.resize(200001);
+
+    auto spilled = std::make_shared<SpillingBodySink>(1024);
+    write(*spilled, body);
+    QVERIFY(spilled->spilled());
+    auto spill_path = spilled->file_name();
+
+    CaptureRecord record;
+    record.id = 4;
+    record.request = make_request("POST", "/upload");
+    record.request_body = spilled;
+    record.response = make_response(204, "No Content");
+
+    CaptureWriter writer(16);
+    QVERIFY(!writer.open(path));
+    writer.write(record);
+
+    // The record keeps the spill file until it has been written.
+    record = CaptureRecord();
+    spilled.reset();
+    writer.close();
+    QVERIFY(!writer.error());
+    QVERIFY(!QFile::exists(spill_path));
+
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    auto line = file.readAll();
+    QVERIFY(line.startsWith("{\"id\":4,"));
+    QVERIFY(line.endsWith("}\n"));
+
+    QByteArray prefix = "\"body\":{\"size\":200001,\"base64\":\"";
+    auto start = line.indexOf(prefix);
+    QVERIFY(start > 0);
+    start += prefix.size();
+    auto end = line.indexOf('"', start);
+    QVERIFY(end > start);
+    QCOMPARE(QByteArray::fromBase64(line.mid(start, end - start)), QByteArray::fromStdString(body));
+    QVERIFY(line.indexOf("\"response\":{\"status\":204,", end) > end);
+}
+
+void CaptureWriterTest::reports_files_it_cannot_open()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    CaptureWriter writer;
+    QVERIFY(writer.open(dir.filePath("missing/captures.jsonl")));
+    QVERIFY(!writer.is_open());
+
+    auto request = make_request("GET", "/");
+    CaptureRecord record;
+    record.request = request;
+    writer.write(record);
+    QCOMPARE(writer.records(), uint64_t{0});
+}
+
+QTEST_GUILESS_MAIN(CaptureWriterTest)
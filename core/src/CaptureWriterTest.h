@@ -0,0 +1,37 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <QObject>
+
+class CaptureWriterTest : public QObject
+{
+    Q_OBJECT
+
+public:
+    CaptureWriterTest() = default;
+
+private Q_SLOTS:
+    void formats_request_and_response();
+    void escapes_bytes_as_latin1();
+    void describes_bodies_by_capture_policy();
+    void records_errors_and_tunnels();
+    void streams_records_from_many_threads();
+    void streams_spilled_bodies();
+    void reports_files_it_cannot_open();
+};
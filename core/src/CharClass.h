@@ -0,0 +1,146 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstdint>
+
+namespace ama {
+
+namespace chars {
+
+// The character classes of RFC 2616 (s) 2.2, as HttpMessageParser and the
+// ByteScan kernels use them, looked up in a 256-entry table computed at
+// compile time.  Bytes above 127 belong to no class at all.
+
+enum Class : uint8_t
+{
+    kChar     = 1 << 0, // 0-127
+    kCtl      = 1 << 1, // 0-31 and DEL
+    kTspecial = 1 << 2, // separators, including SP and HT
+    kDigit    = 1 << 3,
+    kHex      = 1 << 4,
+    kToken    = 1 << 5, // a CHAR that is neither a CTL nor a separator
+};
+
+// Marks a byte that is not a hex digit in Table::hex_value.
+constexpr int8_t kNotHex = -1;
+
+struct Table
+{
+    uint8_t classes[256];
+    int8_t hex_value[256];
+};
+
+constexpr bool is_separator_byte(unsigned c)
+{
+    switch (c)
+    {
+    case '(': case ')': case '<': case '@': case ',': case ';': case ':':
+    case '\\': case '"': case '/': case '[': case ']': case '?': case '=':
+    case '{': case '}': case ' ': case '\t':
+        return true;
+    default:
+        return false;
+    }
+}
+
+constexpr Table make_table()
+{
+    Table table{};
+    for (unsigned c = 0; c < 256; ++c)
+    {
+        uint8_t classes = 0;
+        int8_t hex = kNotHex;
+
+        if (c <= 127)
+        {
+            classes |= kChar;
+        }
+        if (c <= 31 || c == 127)
+        {
+            classes |= kCtl;
+        }
+        if (is_separator_byte(c))
+        {
+            classes |= kTspecial;
+        }
+        if (c >= '0' && c <= '9')
+        {
+            classes |= kDigit | kHex;
+            hex = static_cast<int8_t>(c - '0');
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            classes |= kHex;
+            hex = static_cast<int8_t>(c - 'a' + 10);
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            classes |= kHex;
+            hex = static_cast<int8_t>(c - 'A' + 10);
+        }
+        if ((classes & (kChar | kCtl | kTspecial)) == kChar)
+        {
+            classes |= kToken;
+        }
+
+        table.classes[c] = classes;
+        table.hex_value[c] = hex;
+    }
+    return table;
+}
+
+inline constexpr Table kTable = make_table();
+
+// The predicates have internal linkage for the same reason as everything in
+// ByteScanKernels.h: that header, which uses them, is also compiled with
+// AVX2 enabled.
+namespace {
+
+constexpr bool is_a(char c, Class cls)
+{
+    return (kTable.classes[static_cast<unsigned char>(c)] & cls) != 0;
+}
+
+constexpr bool is_char(char c)     { return is_a(c, kChar); }
+constexpr bool is_ctl(char c)      { return is_a(c, kCtl); }
+constexpr bool is_tspecial(char c) { return is_a(c, kTspecial); }
+constexpr bool is_digit(char c)    { return is_a(c, kDigit); }
+constexpr bool is_hex(char c)      { return is_a(c, kHex); }
+constexpr bool is_token(char c)    { return is_a(c, kToken); }
+
+/**
+ * @brief Returns the value of hex digit @p c, or kNotHex if it is not one.
+ */
+constexpr int hex_value(char c)
+{
+    return kTable.hex_value[static_cast<unsigned char>(c)];
+}
+
+static_assert(is_token('G') && is_token('-') && is_token('~'));
+static_assert(!is_token(':') && !is_token(' ') && !is_token('\x7f') && !is_token('\x80'));
+static_assert(is_ctl('\r') && is_ctl('\t') && !is_ctl(' ') && !is_ctl('\xff'));
+static_assert(hex_value('7') == 7 && hex_value('b') == 11 && hex_value('F') == 15);
+static_assert(hex_value('g') == kNotHex && hex_value('\0') == kNotHex);
+
+} // namespace
+
+} // namespace chars
+
+} // namespace ama
@@ -18,44 +18,382 @@
 #include "core/ConnectionPool.h"
 
 #include "AsioConnection.h"
+#include "IoUring.h"
+
+#include "log/Log.h"
+
+#include <algorithm>
+#include <vector>
 
 using namespace ama;
 
 using tcp = asio::ip::tcp;
 
+namespace {
+
+// Browsers open about six connections per host; keeping that many warm
+// covers them without hoarding sockets on servers we rarely talk to.
+constexpr size_t kDefaultMaxIdlePerHost = 6;
+constexpr size_t kDefaultMaxIdle = 256;
+
+// Comfortably below the keep-alive timeouts of common servers (nginx
+// defaults to 75 seconds), so we rarely lease a connection that the
+// server is about to close.
+constexpr std::chrono::seconds kDefaultIdleTimeout{30};
+
+void close_quietly(const std::shared_ptr<IConnection>& connection)
+{
+    std::error_code ec;
+    connection->close(ec);
+}
+
+void close_quietly(const std::vector<std::shared_ptr<IConnection>>& connections)
+{
+    for (const auto& connection : connections)
+    {
+        close_quietly(connection);
+    }
+}
+
+} // namespace
+
 ConnectionPool::ConnectionPool(asio::io_context& context, QObject* parent)
     : QObject{parent}
     , context_(context)
     , resolver_(context)
+    , io_uring_(nullptr)
+    , mutex_()
+    , idle_()
+    , num_idle_(0)
+    , sweep_timer_(context)
+    , sweep_scheduled_(false)
+    , max_idle_per_host_(kDefaultMaxIdlePerHost)
+    , max_idle_(kDefaultMaxIdle)
+    , idle_timeout_(kDefaultIdleTimeout)
+    , num_hits_(0)
+    , num_misses_(0)
 {}
 
 ConnectionPool::~ConnectionPool()
 {
+    shutdown();
+}
+
+void ConnectionPool::shutdown()
+{
+    std::map<Key, std::deque<IdleConnection>> idle;
+
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        idle.swap(idle_);
+        num_idle_ = 0;
+        sweep_timer_.cancel();
+        sweep_scheduled_ = false;
+    }
+
+    for (const auto& entry : idle)
+    {
+        for (const auto& idle_connection : entry.second)
+        {
+            close_quietly(idle_connection.connection);
+        }
+    }
+
+    resolver_.cancel();
+}
 
+asio::io_context& ConnectionPool::context() const
+{
+    return context_;
 }
 
 std::shared_ptr<IConnection> ConnectionPool::make_connection(asio::ip::tcp::socket &&socket)
 {
+    if (io_uring_ != nullptr)
+    {
+        return make_connection(socket.release());
+    }
+
     auto connection = std::make_shared<TcpConnection>(std::move(socket));
     emit client_connected(connection);
     return connection;
 }
 
-std::shared_ptr<IConnection> ConnectionPool::find_open_connection(const std::string &host, int port)
+std::shared_ptr<IConnection> ConnectionPool::make_connection(asio::ip::tcp::socket::native_handle_type socket)
 {
-    (void) host;
-    (void) port;
-    return std::shared_ptr<IConnection>(nullptr);
+    auto connection = io_uring_->make_connection(socket);
+    emit client_connected(connection);
+    return connection;
 }
 
-void ConnectionPool::try_open(const std::string &host, const std::string &port, OpenCallback&& callback)
+void ConnectionPool::set_io_uring(IoUring* ring)
 {
-    auto conn = std::make_shared<TcpConnection>(asio::ip::tcp::socket(context_));
+    io_uring_ = ring;
+}
+
+std::shared_ptr<IConnection> ConnectionPool::find_open_connection(const std::string &host, int port, const std::string& scheme)
+{
+    Evicted dead;
+    std::shared_ptr<IConnection> result;
+
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        evict_expired(Clock::now(), dead);
+
+        auto it = idle_.find(Key{host, port, scheme});
+        if (it != idle_.end())
+        {
+            auto& connections = it->second;
 
+            // Most-recently-used first; it is the least likely to have
+            // been closed by the server in the meantime.
+            while (!connections.empty() && result == nullptr)
+            {
+                auto candidate = std::move(connections.back().connection);
+                connections.pop_back();
+                num_idle_--;
+
+                if (candidate->is_reusable())
+                {
+                    result = std::move(candidate);
+                }
+                else
+                {
+                    dead.push_back(std::move(candidate));
+                }
+            }
+
+            if (connections.empty())
+            {
+                idle_.erase(it);
+            }
+        }
+    }
+
+    close_quietly(dead);
+
+    if (result != nullptr)
+    {
+        num_hits_++;
+        log::debug("ConnectionPool: reusing idle connection", log::StringValue("host", host), log::IntValue("port", port));
+    }
+    else
+    {
+        num_misses_++;
+    }
+
+    return result;
+}
+
+void ConnectionPool::release_connection(const std::string& host, int port, const std::string& scheme, std::shared_ptr<IConnection> connection)
+{
+    if (connection == nullptr)
+    {
+        return;
+    }
+
+    Evicted evicted;
+
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+
+        if (max_idle_per_host_ == 0 || max_idle_ == 0)
+        {
+            evicted.push_back(std::move(connection));
+        }
+        else
+        {
+            auto now = Clock::now();
+            evict_expired(now, evicted);
+
+            Key key{host, port, scheme};
+            auto it = idle_.find(key);
+            if (it != idle_.end() && it->second.size() >= max_idle_per_host_)
+            {
+                evicted.push_back(std::move(it->second.front().connection));
+                it->second.pop_front();
+                num_idle_--;
+            }
+            else if (num_idle_ >= max_idle_)
+            {
+                evict_oldest(evicted);
+            }
+
+            idle_[key].push_back(IdleConnection{std::move(connection), now});
+            num_idle_++;
+            schedule_sweep();
+        }
+    }
+
+    close_quietly(evicted);
+}
+
+void ConnectionPool::set_max_idle_per_host(size_t max_idle)
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    max_idle_per_host_ = max_idle;
+}
+
+void ConnectionPool::set_max_idle(size_t max_idle)
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    max_idle_ = max_idle;
+}
+
+void ConnectionPool::set_idle_timeout(std::chrono::steady_clock::duration timeout)
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    idle_timeout_ = timeout;
+
+    // Connections may now expire sooner than the sweep was due.
+    if (sweep_scheduled_)
+    {
+        sweep_timer_.cancel();
+        sweep_scheduled_ = false;
+        schedule_sweep();
+    }
+}
+
+size_t ConnectionPool::num_idle() const
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    return num_idle_;
+}
+
+size_t ConnectionPool::num_hits() const
+{
+    return num_hits_.load(std::memory_order_relaxed);
+}
+
+size_t ConnectionPool::num_misses() const
+{
+    return num_misses_.load(std::memory_order_relaxed);
+}
+
+void ConnectionPool::evict_expired(Clock::time_point now, Evicted& evicted)
+{
+    for (auto it = idle_.begin(); it != idle_.end(); )
+    {
+        auto& connections = it->second;
+        while (!connections.empty() && now - connections.front().idle_since >= idle_timeout_)
+        {
+            evicted.push_back(std::move(connections.front().connection));
+            connections.pop_front();
+            num_idle_--;
+        }
+
+        if (connections.empty())
+        {
+            it = idle_.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+void ConnectionPool::evict_oldest(Evicted& evicted)
+{
+    auto oldest = idle_.end();
+    for (auto it = idle_.begin(); it != idle_.end(); ++it)
+    {
+        if (it->second.empty())
+        {
+            continue;
+        }
+
+        if (oldest == idle_.end() || it->second.front().idle_since < oldest->second.front().idle_since)
+        {
+            oldest = it;
+        }
+    }
+
+    if (oldest == idle_.end())
+    {
+        return;
+    }
+
+    evicted.push_back(std::move(oldest->second.front().connection));
+    oldest->second.pop_front();
+    num_idle_--;
+
+    if (oldest->second.empty())
+    {
+        idle_.erase(oldest);
+    }
+}
+
+void ConnectionPool::schedule_sweep()
+{
+    if (sweep_scheduled_ || idle_.empty())
+    {
+        return;
+    }
+
+    // Each host's connections are kept oldest first.
+    auto next_expiry = Clock::time_point::max();
+    for (const auto& entry : idle_)
+    {
+        next_expiry = std::min(next_expiry, entry.second.front().idle_since + idle_timeout_);
+    }
+
+    sweep_scheduled_ = true;
+    sweep_timer_.expires_at(next_expiry);
+    sweep_timer_.async_wait([this](std::error_code ec)
+    {
+        // A cancelled sweep may outlive the pool.
+        if (ec)
+        {
+            return;
+        }
+
+        sweep();
+    });
+}
+
+void ConnectionPool::sweep()
+{
+    Evicted evicted;
+
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        sweep_scheduled_ = false;
+        evict_expired(Clock::now(), evicted);
+        schedule_sweep();
+    }
+
+    if (!evicted.empty())
+    {
+        log::debug("ConnectionPool: closing expired idle connections", log::IntValue("count", static_cast<int>(evicted.size())));
+    }
+    close_quietly(evicted);
+}
+
+void ConnectionPool::try_open(const std::string &host, const std::string &port, OpenCallback&& callback)
+{
     tcp::resolver::query query(host, port);
 
+    if (io_uring_ != nullptr)
+    {
+        resolver_.async_resolve(query, [ring = io_uring_, callback = std::move(callback)]
+                                (asio::error_code ec, tcp::resolver::iterator result) mutable
+        {
+            if (ec)
+            {
+                callback(nullptr, ec);
+                return;
+            }
+
+            ring->open(result, std::move(callback));
+        });
+        return;
+    }
+
+    auto conn = std::make_shared<TcpConnection>(asio::ip::tcp::socket(context_));
+
     resolver_.async_resolve(query, [conn, callback = std::move(callback)]
-                            (asio::error_code ec, tcp::resolver::iterator result)
+                            (asio::error_code ec, tcp::resolver::iterator result) mutable
     {
         if (ec)
         {
@@ -0,0 +1,202 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "ConnectionPoolTest.h"
+
+#include <chrono>
+#include <memory>
+
+#include <QtTest>
+
+#include "core/ConnectionPool.h"
+#include "core/IConnection.h"
+
+using namespace ama;
+
+namespace {
+
+class FakeConnection : public IConnection
+{
+public:
+    void async_write(const QByteArrayView, Callback&&) override {}
+    void async_writev(const std::vector<QByteArrayView>&, Callback&&) override {}
+    void async_read(QByteArrayView, Callback&&) override {}
+    void async_wait_readable(Callback&&) override {}
+
+    bool is_reusable() override
+    {
+        return reusable && !closed;
+    }
+
+    void close(std::error_code& ec) override
+    {
+        ec = {};
+        closed = true;
+    }
+
+    bool reusable = true;
+    bool closed = false;
+};
+
+} // namespace
+
+void ConnectionPoolTest::empty_pool_misses()
+{
+    asio::io_context context;
+    ConnectionPool pool(context);
+
+    QVERIFY(pool.find_open_connection("example.com", 80) == nullptr);
+    QCOMPARE(pool.num_hits(), size_t(0));
+    QCOMPARE(pool.num_misses(), size_t(1));
+}
+
+void ConnectionPoolTest::released_connection_is_reused()
+{
+    asio::io_context context;
+    ConnectionPool pool(context);
+
+    auto conn = std::make_shared<FakeConnection>();
+    pool.release_connection("example.com", 80, "http", conn);
+    QCOMPARE(pool.num_idle(), size_t(1));
+
+    auto leased = pool.find_open_connection("example.com", 80);
+    QVERIFY(leased == conn);
+    QCOMPARE(pool.num_idle(), size_t(0));
+    QCOMPARE(pool.num_hits(), size_t(1));
+
+    // Leasing removes the connection from the pool.
+    QVERIFY(pool.find_open_connection("example.com", 80) == nullptr);
+}
+
+void ConnectionPoolTest::keys_include_port_and_scheme()
+{
+    asio::io_context context;
+    ConnectionPool pool(context);
+
+    pool.release_connection("example.com", 80, "http", std::make_shared<FakeConnection>());
+
+    QVERIFY(pool.find_open_connection("example.com", 8080) == nullptr);
+    QVERIFY(pool.find_open_connection("example.com", 80, "https") == nullptr);
+    QVERIFY(pool.find_open_connection("example.org", 80) == nullptr);
+    QVERIFY(pool.find_open_connection("example.com", 80, "http") != nullptr);
+}
+
+void ConnectionPoolTest::dead_connections_are_discarded()
+{
+    asio::io_context context;
+    ConnectionPool pool(context);
+
+    auto alive = std::make_shared<FakeConnection>();
+    auto dead = std::make_shared<FakeConnection>();
+    dead->reusable = false;
+
+    pool.release_connection("example.com", 80, "http", alive);
+    pool.release_connection("example.com", 80, "http", dead);
+
+    QVERIFY(pool.find_open_connection("example.com", 80) == alive);
+    QVERIFY(dead->closed);
+    QCOMPARE(pool.num_idle(), size_t(0));
+}
+
+void ConnectionPoolTest::per_host_limit_closes_oldest()
+{
+    asio::io_context context;
+    ConnectionPool pool(context);
+    pool.set_max_idle_per_host(2);
+
+    auto first = std::make_shared<FakeConnection>();
+    auto second = std::make_shared<FakeConnection>();
+    auto third = std::make_shared<FakeConnection>();
+
+    pool.release_connection("example.com", 80, "http", first);
+    pool.release_connection("example.com", 80, "http", second);
+    pool.release_connection("example.com", 80, "http", third);
+
+    QVERIFY(first->closed);
+    QVERIFY(!second->closed);
+    QVERIFY(!third->closed);
+    QCOMPARE(pool.num_idle(), size_t(2));
+}
+
+void ConnectionPoolTest::global_limit_closes_oldest()
+{
+    asio::io_context context;
+    ConnectionPool pool(context);
+    pool.set_max_idle(2);
+
+    auto a = std::make_shared<FakeConnection>();
+    auto b = std::make_shared<FakeConnection>();
+    auto c = std::make_shared<FakeConnection>();
+
+    pool.release_connection("a.example", 80, "http", a);
+    pool.release_connection("b.example", 80, "http", b);
+    pool.release_connection("c.example", 80, "http", c);
+
+    QVERIFY(a->closed);
+    QCOMPARE(pool.num_idle(), size_t(2));
+    QVERIFY(pool.find_open_connection("c.example", 80) == c);
+}
+
+void ConnectionPoolTest::expired_connections_are_closed()
+{
+    asio::io_context context;
+    ConnectionPool pool(context);
+    pool.set_idle_timeout(std::chrono::steady_clock::duration::zero());
+
+    auto conn = std::make_shared<FakeConnection>();
+    pool.release_connection("example.com", 80, "http", conn);
+
+    QVERIFY(pool.find_open_connection("example.com", 80) == nullptr);
+    QVERIFY(conn->closed);
+}
+
+void ConnectionPoolTest::idle_connections_expire_without_traffic()
+{
+    asio::io_context context;
+    ConnectionPool pool(context);
+    pool.set_idle_timeout(std::chrono::milliseconds(20));
+
+    auto conn = std::make_shared<FakeConnection>();
+    pool.release_connection("example.com", 80, "http", conn);
+    QVERIFY(!conn->closed);
+
+    // Nothing leases or releases a connection; the pool's own sweep, the
+    // only work on the context, closes it.
+    context.run_for(std::chrono::seconds(5));
+    QVERIFY(conn->closed);
+    QCOMPARE(pool.num_idle(), size_t(0));
+}
+
+void ConnectionPoolTest::shutdown_closes_idle_connections()
+{
+    asio::io_context context;
+    ConnectionPool pool(context);
+
+    auto first = std::make_shared<FakeConnection>();
+    auto second = std::make_shared<FakeConnection>();
+    pool.release_connection("example.com", 80, "http", first);
+    pool.release_connection("example.org", 443, "https", second);
+
+    pool.shutdown();
+
+    QCOMPARE(pool.num_idle(), size_t(0));
+    QVERIFY(first->closed);
+    QVERIFY(second->closed);
+    QVERIFY(pool.find_open_connection("example.com", 80) == nullptr);
+}
+
+QTEST_GUILESS_MAIN(ConnectionPoolTest)
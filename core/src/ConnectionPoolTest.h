@@ -0,0 +1,39 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <QObject>
+
+class ConnectionPoolTest : public QObject
+{
+    Q_OBJECT
+
+public:
+    ConnectionPoolTest() = default;
+
+private Q_SLOTS:
+    void empty_pool_misses();
+    void released_connection_is_reused();
+    void keys_include_port_and_scheme();
+    void dead_connections_are_discarded();
+    void per_host_limit_closes_oldest();
+    void global_limit_closes_oldest();
+    void expired_connections_are_closed();
+    void idle_connections_expire_without_traffic();
+    void shutdown_closes_idle_connections();
+};
@@ -17,63 +17,284 @@
 
 #include "core/Headers.h"
 
+#include <cassert>
+#include <cstring>
+#include <utility>
+
 using namespace ama;
 
+namespace {
+
+char to_lower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+char to_upper(char c)
+{
+    return (c >= 'a' && c <= 'z') ? static_cast<char>(c - 'a' + 'A') : c;
+}
+
+bool same_name(std::string_view lhs, std::string_view rhs)
+{
+    if (lhs.size() != rhs.size())
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < lhs.size(); ++i)
+    {
+        if (to_lower(lhs[i]) != to_lower(rhs[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string_view trimmed(std::string_view view)
+{
+    while (!view.empty() && (view.front() == ' ' || view.front() == '\t'))
+    {
+        view.remove_prefix(1);
+    }
+    while (!view.empty() && (view.back() == ' ' || view.back() == '\t'))
+    {
+        view.remove_suffix(1);
+    }
+    return view;
+}
+
+KnownHeader lookup(std::string_view name)
+{
+    return known_header(QByteArrayView(name.data(), static_cast<qsizetype>(name.size())));
+}
+
+std::string_view canonical_name(KnownHeader header)
+{
+    auto name = known_header_name(header);
+    return std::string_view(name.data(), static_cast<size_t>(name.size()));
+}
+
+QString to_qstring(const std::string& bytes)
+{
+    return QString::fromLatin1(bytes.data(), static_cast<qsizetype>(bytes.size()));
+}
+
+} // namespace
+
+QString Headers::Field::name_string() const
+{
+    return to_qstring(name);
+}
+
+QString Headers::Field::value_string() const
+{
+    return to_qstring(value);
+}
+
 Headers::Headers()
-    : values_()
-    , insertion_order_()
+    : ids_()
+    , fields_()
+{
+}
+
+Headers::const_iterator Headers::begin() const
 {
+    return fields_.constData();
+}
+
+Headers::const_iterator Headers::end() const
+{
+    return fields_.constData() + fields_.size();
 }
 
 bool Headers::empty() const
 {
-    return values_.empty();
+    return fields_.isEmpty();
 }
 
 size_t Headers::size() const
 {
-    return static_cast<size_t>(values_.size());
+    return static_cast<size_t>(fields_.size());
 }
 
-void Headers::insert(const QString& name, const QString& value)
+void Headers::insert(std::string_view name, std::string_view value)
 {
-    auto canon = canonicalize(name);
-    if (!values_.contains(canon))
+    auto id = lookup(name);
+    if (id != KnownHeader::Unknown)
     {
-        insertion_order_.append(canon);
+        insert(id, value);
+        return;
     }
-    values_.insert(canon, value);
+
+    ids_.append(static_cast<quint8>(KnownHeader::Unknown));
+    fields_.append(Field{KnownHeader::Unknown, canonicalize(name), std::string(value)});
+}
+
+void Headers::insert(KnownHeader header, std::string_view value)
+{
+    assert(header != KnownHeader::Unknown);
+
+    ids_.append(static_cast<quint8>(header));
+    fields_.append(Field{header, std::string(canonical_name(header)), std::string(value)});
+}
+
+size_t Headers::remove(std::string_view name)
+{
+    auto id = lookup(name);
+
+    qsizetype kept = 0;
+    for (qsizetype i = 0; i < fields_.size(); ++i)
+    {
+        bool matches = id != KnownHeader::Unknown
+                ? fields_[i].id == id
+                : fields_[i].id == KnownHeader::Unknown && same_name(name, fields_[i].name);
+        if (matches)
+        {
+            continue;
+        }
+
+        if (kept != i)
+        {
+            ids_[kept] = ids_[i];
+            fields_[kept] = std::move(fields_[i]);
+        }
+        ++kept;
+    }
+
+    auto removed = fields_.size() - kept;
+    ids_.resize(kept);
+    fields_.resize(kept);
+    return static_cast<size_t>(removed);
 }
 
 QList<QString> Headers::find_by_name(const QString& name) const
 {
-    return values_.values(canonicalize(name));
+    auto id = known_header(QStringView(name));
+    if (id != KnownHeader::Unknown)
+    {
+        return find_by_name(id);
+    }
+
+    auto latin1 = name.toLatin1();
+    std::string_view bytes(latin1.constData(), static_cast<size_t>(latin1.size()));
+
+    QList<QString> values;
+    for (auto i = index_of(bytes); i != -1; i = index_of(bytes, i + 1))
+    {
+        values.append(fields_[i].value_string());
+    }
+    return values;
 }
 
-QList<QString> Headers::names() const
+QList<QString> Headers::find_by_name(KnownHeader header) const
 {
-    return insertion_order_;
+    QList<QString> values;
+    for (auto i = index_of(header); i != -1; i = index_of(header, i + 1))
+    {
+        values.append(fields_[i].value_string());
+    }
+    return values;
 }
 
-QString Headers::canonicalize(const QString &name) const
+QString Headers::value(KnownHeader header) const
 {
-    QString canon{name};
+    auto i = index_of(header);
+    return i == -1 ? QString() : fields_[i].value_string();
+}
 
-    bool first = true;
-    for (qsizetype i = 0; i < name.size(); ++i)
+std::string_view Headers::value_bytes(KnownHeader header) const
+{
+    auto i = index_of(header);
+    return i == -1 ? std::string_view() : std::string_view(fields_[i].value);
+}
+
+bool Headers::contains(KnownHeader header) const
+{
+    return index_of(header) != -1;
+}
+
+bool Headers::has_token(KnownHeader header, std::string_view token) const
+{
+    for (auto i = index_of(header); i != -1; i = index_of(header, i + 1))
     {
-        QChar c = name.at(i);
-        if (c.isLetter())
+        std::string_view rest = fields_[i].value;
+        while (true)
         {
-            if (first)
+            auto comma = rest.find(',');
+            if (same_name(trimmed(rest.substr(0, comma)), token))
             {
-                canon[i] = c.toUpper();
-                first = false;
+                return true;
             }
-            else
+            if (comma == std::string_view::npos)
             {
-                canon[i] = c.toLower();
+                break;
             }
+            rest.remove_prefix(comma + 1);
+        }
+    }
+    return false;
+}
+
+bool Headers::has_token(KnownHeader header, QStringView token) const
+{
+    auto latin1 = token.toLatin1();
+    return has_token(header, std::string_view(latin1.constData(), static_cast<size_t>(latin1.size())));
+}
+
+QList<QString> Headers::names() const
+{
+    QList<QString> names;
+    for (qsizetype i = 0; i < fields_.size(); ++i)
+    {
+        const auto& field = fields_[i];
+        bool seen = field.id != KnownHeader::Unknown
+                ? index_of(field.id) < i
+                : index_of(std::string_view(field.name)) < i;
+        if (!seen)
+        {
+            names.append(field.name_string());
+        }
+    }
+    return names;
+}
+
+qsizetype Headers::index_of(KnownHeader header, qsizetype from) const
+{
+    if (header == KnownHeader::Unknown || from >= ids_.size())
+    {
+        return -1;
+    }
+
+    auto begin = ids_.constData();
+    auto found = std::memchr(begin + from, static_cast<quint8>(header), static_cast<size_t>(ids_.size() - from));
+    return found == nullptr ? -1 : static_cast<const quint8*>(found) - begin;
+}
+
+qsizetype Headers::index_of(std::string_view name, qsizetype from) const
+{
+    for (qsizetype i = from; i < fields_.size(); ++i)
+    {
+        if (ids_[i] == static_cast<quint8>(KnownHeader::Unknown) && same_name(name, fields_[i].name))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+std::string Headers::canonicalize(std::string_view name) const
+{
+    std::string canon{name};
+
+    bool first = true;
+    for (auto& c : canon)
+    {
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+        {
+            c = first ? to_upper(c) : to_lower(c);
+            first = false;
         }
         else if (c == '-')
         {
@@ -24,6 +24,7 @@
 
 #include <algorithm>
 #include <functional>
+#include <string>
 
 using namespace ama;
 
@@ -62,4 +63,140 @@ void HeadersTests::multipleInsertionsOfOneName()
     QVERIFY2(std::all_of(expectedValues.begin(), expectedValues.end(), containsFn), "headers returns all expected values");
 }
 
+void HeadersTests::removeDropsEveryValue()
+{
+    Headers headers;
+    headers.insert("Host", "example.com");
+    headers.insert("Expect", "100-continue");
+    headers.insert("expect", "something-else");
+
+    QCOMPARE(headers.remove("EXPECT"), 2);
+    QCOMPARE(headers.remove("Expect"), 0);
+
+    QList<QString> expectedNames;
+    expectedNames << "Host";
+
+    QCOMPARE(expectedNames, headers.names());
+    QVERIFY(headers.find_by_name("Expect").isEmpty());
+    QCOMPARE(headers.size(), 1);
+}
+
+void HeadersTests::knownAndOtherNamesKeepTheirOrder()
+{
+    Headers headers;
+    headers.insert("x-first", "1");
+    headers.insert("content-type", "text/plain");
+    headers.insert("X-Second", "2");
+    headers.insert("www-authenticate", "Basic");
+    headers.insert("Content-Type", "text/html");
+
+    QList<QString> expected;
+    expected << "X-First" << "Content-Type" << "X-Second" << "Www-Authenticate";
+
+    QCOMPARE(headers.names(), expected);
+    QCOMPARE(headers.size(), 5);
+
+    QCOMPARE(headers.remove("CONTENT-TYPE"), 2);
+    expected.removeAll("Content-Type");
+    QCOMPARE(headers.names(), expected);
+}
+
+void HeadersTests::knownHeadersFoundById()
+{
+    Headers headers;
+    headers.insert("transfer-encoding", "gzip");
+    headers.insert(KnownHeader::TransferEncoding, "chunked");
+
+    QVERIFY(headers.contains(KnownHeader::TransferEncoding));
+    QVERIFY(!headers.contains(KnownHeader::ContentLength));
+
+    QList<QString> expected;
+    expected << "gzip" << "chunked";
+
+    QCOMPARE(headers.find_by_name(KnownHeader::TransferEncoding), expected);
+    QCOMPARE(headers.find_by_name("Transfer-Encoding"), expected);
+}
+
+void HeadersTests::fieldsKeepInsertionOrder()
+{
+    Headers headers;
+    headers.insert("set-cookie", "a=1");
+    headers.insert("X-Trace", "abc");
+    headers.insert("Set-Cookie", "b=2");
+
+    QList<QString> names;
+    QList<QString> values;
+    for (const auto& field : headers)
+    {
+        names << field.name_string();
+        values << field.value_string();
+    }
+
+    QList<QString> expectedNames;
+    expectedNames << "Set-Cookie" << "X-Trace" << "Set-Cookie";
+    QList<QString> expectedValues;
+    expectedValues << "a=1" << "abc" << "b=2";
+
+    QCOMPARE(names, expectedNames);
+    QCOMPARE(values, expectedValues);
+    QCOMPARE(headers.begin()->id, KnownHeader::SetCookie);
+    QCOMPARE((headers.begin() + 1)->id, KnownHeader::Unknown);
+}
+
+void HeadersTests::valueAndTokens()
+{
+    Headers headers;
+    headers.insert("Connection", "Upgrade");
+    headers.insert("connection", " keep-alive , Close");
+
+    QVERIFY(headers.value(KnownHeader::Connection) == QString("Upgrade"));
+    QVERIFY(headers.value(KnownHeader::Host).isNull());
+
+    QVERIFY(headers.has_token(KnownHeader::Connection, QString("close")));
+    QVERIFY(headers.has_token(KnownHeader::Connection, QString("KEEP-ALIVE")));
+    QVERIFY(!headers.has_token(KnownHeader::Connection, QString("keep")));
+    QVERIFY(!headers.has_token(KnownHeader::TransferEncoding, QString("chunked")));
+}
+
+void HeadersTests::growsPastInlineCapacity()
+{
+    Headers headers;
+    for (int i = 0; i < 100; ++i)
+    {
+        headers.insert("X-Field-" + std::to_string(i), std::to_string(i));
+        headers.insert("Via", std::to_string(i));
+    }
+
+    QCOMPARE(headers.size(), 200);
+    QCOMPARE(headers.names().size(), 101);
+    QCOMPARE(headers.find_by_name("x-field-99"), QList<QString>() << "99");
+    QCOMPARE(headers.find_by_name(KnownHeader::Via).size(), 100);
+
+    QCOMPARE(headers.remove("VIA"), 100);
+    QCOMPARE(headers.size(), 100);
+    QVERIFY(!headers.contains(KnownHeader::Via));
+    QVERIFY(headers.begin()->name == "X-Field-0");
+    QVERIFY((headers.end() - 1)->value == "99");
+}
+
+void HeadersTests::keepsValuesAsBytes()
+{
+    // "caf\xc3\xa9" is UTF-8, and stays exactly those bytes until someone
+    // asks for a QString, which is decoded as Latin-1.
+    Headers headers;
+    headers.insert("x-label", "caf\xc3\xa9");
+    headers.insert(KnownHeader::Connection, "Upgrade, \xe9t\xe9");
+
+    QVERIFY(headers.begin()->name == "X-Label");
+    QVERIFY(headers.begin()->value == "caf\xc3\xa9");
+    QCOMPARE(headers.begin()->value_string(), QString::fromLatin1("caf\xc3\xa9"));
+    QCOMPARE(headers.find_by_name("X-LABEL"), QList<QString>() << QString::fromLatin1("caf\xc3\xa9"));
+
+    QVERIFY(headers.value_bytes(KnownHeader::Connection) == "Upgrade, \xe9t\xe9");
+    QVERIFY(headers.value_bytes(KnownHeader::Host).empty());
+    QVERIFY(headers.has_token(KnownHeader::Connection, "upgrade"));
+    QVERIFY(headers.has_token(KnownHeader::Connection, "\xe9t\xe9"));
+    QVERIFY(!headers.has_token(KnownHeader::Connection, "Upgrade, \xe9t\xe9"));
+}
+
 QTEST_GUILESS_MAIN(HeadersTests)
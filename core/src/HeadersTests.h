@@ -26,4 +26,11 @@ class HeadersTests : public QObject
 private Q_SLOTS:
     void namesAreCanonicalized();
     void multipleInsertionsOfOneName();
+    void removeDropsEveryValue();
+    void knownAndOtherNamesKeepTheirOrder();
+    void knownHeadersFoundById();
+    void fieldsKeepInsertionOrder();
+    void valueAndTokens();
+    void growsPastInlineCapacity();
+    void keepsValuesAsBytes();
 };
@@ -36,10 +36,20 @@ HttpMessage::HttpMessage() :
 
 const QString HttpMessage::method() const
 {
-    return method_;
+    return QString::fromLatin1(method_.data(), static_cast<qsizetype>(method_.size()));
 }
 
 const QString HttpMessage::uri() const
+{
+    return QString::fromLatin1(uri_.data(), static_cast<qsizetype>(uri_.size()));
+}
+
+std::string_view HttpMessage::method_bytes() const noexcept
+{
+    return method_;
+}
+
+std::string_view HttpMessage::uri_bytes() const noexcept
 {
     return uri_;
 }
@@ -50,6 +60,11 @@ int HttpMessage::status_code() const
 }
 
 const QString HttpMessage::status_message() const
+{
+    return QString::fromUtf8(status_message_.data(), static_cast<qsizetype>(status_message_.size()));
+}
+
+std::string_view HttpMessage::status_message_bytes() const noexcept
 {
     return status_message_;
 }
@@ -84,14 +99,14 @@ QByteArray HttpMessage::body()
     return body_;
 }
 
-void HttpMessage::set_method(const QString& method)
+void HttpMessage::set_method(std::string_view method)
 {
-    method_ = method;
+    method_.assign(method);
 }
 
-void HttpMessage::set_uri(const QString& uri)
+void HttpMessage::set_uri(std::string_view uri)
 {
-    uri_ = uri;
+    uri_.assign(uri);
 }
 
 void HttpMessage::set_major_version(int major_version)
@@ -119,14 +134,14 @@ void HttpMessage::set_status_code(int status_code)
     status_code_ = status_code;
 }
 
-void HttpMessage::set_status_message(const QString& message)
+void HttpMessage::set_status_message(std::string_view message)
 {
-    status_message_ = message;
+    status_message_.assign(message);
 }
 
-void HttpMessage::add_header(const QString& name, const QString& value)
+void HttpMessage::add_header(std::string_view name, std::string_view value)
 {
-    headers_.insert(name, value);;
+    headers_.insert(name, value);
 }
 
 const QString HttpMessage::body_as_string() const
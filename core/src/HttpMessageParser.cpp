@@ -17,19 +17,27 @@
 
 #include "core/HttpMessageParser.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cctype>
 #include <cerrno>
 #include <cstdlib>
 #include <iostream>
-#include <sstream>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <utility>
 
+#include <QByteArrayView>
 #include <QDebug>
-#include <QString>
-#include <QStringView>
 
 #include "core/Headers.h"
 #include "core/HttpMessage.h"
+#include "core/HttpMessageView.h"
+#include "core/KnownHeader.h"
+
+#include "ByteScan.h"
+#include "CharClass.h"
 
 namespace ama {
 
@@ -58,568 +66,826 @@ bool parse_uint64_t(const std::string &str, uint64_t &result, int base = 10)
     return true;
 }
 
-inline bool is_char(int input)
+// Whether QChar::isSpace() holds for the Latin-1 character.
+inline bool is_qstring_space(char c)
 {
-    return input >= 0 && input <= 127;
+    auto u = static_cast<unsigned char>(c);
+    return u == ' ' || (u >= '\t' && u <= '\r') || u == 0x85 || u == 0xA0;
 }
 
-inline bool is_ctl(int input)
+// Trims the way QStringView::trimmed() would.
+inline QByteArrayView trimmed_like_qstring(QByteArrayView view)
 {
-    return (input >= 0 && input <= 31) || (input == 127);
+    while (!view.isEmpty() && is_qstring_space(view.front()))
+    {
+        view = view.sliced(1);
+    }
+    while (!view.isEmpty() && is_qstring_space(view.back()))
+    {
+        view.chop(1);
+    }
+    return view;
 }
 
-inline bool is_tspecial(int input)
+// Whether "chunked" is one of the comma-separated items of a
+// Transfer-Encoding value.
+bool lists_chunked(QByteArrayView value)
 {
-    switch (input)
-    {
-    case '(':
-    case ')':
-    case '<':
-    case '@':
-    case ',':
-    case ';':
-    case ':':
-    case '\\':
-    case '"':
-    case '/':
-    case '[':
-    case ']':
-    case '?':
-    case '=':
-    case '{':
-    case '}':
-    case ' ':
-    case '\t':
-        return true;
-
-    default:
-        return false;
+    while (!value.isEmpty())
+    {
+        auto comma = std::find(value.begin(), value.end(), ',');
+        auto token = QByteArrayView(value.begin(), comma - value.begin());
+        if (trimmed_like_qstring(token) == QByteArrayView("chunked"))
+        {
+            return true;
+        }
+        value = comma == value.end() ? QByteArrayView() : value.sliced(comma - value.begin() + 1);
     }
+    return false;
 }
 
-inline bool is_digit(int input)
+// Parses a Content-Length value the way QString::toULongLong() would,
+// without decoding it first.
+bool parse_content_length(QByteArrayView value, uint64_t& length)
 {
-    return input >= '0' && input <= '9';
+    value = trimmed_like_qstring(value);
+    if (!value.isEmpty() && value.front() == '+')
+    {
+        value = value.sliced(1);
+    }
+    if (value.isEmpty())
+    {
+        return false;
+    }
+
+    uint64_t result = 0;
+    for (char c : value)
+    {
+        if (c < '0' || c > '9')
+        {
+            return false;
+        }
+
+        auto digit = static_cast<uint64_t>(c - '0');
+        if (result > (std::numeric_limits<uint64_t>::max() - digit) / 10)
+        {
+            return false;
+        }
+        result = result * 10 + digit;
+    }
+
+    length = result;
+    return true;
 }
 
-inline bool is_hex(int input)
+QByteArrayView bytes_of(const std::string& str)
 {
-    return is_digit(input)
-            || (input >= 'a' && input <= 'f')
-            || (input >= 'A' && input <= 'F');
+    return QByteArrayView(str.data(), static_cast<qsizetype>(str.size()));
 }
 
-inline int hex_value(char c)
+} // anonymous namespace
+
+// Records parsed elements straight into an HttpMessage, collecting header
+// names, values and the reason phrase in the parser's scratch buffers.
+class HttpMessageParser::MessageTarget
 {
-    if (is_digit(c))
+public:
+    MessageTarget(HttpMessageParser& parser, HttpMessage& message)
+        : parser_(parser)
+        , message_(message)
+    {}
+
+    void append_method(const char* data, size_t length)
     {
-        return c - '0';
+        message_.method_.append(data, length);
     }
-    else if (c >= 'a' && c <= 'f')
+
+    void append_uri(const char* data, size_t length)
     {
-        return c - 'a' + 10;
+        message_.uri_.append(data, length);
     }
-    else if (c >= 'A' && c <= 'F')
+
+    int& major_version() { return message_.major_version_; }
+    int& minor_version() { return message_.minor_version_; }
+    int& status_code() { return message_.status_code_; }
+
+    void begin_reason_phrase(const char* data)
     {
-        return c - 'A' + 10;
+        parser_.buffer_.clear();
+        parser_.buffer_.append(data, 1);
     }
-    else
+
+    void append_reason_phrase(const char* data, size_t length)
     {
-        std::stringstream ss;
-        ss << "Not a hex value: " << c;
-        throw std::domain_error(ss.str());
+        parser_.buffer_.append(data, length);
     }
-}
-
-} // anonymous namespace
 
-HttpMessageParser::HttpMessageParser() :
-    state_(method_start),
-    remaining_(0),
-    buffer_(),
-    value_buffer_()
-{
-    buffer_.reserve(64);
-    value_buffer_.reserve(64);
-}
-
-HttpMessageParser::~HttpMessageParser()
-{
-    // here to satisfy my wonky build setup
-}
-
-void HttpMessageParser::resetForRequest()
-{
-    state_ = method_start;
-    remaining_ = 0;
-    buffer_.clear();
-    value_buffer_.clear();
-}
+    void end_reason_phrase()
+    {
+        message_.status_message_.assign(parser_.buffer_.data(), parser_.buffer_.size());
+    }
 
-void HttpMessageParser::resetForResponse()
-{
-    state_ = response_start;
-    remaining_ = 0;
-    buffer_.clear();
-    value_buffer_.clear();
-}
+    bool has_headers() const
+    {
+        return !message_.headers_.empty();
+    }
 
-void HttpMessageParser::transition_to_state(ParserState newState)
-{
-    state_ = newState;
-}
+    void begin_header_name(const char* data)
+    {
+        parser_.buffer_.clear();
+        parser_.buffer_.append(data, 1);
+    }
 
-HttpMessageParser::State HttpMessageParser::consume(HttpMessage &message, char input, ParsePhase* phase)
-{
-#define TRANSIT(x) do { \
-    if (phase != nullptr) { \
-        *phase = get_phase_for_state_transition(*phase, state_, (x)); \
-    } \
-    transition_to_state((x)); \
-} while (false)
+    void append_header_name(const char* data, size_t length)
+    {
+        parser_.buffer_.append(data, length);
+    }
 
-    switch (state_)
+    void begin_header_value()
     {
-    case method_start:
-        if (!is_char(input) || is_ctl(input) || is_tspecial(input))
-        {
-            return Invalid;
-        }
+        parser_.value_buffer_.clear();
+    }
 
-        TRANSIT(method);
-        message.method_.push_back(input);
-        return Incomplete;
+    void append_header_value(const char* data, size_t length)
+    {
+        parser_.value_buffer_.append(data, length);
+    }
 
-    case method:
-        if (input == ' ')
-        {
-            TRANSIT(uri);
-            return Incomplete;
-        }
-        else if (!is_char(input) || is_ctl(input) || is_tspecial(input))
+    void end_header()
+    {
+        QByteArrayView name(parser_.buffer_.data(), static_cast<qsizetype>(parser_.buffer_.size()));
+        std::string_view value(parser_.value_buffer_.data(), parser_.value_buffer_.size());
+        auto id = known_header(name);
+        if (id != KnownHeader::Unknown)
         {
-            return Invalid;
+            message_.headers_.insert(id, value);
         }
         else
         {
-            message.method_.push_back(input);
-            return Incomplete;
+            message_.headers_.insert(std::string_view(parser_.buffer_.data(), parser_.buffer_.size()), value);
         }
 
-    case uri:
-        if (input == ' ')
-        {
-            TRANSIT(http_version_h);
-            return Incomplete;
-        }
-        else if (is_ctl(input))
-        {
-            return Invalid;
-        }
-        else
-        {
-            message.uri_.push_back(input);
-            return Incomplete;
-        }
+        parser_.buffer_.clear();
+        parser_.value_buffer_.clear();
+    }
 
-    case http_version_h:
-        if (input == 'H'){
-            TRANSIT(http_version_t1);
-            return Incomplete;
-        }
-        return Invalid;
+    void end_head(const char*) {}
 
-    case http_version_t1:
-        if (input == 'T')
+    bool is_chunked() const
+    {
+        // Is this a simple chunk stream?  If not, do we have a comma-separated list
+        // of encodings, one of which might be 'chunked'?
+        for (const auto& field : message_.headers_)
         {
-            TRANSIT(http_version_t2);
-            return Incomplete;
-        }
-        return Invalid;
+            if (field.id != KnownHeader::TransferEncoding)
+            {
+                continue;
+            }
 
-    case http_version_t2:
-        if (input == 'T')
-        {
-            TRANSIT(http_version_p);
-            return Incomplete;
+            if (lists_chunked(bytes_of(field.value)))
+            {
+                return true;
+            }
         }
-        return Invalid;
+        return false;
+    }
 
-    case http_version_p:
-        if (input == 'P')
+    ContentLength content_length(uint64_t& length) const
+    {
+        // The last Content-Length header wins.
+        const Headers::Field* last = nullptr;
+        for (const auto& field : message_.headers_)
         {
-            TRANSIT(http_version_slash);
-            return Incomplete;
+            if (field.id == KnownHeader::ContentLength)
+            {
+                last = &field;
+            }
         }
-        return Invalid;
 
-    case http_version_slash:
-        if (input == '/')
+        if (last == nullptr)
         {
-            TRANSIT(http_version_major_start);
-            message.major_version_ = 0;
-            message.minor_version_ = 0;
-            return Incomplete;
+            return ContentLength::Absent;
         }
-        return Invalid;
 
-    case http_version_major_start:
-        if (is_digit(input))
-        {
-            TRANSIT(http_version_major);
-            message.major_version_ = input - '0';
-            return Incomplete;
-        }
-        return Invalid;
+        return parse_content_length(bytes_of(last->value), length) ? ContentLength::Present : ContentLength::Invalid;
+    }
 
-    case http_version_major:
-        if (input == '.')
-        {
-            TRANSIT(http_version_minor_start);
-            return Incomplete;
-        }
-        else if (is_digit(input))
+    void begin_body(uint64_t size_hint)
+    {
+        message_.body_.clear();
+        if (size_hint > 0)
         {
-            message.major_version_ *= 10;
-            message.major_version_ += input - '0';
-            return Incomplete;
+            message_.body_.reserve(static_cast<size_t>(size_hint));  // TODO: can length be bigger than a size_t?
         }
-        return Invalid;
+    }
 
-    case http_version_minor_start:
-        if (is_digit(input))
-        {
-            TRANSIT(http_version_minor);
-            message.minor_version_ = input - '0';
-            return Incomplete;
-        }
-        return Invalid;
+    void append_body(const char* data, size_t length)
+    {
+        message_.body_.append(data, static_cast<qsizetype>(length));
+    }
 
-    case http_version_minor:
-        if (input == '\r')
-        {
-            TRANSIT(newline_1);
-            return Incomplete;
-        }
-        else if (is_digit(input))
-        {
-            message.minor_version_ *= 10;
-            message.minor_version_ += input - '0';
-            return Incomplete;
-        }
-        return Invalid;
+private:
+    HttpMessageParser& parser_;
+    HttpMessage& message_;
+};
 
-    case newline_1:
-        if (input == '\n')
-        {
-            TRANSIT(header_line_start);
-            return Incomplete;
-        }
-        return Invalid;
+// Records parsed elements as offsets into the buffer being parsed, which is
+// either the view's own receive buffer or one holding body bytes.
+class HttpMessageParser::ViewTarget
+{
+public:
+    ViewTarget(HttpMessageView& view, const QByteArray& buffer)
+        : view_(view)
+        , buffer_(buffer)
+    {}
 
-    case response_start:
-        if (input == 'H')
-        {
-            TRANSIT(response_http_t1);
-            return Incomplete;
-        }
-        return Invalid;
+    void append_method(const char* data, size_t length)
+    {
+        extend(view_.method_, data, length);
+    }
 
-    case response_http_t1:
-        if (input == 'T')
-        {
-            TRANSIT(response_http_t2);
-            return Incomplete;
-        }
-        return Invalid;
+    void append_uri(const char* data, size_t length)
+    {
+        extend(view_.uri_, data, length);
+    }
 
-    case response_http_t2:
-        if (input == 'T')
-        {
-            TRANSIT(response_http_p);
-            return Incomplete;
-        }
-        return Invalid;
+    int& major_version() { return view_.major_version_; }
+    int& minor_version() { return view_.minor_version_; }
+    int& status_code() { return view_.status_code_; }
 
-    case response_http_p:
-        if (input == 'P')
-        {
-            TRANSIT(response_http_slash);
-            return Incomplete;
-        }
-        return Invalid;
+    void begin_reason_phrase(const char* data)
+    {
+        view_.reason_phrase_ = HttpMessageView::Span{offset_of(data), 1};
+    }
 
-    case response_http_slash:
-        if (input == '/')
-        {
-            TRANSIT(response_major_version_start);
-            return Incomplete;
-        }
-        return Invalid;
+    void append_reason_phrase(const char* data, size_t length)
+    {
+        extend(view_.reason_phrase_, data, length);
+    }
 
-    case response_major_version_start:
-        if (is_digit(input))
-        {
-            TRANSIT(response_major_version);
-            message.major_version_ = input - '0';
-            return Incomplete;
-        }
-        return Invalid;
+    void end_reason_phrase() {}
 
-    case response_major_version:
-        if (input == '.')
-        {
-            TRANSIT(response_minor_version_start);
-            return Incomplete;
-        }
-        else if (is_digit(input))
-        {
-            message.major_version_ = (message.major_version_ * 10) + (input - '0');
-            return Incomplete;
-        }
-        return Invalid;
+    bool has_headers() const
+    {
+        return !view_.fields_.empty();
+    }
 
-    case response_minor_version_start:
-        if (is_digit(input))
-        {
-            TRANSIT(response_minor_version);
-            message.minor_version_ = input - '0';
-            return Incomplete;
-        }
-        return Invalid;
+    void begin_header_name(const char* data)
+    {
+        view_.pending_field_.name = HttpMessageView::Span{offset_of(data), 1};
+    }
 
-    case response_minor_version:
-        if (input == ' ')
-        {
-            TRANSIT(response_status_code_start);
-            return Incomplete;
-        }
-        else if (is_digit(input))
-        {
-            message.minor_version_ = (message.minor_version_ * 10) + (input - '0');
-            return Incomplete;
-        }
-        return Invalid;
+    void append_header_name(const char* data, size_t length)
+    {
+        extend(view_.pending_field_.name, data, length);
+    }
 
-    case response_status_code_start:
-        if (is_digit(input))
-        {
-            TRANSIT(response_status_code);
-            message.status_code_ = input - '0';
-            return Incomplete;
-        }
-        return Invalid;
+    void begin_header_value()
+    {
+        view_.pending_field_.value = HttpMessageView::Span{0, 0};
+    }
 
-    case response_status_code:
-        if (input == ' ')
-        {
-            TRANSIT(response_status_message_start);
-            return Incomplete;
-        }
-        else if (is_digit(input))
-        {
-            message.status_code_ = (message.status_code_ * 10) + (input - '0');
-            return Incomplete;
-        }
-        return Invalid;
+    void append_header_value(const char* data, size_t length)
+    {
+        extend(view_.pending_field_.value, data, length);
+    }
+
+    void end_header()
+    {
+        auto& field = view_.pending_field_;
+        field.id = known_header(view_.view_of(field.name));
+        view_.fields_.push_back(field);
+        field = HttpMessageView::Field{{0, 0}, {0, 0}, KnownHeader::Unknown, false};
+    }
 
-    case response_status_message_start:
-        if (is_char(input))
+    void end_head(const char* data)
+    {
+        // data is the blank line's LF.
+        view_.head_end_ = offset_of(data) + 1;
+    }
+
+    bool is_chunked() const
+    {
+        for (const auto& field : view_.fields_)
         {
-            TRANSIT(response_status_message);
-            buffer_.clear();
-            buffer_.push_back(input);
-            return Incomplete;
+            if (!is_named(field, KnownHeader::TransferEncoding))
+            {
+                continue;
+            }
+
+            if (lists_chunked(view_.view_of(field.value)))
+            {
+                return true;
+            }
         }
-        return Invalid;
+        return false;
+    }
 
-    case response_status_message:
-        if (input == '\r')
+    ContentLength content_length(uint64_t& length) const
+    {
+        // As with HttpMessage, the last Content-Length header wins.
+        for (auto it = view_.fields_.rbegin(); it != view_.fields_.rend(); ++it)
         {
-            TRANSIT(response_newline);
-            message.status_message_ = buffer_;
-            return Incomplete;
+            if (is_named(*it, KnownHeader::ContentLength))
+            {
+                return parse_content_length(view_.view_of(it->value), length) ? ContentLength::Present : ContentLength::Invalid;
+            }
         }
-        else if (is_char(input) || input == ' ')
+        return ContentLength::Absent;
+    }
+
+    void begin_body(uint64_t) {}
+
+    void append_body(const char* data, size_t length)
+    {
+        view_.append_body(buffer_, data - buffer_.constData(), static_cast<qsizetype>(length));
+    }
+
+private:
+    uint32_t offset_of(const char* data) const
+    {
+        return static_cast<uint32_t>(data - buffer_.constData());
+    }
+
+    void extend(HttpMessageView::Span& span, const char* data, size_t length)
+    {
+        if (span.length == 0)
         {
-            buffer_.push_back(input);
-            return Incomplete;
+            span.offset = offset_of(data);
         }
-        return Invalid;
+        span.length += static_cast<uint32_t>(length);
+    }
 
-    case response_newline:
-        if (input == '\n')
+    bool is_named(const HttpMessageView::Field& field, KnownHeader id) const
+    {
+        return !field.removed && field.id == id;
+    }
+
+    HttpMessageView& view_;
+    const QByteArray& buffer_;
+};
+
+// The request line, status line and headers are parsed by table.  Each of
+// their states maps every class of byte to the state that follows and to
+// what is done with the byte, so that consume_impl() makes one lookup per
+// byte instead of working through a ladder of comparisons.  Bodies and
+// trailers keep their switch; most of their bytes go through
+// consume_run_impl() anyway.
+class HttpMessageParser::HeadTable
+{
+public:
+    enum Action : uint8_t
+    {
+        Reject = 0,
+        Skip,
+        AppendMethod,
+        AppendUri,
+        ResetVersion,
+        FirstMajorDigit,
+        NextMajorDigit,
+        FirstMinorDigit,
+        NextMinorDigit,
+        FirstStatusDigit,
+        NextStatusDigit,
+        BeginReasonPhrase,
+        AppendReasonPhrase,
+        EndReasonPhrase,
+        ContinueHeader,
+        BeginHeaderName,
+        AppendHeaderName,
+        BeginHeaderValue,
+        AppendHeaderValue,
+        EndHeader,
+        EndHead,
+    };
+
+    struct Step
+    {
+        ParserState next;
+        Action action;
+    };
+
+    static bool covers(ParserState state)
+    {
+        return static_cast<unsigned>(state) < kStateLimit;
+    }
+
+    static const Step& step(ParserState state, char input)
+    {
+        return kTables.steps[state][kTables.bytes[static_cast<unsigned char>(input)]];
+    }
+
+private:
+    // The classes of byte that the head states tell apart.
+    enum Byte : uint8_t
+    {
+        cr,
+        lf,
+        sp,
+        ht,
+        colon,
+        dot,
+        slash,
+        letter_h,
+        letter_t,
+        letter_p,
+        digit,
+        other_token,
+        other_separator,
+        other_ctl,
+        non_ascii,
+
+        byte_class_count
+    };
+
+    using ByteSet = uint32_t;
+
+    static constexpr ByteSet of(Byte b) { return ByteSet{1} << b; }
+
+    static constexpr ByteSet kAll = (ByteSet{1} << byte_class_count) - 1;
+    static constexpr ByteSet kAscii = kAll & ~(ByteSet{1} << non_ascii);
+    static constexpr ByteSet kCtl = (ByteSet{1} << cr) | (ByteSet{1} << lf) | (ByteSet{1} << ht) | (ByteSet{1} << other_ctl);
+    static constexpr ByteSet kToken = (ByteSet{1} << dot) | (ByteSet{1} << letter_h) | (ByteSet{1} << letter_t)
+            | (ByteSet{1} << letter_p) | (ByteSet{1} << digit) | (ByteSet{1} << other_token);
+
+    // Every state below this one belongs to the head.  Rows are indexed by
+    // state; those for the gaps in ParserState are never used.
+    static constexpr unsigned kStateLimit = newline_3 + 1;
+
+    struct Tables
+    {
+        uint8_t bytes[256];
+        Step steps[kStateLimit][byte_class_count];
+    };
+
+    static constexpr Byte classify(char c)
+    {
+        switch (c)
+        {
+        case '\r': return cr;
+        case '\n': return lf;
+        case ' ':  return sp;
+        case '\t': return ht;
+        case ':':  return colon;
+        case '.':  return dot;
+        case '/':  return slash;
+        case 'H':  return letter_h;
+        case 'T':  return letter_t;
+        case 'P':  return letter_p;
+        default:
+            break;
+        }
+
+        if (chars::is_digit(c)) return digit;
+        if (chars::is_token(c)) return other_token;
+        if (chars::is_tspecial(c)) return other_separator;
+        if (chars::is_ctl(c)) return other_ctl;
+        return non_ascii;
+    }
+
+    // Bytes in @p bytes move @p from to @p to, doing @p action.  Later
+    // calls override earlier ones, so that a state can give a few bytes
+    // a meaning of their own after dealing with a whole class.
+    static constexpr void on(Tables& t, ParserState from, ByteSet bytes, ParserState to, Action action)
+    {
+        for (unsigned b = 0; b < byte_class_count; ++b)
         {
-            TRANSIT(header_line_start);
-            return Incomplete;
+            if (bytes & (ByteSet{1} << b))
+            {
+                t.steps[from][b] = Step{to, action};
+            }
         }
+    }
+
+    static constexpr Tables build()
+    {
+        Tables t{};
+        for (unsigned c = 0; c < 256; ++c)
+        {
+            t.bytes[c] = classify(static_cast<char>(c));
+        }
+
+        // Request line
+        on(t, method_start, kToken, method, AppendMethod);
+        on(t, method, kToken, method, AppendMethod);
+        on(t, method, of(sp), uri, Skip);
+        on(t, uri, kAll & ~kCtl, uri, AppendUri);
+        on(t, uri, of(sp), http_version_h, Skip);
+        on(t, http_version_h, of(letter_h), http_version_t1, Skip);
+        on(t, http_version_t1, of(letter_t), http_version_t2, Skip);
+        on(t, http_version_t2, of(letter_t), http_version_p, Skip);
+        on(t, http_version_p, of(letter_p), http_version_slash, Skip);
+        on(t, http_version_slash, of(slash), http_version_major_start, ResetVersion);
+        on(t, http_version_major_start, of(digit), http_version_major, FirstMajorDigit);
+        on(t, http_version_major, of(digit), http_version_major, NextMajorDigit);
+        on(t, http_version_major, of(dot), http_version_minor_start, Skip);
+        on(t, http_version_minor_start, of(digit), http_version_minor, FirstMinorDigit);
+        on(t, http_version_minor, of(digit), http_version_minor, NextMinorDigit);
+        on(t, http_version_minor, of(cr), newline_1, Skip);
+        on(t, newline_1, of(lf), header_line_start, Skip);
+
+        // Status line
+        on(t, response_start, of(letter_h), response_http_t1, Skip);
+        on(t, response_http_t1, of(letter_t), response_http_t2, Skip);
+        on(t, response_http_t2, of(letter_t), response_http_p, Skip);
+        on(t, response_http_p, of(letter_p), response_http_slash, Skip);
+        on(t, response_http_slash, of(slash), response_major_version_start, Skip);
+        on(t, response_major_version_start, of(digit), response_major_version, FirstMajorDigit);
+        on(t, response_major_version, of(digit), response_major_version, NextMajorDigit);
+        on(t, response_major_version, of(dot), response_minor_version_start, Skip);
+        on(t, response_minor_version_start, of(digit), response_minor_version, FirstMinorDigit);
+        on(t, response_minor_version, of(digit), response_minor_version, NextMinorDigit);
+        on(t, response_minor_version, of(sp), response_status_code_start, Skip);
+        on(t, response_status_code_start, of(digit), response_status_code, FirstStatusDigit);
+        on(t, response_status_code, of(digit), response_status_code, NextStatusDigit);
+        on(t, response_status_code, of(sp), response_status_message_start, Skip);
+        on(t, response_status_message_start, kAscii, response_status_message, BeginReasonPhrase);
+        on(t, response_status_message, kAscii, response_status_message, AppendReasonPhrase);
+        on(t, response_status_message, of(cr), response_newline, EndReasonPhrase);
+        on(t, response_newline, of(lf), header_line_start, Skip);
+
+        // Headers
+        on(t, header_line_start, kToken, header_name, BeginHeaderName);
+        on(t, header_line_start, of(sp) | of(ht), header_lws, ContinueHeader);
+        on(t, header_line_start, of(cr), newline_3, Skip);
+        on(t, header_lws, kAll & ~kCtl, header_value, Skip);
+        on(t, header_lws, of(sp) | of(ht), header_lws, Skip);
+        on(t, header_lws, of(cr), newline_2, Skip);
+        on(t, header_name, kToken, header_name, AppendHeaderName);
+        on(t, header_name, of(colon), header_space, Skip);
+        on(t, header_space, of(sp), header_value, BeginHeaderValue);
+        on(t, header_value, kAll & ~kCtl, header_value, AppendHeaderValue);
+        on(t, header_value, of(cr), newline_2, EndHeader);
+        on(t, newline_2, of(lf), header_line_start, Skip);
+        on(t, newline_3, of(lf), newline_3, EndHead);
+
+        return t;
+    }
+
+    static const Tables kTables;
+};
+
+constexpr HttpMessageParser::HeadTable::Tables HttpMessageParser::HeadTable::kTables = HttpMessageParser::HeadTable::build();
+
+HttpMessageParser::HttpMessageParser(std::pmr::memory_resource* resource) :
+    state_(method_start),
+    remaining_(0),
+    is_response_(false),
+    is_head_response_(false),
+    body_sink_(),
+    buffer_(resource),
+    value_buffer_(resource)
+{
+    buffer_.reserve(64);
+    value_buffer_.reserve(64);
+}
+
+HttpMessageParser::~HttpMessageParser()
+{
+    // here to satisfy my wonky build setup
+}
+
+void HttpMessageParser::resetForRequest()
+{
+    state_ = method_start;
+    remaining_ = 0;
+    is_response_ = false;
+    is_head_response_ = false;
+    body_sink_ = nullptr;
+    buffer_.clear();
+    value_buffer_.clear();
+}
+
+void HttpMessageParser::resetForResponse()
+{
+    state_ = response_start;
+    remaining_ = 0;
+    is_response_ = true;
+    is_head_response_ = false;
+    body_sink_ = nullptr;
+    buffer_.clear();
+    value_buffer_.clear();
+}
+
+void HttpMessageParser::resetForResponse(const Request& request)
+{
+    resetForResponse();
+    is_head_response_ = request.method_bytes() == "HEAD";
+}
+
+void HttpMessageParser::resetForResponse(const HttpMessageView& request)
+{
+    resetForResponse();
+    is_head_response_ = request.method() == QByteArrayView("HEAD");
+}
+
+HttpMessageParser::State HttpMessageParser::finish()
+{
+    if (state_ != close_delimited_entity)
+    {
         return Invalid;
+    }
+
+    if (body_sink_)
+    {
+        body_sink_->end();
+    }
+    return Valid;
+}
+
+void HttpMessageParser::transition_to_state(ParserState newState)
+{
+    state_ = newState;
+}
+
+HttpMessageParser::State HttpMessageParser::parse(HttpMessageView &view, ParsePhase& phase)
+{
+    return parse(view, view.buffer_, view.parsed_, view.size_, phase);
+}
 
-    // Headers
-    //
+HttpMessageParser::State HttpMessageParser::parse(HttpMessageView &view, const QByteArray& buffer, qsizetype& offset, qsizetype end, ParsePhase& phase)
+{
+    ViewTarget target(view, buffer);
 
-    case header_line_start:
-        if (input == '\r')
-        {
-            TRANSIT(newline_3);
-            return Incomplete;
-        }
-        else if (!message.headers_.empty() && (input == ' ' || input == '\t'))
-        {
-            TRANSIT(header_lws);
-            return Incomplete;
-        }
-        else if (!is_char(input) || is_ctl(input) || is_tspecial(input))
-        {
-            return Invalid;
-        }
-        else
-        {
-            TRANSIT(header_name);
-            buffer_.clear();
-            buffer_.push_back(input);
-            return Incomplete;
-        }
+    const char* begin = buffer.constData() + offset;
+    auto state = parse_contiguous(target, begin, buffer.constData() + end, &phase);
+    offset = begin - buffer.constData();
+    return state;
+}
 
-    case header_lws:
-        if (input == '\r')
-        {
-            TRANSIT(newline_2);
-            return Incomplete;
-        }
-        else if (input == ' ' || input == '\t')
-        {
-            return Incomplete;
-        }
-        else if (is_ctl(input))
+template <typename Target>
+HttpMessageParser::State HttpMessageParser::parse_contiguous(Target& target, const char*& begin, const char* end, ParsePhase* phase)
+{
+    ParsePhase startingPhase = *phase;
+
+    while (begin != end)
+    {
+        begin += consume_run_impl(target, begin, end);
+        if (begin == end)
         {
-            return Invalid;
+            break;
         }
-        else
+
+        auto state = consume_impl(target, begin++, phase);
+        if (state != State::Incomplete)
         {
-            TRANSIT(header_value);
-            return Incomplete;
+            if (state == State::Valid)
+            {
+                if (body_sink_ != nullptr)
+                {
+                    body_sink_->end();
+                }
+                *phase = ParsePhase::ReceivedFullMessage;
+            }
+            return state;
         }
 
-    case header_name:
-        if (input == ':')
+        if (*phase != startingPhase)
         {
-            TRANSIT(header_space);
-            return Incomplete;
+            break;
         }
-        else if (!is_char(input) || is_ctl(input) || is_tspecial(input))
+    }
+
+    return Incomplete;
+}
+
+HttpMessageParser::State HttpMessageParser::consume(HttpMessage &message, char input, ParsePhase* phase)
+{
+    MessageTarget target(*this, message);
+    return consume_impl(target, &input, phase);
+}
+
+size_t HttpMessageParser::consume_run(HttpMessage &message, const char* begin, const char* end)
+{
+    MessageTarget target(*this, message);
+    return consume_run_impl(target, begin, end);
+}
+
+#define TRANSIT(x) do { \
+    if (phase != nullptr) { \
+        *phase = get_phase_for_state_transition(*phase, state_, (x)); \
+    } \
+    transition_to_state((x)); \
+} while (false)
+
+template <typename Target>
+HttpMessageParser::State HttpMessageParser::consume_impl(Target& target, const char* p, ParsePhase* phase)
+{
+    const char input = *p;
+
+    if (HeadTable::covers(state_))
+    {
+        const auto step = HeadTable::step(state_, input);
+        switch (step.action)
         {
+        case HeadTable::Reject:
             return Invalid;
-        }
-        else
-        {
-            buffer_.push_back(input);
-            return Incomplete;
-        }
 
-    case header_space:
-        if (input == ' ')
-        {
-            TRANSIT(header_value);
-            value_buffer_.clear();
-            return Incomplete;
-        }
-        return Invalid;
+        case HeadTable::Skip:
+            break;
 
-    case header_value:
-        if (input == '\r')
-        {
-            TRANSIT(newline_2);
-            QString name = QString::fromLatin1(buffer_);
-            QString value = QString::fromLatin1(value_buffer_);
-            message.headers_.insert(name, value);
+        case HeadTable::AppendMethod:
+            target.append_method(p, 1);
+            break;
 
-            buffer_.clear();
-            value_buffer_.clear();
+        case HeadTable::AppendUri:
+            target.append_uri(p, 1);
+            break;
 
-            return Incomplete;
-        }
-        else if (! is_ctl(input))
-        {
-            value_buffer_.push_back(input);
-            return Incomplete;
-        }
-        return Invalid;
+        case HeadTable::ResetVersion:
+            target.major_version() = 0;
+            target.minor_version() = 0;
+            break;
 
-    case newline_2:
-        if (input == '\n')
-        {
-            TRANSIT(header_line_start);
-            return Incomplete;
-        }
-        return Invalid;
+        case HeadTable::FirstMajorDigit:
+            target.major_version() = input - '0';
+            break;
 
-    case newline_3:
-        if (input == '\n')
-        {
-            auto headerValues = message.headers_.find_by_name("Transfer-Encoding");
-            for (auto &value : headerValues)
-            {
-                bool is_chunked = false;
+        case HeadTable::NextMajorDigit:
+            target.major_version() = (target.major_version() * 10) + (input - '0');
+            break;
 
-                // Is this a simple chunk stream?  If not, do we have a comma-separated list
-                // of encodings, one of which might be 'chunked'?
-                QStringView dataView(value);
+        case HeadTable::FirstMinorDigit:
+            target.minor_version() = input - '0';
+            break;
 
-                for (const auto& token : dataView.split(','))
-                {
-                    if (token.trimmed() == QStringLiteral("chunked"))
-                    {
-                        is_chunked = true;
-                        break;
-                    }
-                }
+        case HeadTable::NextMinorDigit:
+            target.minor_version() = (target.minor_version() * 10) + (input - '0');
+            break;
 
-                if (is_chunked)
-                {
-                    TRANSIT(chunk_length_start);
-                    message.body_.clear();
-                    return Incomplete;
-                }
-            }
+        case HeadTable::FirstStatusDigit:
+            target.status_code() = input - '0';
+            break;
 
-            headerValues = message.headers_.find_by_name("Content-Length");
-            for (auto &value : headerValues)
-            {
-                bool ok = false;
-                auto length = value.toULongLong(&ok);
-                if (! ok)
-                {
-                    return Invalid;
-                }
+        case HeadTable::NextStatusDigit:
+            target.status_code() = (target.status_code() * 10) + (input - '0');
+            break;
 
-                if (length == 0)
-                {
-                    return Valid;
-                }
+        case HeadTable::BeginReasonPhrase:
+            target.begin_reason_phrase(p);
+            break;
 
-                TRANSIT(fixed_length_entity);
-                remaining_ = length;
-                message.body_.clear();
-                message.body_.reserve(static_cast<size_t>(length));  // TODO: can length be bigger than a size_t?
-                return Incomplete;
+        case HeadTable::AppendReasonPhrase:
+            target.append_reason_phrase(p, 1);
+            break;
+
+        case HeadTable::EndReasonPhrase:
+            target.end_reason_phrase();
+            break;
+
+        case HeadTable::BeginHeaderName:
+            target.begin_header_name(p);
+            break;
+
+        case HeadTable::AppendHeaderName:
+            target.append_header_name(p, 1);
+            break;
+
+        case HeadTable::BeginHeaderValue:
+            target.begin_header_value();
+            break;
+
+        case HeadTable::AppendHeaderValue:
+            target.append_header_value(p, 1);
+            break;
+
+        case HeadTable::EndHeader:
+            target.end_header();
+            break;
+
+        case HeadTable::ContinueHeader:
+            // A line starting with whitespace continues the previous
+            // header, so there has to be one.
+            if (!target.has_headers())
+            {
+                return Invalid;
             }
+            break;
 
-            // No entity expected, we're done!
-            return Valid;
+        case HeadTable::EndHead:
+            target.end_head(p);
+            return end_of_head(target, phase);
         }
-        return Invalid;
 
+        if (step.next != state_)
+        {
+            TRANSIT(step.next);
+        }
+        return Incomplete;
+    }
+
+    switch (state_)
+    {
     case chunk_length_start:
         // RFC 7230 (s) 4.1.1. defines the terminal chunk length
         // as being exactly "0" (that is, only one zero), we
         // are more lenient here due to Github issue #23, where
         // we encountered servers that seem to prefix extra zeroes
         // to chunk lengths.
-        if (is_hex(input))
+        if (int digit = chars::hex_value(input); digit != chars::kNotHex)
         {
             TRANSIT(chunk_length);
-            remaining_ = hex_value(input);
+            remaining_ = static_cast<uint64_t>(digit);
             return Incomplete;
         }
         return Invalid;
@@ -630,20 +896,46 @@ HttpMessageParser::State HttpMessageParser::consume(HttpMessage &message, char i
             TRANSIT(chunk_length_newline);
             return Incomplete;
         }
-        else if (is_hex(input))
+        else if (int digit = chars::hex_value(input); digit != chars::kNotHex)
         {
-            remaining_ = (remaining_ * 16) + hex_value(input);
+            // A length that does not fit in 64 bits can only be an attack.
+            if (remaining_ > (std::numeric_limits<uint64_t>::max() >> 4))
+            {
+                return Invalid;
+            }
+            remaining_ = (remaining_ * 16) + static_cast<uint64_t>(digit);
             return Incomplete;
         }
         else if (input == ';')
         {
-            qFatal("extensions not implemented");
+            TRANSIT(chunk_extension);
+            return Incomplete;
         }
         return Invalid;
 
+    case chunk_extension:
+        // RFC 7230 (s) 4.1.1. lets a recipient ignore extensions it does
+        // not understand, and we understand none; skip to the end of the
+        // line.
+        if (input == '\r')
+        {
+            TRANSIT(chunk_length_newline);
+            return Incomplete;
+        }
+        else if (input == '\n')
+        {
+            return Invalid;
+        }
+        return Incomplete;
+
     case chunk_length_newline:
         if (input == '\n')
         {
+            if (body_sink_)
+            {
+                body_sink_->begin_chunk(remaining_);
+            }
+
             if (remaining_ > 0)
             {
                 TRANSIT(chunk);
@@ -668,7 +960,7 @@ HttpMessageParser::State HttpMessageParser::consume(HttpMessage &message, char i
         }
         else
         {
-            message.body_.push_back(input);
+            append_body(target, p, 1);
             remaining_--;
             return Incomplete;
         }
@@ -687,7 +979,68 @@ HttpMessageParser::State HttpMessageParser::consume(HttpMessage &message, char i
             TRANSIT(chunk_terminating_newline);
             return Incomplete;
         }
-        qFatal("Trailing headers not implemented");
+        else if (!chars::is_token(input))
+        {
+            return Invalid;
+        }
+        else
+        {
+            TRANSIT(chunk_trailing_header_name);
+            buffer_.clear();
+            buffer_.push_back(input);
+            return Incomplete;
+        }
+
+    case chunk_trailing_header_name:
+        if (input == ':')
+        {
+            TRANSIT(chunk_trailing_header_space);
+            value_buffer_.clear();
+            return Incomplete;
+        }
+        else if (!chars::is_token(input))
+        {
+            return Invalid;
+        }
+        else
+        {
+            buffer_.push_back(input);
+            return Incomplete;
+        }
+
+    case chunk_trailing_header_space:
+        if (input == ' ' || input == '\t')
+        {
+            return Incomplete;
+        }
+        // Anything else begins the value, which may be empty.
+        TRANSIT(chunk_trailing_header_value);
+        [[fallthrough]];
+
+    case chunk_trailing_header_value:
+        if (input == '\r')
+        {
+            TRANSIT(chunk_trailing_header_newline);
+            if (body_sink_)
+            {
+                body_sink_->trailer(QByteArrayView(buffer_.data(), static_cast<qsizetype>(buffer_.size())),
+                                    QByteArrayView(value_buffer_.data(), static_cast<qsizetype>(value_buffer_.size())));
+            }
+            return Incomplete;
+        }
+        else if (!chars::is_ctl(input))
+        {
+            value_buffer_.push_back(input);
+            return Incomplete;
+        }
+        return Invalid;
+
+    case chunk_trailing_header_newline:
+        if (input == '\n')
+        {
+            TRANSIT(chunk_trailing_header_line_start);
+            return Incomplete;
+        }
         return Invalid;
 
     case chunk_terminating_newline:
@@ -698,7 +1051,7 @@ HttpMessageParser::State HttpMessageParser::consume(HttpMessage &message, char i
         return Invalid;
 
     case fixed_length_entity:
-        message.body_.push_back(static_cast<uint8_t>(input));
+        append_body(target, p, 1);
         --remaining_;
 
         if (remaining_ == 0)
@@ -710,6 +1063,10 @@ HttpMessageParser::State HttpMessageParser::consume(HttpMessage &message, char i
             return Incomplete;
         }
 
+    case close_delimited_entity:
+        append_body(target, p, 1);
+        return Incomplete;
+
     default:
         qFatal("Unimplemented state: %d", state_);
         return Invalid;
@@ -718,6 +1075,141 @@ HttpMessageParser::State HttpMessageParser::consume(HttpMessage &message, char i
     return Invalid;
 }
 
+template <typename Target>
+HttpMessageParser::State HttpMessageParser::end_of_head(Target& target, ParsePhase* phase)
+{
+    if (is_response_)
+    {
+        // RFC 7230 (s) 3.3.3: responses to HEAD, and 1xx, 204 and 304
+        // responses, end with their headers no matter what they say.
+        auto code = target.status_code();
+        if (is_head_response_ || (code >= 100 && code < 200) || code == 204 || code == 304)
+        {
+            return Valid;
+        }
+    }
+
+    if (target.is_chunked())
+    {
+        TRANSIT(chunk_length_start);
+        target.begin_body(0);
+        return Incomplete;
+    }
+
+    uint64_t length = 0;
+    switch (target.content_length(length))
+    {
+    case ContentLength::Invalid:
+        return Invalid;
+
+    case ContentLength::Present:
+        if (length == 0)
+        {
+            return Valid;
+        }
+
+        TRANSIT(fixed_length_entity);
+        remaining_ = length;
+        target.begin_body(body_sink_ ? 0 : length);
+        return Incomplete;
+
+    case ContentLength::Absent:
+        break;
+    }
+
+    if (is_response_)
+    {
+        // A response with no framing information runs until the
+        // server closes the connection.
+        TRANSIT(close_delimited_entity);
+        target.begin_body(0);
+        return Incomplete;
+    }
+
+    // No entity expected, we're done!
+    return Valid;
+}
+
+template <typename Target>
+size_t HttpMessageParser::consume_run_impl(Target& target, const char* begin, const char* end)
+{
+    const char* stop;
+    switch (state_)
+    {
+    case method:
+        stop = scan::skip_token(begin, end);
+        target.append_method(begin, static_cast<size_t>(stop - begin));
+        break;
+
+    case uri:
+        stop = scan::skip_uri(begin, end);
+        target.append_uri(begin, static_cast<size_t>(stop - begin));
+        break;
+
+    case response_status_message:
+        stop = scan::skip_reason_phrase(begin, end);
+        target.append_reason_phrase(begin, static_cast<size_t>(stop - begin));
+        break;
+
+    case header_name:
+        stop = scan::skip_token(begin, end);
+        target.append_header_name(begin, static_cast<size_t>(stop - begin));
+        break;
+
+    case header_value:
+        stop = scan::skip_field_value(begin, end);
+        target.append_header_value(begin, static_cast<size_t>(stop - begin));
+        break;
+
+    case fixed_length_entity:
+        // The final byte is left to consume(), which reports the message
+        // as complete.
+        stop = begin + static_cast<size_t>(std::min<uint64_t>(remaining_ - 1, static_cast<uint64_t>(end - begin)));
+        append_body(target, begin, static_cast<size_t>(stop - begin));
+        remaining_ -= static_cast<uint64_t>(stop - begin);
+        break;
+
+    case chunk:
+        stop = begin + static_cast<size_t>(std::min<uint64_t>(remaining_, static_cast<uint64_t>(end - begin)));
+        append_body(target, begin, static_cast<size_t>(stop - begin));
+        remaining_ -= static_cast<uint64_t>(stop - begin);
+        break;
+
+    case close_delimited_entity:
+        stop = end;
+        append_body(target, begin, static_cast<size_t>(stop - begin));
+        break;
+
+    default:
+        return 0;
+    }
+
+    return static_cast<size_t>(stop - begin);
+}
+
+template <typename Target>
+void HttpMessageParser::append_body(Target& target, const char* data, size_t length)
+{
+    if (length == 0)
+    {
+        return;
+    }
+
+    if (body_sink_)
+    {
+        body_sink_->write(data, length);
+    }
+    else
+    {
+        target.append_body(data, length);
+    }
+}
+
+void HttpMessageParser::set_body_sink(std::shared_ptr<BodySink> sink)
+{
+    body_sink_ = std::move(sink);
+}
+
 ParsePhase HttpMessageParser::get_phase_for_state_transition(
         ParsePhase currentPhase,
         HttpMessageParser::ParserState oldState,
@@ -739,6 +1231,7 @@ ParsePhase HttpMessageParser::get_phase_for_state_transition(
 
     case chunk_length_start:
     case fixed_length_entity:
+    case close_delimited_entity:
         if (currentPhase == ParsePhase::ReceivedMessageLine)
         {
             return ParsePhase::ReceivedHeaders;
@@ -0,0 +1,295 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// core_bench_parser: measures HttpMessageParser::parse over a corpus of
+// realistic requests and responses, each fed to the parser either in one
+// contiguous buffer or in randomly-sized pieces, the way a socket might
+// deliver it.
+//
+// Usage: core_bench_parser [--json] [--filter TEXT] [--min-time SECONDS] [--seed N]
+//
+// Options and output are those of every benchmark; see
+// cmake/benchmark/BenchmarkHarness.h.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "core/HttpMessage.h"
+#include "core/HttpMessageParser.h"
+
+#include "BenchmarkHarness.h"
+
+using namespace ama;
+
+namespace {
+
+// The largest piece a split run hands to the parser at once; pieces are
+// anywhere from one byte to this long.  It is kept small so that even the
+// smallest fixture is cut somewhere, and the larger ones are cut inside
+// every kind of token.
+constexpr size_t kMaxSplitSize = 64;
+
+struct Fixture
+{
+    const char* name;
+    bool response;
+    std::string text;
+};
+
+std::string make_small_get()
+{
+    return "GET http://example.com/index.html HTTP/1.1\r\n"
+           "Host: example.com\r\n"
+           "User-Agent: curl/7.85.0\r\n"
+           "Accept: */*\r\n"
+           "\r\n";
+}
+
+std::string make_cookie_heavy_get()
+{
+    std::string text =
+            "GET http://www.example.com/account/settings?tab=privacy&lang=en-US HTTP/1.1\r\n"
+            "Host: www.example.com\r\n"
+            "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:105.0) Gecko/20100101 Firefox/105.0\r\n"
+            "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+            "Accept-Language: en-US,en;q=0.5\r\n"
+            "Accept-Encoding: gzip, deflate, br\r\n"
+            "Referer: http://www.example.com/account/\r\n"
+            "Connection: keep-alive\r\n"
+            "Upgrade-Insecure-Requests: 1\r\n"
+            "Sec-Fetch-Dest: document\r\n"
+            "Sec-Fetch-Mode: navigate\r\n"
+            "Sec-Fetch-Site: same-origin\r\n"
+            "Sec-Fetch-User: ?1\r\n"
+            "Cookie: ";
+
+    for (int i = 0; i < 40; ++i)
+    {
+        if (i > 0)
+        {
+            text += "; ";
+        }
+        text += "_ck" + std::to_string(i) + "=";
+        for (int j = 0; j < 48; ++j)
+        {
+            text += "0123456789abcdef"[(i * 7 + j * 13) % 16];
+        }
+    }
+
+    text += "\r\n\r\n";
+    return text;
+}
+
+std::string make_many_header_response()
+{
+    std::string text =
+            "HTTP/1.1 200 OK\r\n"
+            "Date: Mon, 03 Oct 2022 17:02:11 GMT\r\n"
+            "Content-Type: application/json; charset=utf-8\r\n"
+            "Content-Length: 2\r\n";
+
+    // Three above, ninety-seven here: a hundred in all.
+    for (int i = 0; i < 97; ++i)
+    {
+        text += "X-Trace-Attribute-" + std::to_string(i) + ": ";
+        text += "span=" + std::to_string(1000003 * (i + 1)) + "; sampled=1; origin=edge-" + std::to_string(i % 12) + "\r\n";
+    }
+
+    text += "\r\n{}";
+    return text;
+}
+
+std::string make_small_chunk_response()
+{
+    std::string text =
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: text/event-stream\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "\r\n";
+
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> length(1, 64);
+    char hex[16];
+    for (int i = 0; i < 1024; ++i)
+    {
+        int n = length(rng);
+        std::snprintf(hex, sizeof(hex), "%x\r\n", n);
+        text += hex;
+        text.append(static_cast<size_t>(n), static_cast<char>('a' + i % 26));
+        text += "\r\n";
+    }
+
+    text += "0\r\n\r\n";
+    return text;
+}
+
+std::string make_large_body_response()
+{
+    constexpr size_t kBodySize = 1024 * 1024;
+
+    std::string text =
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: application/octet-stream\r\n"
+            "Content-Length: " + std::to_string(kBodySize) + "\r\n"
+            "\r\n";
+
+    size_t head = text.size();
+    text.resize(head + kBodySize);
+    for (size_t i = 0; i < kBodySize; ++i)
+    {
+        text[head + i] = static_cast<char>((i * 31) & 0xFF);
+    }
+    return text;
+}
+
+std::vector<Fixture> make_corpus()
+{
+    std::vector<Fixture> corpus;
+    corpus.push_back({ "small_get", false, make_small_get() });
+    corpus.push_back({ "cookie_heavy_get", false, make_cookie_heavy_get() });
+    corpus.push_back({ "response_100_headers", true, make_many_header_response() });
+    corpus.push_back({ "chunked_small_chunks", true, make_small_chunk_response() });
+    corpus.push_back({ "fixed_length_1mib", true, make_large_body_response() });
+    return corpus;
+}
+
+// Cuts [0, size) into consecutive pieces, returning the offset at which
+// each one ends.
+std::vector<size_t> make_split_points(size_t size, std::mt19937& rng)
+{
+    std::uniform_int_distribution<size_t> length(1, kMaxSplitSize);
+
+    std::vector<size_t> ends;
+    size_t offset = 0;
+    while (offset < size)
+    {
+        offset = std::min(size, offset + length(rng));
+        ends.push_back(offset);
+    }
+    return ends;
+}
+
+bool parse_once(const Fixture& fixture, const std::vector<size_t>& ends)
+{
+    HttpMessage message;
+    HttpMessageParser parser;
+    if (fixture.response)
+    {
+        parser.resetForResponse();
+    }
+
+    const char* data = fixture.text.data();
+    const char* begin = data;
+    auto state = HttpMessageParser::Incomplete;
+    for (size_t end : ends)
+    {
+        state = parser.parse(message, begin, data + end);
+        if (state != HttpMessageParser::Incomplete)
+        {
+            break;
+        }
+    }
+
+    return state == HttpMessageParser::Valid && begin == data + fixture.text.size();
+}
+
+bool run(const Fixture& fixture, const char* mode, const std::vector<size_t>& ends, BenchmarkHarness& harness)
+{
+    if (!parse_once(fixture, ends))
+    {
+        std::cerr << "core_bench_parser: " << fixture.name << " (" << mode << ") did not parse" << std::endl;
+        return false;
+    }
+
+    auto measurement = harness.measure([&](uint64_t iterations)
+    {
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            parse_once(fixture, ends);
+        }
+    });
+
+    double messages_per_second = measurement.seconds > 0 ? measurement.iterations / measurement.seconds : 0;
+    harness.add_result({
+        fixture.name,
+        mode,
+        fixture.text.size(),
+        ends.size(),
+        measurement.iterations,
+        measurement.seconds,
+        messages_per_second,
+        messages_per_second * fixture.text.size() / 1e6,
+    });
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    uint32_t seed = 20221003;
+
+    BenchmarkHarness harness("core_bench_parser");
+    harness.add_option("--seed", "N", [&seed](const char* value)
+    {
+        seed = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        return true;
+    });
+    harness.set_columns({
+        { "fixture", "fixture", 24, 0, true },
+        { "mode", "mode", 8, 0, true },
+        { "bytes", "bytes", 10 },
+        { "pieces", "pieces", 10 },
+        { "iterations", nullptr, 0 },
+        { "seconds", nullptr, 0 },
+        { "messages_per_second", "msgs/s", 14, 0 },
+        { "mb_per_second", "MB/s", 12, 1 },
+    });
+
+    if (!harness.parse_args(argc, argv))
+    {
+        return 2;
+    }
+    harness.add_property("seed", seed);
+
+    std::mt19937 rng(seed);
+    bool ok = true;
+
+    for (const auto& fixture : make_corpus())
+    {
+        // Drawn for every fixture, filtered or not, so that a given seed
+        // always splits a given fixture the same way.
+        auto split_ends = make_split_points(fixture.text.size(), rng);
+
+        if (!harness.selected(fixture.name))
+        {
+            continue;
+        }
+
+        ok = run(fixture, "whole", { fixture.text.size() }, harness) && ok;
+        ok = run(fixture, "split", split_ends, harness) && ok;
+    }
+
+    harness.report();
+    return ok ? 0 : 1;
+}
@@ -17,18 +17,117 @@
 
 #include "HttpMessageParserTests.h"
 
+#include <list>
+#include <memory>
 #include <string>
 #include <sstream>
+#include <vector>
 
 #include <QString>
 #include <QtTest>
 
+#include "core/BodySink.h"
 #include "core/Headers.h"
 #include "core/HttpMessage.h"
 #include "core/HttpMessageParser.h"
 
 using namespace ama;
 
+namespace {
+
+// Summarizes everything a parse produced, so that two parses can be
+// compared with a single QCOMPARE.
+QString describe(const HttpMessage& message, HttpMessageParser::State state, size_t consumed)
+{
+    QString result;
+    QTextStream ts(&result);
+    ts << "state=" << static_cast<int>(state) << " consumed=" << consumed << "\n";
+    ts << "method=" << message.method() << " uri=" << message.uri() << "\n";
+    ts << "version=" << message.major_version() << "." << message.minor_version() << "\n";
+    ts << "status=" << message.status_code() << " " << message.status_message() << "\n";
+    for (const auto& name : message.headers().names())
+    {
+        ts << name << "=" << message.headers().find_by_name(name).join(QStringLiteral("|")) << "\n";
+    }
+    ts << "body=" << QString::fromLatin1(message.body().toHex()) << "\n";
+    return result;
+}
+
+// Parses one buffer at a time, as Transaction does, resuming after each
+// phase change.
+template <typename Container>
+QString parse_in_pieces(const std::string& text, bool response, size_t piece_size)
+{
+    HttpMessage message;
+    HttpMessageParser parser;
+    if (response)
+    {
+        parser.resetForResponse();
+    }
+    else
+    {
+        parser.resetForRequest();
+    }
+
+    auto state = HttpMessageParser::State::Incomplete;
+    size_t consumed = 0;
+    for (size_t offset = 0; offset < text.size() && state == HttpMessageParser::State::Incomplete; offset += piece_size)
+    {
+        Container piece(text.begin() + offset, text.begin() + std::min(offset + piece_size, text.size()));
+        auto begin = piece.begin();
+        auto end = piece.end();
+        auto phase = ParsePhase::Start;
+        do
+        {
+            state = parser.parse(message, begin, end, phase);
+        } while (state == HttpMessageParser::State::Incomplete && begin != end);
+        consumed = offset + static_cast<size_t>(std::distance(piece.begin(), begin));
+    }
+
+    return describe(message, state, consumed);
+}
+
+// Remembers everything a parser hands to its body sink.
+class RecordingSink : public BodySink
+{
+public:
+    void write(const char* data, size_t length) override
+    {
+        received.append(data, length);
+        ++writes;
+    }
+
+    void begin_chunk(uint64_t size) override
+    {
+        chunks.push_back(size);
+    }
+
+    void end() override
+    {
+        ended = true;
+    }
+
+    std::string received;
+    int writes = 0;
+    std::vector<uint64_t> chunks;
+    bool ended = false;
+};
+
+void verify_bulk_matches_bytewise(const std::string& text, bool response)
+{
+    // std::list iterators take the byte-at-a-time path; std::string and
+    // std::vector iterators take the bulk path.
+    auto expected = parse_in_pieces<std::list<char>>(text, response, text.size());
+    QCOMPARE(parse_in_pieces<std::string>(text, response, text.size()), expected);
+
+    for (size_t piece_size = 1; piece_size < 40 && piece_size < text.size(); ++piece_size)
+    {
+        QCOMPARE(parse_in_pieces<std::vector<unsigned char>>(text, response, piece_size), expected);
+    }
+}
+
+} // namespace
+
 HttpMessageParserTests::HttpMessageParserTests()
 {
 }
@@ -321,4 +420,345 @@ void HttpMessageParserTests::zero_prefixed_chunk_lengths()
     QCOMPARE(HttpMessageParser::State::Valid, state);
 }
 
+void HttpMessageParserTests::oversized_chunk_length_is_invalid()
+{
+    // Seventeen hex digits cannot fit in 64 bits; the leading zeroes that
+    // zero_prefixed_chunk_lengths() allows do not count.
+    std::string text =
+            "HTTP/1.1 200 OK\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "\r\n"
+            "0000ffffffffffffffff\r\n"
+            "aaaaa\r\n";
+
+    HttpMessage message;
+    HttpMessageParser parser;
+    parser.resetForResponse();
+
+    auto begin = text.begin();
+    QCOMPARE(HttpMessageParser::State::Incomplete, parser.parse(message, begin, text.end()));
+
+    std::string oversized =
+            "HTTP/1.1 200 OK\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "\r\n"
+            "1ffffffffffffffff\r\n"
+            "aaaaa\r\n";
+
+    HttpMessage other;
+    parser.resetForResponse();
+
+    begin = oversized.begin();
+    QCOMPARE(HttpMessageParser::State::Invalid, parser.parse(other, begin, oversized.end()));
+}
+
+void HttpMessageParserTests::chunk_extensions_are_ignored()
+{
+    std::string text =
+            "HTTP/1.1 200 OK\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "\r\n"
+            "5;name=value;flag\r\n"
+            "aaaaa\r\n"
+            "3;quoted=\"a;b\"\r\n"
+            "bbb\r\n"
+            "0;last\r\n"
+            "\r\n";
+
+    HttpMessage message;
+    HttpMessageParser parser;
+    parser.resetForResponse();
+
+    auto begin = text.begin();
+    QCOMPARE(HttpMessageParser::State::Valid, parser.parse(message, begin, text.end()));
+    QCOMPARE(QByteArray("aaaaabbb"), message.body());
+
+    // An extension still has to end with CRLF.
+    std::string bare =
+            "HTTP/1.1 200 OK\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "\r\n"
+            "5;name\n"
+            "aaaaa\r\n";
+
+    HttpMessage other;
+    parser.resetForResponse();
+
+    begin = bare.begin();
+    QCOMPARE(HttpMessageParser::State::Invalid, parser.parse(other, begin, bare.end()));
+}
+
+void HttpMessageParserTests::head_response_has_no_body()
+{
+    std::string text =
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Length: 1024\r\n"
+            "\r\n";
+
+    Request request;
+    request.set_method("HEAD");
+
+    HttpMessage message;
+    HttpMessageParser parser;
+    parser.resetForResponse(request);
+
+    auto begin = text.begin();
+    auto end = text.end();
+    auto state = parser.parse(message, begin, end);
+
+    QCOMPARE(HttpMessageParser::State::Valid, state);
+    QVERIFY(begin == end);
+    QCOMPARE(0, message.body().size());
+}
+
+void HttpMessageParserTests::no_content_response_has_no_body()
+{
+    std::string text =
+            "HTTP/1.1 204 No Content\r\n"
+            "\r\n"
+            "HTTP/1.1 200 OK\r\n";
+
+    HttpMessage message;
+    HttpMessageParser parser;
+    parser.resetForResponse();
+
+    auto begin = text.begin();
+    auto end = text.end();
+    auto state = parser.parse(message, begin, end);
+
+    QCOMPARE(HttpMessageParser::State::Valid, state);
+    QCOMPARE(std::string("HTTP/1.1 200 OK\r\n"), std::string(begin, end));
+}
+
+void HttpMessageParserTests::close_delimited_response()
+{
+    std::string text =
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: text/event-stream\r\n"
+            "\r\n"
+            "data: one\n\n"
+            "data: two\n\n";
+
+    HttpMessage message;
+    HttpMessageParser parser;
+    parser.resetForResponse();
+
+    QCOMPARE(HttpMessageParser::State::Invalid, parser.finish());
+
+    auto begin = text.begin();
+    auto end = text.end();
+    auto state = parser.parse(message, begin, end);
+
+    QCOMPARE(HttpMessageParser::State::Incomplete, state);
+    QCOMPARE(HttpMessageParser::State::Valid, parser.finish());
+    QCOMPARE(QByteArrayLiteral("data: one\n\ndata: two\n\n"), message.body());
+}
+
+void HttpMessageParserTests::bulk_parsing_matches_bytewise_parsing()
+{
+    verify_bulk_matches_bytewise(
+            "POST http://example.com/a/rather/long/path/to/something?with=a&query=string HTTP/1.1\r\n"
+            "Host: example.com\r\n"
+            "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:105.0) Gecko/20100101 Firefox/105.0\r\n"
+            "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,*/*;q=0.8\r\n"
+            "X-A-Very-Long-Header-Name-That-Spans-Several-Vector-Blocks: yes\r\n"
+            "Content-Length: 11\r\n"
+            "\r\n"
+            "hello world",
+            false);
+
+    verify_bulk_matches_bytewise(
+            "HTTP/1.1 404 Not Found, Nor Was It Ever Here To Begin With\r\n"
+            "Content-Type: text/plain; charset=utf-8\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "\r\n"
+            "5\r\nhello\r\n"
+            "0\r\n\r\n",
+            true);
+
+    // Malformed input has to fail in the same place, too.
+    verify_bulk_matches_bytewise("GET /path HTTP/1.1\r\nBad Header: value\r\n\r\n", false);
+    verify_bulk_matches_bytewise("GE{T / HTTP/1.1\r\n\r\n", false);
+    verify_bulk_matches_bytewise("HTTP/1.1 200 O\xe9\r\n\r\n", true);
+}
+
+void HttpMessageParserTests::bulk_parsing_matches_bytewise_parsing_for_every_byte()
+{
+    // Drop every possible byte into each of the places that the parser
+    // scans in bulk, padded out so that it falls inside a vector block.
+    const std::string pad(20, 'x');
+    for (int value = 0; value < 256; ++value)
+    {
+        std::string b(1, static_cast<char>(value));
+
+        verify_bulk_matches_bytewise("GE" + pad + b + pad + " / HTTP/1.1\r\n\r\n", false);
+        verify_bulk_matches_bytewise("GET /" + pad + b + pad + " HTTP/1.1\r\n\r\n", false);
+        verify_bulk_matches_bytewise("GET / HTTP/1.1\r\nX-" + pad + b + pad + ": v\r\n\r\n", false);
+        verify_bulk_matches_bytewise("GET / HTTP/1.1\r\nX: " + pad + b + pad + "\r\n\r\n", false);
+        verify_bulk_matches_bytewise("HTTP/1.1 200 O" + pad + b + pad + "\r\n\r\n", true);
+    }
+}
+
+void HttpMessageParserTests::bulk_parsing_matches_bytewise_parsing_for_bodies()
+{
+    std::string body;
+    for (int i = 0; i < 5000; ++i)
+    {
+        body.push_back(static_cast<char>(i * 7));
+    }
+
+    verify_bulk_matches_bytewise(
+            "PUT /upload HTTP/1.1\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n"
+            "\r\n" + body,
+            false);
+
+    verify_bulk_matches_bytewise(
+            "HTTP/1.1 200 OK\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "\r\n"
+            "7d0\r\n" + body.substr(0, 2000) + "\r\n"
+            "1\r\n" + body.substr(2000, 1) + "\r\n"
+            "bb7\r\n" + body.substr(2001) + "\r\n"
+            "0\r\n\r\n",
+            true);
+
+    verify_bulk_matches_bytewise("HTTP/1.1 200 OK\r\n\r\n" + body, true);
+
+    // A chunk that overruns its declared length is an error either way.
+    verify_bulk_matches_bytewise(
+            "HTTP/1.1 200 OK\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "\r\n"
+            "5\r\nabcdefg\r\n0\r\n\r\n",
+            true);
+}
+
+void HttpMessageParserTests::body_sink_receives_entity_in_runs()
+{
+    std::string body(4096, 'z');
+    std::string text =
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Length: 4096\r\n"
+            "\r\n" + body;
+
+    HttpMessage message;
+    HttpMessageParser parser;
+    parser.resetForResponse();
+
+    auto sink = std::make_shared<RecordingSink>();
+    parser.set_body_sink(sink);
+
+    const char* begin = text.data();
+    const char* end = begin + text.size();
+    ParsePhase phase = ParsePhase::Start;
+
+    auto state = parser.parse(message, begin, end, phase);
+    QCOMPARE(HttpMessageParser::State::Incomplete, state);
+    QCOMPARE(ParsePhase::ReceivedMessageLine, phase);
+
+    state = parser.parse(message, begin, end, phase);
+    QCOMPARE(HttpMessageParser::State::Incomplete, state);
+    QCOMPARE(ParsePhase::ReceivedHeaders, phase);
+
+    state = parser.parse(message, begin, end, phase);
+    QCOMPARE(HttpMessageParser::State::Valid, state);
+    QCOMPARE(ParsePhase::ReceivedFullMessage, phase);
+    QVERIFY(begin == end);
+
+    QVERIFY(sink->received == body);
+    QVERIFY(sink->writes <= 2);
+    QVERIFY(sink->ended);
+    QCOMPARE(0, message.body().size());
+
+    // Resetting the parser removes the sink.
+    HttpMessage next;
+    parser.resetForResponse();
+    begin = text.data();
+    state = parser.parse(next, begin, end);
+    QCOMPARE(HttpMessageParser::State::Valid, state);
+    QCOMPARE(4096, next.body().size());
+}
+
+void HttpMessageParserTests::body_sink_receives_chunks_and_trailers()
+{
+    std::string text =
+            "HTTP/1.1 200 OK\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "Trailer: Digest, Expires\r\n"
+            "\r\n"
+            "5\r\nhello\r\n"
+            "6\r\n world\r\n"
+            "0\r\n"
+            "Digest:  sha-256=abc\r\n"
+            "Expires:\r\n"
+            "\r\n";
+
+    HttpMessage message;
+    HttpMessageParser parser;
+    parser.resetForResponse();
+
+    auto sink = std::make_shared<RecordingSink>();
+    parser.set_body_sink(sink);
+
+    auto begin = text.begin();
+    auto end = text.end();
+    QCOMPARE(HttpMessageParser::State::Valid, parser.parse(message, begin, end));
+    QVERIFY(begin == end);
+
+    QVERIFY(sink->received == "hello world");
+    QVERIFY(sink->chunks == (std::vector<uint64_t>{5, 6, 0}));
+    QCOMPARE(size_t{2}, sink->trailers().size());
+    QCOMPARE(QByteArray("Digest"), sink->trailers()[0].first);
+    QCOMPARE(QByteArray("sha-256=abc"), sink->trailers()[0].second);
+    QCOMPARE(QByteArray("Expires"), sink->trailers()[1].first);
+    QCOMPARE(QByteArray(), sink->trailers()[1].second);
+    QVERIFY(sink->ended);
+}
+
+void HttpMessageParserTests::trailers_are_parsed_without_a_sink()
+{
+    verify_bulk_matches_bytewise(
+            "HTTP/1.1 200 OK\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "\r\n"
+            "3\r\nabc\r\n"
+            "0\r\n"
+            "X-Checksum: 1234\r\n"
+            "\r\n",
+            true);
+
+    std::string text =
+            "PUT / HTTP/1.1\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "\r\n"
+            "3\r\nabc\r\n"
+            "0\r\n"
+            "X-Checksum: 1234\r\n"
+            "\r\n";
+
+    HttpMessage message;
+    HttpMessageParser parser;
+    parser.resetForRequest();
+
+    auto begin = text.begin();
+    auto end = text.end();
+    QCOMPARE(HttpMessageParser::State::Valid, parser.parse(message, begin, end));
+    QCOMPARE(QByteArrayLiteral("abc"), message.body());
+    QVERIFY(message.headers().find_by_name("X-Checksum").isEmpty());
+
+    // A trailer without a name is malformed.
+    std::string malformed =
+            "PUT / HTTP/1.1\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "\r\n"
+            "0\r\n"
+            ": 1234\r\n"
+            "\r\n";
+    parser.resetForRequest();
+    HttpMessage other;
+    auto mbegin = malformed.begin();
+    QCOMPARE(HttpMessageParser::State::Invalid, parser.parse(other, mbegin, malformed.end()));
+}
+
 QTEST_GUILESS_MAIN(HttpMessageParserTests)
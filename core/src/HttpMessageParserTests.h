@@ -39,4 +39,18 @@ private Q_SLOTS:
     void pauses_on_phase_transitions();
 
     void zero_prefixed_chunk_lengths();
+    void oversized_chunk_length_is_invalid();
+    void chunk_extensions_are_ignored();
+
+    void head_response_has_no_body();
+    void no_content_response_has_no_body();
+    void close_delimited_response();
+
+    void bulk_parsing_matches_bytewise_parsing();
+    void bulk_parsing_matches_bytewise_parsing_for_every_byte();
+    void bulk_parsing_matches_bytewise_parsing_for_bodies();
+
+    void body_sink_receives_entity_in_runs();
+    void body_sink_receives_chunks_and_trailers();
+    void trailers_are_parsed_without_a_sink();
 };
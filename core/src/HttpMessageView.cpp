@@ -0,0 +1,461 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "core/HttpMessageView.h"
+
+#include <string_view>
+
+#include <algorithm>
+
+namespace ama {
+
+namespace {
+
+// Enough for the headers of nearly every real message, so that a view
+// that is reused doesn't allocate while parsing.
+constexpr size_t kExpectedHeaderCount = 32;
+
+char to_lower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+bool equals_ignoring_case(QByteArrayView lhs, QByteArrayView rhs)
+{
+    if (lhs.size() != rhs.size())
+    {
+        return false;
+    }
+
+    for (qsizetype i = 0; i < lhs.size(); ++i)
+    {
+        if (to_lower(lhs[i]) != to_lower(rhs[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+QByteArrayView trimmed(QByteArrayView view)
+{
+    while (!view.isEmpty() && (view.front() == ' ' || view.front() == '\t'))
+    {
+        view = view.sliced(1);
+    }
+    while (!view.isEmpty() && (view.back() == ' ' || view.back() == '\t'))
+    {
+        view.chop(1);
+    }
+    return view;
+}
+
+// Whether @p token is one of the comma-separated items of @p value.
+bool has_token(QByteArrayView value, QByteArrayView token)
+{
+    QByteArrayView rest = value;
+    while (!rest.isEmpty())
+    {
+        auto comma = rest.indexOf(',');
+        auto item = comma == -1 ? rest : rest.first(comma);
+        if (equals_ignoring_case(trimmed(item), token))
+        {
+            return true;
+        }
+        rest = comma == -1 ? QByteArrayView() : rest.sliced(comma + 1);
+    }
+    return false;
+}
+
+std::string_view bytes_of(QByteArrayView view)
+{
+    return std::string_view(view.data(), static_cast<size_t>(view.size()));
+}
+
+} // namespace
+
+HttpMessageView::HttpMessageView(std::pmr::memory_resource* resource)
+    : buffer_()
+    , size_(0)
+    , parsed_(0)
+    , method_{0, 0}
+    , uri_{0, 0}
+    , reason_phrase_{0, 0}
+    , status_code_(0)
+    , major_version_(0)
+    , minor_version_(0)
+    , fields_(resource)
+    , head_end_(0)
+    , pending_field_{{0, 0}, {0, 0}, KnownHeader::Unknown, false}
+    , body_(resource)
+    , body_size_(0)
+{
+    fields_.reserve(kExpectedHeaderCount);
+}
+
+void HttpMessageView::clear()
+{
+    size_ = 0;
+    parsed_ = 0;
+    next_message();
+}
+
+void HttpMessageView::next_message()
+{
+    // The message's bytes stay where they are; the next message's offsets
+    // simply start after them.
+    method_ = {0, 0};
+    uri_ = {0, 0};
+    reason_phrase_ = {0, 0};
+    status_code_ = 0;
+    major_version_ = 0;
+    minor_version_ = 0;
+    fields_.clear();
+    head_end_ = 0;
+    pending_field_ = {{0, 0}, {0, 0}, KnownHeader::Unknown, false};
+    body_.clear();
+    body_size_ = 0;
+}
+
+QByteArrayView HttpMessageView::prepare(qsizetype size)
+{
+    if (buffer_.size() - size_ < size)
+    {
+        buffer_.resize(std::max(size_ + size, buffer_.size() * 2));
+    }
+
+    // data() detaches the buffer if a body segment still shares it.
+    return QByteArrayView(buffer_.data() + size_, buffer_.size() - size_);
+}
+
+void HttpMessageView::commit(qsizetype size)
+{
+    size_ = std::min(size_ + size, buffer_.size());
+}
+
+QByteArrayView HttpMessageView::data() const
+{
+    return QByteArrayView(buffer_.constData(), size_);
+}
+
+qsizetype HttpMessageView::parsed_size() const
+{
+    return parsed_;
+}
+
+QByteArrayView HttpMessageView::unparsed() const
+{
+    return data().sliced(parsed_);
+}
+
+QByteArrayView HttpMessageView::method() const
+{
+    return view_of(method_);
+}
+
+QByteArrayView HttpMessageView::uri() const
+{
+    return view_of(uri_);
+}
+
+int HttpMessageView::status_code() const
+{
+    return status_code_;
+}
+
+QByteArrayView HttpMessageView::reason_phrase() const
+{
+    return view_of(reason_phrase_);
+}
+
+int HttpMessageView::major_version() const
+{
+    return major_version_;
+}
+
+int HttpMessageView::minor_version() const
+{
+    return minor_version_;
+}
+
+qsizetype HttpMessageView::header_count() const
+{
+    return static_cast<qsizetype>(fields_.size());
+}
+
+QByteArrayView HttpMessageView::header_name(qsizetype index) const
+{
+    return view_of(fields_[static_cast<size_t>(index)].name);
+}
+
+QByteArrayView HttpMessageView::header_value(qsizetype index) const
+{
+    return view_of(fields_[static_cast<size_t>(index)].value);
+}
+
+QByteArrayView HttpMessageView::header(QByteArrayView name) const
+{
+    auto id = known_header(name);
+    if (id != KnownHeader::Unknown)
+    {
+        return header(id);
+    }
+
+    for (const auto& field : fields_)
+    {
+        if (!field.removed && equals_ignoring_case(view_of(field.name), name))
+        {
+            return view_of(field.value);
+        }
+    }
+    return QByteArrayView();
+}
+
+QByteArrayView HttpMessageView::header(KnownHeader header) const
+{
+    for (const auto& field : fields_)
+    {
+        if (!field.removed && field.id == header)
+        {
+            return view_of(field.value);
+        }
+    }
+    return QByteArrayView();
+}
+
+bool HttpMessageView::header_has_token(QByteArrayView name, QByteArrayView token) const
+{
+    auto id = known_header(name);
+    if (id != KnownHeader::Unknown)
+    {
+        return header_has_token(id, token);
+    }
+
+    for (const auto& field : fields_)
+    {
+        if (!field.removed && equals_ignoring_case(view_of(field.name), name) && has_token(view_of(field.value), token))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HttpMessageView::header_has_token(KnownHeader header, QByteArrayView token) const
+{
+    for (const auto& field : fields_)
+    {
+        if (!field.removed && field.id == header && has_token(view_of(field.value), token))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void HttpMessageView::remove_header(QByteArrayView name)
+{
+    auto id = known_header(name);
+    if (id != KnownHeader::Unknown)
+    {
+        remove_header(id);
+        return;
+    }
+
+    for (auto& field : fields_)
+    {
+        if (equals_ignoring_case(view_of(field.name), name))
+        {
+            field.removed = true;
+        }
+    }
+}
+
+void HttpMessageView::remove_header(KnownHeader header)
+{
+    for (auto& field : fields_)
+    {
+        if (field.id == header)
+        {
+            field.removed = true;
+        }
+    }
+}
+
+void HttpMessageView::append_body(const QByteArray& buffer, qsizetype offset, qsizetype length)
+{
+    if (length <= 0)
+    {
+        return;
+    }
+
+    // Runs that continue the previous segment, as fixed-length bodies
+    // parsed a byte at a time do, are merged into it.
+    if (!body_.empty())
+    {
+        auto& last = body_.back();
+        if (last.buffer.constData() == buffer.constData() && last.offset + last.length == offset)
+        {
+            last.length += length;
+            body_size_ += length;
+            return;
+        }
+    }
+
+    body_.push_back({buffer, offset, length});
+    body_size_ += length;
+}
+
+qsizetype HttpMessageView::body_size() const
+{
+    return body_size_;
+}
+
+QByteArray HttpMessageView::format_request_head() const
+{
+    QByteArray result;
+    if (head_end_ != 0)
+    {
+        result.reserve(head_end_ - method_.offset);
+    }
+
+    for (const auto& segment : request_head_segments())
+    {
+        result.append(segment);
+    }
+    return result;
+}
+
+std::vector<QByteArrayView> HttpMessageView::request_head_segments() const
+{
+    std::vector<QByteArrayView> segments;
+    if (head_end_ == 0)
+    {
+        return segments;
+    }
+
+    // A header's line runs from its name to the next header's name, or to
+    // the blank line.  Continuation lines are parsed as fields without a
+    // name; they stay with the header before them.
+    const qsizetype head_begin = method_.offset;
+    const qsizetype blank_line = head_end_ - 2;
+
+    // Runs of bytes to keep are taken whole, so a head with nothing to
+    // drop is a single segment.
+    qsizetype keep_from = head_begin;
+    for (size_t i = 0; i < fields_.size(); ++i)
+    {
+        const auto& field = fields_[i];
+        if (field.name.length == 0 || (!field.removed && !is_hop_by_hop(field)))
+        {
+            continue;
+        }
+
+        qsizetype line_end = blank_line;
+        for (size_t j = i + 1; j < fields_.size(); ++j)
+        {
+            if (fields_[j].name.length != 0)
+            {
+                line_end = fields_[j].name.offset;
+                break;
+            }
+        }
+
+        if (field.name.offset > keep_from)
+        {
+            segments.emplace_back(buffer_.constData() + keep_from, field.name.offset - keep_from);
+        }
+        keep_from = line_end;
+    }
+    segments.emplace_back(buffer_.constData() + keep_from, head_end_ - keep_from);
+
+    return segments;
+}
+
+HttpMessage HttpMessageView::materialize() const
+{
+    HttpMessage message;
+    message.set_method(bytes_of(method()));
+    message.set_uri(bytes_of(uri()));
+    message.set_major_version(major_version_);
+    message.set_minor_version(minor_version_);
+    message.set_status_code(status_code_);
+    message.set_status_message(bytes_of(reason_phrase()));
+
+    for (const auto& field : fields_)
+    {
+        if (field.removed)
+        {
+            continue;
+        }
+
+        auto value = bytes_of(view_of(field.value));
+        if (field.id != KnownHeader::Unknown)
+        {
+            message.headers().insert(field.id, value);
+        }
+        else
+        {
+            message.add_header(bytes_of(view_of(field.name)), value);
+        }
+    }
+
+    if (!body_.empty())
+    {
+        QByteArray body;
+        body.reserve(body_size_);
+        for (const auto& segment : body_)
+        {
+            body.append(segment.buffer.constData() + segment.offset, segment.length);
+        }
+        message.set_body(std::move(body));
+    }
+
+    return message;
+}
+
+QByteArrayView HttpMessageView::view_of(Span span) const
+{
+    return QByteArrayView(buffer_.constData() + span.offset, span.length);
+}
+
+bool HttpMessageView::is_hop_by_hop(const Field& field) const
+{
+    switch (field.id)
+    {
+    case KnownHeader::Connection:
+    case KnownHeader::KeepAlive:
+    case KnownHeader::ProxyConnection:
+    case KnownHeader::Te:
+    case KnownHeader::Upgrade:
+        return true;
+
+    case KnownHeader::Host:
+    case KnownHeader::ContentLength:
+    case KnownHeader::TransferEncoding:
+        // The body is relayed exactly as it arrived, so whatever frames it
+        // goes along, whatever Connection says.
+        return false;
+
+    default:
+        // RFC 7230 § 6.1: a proxy removes every field that Connection names.
+        return header_has_token(KnownHeader::Connection, view_of(field.name));
+    }
+}
+
+} // namespace ama
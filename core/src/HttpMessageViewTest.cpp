@@ -0,0 +1,390 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "HttpMessageViewTest.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include <QByteArray>
+#include <QString>
+#include <QtTest>
+
+#include "core/HttpMessage.h"
+#include "core/HttpMessageParser.h"
+#include "core/HttpMessageView.h"
+
+using namespace ama;
+
+namespace {
+
+QString describe(const HttpMessage& message, HttpMessageParser::State state)
+{
+    QString result;
+    QTextStream ts(&result);
+    ts << "state=" << static_cast<int>(state) << "\n";
+    ts << "method=" << message.method() << " uri=" << message.uri() << "\n";
+    ts << "version=" << message.major_version() << "." << message.minor_version() << "\n";
+    ts << "status=" << message.status_code() << " " << message.status_message() << "\n";
+    for (const auto& name : message.headers().names())
+    {
+        ts << name << "=" << message.headers().find_by_name(name).join(QStringLiteral("|")) << "\n";
+    }
+    ts << "body=" << QString::fromLatin1(message.body().toHex()) << "\n";
+    return result;
+}
+
+QString parse_message(const std::string& text, bool response)
+{
+    HttpMessage message;
+    HttpMessageParser parser;
+    if (response)
+    {
+        parser.resetForResponse();
+    }
+    else
+    {
+        parser.resetForRequest();
+    }
+
+    auto begin = text.begin();
+    auto end = text.end();
+    auto state = parser.parse(message, begin, end);
+    if (state == HttpMessageParser::State::Incomplete)
+    {
+        state = parser.finish();
+    }
+    return describe(message, state);
+}
+
+// Parses as Transaction does: the head is read into the view, and once the
+// headers are in, the body arrives in buffers of its own.
+QString parse_view(const std::string& text, bool response, size_t piece_size)
+{
+    HttpMessageView view;
+    HttpMessageParser parser;
+    if (response)
+    {
+        parser.resetForResponse();
+    }
+    else
+    {
+        parser.resetForRequest();
+    }
+
+    auto phase = ParsePhase::Start;
+    auto state = HttpMessageParser::State::Incomplete;
+    for (size_t offset = 0; offset < text.size() && state == HttpMessageParser::State::Incomplete; offset += piece_size)
+    {
+        auto length = static_cast<qsizetype>(std::min(piece_size, text.size() - offset));
+        if (phase < ParsePhase::ReceivedHeaders)
+        {
+            auto buffer = view.prepare(length);
+            std::memcpy(const_cast<char*>(buffer.data()), text.data() + offset, static_cast<size_t>(length));
+            view.commit(length);
+            do
+            {
+                state = parser.parse(view, phase);
+            } while (state == HttpMessageParser::State::Incomplete && view.parsed_size() != view.data().size());
+        }
+        else
+        {
+            QByteArray buffer(text.data() + offset, length);
+            qsizetype parsed = 0;
+            do
+            {
+                state = parser.parse(view, buffer, parsed, length, phase);
+            } while (state == HttpMessageParser::State::Incomplete && parsed != length);
+        }
+    }
+
+    if (state == HttpMessageParser::State::Incomplete)
+    {
+        state = parser.finish();
+    }
+    return describe(view.materialize(), state);
+}
+
+HttpMessageView parse_request_view(const std::string& text)
+{
+    HttpMessageView view;
+    auto buffer = view.prepare(static_cast<qsizetype>(text.size()));
+    std::memcpy(const_cast<char*>(buffer.data()), text.data(), text.size());
+    view.commit(static_cast<qsizetype>(text.size()));
+
+    HttpMessageParser parser;
+    parser.resetForRequest();
+
+    auto phase = ParsePhase::Start;
+    while (parser.parse(view, phase) == HttpMessageParser::State::Incomplete && view.parsed_size() != view.data().size())
+    {
+    }
+    return view;
+}
+
+} // namespace
+
+void HttpMessageViewTest::materializes_like_http_message()
+{
+    const std::pair<std::string, bool> corpus[] = {
+        {"GET /path?q=1 HTTP/1.1\r\nHost: example.com\r\nAccept: */*\r\nAccept: text/html\r\n\r\n", false},
+        {"POST /upload HTTP/1.1\r\nHost: example.com\r\nContent-Length: 11\r\n\r\nhello world", false},
+        {"PUT / HTTP/1.1\r\nHost: a\r\nTransfer-Encoding: gzip, chunked\r\n\r\n5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n", false},
+        {"HTTP/1.1 200 OK\r\nContent-Length: 4\r\nContent-Length: 3\r\n\r\nabc", true},
+        {"HTTP/1.1 404 Not Found\r\nServer: test\r\nContent-Length: 0\r\n\r\n", true},
+        {"HTTP/1.0 200 Fine\r\nX-Thing:  spaced out  \r\n\r\nuntil the connection closes", true},
+        {"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n1a\r\nabcdefghijklmnopqrstuvwxyz\r\n0\r\n\r\n", true},
+        {"HTTP/1.1 200 OK\r\nContent-Length: nope\r\n\r\n", true},
+        {"GET / HTTP/1.1\r\nBad Header: value\r\n\r\n", false},
+    };
+
+    for (const auto& [text, response] : corpus)
+    {
+        auto expected = parse_message(text, response);
+        for (size_t piece_size = 1; piece_size <= text.size(); ++piece_size)
+        {
+            QCOMPARE(parse_view(text, response, piece_size), expected);
+        }
+    }
+}
+
+void HttpMessageViewTest::finds_headers_ignoring_case()
+{
+    auto view = parse_request_view(
+                "GET / HTTP/1.1\r\n"
+                "Host: example.com\r\n"
+                "X-Thing: one\r\n"
+                "x-thing: two\r\n"
+                "\r\n");
+
+    QCOMPARE(view.method(), QByteArrayView("GET"));
+    QCOMPARE(view.uri(), QByteArrayView("/"));
+    QCOMPARE(view.header_count(), qsizetype{3});
+    QCOMPARE(view.header("host"), QByteArrayView("example.com"));
+    QCOMPARE(view.header("X-THING"), QByteArrayView("one"));
+    QVERIFY(view.header("Content-Length").isNull());
+}
+
+void HttpMessageViewTest::matches_tokens_in_lists()
+{
+    auto view = parse_request_view(
+                "GET / HTTP/1.1\r\n"
+                "Connection: Upgrade\r\n"
+                "Connection: keep-alive , Close\r\n"
+                "\r\n");
+
+    QVERIFY(view.header_has_token("connection", "upgrade"));
+    QVERIFY(view.header_has_token("Connection", "close"));
+    QVERIFY(view.header_has_token("Connection", "keep-alive"));
+    QVERIFY(!view.header_has_token("Connection", "keep"));
+    QVERIFY(!view.header_has_token("Upgrade", "close"));
+}
+
+void HttpMessageViewTest::formats_request_head()
+{
+    auto view = parse_request_view(
+                "POST /submit HTTP/1.1\r\n"
+                "Host: example.com\r\n"
+                "Content-Length: 3\r\n"
+                "\r\n"
+                "abc");
+
+    QCOMPARE(view.format_request_head(), QByteArray(
+                "POST /submit HTTP/1.1\r\n"
+                "Host: example.com\r\n"
+                "Content-Length: 3\r\n"
+                "\r\n"));
+    QCOMPARE(view.body_size(), qsizetype{3});
+}
+
+void HttpMessageViewTest::omits_removed_headers()
+{
+    auto view = parse_request_view(
+                "PUT /file HTTP/1.1\r\n"
+                "Host: example.com\r\n"
+                "Expect: 100-continue\r\n"
+                "Content-Length: 0\r\n"
+                "\r\n");
+
+    view.remove_header("expect");
+
+    QVERIFY(view.header("Expect").isNull());
+    QCOMPARE(view.format_request_head(), QByteArray(
+                "PUT /file HTTP/1.1\r\n"
+                "Host: example.com\r\n"
+                "Content-Length: 0\r\n"
+                "\r\n"));
+    QVERIFY(view.materialize().headers().find_by_name("Expect").isEmpty());
+}
+
+void HttpMessageViewTest::forwards_head_byte_for_byte()
+{
+    const std::string head =
+            "GET http://example.com/a%20b?x=1 HTTP/1.1\r\n"
+            "hOsT: example.com\r\n"
+            "Cookie: a=1\r\n"
+            "X-Weird-CASING: Keeps  its  spacing \r\n"
+            "cookie: b=2\r\n"
+            "\r\n";
+    auto view = parse_request_view(head + "GET /next HTTP/1.1\r\n");
+
+    QCOMPARE(view.format_request_head(), QByteArray(head.data(), static_cast<qsizetype>(head.size())));
+}
+
+void HttpMessageViewTest::strips_hop_by_hop_headers()
+{
+    auto view = parse_request_view(
+                "POST /form HTTP/1.1\r\n"
+                "Host: example.com\r\n"
+                "Connection: keep-alive, X-Secret, Content-Length\r\n"
+                "Keep-Alive: timeout=5\r\n"
+                "X-Secret: 1\r\n"
+                "Proxy-Connection: keep-alive\r\n"
+                "TE: trailers\r\n"
+                "Upgrade: websocket\r\n"
+                "Content-Length: 2\r\n"
+                "X-Kept: yes\r\n"
+                "\r\n"
+                "ok");
+
+    QCOMPARE(view.format_request_head(), QByteArray(
+                "POST /form HTTP/1.1\r\n"
+                "Host: example.com\r\n"
+                "Content-Length: 2\r\n"
+                "X-Kept: yes\r\n"
+                "\r\n"));
+
+    // They are only left out of what goes upstream.
+    QVERIFY(view.header_has_token(KnownHeader::Connection, "keep-alive"));
+    QCOMPARE(view.header("X-Secret"), QByteArrayView("1"));
+}
+
+void HttpMessageViewTest::strips_continuation_lines_with_their_header()
+{
+    auto view = parse_request_view(
+                "GET / HTTP/1.1\r\n"
+                "Keep-Alive: timeout=5,\r\n"
+                "  max=100\r\n"
+                "X-Folded: a,\r\n"
+                "\tb\r\n"
+                "Host: example.com\r\n"
+                "\r\n");
+
+    QCOMPARE(view.format_request_head(), QByteArray(
+                "GET / HTTP/1.1\r\n"
+                "X-Folded: a,\r\n"
+                "\tb\r\n"
+                "Host: example.com\r\n"
+                "\r\n"));
+}
+
+void HttpMessageViewTest::segments_head_without_copying()
+{
+    auto view = parse_request_view(
+                "GET / HTTP/1.1\r\n"
+                "Host: example.com\r\n"
+                "Connection: keep-alive\r\n"
+                "Accept: */*\r\n"
+                "\r\n");
+
+    auto segments = view.request_head_segments();
+    QCOMPARE(segments.size(), size_t{2});
+    QCOMPARE(segments[0], QByteArrayView("GET / HTTP/1.1\r\nHost: example.com\r\n"));
+    QCOMPARE(segments[1], QByteArrayView("Accept: */*\r\n\r\n"));
+
+    // Both are views of the bytes as they were received.
+    QCOMPARE(segments[0].data(), view.data().data());
+    QCOMPARE(segments[1].data(), segments[0].data() + segments[0].size() + qstrlen("Connection: keep-alive\r\n"));
+
+    QByteArray joined;
+    for (const auto& segment : segments)
+    {
+        joined.append(segment);
+    }
+    QCOMPARE(joined, view.format_request_head());
+}
+
+void HttpMessageViewTest::keeps_bytes_after_message()
+{
+    HttpMessageView view;
+    std::string text =
+            "HTTP/1.1 100 Continue\r\n"
+            "\r\n"
+            "HTTP/1.1 201 Created\r\n"
+            "Content-Length: 2\r\n"
+            "\r\n"
+            "ok";
+    auto buffer = view.prepare(static_cast<qsizetype>(text.size()));
+    std::memcpy(const_cast<char*>(buffer.data()), text.data(), text.size());
+    view.commit(static_cast<qsizetype>(text.size()));
+
+    HttpMessageParser parser;
+    parser.resetForResponse();
+
+    auto phase = ParsePhase::Start;
+    auto state = parser.parse(view, phase);
+    while (state == HttpMessageParser::State::Incomplete)
+    {
+        state = parser.parse(view, phase);
+    }
+    QCOMPARE(state, HttpMessageParser::State::Valid);
+    QCOMPARE(view.status_code(), 100);
+
+    view.next_message();
+    parser.resetForResponse();
+    phase = ParsePhase::Start;
+    state = parser.parse(view, phase);
+    while (state == HttpMessageParser::State::Incomplete)
+    {
+        state = parser.parse(view, phase);
+    }
+
+    QCOMPARE(state, HttpMessageParser::State::Valid);
+    QCOMPARE(view.status_code(), 201);
+    QCOMPARE(view.reason_phrase(), QByteArrayView("Created"));
+    QCOMPARE(view.header_count(), qsizetype{1});
+    QCOMPARE(view.materialize().body(), QByteArray("ok"));
+    QCOMPARE(view.parsed_size(), view.data().size());
+}
+
+void HttpMessageViewTest::leaves_pipelined_request_unparsed()
+{
+    std::string first =
+            "POST /one HTTP/1.1\r\n"
+            "Host: example.com\r\n"
+            "Content-Length: 3\r\n"
+            "\r\n"
+            "abc";
+    std::string second =
+            "GET /two HTTP/1.1\r\n"
+            "Host: example.com\r\n"
+            "\r\n";
+
+    auto view = parse_request_view(first + second);
+    QCOMPARE(view.uri(), QByteArrayView("/one"));
+    QCOMPARE(view.materialize().body(), QByteArray("abc"));
+    QCOMPARE(view.unparsed(), QByteArrayView(second.data(), static_cast<qsizetype>(second.size())));
+
+    // What is left over parses as a request of its own.
+    auto next = parse_request_view(std::string(view.unparsed().data(), static_cast<size_t>(view.unparsed().size())));
+    QCOMPARE(next.method(), QByteArrayView("GET"));
+    QCOMPARE(next.uri(), QByteArrayView("/two"));
+    QVERIFY(next.unparsed().isEmpty());
+}
+
+QTEST_GUILESS_MAIN(HttpMessageViewTest)
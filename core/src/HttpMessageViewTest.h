@@ -0,0 +1,41 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <QObject>
+
+class HttpMessageViewTest : public QObject
+{
+    Q_OBJECT
+
+public:
+    HttpMessageViewTest() = default;
+
+private Q_SLOTS:
+    void materializes_like_http_message();
+    void finds_headers_ignoring_case();
+    void matches_tokens_in_lists();
+    void formats_request_head();
+    void omits_removed_headers();
+    void forwards_head_byte_for_byte();
+    void strips_hop_by_hop_headers();
+    void strips_continuation_lines_with_their_header();
+    void segments_head_without_copying();
+    void keeps_bytes_after_message();
+    void leaves_pipelined_request_unparsed();
+};
@@ -0,0 +1,162 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "InplaceFunctionTest.h"
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <system_error>
+
+#include <QtTest>
+
+#include "core/InplaceFunction.h"
+
+using namespace ama;
+
+namespace {
+
+using Callback = InplaceFunction<void(std::error_code, std::size_t)>;
+
+// Counts how many of its copies are alive, to catch leaks and double
+// destruction alike.
+struct Tracked
+{
+    explicit Tracked(int* live)
+        : live_(live)
+    {
+        ++*live_;
+    }
+
+    Tracked(Tracked&& other) noexcept
+        : live_(other.live_)
+    {
+        ++*live_;
+    }
+
+    ~Tracked()
+    {
+        --*live_;
+    }
+
+    int* live_;
+};
+
+} // namespace
+
+void InplaceFunctionTest::empty_by_default()
+{
+    Callback callback;
+    QVERIFY(!callback);
+
+    Callback null = nullptr;
+    QVERIFY(!null);
+}
+
+void InplaceFunctionTest::calls_small_target_inline()
+{
+    std::size_t seen = 0;
+    auto target = [&seen](std::error_code ec, std::size_t n) { seen = ec ? 0 : n; };
+    QVERIFY(Callback::stores_inline<decltype(target)>());
+
+    Callback callback = target;
+    QVERIFY(static_cast<bool>(callback));
+
+    callback({}, 42);
+    QCOMPARE(seen, std::size_t{42});
+}
+
+void InplaceFunctionTest::calls_large_target_on_heap()
+{
+    std::array<std::size_t, 32> padding{};
+    padding[31] = 7;
+
+    std::size_t seen = 0;
+    auto target = [&seen, padding](std::error_code, std::size_t n) { seen = n + padding[31]; };
+    QVERIFY(!Callback::stores_inline<decltype(target)>());
+
+    Callback callback = target;
+    callback({}, 1);
+    QCOMPARE(seen, std::size_t{8});
+}
+
+void InplaceFunctionTest::holds_move_only_targets()
+{
+    auto value = std::make_unique<int>(5);
+    int seen = 0;
+
+    InplaceFunction<void()> callback = [&seen, value = std::move(value)]() { seen = *value; };
+    callback();
+    QCOMPARE(seen, 5);
+}
+
+void InplaceFunctionTest::move_transfers_target()
+{
+    int calls = 0;
+    Callback first = [&calls](std::error_code, std::size_t) { ++calls; };
+
+    Callback second = std::move(first);
+    QVERIFY(!first);
+    QVERIFY(static_cast<bool>(second));
+
+    Callback third;
+    third = std::move(second);
+    QVERIFY(!second);
+
+    third({}, 0);
+    QCOMPARE(calls, 1);
+
+    third = nullptr;
+    QVERIFY(!third);
+}
+
+void InplaceFunctionTest::destroys_target_once()
+{
+    int live = 0;
+    {
+        InplaceFunction<void()> small = [tracked = Tracked(&live)]() {};
+        InplaceFunction<void()> moved = std::move(small);
+        QCOMPARE(live, 1);
+
+        std::array<char, 128> padding{};
+        InplaceFunction<void()> large = [tracked = Tracked(&live), padding]() { (void) padding; };
+        InplaceFunction<void()> moved_large = std::move(large);
+        QCOMPARE(live, 2);
+
+        moved = std::move(moved_large);
+        QCOMPARE(live, 1);
+    }
+    QCOMPARE(live, 0);
+}
+
+void InplaceFunctionTest::calling_empty_throws()
+{
+    Callback callback;
+
+    bool thrown = false;
+    try
+    {
+        callback({}, 0);
+    }
+    catch (const std::bad_function_call&)
+    {
+        thrown = true;
+    }
+    QVERIFY(thrown);
+}
+
+QTEST_GUILESS_MAIN(InplaceFunctionTest)
@@ -0,0 +1,37 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <QObject>
+
+class InplaceFunctionTest : public QObject
+{
+    Q_OBJECT
+
+public:
+    InplaceFunctionTest() = default;
+
+private Q_SLOTS:
+    void empty_by_default();
+    void calls_small_target_inline();
+    void calls_large_target_on_heap();
+    void holds_move_only_targets();
+    void move_transfers_target();
+    void destroys_target_once();
+    void calling_empty_throws();
+};
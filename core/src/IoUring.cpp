@@ -0,0 +1,2063 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "IoUring.h"
+
+#include "AsioConnection.h"
+#include "log/Log.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+// Multishot receive is the newest thing used here; headers that have it
+// have everything else too.
+#if defined(IORING_RECV_MULTISHOT)
+#define AMA_HAS_IO_URING 1
+#else
+#define AMA_HAS_IO_URING 0
+#endif
+
+#if AMA_HAS_IO_URING
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace ama {
+
+#if AMA_HAS_IO_URING
+
+namespace {
+
+// Enough room for every operation started by one run of handlers to go to
+// the kernel in a single batch; completions get four times the room, and
+// the kernel holds on to any that overflow even that.
+constexpr unsigned kQueueDepth = 4096;
+
+// Receives land in buffers of this size, drawn from one ring that every
+// socket shares.  The count must be a power of two.
+constexpr uint16_t kBufferGroup = 0;
+constexpr uint32_t kBufferSize = 16 * 1024;
+constexpr uint16_t kBufferCount = 512;
+
+// A socket that has this much received and unread stops receiving until
+// it is read, so that one slow reader can't take every buffer.
+constexpr size_t kMaxBufferedPerSocket = 4 * kBufferSize;
+
+int io_uring_setup(unsigned entries, io_uring_params* params)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+unsigned load_acquire(const unsigned* p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+void store_release(unsigned* p, unsigned value)
+{
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+std::error_code errno_code(int error)
+{
+    return std::error_code(error, std::system_category());
+}
+
+// What a failed operation reports: cancellation as asio reports it, so
+// that callers can tell it from a failure of the connection.
+std::error_code result_code(int result)
+{
+    if (result == -ECANCELED)
+    {
+        return asio::error::operation_aborted;
+    }
+    return errno_code(-result);
+}
+
+/**
+ * @brief Something that the kernel has been asked to do.
+ */
+class Operation
+{
+public:
+    /**
+     * @brief Called from the reaping thread with each completion; a
+     *        multishot operation's last one lacks IORING_CQE_F_MORE.
+     */
+    virtual void complete(int result, uint32_t flags) = 0;
+
+    /**
+     * @brief Called instead, from the submitting thread, when the ring has
+     *        shut down and the operation will never start.
+     */
+    virtual void abandon()
+    {}
+
+protected:
+    ~Operation() = default;
+};
+
+/**
+ * @brief An operation whose completions go to a member of @p Owner, which
+ *        it keeps alive until the last of them.
+ */
+template <typename Owner, void (Owner::*Complete)(int, uint32_t)>
+class MemberOperation final : public Operation
+{
+public:
+    explicit MemberOperation(Owner& owner)
+        : owner_(owner)
+    {}
+
+    void hold(std::shared_ptr<Owner> owner)
+    {
+        keep_alive_ = std::move(owner);
+    }
+
+    std::shared_ptr<Owner> release()
+    {
+        return std::move(keep_alive_);
+    }
+
+    void complete(int result, uint32_t flags) override
+    {
+        (owner_.*Complete)(result, flags);
+    }
+
+    void abandon() override
+    {
+        keep_alive_.reset();
+    }
+
+private:
+    Owner& owner_;
+    std::shared_ptr<Owner> keep_alive_;
+};
+
+// For requests whose outcome doesn't matter, like a cancellation at
+// shutdown.
+class IgnoredOperation final : public Operation
+{
+public:
+    void complete(int, uint32_t) override
+    {}
+};
+
+IgnoredOperation ignored_operation;
+
+/**
+ * @brief The provided buffers that multishot receives land in, shared by
+ *        every socket on the ring and returned as they are read.
+ */
+class BufferRing
+{
+public:
+    BufferRing() = default;
+    ~BufferRing();
+
+    BufferRing(const BufferRing&) = delete;
+    BufferRing& operator=(const BufferRing&) = delete;
+
+    bool init(int ring_fd, std::string& failure);
+
+    const char* buffer(uint16_t id) const
+    {
+        return memory_ + static_cast<size_t>(id) * kBufferSize;
+    }
+
+    void recycle(uint16_t id)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        add(id);
+        publish();
+    }
+
+private:
+    void add(uint16_t id);
+    void publish();
+
+    std::mutex mutex_;
+    io_uring_buf_ring* ring_ = nullptr;
+    size_t ring_size_ = 0;
+    char* memory_ = nullptr;
+    size_t memory_size_ = 0;
+    uint16_t tail_ = 0;
+};
+
+BufferRing::~BufferRing()
+{
+    if (ring_ != nullptr)
+    {
+        ::munmap(ring_, ring_size_);
+    }
+    if (memory_ != nullptr)
+    {
+        ::munmap(memory_, memory_size_);
+    }
+}
+
+bool BufferRing::init(int ring_fd, std::string& failure)
+{
+    ring_size_ = sizeof(io_uring_buf) * kBufferCount;
+    void* ring = ::mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED)
+    {
+        failure = "mmap of the buffer ring failed";
+        return false;
+    }
+    ring_ = static_cast<io_uring_buf_ring*>(ring);
+
+    // Only touched as it is received into.
+    memory_size_ = static_cast<size_t>(kBufferSize) * kBufferCount;
+    void* memory = ::mmap(nullptr, memory_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        failure = "mmap of the receive buffers failed";
+        return false;
+    }
+    memory_ = static_cast<char*>(memory);
+
+    io_uring_buf_reg registration;
+    std::memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = reinterpret_cast<uintptr_t>(ring_);
+    registration.ring_entries = kBufferCount;
+    registration.bgid = kBufferGroup;
+    if (io_uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &registration, 1) != 0)
+    {
+        failure = "provided buffer rings are not supported";
+        return false;
+    }
+
+    for (uint16_t id = 0; id < kBufferCount; ++id)
+    {
+        add(id);
+    }
+    publish();
+    return true;
+}
+
+void BufferRing::add(uint16_t id)
+{
+    // The tail overlays the first entry's reserved field, so entries are
+    // written one by one rather than through a flexible array member.
+    auto* entries = reinterpret_cast<io_uring_buf*>(ring_);
+    auto& entry = entries[tail_ & (kBufferCount - 1)];
+    entry.addr = reinterpret_cast<uintptr_t>(buffer(id));
+    entry.len = kBufferSize;
+    entry.bid = id;
+    ++tail_;
+}
+
+void BufferRing::publish()
+{
+    __atomic_store_n(&ring_->tail, tail_, __ATOMIC_RELEASE);
+}
+
+class Ring;
+
+/**
+ * @brief A socket, and whatever the kernel is doing with it.
+ *
+ * Received data is queued in the ring's provided buffers, by a multishot
+ * receive that stays armed across reads; a read takes what is queued, or
+ * waits for the next of it.  When the ring runs out of buffers, a read
+ * receives straight into the caller's buffer instead.
+ *
+ * Operations hold the socket until their last completion, and the
+ * socket is only closed once it is destroyed, so that the kernel never
+ * sees its descriptor reused underneath it.
+ */
+class UringSocket : public std::enable_shared_from_this<UringSocket>
+{
+public:
+    using Callback = IConnection::Callback;
+
+    UringSocket(std::shared_ptr<Ring> ring, int fd);
+    ~UringSocket() noexcept;
+
+    UringSocket(const UringSocket&) = delete;
+    UringSocket& operator=(const UringSocket&) = delete;
+
+    void connect(const asio::ip::tcp::endpoint& endpoint, Callback&& callback);
+    void read(QByteArrayView buffer, Callback&& callback, std::shared_ptr<IConnection> owner);
+    void wait_readable(Callback&& callback, std::shared_ptr<IConnection> owner);
+    void write(const QByteArrayView* buffers, size_t count, Callback&& callback, std::shared_ptr<IConnection> owner);
+    bool is_reusable();
+    void close();
+
+private:
+    enum class Want
+    {
+        Nothing,
+        Data,
+        Readable,
+    };
+
+    struct Received
+    {
+        uint16_t id;
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    // A callback to call once the socket's lock is released.
+    struct Completion
+    {
+        Callback callback;
+        std::shared_ptr<IConnection> owner;
+        std::error_code ec;
+        size_t bytes = 0;
+
+        explicit operator bool() const
+        {
+            return static_cast<bool>(callback);
+        }
+
+        void operator()()
+        {
+            callback(ec, bytes);
+        }
+    };
+
+    // These are called with mutex_ held.
+    Completion take_read();
+    Completion finish_read(std::error_code ec, size_t bytes);
+    Completion finish_write(std::error_code ec);
+    size_t copy_out();
+    void start_receiving();
+    void stop_receiving();
+    void receive_directly();
+    void send();
+    bool busy() const;
+
+    void post(Completion&& completion, details::HandlerMemory& memory);
+
+    void on_receive(int result, uint32_t flags);
+    void on_direct(int result, uint32_t flags);
+    void on_write(int result, uint32_t flags);
+    void on_connect(int result, uint32_t flags);
+    void on_cancel(int result, uint32_t flags);
+    void on_close(int result, uint32_t flags);
+
+    std::shared_ptr<Ring> ring_;
+    BufferRing& buffers_;
+    const int fd_;
+
+    std::mutex mutex_;
+    bool open_;
+
+    // Receiving.
+    std::deque<Received> received_;
+    size_t buffered_;
+    bool receiving_;
+    bool receive_cancelled_;
+    bool reading_directly_;
+    bool ended_;
+    std::error_code receive_error_;
+
+    Want want_;
+    char* read_data_;
+    size_t read_size_;
+    Callback read_callback_;
+    std::shared_ptr<IConnection> read_owner_;
+
+    // Sending.
+    bool writing_;
+    std::vector<iovec> iov_;
+    size_t iov_index_;
+    msghdr message_;
+    size_t written_;
+    Callback write_callback_;
+    std::shared_ptr<IConnection> write_owner_;
+
+    // Connecting.
+    bool connecting_;
+    sockaddr_storage address_;
+    socklen_t address_size_;
+    Callback connect_callback_;
+
+    bool cancelling_;
+    bool closing_;
+
+    MemberOperation<UringSocket, &UringSocket::on_receive> receive_op_;
+    MemberOperation<UringSocket, &UringSocket::on_direct> direct_op_;
+    MemberOperation<UringSocket, &UringSocket::on_write> write_op_;
+    MemberOperation<UringSocket, &UringSocket::on_connect> connect_op_;
+    MemberOperation<UringSocket, &UringSocket::on_cancel> cancel_op_;
+    MemberOperation<UringSocket, &UringSocket::on_close> close_op_;
+
+    details::HandlerMemory read_memory_;
+    details::HandlerMemory write_memory_;
+};
+
+class IoUringConnection final : public IConnection, public std::enable_shared_from_this<IoUringConnection>
+{
+public:
+    explicit IoUringConnection(std::shared_ptr<UringSocket> socket)
+        : socket_(std::move(socket))
+    {}
+
+    ~IoUringConnection() noexcept override
+    {
+        socket_->close();
+    }
+
+    void async_write(const QByteArrayView data, Callback&& callback) override
+    {
+        socket_->write(&data, 1, std::move(callback), shared_from_this());
+    }
+
+    void async_writev(const std::vector<QByteArrayView>& buffers, Callback&& callback) override
+    {
+        socket_->write(buffers.data(), buffers.size(), std::move(callback), shared_from_this());
+    }
+
+    void async_read(QByteArrayView buffer, Callback&& callback) override
+    {
+        socket_->read(buffer, std::move(callback), shared_from_this());
+    }
+
+    void async_wait_readable(Callback&& callback) override
+    {
+        socket_->wait_readable(std::move(callback), shared_from_this());
+    }
+
+    bool is_reusable() override
+    {
+        return socket_->is_reusable();
+    }
+
+    void close(std::error_code& ec) override
+    {
+        ec = {};
+        socket_->close();
+    }
+
+private:
+    std::shared_ptr<UringSocket> socket_;
+};
+
+class MultishotAcceptor final : public IoUringAcceptor, public std::enable_shared_from_this<MultishotAcceptor>
+{
+public:
+    MultishotAcceptor(std::shared_ptr<Ring> ring, int listener, IoUring::AcceptCallback&& callback);
+    ~MultishotAcceptor() noexcept override;
+
+    void start();
+    void close() override;
+
+private:
+    // Called with mutex_ held.
+    void arm();
+
+    void on_accept(int result, uint32_t flags);
+    void on_cancel(int result, uint32_t flags);
+
+    std::shared_ptr<Ring> ring_;
+    const int listener_;
+    IoUring::AcceptCallback callback_;
+
+    std::mutex mutex_;
+    bool open_;
+    bool accepting_;
+
+    MemberOperation<MultishotAcceptor, &MultishotAcceptor::on_accept> accept_op_;
+    MemberOperation<MultishotAcceptor, &MultishotAcceptor::on_cancel> cancel_op_;
+};
+
+/**
+ * @brief The ring itself, shared by the sockets and acceptors on it so
+ *        that none of them can outlive it.
+ */
+class Ring final : public std::enable_shared_from_this<Ring>
+{
+public:
+    explicit Ring(asio::io_context& context);
+    ~Ring() noexcept;
+
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+
+    /**
+     * @brief Sets the ring up, or describes in @p failure the first thing
+     *        that the kernel couldn't do.
+     */
+    bool init(std::string& failure);
+
+    /**
+     * @brief Cancels everything still with the kernel and waits for it to
+     *        complete; operations submitted from then on never start.
+     */
+    void shutdown();
+
+    std::shared_ptr<IConnection> make_connection(int socket);
+    void open(asio::ip::tcp::resolver::iterator endpoints, IoUring::OpenCallback&& callback);
+    std::shared_ptr<IoUringAcceptor> accept(int listener, IoUring::AcceptCallback&& callback);
+
+    BufferRing& buffers()
+    {
+        return buffers_;
+    }
+
+    /**
+     * @brief Posts @p handler to the context, unless the ring has shut
+     *        down - in which case the context may well be gone.
+     */
+    template <typename Handler>
+    void post(Handler&& handler)
+    {
+        if (!shut_down_.load(std::memory_order_acquire))
+        {
+            asio::post(context_, std::forward<Handler>(handler));
+        }
+    }
+
+    /**
+     * @brief Queues @p operation, whose entry @p prepare fills in, to go
+     *        to the kernel with everything else queued before the next
+     *        flush.
+     *
+     * An operation that can't be queued - because the ring is being torn
+     * down, or the kernel won't take any more - is completed with an
+     * error from the flush instead, never from here.
+     */
+    template <typename Prepare>
+    void submit(Operation& operation, Prepare&& prepare);
+
+private:
+    struct Refused
+    {
+        Operation* operation;
+        int result;
+    };
+
+    bool map_rings(const io_uring_params& params, std::string& failure);
+    bool probe_opcodes(std::string& failure);
+    bool probe_multishot_receive(std::string& failure);
+    bool register_eventfd(std::string& failure);
+
+    // These are called with submit_mutex_ held.
+    io_uring_sqe* claim_sqe(int& error);
+    void publish_sqe();
+    void post_flush();
+
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags);
+    void flush();
+    void complete_refused();
+    void wait_for_completions();
+    void reap();
+
+    asio::io_context& context_;
+    int fd_;
+
+    void* ring_memory_;
+    size_t ring_size_;
+    io_uring_sqe* sqes_;
+    size_t sqes_size_;
+
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned* sq_flags_;
+    unsigned* sq_array_;
+    unsigned sq_mask_;
+    unsigned sq_entries_;
+
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned cq_mask_;
+    io_uring_cqe* cqes_;
+
+    std::mutex submit_mutex_;
+    std::mutex reap_mutex_;
+    unsigned next_tail_;
+    unsigned unsubmitted_;
+    bool flush_posted_;
+    bool draining_;
+    std::vector<Refused> refused_;
+
+    // Operations with the kernel, less those that have completed for the
+    // last time.
+    std::atomic<size_t> in_flight_;
+
+    std::atomic<bool> shut_down_;
+
+    BufferRing buffers_;
+
+    std::unique_ptr<asio::posix::stream_descriptor> events_;
+    uint64_t event_count_;
+};
+
+class UringService final : public IoUring
+{
+public:
+    explicit UringService(std::shared_ptr<Ring> ring)
+        : ring_(std::move(ring))
+    {}
+
+    ~UringService() noexcept override
+    {
+        ring_->shutdown();
+    }
+
+    std::shared_ptr<IConnection> make_connection(int socket) override
+    {
+        return ring_->make_connection(socket);
+    }
+
+    void open(asio::ip::tcp::resolver::iterator endpoints, OpenCallback&& callback) override
+    {
+        ring_->open(std::move(endpoints), std::move(callback));
+    }
+
+    std::shared_ptr<IoUringAcceptor> accept(int listener, AcceptCallback&& callback) override
+    {
+        return ring_->accept(listener, std::move(callback));
+    }
+
+private:
+    std::shared_ptr<Ring> ring_;
+};
+
+// ---------------------------------------------------------------------------
+
+UringSocket::UringSocket(std::shared_ptr<Ring> ring, int fd)
+    : ring_(std::move(ring))
+    , buffers_(ring_->buffers())
+    , fd_(fd)
+    , mutex_()
+    , open_(true)
+    , received_()
+    , buffered_(0)
+    , receiving_(false)
+    , receive_cancelled_(false)
+    , reading_directly_(false)
+    , ended_(false)
+    , receive_error_()
+    , want_(Want::Nothing)
+    , read_data_(nullptr)
+    , read_size_(0)
+    , read_callback_()
+    , read_owner_()
+    , writing_(false)
+    , iov_()
+    , iov_index_(0)
+    , message_()
+    , written_(0)
+    , write_callback_()
+    , write_owner_()
+    , connecting_(false)
+    , address_()
+    , address_size_(0)
+    , connect_callback_()
+    , cancelling_(false)
+    , closing_(false)
+    , receive_op_(*this)
+    , direct_op_(*this)
+    , write_op_(*this)
+    , connect_op_(*this)
+    , cancel_op_(*this)
+    , close_op_(*this)
+    , read_memory_()
+    , write_memory_()
+{
+    iov_.reserve(8);
+}
+
+UringSocket::~UringSocket() noexcept
+{
+    for (const auto& received : received_)
+    {
+        buffers_.recycle(received.id);
+    }
+    ::close(fd_);
+}
+
+void UringSocket::connect(const asio::ip::tcp::endpoint& endpoint, Callback&& callback)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::memcpy(&address_, endpoint.data(), endpoint.size());
+    address_size_ = static_cast<socklen_t>(endpoint.size());
+    connect_callback_ = std::move(callback);
+    connecting_ = true;
+
+    connect_op_.hold(shared_from_this());
+    ring_->submit(connect_op_, [this](io_uring_sqe& sqe)
+    {
+        sqe.opcode = IORING_OP_CONNECT;
+        sqe.fd = fd_;
+        sqe.addr = reinterpret_cast<uintptr_t>(&address_);
+        sqe.off = address_size_;
+    });
+}
+
+void UringSocket::read(QByteArrayView buffer, Callback&& callback, std::shared_ptr<IConnection> owner)
+{
+    Completion done;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (want_ != Want::Nothing)
+        {
+            done = Completion{ std::move(callback), std::move(owner), asio::error::already_started, 0 };
+        }
+        else
+        {
+            want_ = Want::Data;
+            read_data_ = const_cast<char*>(buffer.data());
+            read_size_ = static_cast<size_t>(buffer.size());
+            read_callback_ = std::move(callback);
+            read_owner_ = std::move(owner);
+
+            done = read_size_ == 0 ? finish_read({}, 0) : take_read();
+            if (!done)
+            {
+                start_receiving();
+            }
+        }
+    }
+
+    if (done)
+    {
+        post(std::move(done), read_memory_);
+    }
+}
+
+void UringSocket::wait_readable(Callback&& callback, std::shared_ptr<IConnection> owner)
+{
+    Completion done;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (want_ != Want::Nothing)
+        {
+            done = Completion{ std::move(callback), std::move(owner), asio::error::already_started, 0 };
+        }
+        else
+        {
+            want_ = Want::Readable;
+            read_callback_ = std::move(callback);
+            read_owner_ = std::move(owner);
+
+            done = take_read();
+            if (!done)
+            {
+                start_receiving();
+            }
+        }
+    }
+
+    if (done)
+    {
+        post(std::move(done), read_memory_);
+    }
+}
+
+void UringSocket::write(const QByteArrayView* buffers, size_t count, Callback&& callback, std::shared_ptr<IConnection> owner)
+{
+    Completion done;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (!open_ || writing_)
+        {
+            auto ec = open_ ? asio::error::already_started : asio::error::operation_aborted;
+            done = Completion{ std::move(callback), std::move(owner), ec, 0 };
+        }
+        else
+        {
+            iov_.clear();
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (!buffers[i].isEmpty())
+                {
+                    iov_.push_back({ const_cast<char*>(buffers[i].data()), static_cast<size_t>(buffers[i].size()) });
+                }
+            }
+
+            if (iov_.empty())
+            {
+                done = Completion{ std::move(callback), std::move(owner), {}, 0 };
+            }
+            else
+            {
+                writing_ = true;
+                iov_index_ = 0;
+                written_ = 0;
+                write_callback_ = std::move(callback);
+                write_owner_ = std::move(owner);
+                send();
+            }
+        }
+    }
+
+    if (done)
+    {
+        post(std::move(done), write_memory_);
+    }
+}
+
+bool UringSocket::is_reusable()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (!open_ || !received_.empty() || ended_ || receive_error_)
+    {
+        return false;
+    }
+
+    // Whatever the receive hasn't yet picked up is still in the socket.
+    char probe;
+    ssize_t n = ::recv(fd_, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+void UringSocket::close()
+{
+    Completion done;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!open_)
+        {
+            return;
+        }
+        open_ = false;
+
+        // The peer hears of it now, rather than when the last reference to
+        // the socket goes.  Shutting it down also ends any receive or send
+        // in progress; cancelling catches a connect, too.
+        ::shutdown(fd_, SHUT_RDWR);
+        if (busy())
+        {
+            closing_ = true;
+            close_op_.hold(shared_from_this());
+            ring_->submit(close_op_, [this](io_uring_sqe& sqe)
+            {
+                sqe.opcode = IORING_OP_ASYNC_CANCEL;
+                sqe.fd = fd_;
+                sqe.cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+            });
+        }
+
+        for (const auto& received : received_)
+        {
+            buffers_.recycle(received.id);
+        }
+        received_.clear();
+        buffered_ = 0;
+
+        done = take_read();
+    }
+
+    if (done)
+    {
+        post(std::move(done), read_memory_);
+    }
+}
+
+UringSocket::Completion UringSocket::take_read()
+{
+    if (want_ == Want::Nothing)
+    {
+        return {};
+    }
+
+    // The kernel is receiving into the caller's buffer; only its
+    // completion can end the read.
+    if (reading_directly_ && want_ == Want::Data)
+    {
+        return {};
+    }
+
+    if (!open_)
+    {
+        return finish_read(asio::error::operation_aborted, 0);
+    }
+
+    if (!received_.empty())
+    {
+        return finish_read({}, want_ == Want::Data ? copy_out() : buffered_);
+    }
+
+    if (receive_error_)
+    {
+        return finish_read(receive_error_, 0);
+    }
+
+    if (ended_)
+    {
+        // Readable and empty means closed.
+        return want_ == Want::Data ? finish_read(asio::error::eof, 0) : finish_read({}, 0);
+    }
+
+    return {};
+}
+
+UringSocket::Completion UringSocket::finish_read(std::error_code ec, size_t bytes)
+{
+    want_ = Want::Nothing;
+    read_data_ = nullptr;
+    read_size_ = 0;
+    return Completion{ std::move(read_callback_), std::move(read_owner_), ec, bytes };
+}
+
+UringSocket::Completion UringSocket::finish_write(std::error_code ec)
+{
+    writing_ = false;
+    return Completion{ std::move(write_callback_), std::move(write_owner_), ec, written_ };
+}
+
+size_t UringSocket::copy_out()
+{
+    size_t copied = 0;
+    while (copied < read_size_ && !received_.empty())
+    {
+        auto& front = received_.front();
+        size_t n = std::min<size_t>(front.size, read_size_ - copied);
+        std::memcpy(read_data_ + copied, buffers_.buffer(front.id) + front.offset, n);
+        copied += n;
+        buffered_ -= n;
+
+        front.offset += static_cast<uint32_t>(n);
+        front.size -= static_cast<uint32_t>(n);
+        if (front.size == 0)
+        {
+            buffers_.recycle(front.id);
+            received_.pop_front();
+        }
+    }
+    return copied;
+}
+
+void UringSocket::start_receiving()
+{
+    // Whatever is in progress will see to the read when it completes.
+    if (receiving_ || reading_directly_ || cancelling_ || !open_)
+    {
+        return;
+    }
+
+    receiving_ = true;
+    receive_cancelled_ = false;
+    receive_op_.hold(shared_from_this());
+    ring_->submit(receive_op_, [this](io_uring_sqe& sqe)
+    {
+        sqe.opcode = IORING_OP_RECV;
+        sqe.fd = fd_;
+        sqe.ioprio = IORING_RECV_MULTISHOT;
+        sqe.flags = IOSQE_BUFFER_SELECT;
+        sqe.buf_group = kBufferGroup;
+    });
+}
+
+void UringSocket::stop_receiving()
+{
+    receive_cancelled_ = true;
+    cancelling_ = true;
+    cancel_op_.hold(shared_from_this());
+    ring_->submit(cancel_op_, [this](io_uring_sqe& sqe)
+    {
+        sqe.opcode = IORING_OP_ASYNC_CANCEL;
+        sqe.addr = reinterpret_cast<uintptr_t>(static_cast<Operation*>(&receive_op_));
+    });
+}
+
+void UringSocket::receive_directly()
+{
+    reading_directly_ = true;
+    direct_op_.hold(shared_from_this());
+
+    if (want_ == Want::Data)
+    {
+        ring_->submit(direct_op_, [this](io_uring_sqe& sqe)
+        {
+            sqe.opcode = IORING_OP_RECV;
+            sqe.fd = fd_;
+            sqe.addr = reinterpret_cast<uintptr_t>(read_data_);
+            sqe.len = static_cast<uint32_t>(std::min<size_t>(read_size_, UINT32_MAX));
+        });
+    }
+    else
+    {
+        ring_->submit(direct_op_, [this](io_uring_sqe& sqe)
+        {
+            uint32_t events = POLLIN;
+#if __BYTE_ORDER == __BIG_ENDIAN
+            events = (events << 16) | (events >> 16);
+#endif
+            sqe.opcode = IORING_OP_POLL_ADD;
+            sqe.fd = fd_;
+            sqe.poll32_events = events;
+        });
+    }
+}
+
+void UringSocket::send()
+{
+    write_op_.hold(shared_from_this());
+
+    if (iov_.size() - iov_index_ == 1)
+    {
+        const auto& buffer = iov_[iov_index_];
+        ring_->submit(write_op_, [this, &buffer](io_uring_sqe& sqe)
+        {
+            sqe.opcode = IORING_OP_SEND;
+            sqe.fd = fd_;
+            sqe.addr = reinterpret_cast<uintptr_t>(buffer.iov_base);
+            sqe.len = static_cast<uint32_t>(std::min<size_t>(buffer.iov_len, UINT32_MAX));
+            sqe.msg_flags = MSG_NOSIGNAL;
+        });
+        return;
+    }
+
+    std::memset(&message_, 0, sizeof(message_));
+    message_.msg_iov = &iov_[iov_index_];
+    message_.msg_iovlen = iov_.size() - iov_index_;
+    ring_->submit(write_op_, [this](io_uring_sqe& sqe)
+    {
+        sqe.opcode = IORING_OP_SENDMSG;
+        sqe.fd = fd_;
+        sqe.addr = reinterpret_cast<uintptr_t>(&message_);
+        sqe.len = 1;
+        sqe.msg_flags = MSG_NOSIGNAL;
+    });
+}
+
+bool UringSocket::busy() const
+{
+    return receiving_ || reading_directly_ || writing_ || connecting_ || cancelling_;
+}
+
+void UringSocket::post(Completion&& completion, details::HandlerMemory& memory)
+{
+    ring_->post(details::make_allocating_handler(memory, [self = shared_from_this(), completion = std::move(completion)]() mutable
+    {
+        completion();
+    }));
+}
+
+void UringSocket::on_receive(int result, uint32_t flags)
+{
+    std::shared_ptr<UringSocket> self;
+    Completion done;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        bool cancelled = receive_cancelled_;
+        if ((flags & IORING_CQE_F_MORE) == 0)
+        {
+            receiving_ = false;
+            receive_cancelled_ = false;
+            self = receive_op_.release();
+        }
+
+        if (result > 0 && (flags & IORING_CQE_F_BUFFER) != 0)
+        {
+            auto id = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+            if (open_)
+            {
+                received_.push_back({ id, 0, static_cast<uint32_t>(result) });
+                buffered_ += static_cast<size_t>(result);
+            }
+            else
+            {
+                buffers_.recycle(id);
+            }
+        }
+        else if (result == 0)
+        {
+            ended_ = true;
+        }
+        else if (result == -ECANCELED && !cancelled)
+        {
+            // Cancelled by someone else - the ring, going away.
+            receive_error_ = asio::error::operation_aborted;
+        }
+        else if (result < 0 && result != -ENOBUFS && result != -ECANCELED)
+        {
+            receive_error_ = errno_code(-result);
+        }
+
+        done = take_read();
+        if (!done && want_ != Want::Nothing)
+        {
+            if (result == -ENOBUFS)
+            {
+                receive_directly();
+            }
+            else
+            {
+                start_receiving();
+            }
+        }
+        else if (receiving_ && want_ == Want::Nothing && buffered_ >= kMaxBufferedPerSocket && !cancelling_)
+        {
+            stop_receiving();
+        }
+    }
+
+    if (done)
+    {
+        post(std::move(done), read_memory_);
+    }
+}
+
+void UringSocket::on_direct(int result, uint32_t /* flags */)
+{
+    std::shared_ptr<UringSocket> self;
+    Completion done;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        reading_directly_ = false;
+        self = direct_op_.release();
+
+        if (result < 0)
+        {
+            receive_error_ = result_code(result);
+        }
+        else if (want_ == Want::Data && result == 0)
+        {
+            ended_ = true;
+        }
+
+        if (want_ == Want::Data && result > 0)
+        {
+            done = finish_read(open_ ? std::error_code() : asio::error::operation_aborted, open_ ? static_cast<size_t>(result) : 0);
+        }
+        else if (want_ == Want::Readable && result >= 0 && open_)
+        {
+            int available = 0;
+            if (::ioctl(fd_, FIONREAD, &available) != 0)
+            {
+                done = finish_read(errno_code(errno), 0);
+            }
+            else
+            {
+                done = finish_read({}, static_cast<size_t>(available));
+            }
+        }
+        else
+        {
+            done = take_read();
+        }
+    }
+
+    if (done)
+    {
+        post(std::move(done), read_memory_);
+    }
+}
+
+void UringSocket::on_write(int result, uint32_t /* flags */)
+{
+    std::shared_ptr<UringSocket> self;
+    Completion done;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        self = write_op_.release();
+
+        if (result < 0)
+        {
+            done = finish_write(open_ ? result_code(result) : asio::error::operation_aborted);
+        }
+        else
+        {
+            written_ += static_cast<size_t>(result);
+
+            // Skip past whatever went out; a short send leaves the rest of
+            // its buffer, and any after it, to go next.
+            size_t sent = static_cast<size_t>(result);
+            while (iov_index_ < iov_.size() && sent >= iov_[iov_index_].iov_len)
+            {
+                sent -= iov_[iov_index_].iov_len;
+                ++iov_index_;
+            }
+            if (iov_index_ < iov_.size())
+            {
+                auto& partial = iov_[iov_index_];
+                partial.iov_base = static_cast<char*>(partial.iov_base) + sent;
+                partial.iov_len -= sent;
+            }
+
+            if (iov_index_ == iov_.size())
+            {
+                done = finish_write({});
+            }
+            else if (!open_)
+            {
+                done = finish_write(asio::error::operation_aborted);
+            }
+            else if (result == 0)
+            {
+                done = finish_write(asio::error::broken_pipe);
+            }
+            else
+            {
+                send();
+            }
+        }
+    }
+
+    if (done)
+    {
+        post(std::move(done), write_memory_);
+    }
+}
+
+void UringSocket::on_connect(int result, uint32_t /* flags */)
+{
+    std::shared_ptr<UringSocket> self;
+    Completion done;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        connecting_ = false;
+        self = connect_op_.release();
+
+        std::error_code ec;
+        if (!open_)
+        {
+            ec = asio::error::operation_aborted;
+        }
+        else if (result < 0)
+        {
+            ec = result_code(result);
+        }
+        done = Completion{ std::move(connect_callback_), nullptr, ec, 0 };
+    }
+
+    post(std::move(done), write_memory_);
+}
+
+void UringSocket::on_cancel(int /* result */, uint32_t /* flags */)
+{
+    std::shared_ptr<UringSocket> self;
+    Completion done;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cancelling_ = false;
+        self = cancel_op_.release();
+
+        // A read may have come in while receiving was being stopped.
+        if (want_ != Want::Nothing && !receiving_ && !reading_directly_)
+        {
+            done = take_read();
+            if (!done)
+            {
+                start_receiving();
+            }
+        }
+    }
+
+    if (done)
+    {
+        post(std::move(done), read_memory_);
+    }
+}
+
+void UringSocket::on_close(int /* result */, uint32_t /* flags */)
+{
+    std::shared_ptr<UringSocket> self;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    closing_ = false;
+    self = close_op_.release();
+}
+
+// ---------------------------------------------------------------------------
+
+MultishotAcceptor::MultishotAcceptor(std::shared_ptr<Ring> ring, int listener, IoUring::AcceptCallback&& callback)
+    : ring_(std::move(ring))
+    , listener_(listener)
+    , callback_(std::move(callback))
+    , mutex_()
+    , open_(true)
+    , accepting_(false)
+    , accept_op_(*this)
+    , cancel_op_(*this)
+{}
+
+MultishotAcceptor::~MultishotAcceptor() noexcept
+{
+    ::close(listener_);
+}
+
+void MultishotAcceptor::start()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    arm();
+}
+
+void MultishotAcceptor::close()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!open_)
+    {
+        return;
+    }
+    open_ = false;
+
+    if (accepting_)
+    {
+        cancel_op_.hold(shared_from_this());
+        ring_->submit(cancel_op_, [this](io_uring_sqe& sqe)
+        {
+            sqe.opcode = IORING_OP_ASYNC_CANCEL;
+            sqe.addr = reinterpret_cast<uintptr_t>(static_cast<Operation*>(&accept_op_));
+        });
+    }
+}
+
+void MultishotAcceptor::arm()
+{
+    if (!open_ || accepting_)
+    {
+        return;
+    }
+
+    accepting_ = true;
+    accept_op_.hold(shared_from_this());
+    ring_->submit(accept_op_, [this](io_uring_sqe& sqe)
+    {
+        sqe.opcode = IORING_OP_ACCEPT;
+        sqe.fd = listener_;
+        sqe.ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe.accept_flags = SOCK_CLOEXEC;
+    });
+}
+
+void MultishotAcceptor::on_accept(int result, uint32_t flags)
+{
+    std::shared_ptr<MultishotAcceptor> self;
+    bool deliver = false;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if ((flags & IORING_CQE_F_MORE) == 0)
+        {
+            accepting_ = false;
+            self = accept_op_.release();
+        }
+        deliver = open_ && result >= 0;
+    }
+
+    if (deliver)
+    {
+        callback_(result);
+    }
+    else if (result >= 0)
+    {
+        ::close(result);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (accepting_ || !open_)
+    {
+        return;
+    }
+
+    // The kernel ends a multishot accept now and then, as when the
+    // completion queue overflows; that is no reason to stop.  An error is,
+    // as it is for the reactor's acceptor.
+    if (result >= 0 || result == -ECONNABORTED)
+    {
+        arm();
+    }
+    else
+    {
+        log::warn("IoUring: accepting failed", log::StringValue("error", errno_code(-result).message()));
+    }
+}
+
+void MultishotAcceptor::on_cancel(int /* result */, uint32_t /* flags */)
+{
+    std::shared_ptr<MultishotAcceptor> self;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    self = cancel_op_.release();
+}
+
+// ---------------------------------------------------------------------------
+
+Ring::Ring(asio::io_context& context)
+    : context_(context)
+    , fd_(-1)
+    , ring_memory_(nullptr)
+    , ring_size_(0)
+    , sqes_(nullptr)
+    , sqes_size_(0)
+    , sq_head_(nullptr)
+    , sq_tail_(nullptr)
+    , sq_flags_(nullptr)
+    , sq_array_(nullptr)
+    , sq_mask_(0)
+    , sq_entries_(0)
+    , cq_head_(nullptr)
+    , cq_tail_(nullptr)
+    , cq_mask_(0)
+    , cqes_(nullptr)
+    , submit_mutex_()
+    , reap_mutex_()
+    , next_tail_(0)
+    , unsubmitted_(0)
+    , flush_posted_(false)
+    , draining_(false)
+    , refused_()
+    , in_flight_(0)
+    , shut_down_(false)
+    , buffers_()
+    , events_()
+    , event_count_(0)
+{}
+
+Ring::~Ring() noexcept
+{
+    if (sqes_ != nullptr)
+    {
+        ::munmap(sqes_, sqes_size_);
+    }
+    if (ring_memory_ != nullptr)
+    {
+        ::munmap(ring_memory_, ring_size_);
+    }
+    if (fd_ != -1)
+    {
+        ::close(fd_);
+    }
+}
+
+bool Ring::init(std::string& failure)
+{
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP | IORING_SETUP_SUBMIT_ALL;
+    params.cq_entries = kQueueDepth * 4;
+
+    fd_ = io_uring_setup(kQueueDepth, &params);
+    if (fd_ < 0)
+    {
+        failure = "io_uring_setup failed: " + errno_code(errno).message();
+        fd_ = -1;
+        return false;
+    }
+
+    constexpr uint32_t kRequiredFeatures = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_FAST_POLL;
+    if ((params.features & kRequiredFeatures) != kRequiredFeatures)
+    {
+        failure = "the kernel's io_uring lacks required features";
+        return false;
+    }
+
+    return map_rings(params, failure)
+        && probe_opcodes(failure)
+        && buffers_.init(fd_, failure)
+        && probe_multishot_receive(failure)
+        && register_eventfd(failure);
+}
+
+bool Ring::map_rings(const io_uring_params& params, std::string& failure)
+{
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    ring_size_ = std::max(sq_size, cq_size);
+
+    void* ring = ::mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if (ring == MAP_FAILED)
+    {
+        failure = "mmap of the rings failed";
+        return false;
+    }
+    ring_memory_ = ring;
+
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        failure = "mmap of the submission queue entries failed";
+        return false;
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    auto* base = static_cast<char*>(ring_memory_);
+    sq_head_ = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+    sq_flags_ = reinterpret_cast<unsigned*>(base + params.sq_off.flags);
+    sq_array_ = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+    sq_mask_ = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+
+    cq_head_ = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+
+    // Entries are always submitted in order, so each slot of the array
+    // names the entry of the same index.
+    for (unsigned i = 0; i < sq_entries_; ++i)
+    {
+        sq_array_[i] = i;
+    }
+    next_tail_ = *sq_tail_;
+    return true;
+}
+
+bool Ring::probe_opcodes(std::string& failure)
+{
+    constexpr unsigned kOps = 256;
+    std::vector<unsigned char> memory(sizeof(io_uring_probe) + kOps * sizeof(io_uring_probe_op), 0);
+    auto* probe = reinterpret_cast<io_uring_probe*>(memory.data());
+    if (io_uring_register(fd_, IORING_REGISTER_PROBE, probe, kOps) != 0)
+    {
+        failure = "the kernel can't say which io_uring operations it supports";
+        return false;
+    }
+
+    for (unsigned op : { IORING_OP_ACCEPT, IORING_OP_CONNECT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_SENDMSG, IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL })
+    {
+        if (op > probe->last_op || (probe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0)
+        {
+            failure = "an io_uring operation is not supported: " + std::to_string(op);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Nothing but trying it says whether the kernel can receive into provided
+// buffers more than once per request, so a byte is sent across a socket
+// pair and received that way.  This runs before anything else is queued,
+// and reads its completions straight off the ring.
+bool Ring::probe_multishot_receive(std::string& failure)
+{
+    int pair[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0)
+    {
+        failure = "socketpair failed: " + errno_code(errno).message();
+        return false;
+    }
+
+    auto next_completion = [this](io_uring_cqe& completion)
+    {
+        unsigned head = *cq_head_;
+        while (head == load_acquire(cq_tail_))
+        {
+            if (enter(0, 1, IORING_ENTER_GETEVENTS) < 0)
+            {
+                return false;
+            }
+        }
+        completion = cqes_[head & cq_mask_];
+        store_release(cq_head_, head + 1);
+        return true;
+    };
+
+    constexpr uint64_t kReceive = 1;
+    constexpr uint64_t kCancel = 2;
+    int error = 0;
+    bool ok = false;
+
+    if (auto* sqe = claim_sqe(error))
+    {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = pair[0];
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = kBufferGroup;
+        sqe->user_data = kReceive;
+        publish_sqe();
+    }
+
+    io_uring_cqe completion;
+    if (enter(unsubmitted_, 0, 0) >= 0 && ::write(pair[1], "x", 1) == 1 && next_completion(completion))
+    {
+        ok = completion.user_data == kReceive
+          && completion.res == 1
+          && (completion.flags & IORING_CQE_F_BUFFER) != 0
+          && (completion.flags & IORING_CQE_F_MORE) != 0;
+
+        if ((completion.flags & IORING_CQE_F_BUFFER) != 0)
+        {
+            buffers_.recycle(static_cast<uint16_t>(completion.flags >> IORING_CQE_BUFFER_SHIFT));
+        }
+
+        // Still armed, if it worked; it has to end before the socket
+        // pair is closed.
+        if ((completion.flags & IORING_CQE_F_MORE) != 0)
+        {
+            if (auto* sqe = claim_sqe(error))
+            {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->addr = kReceive;
+                sqe->user_data = kCancel;
+                publish_sqe();
+            }
+            enter(unsubmitted_, 0, 0);
+
+            bool receive_ended = false;
+            bool cancel_ended = false;
+            while (!(receive_ended && cancel_ended) && next_completion(completion))
+            {
+                if (completion.user_data == kCancel)
+                {
+                    cancel_ended = true;
+                }
+                else if ((completion.flags & IORING_CQE_F_MORE) == 0)
+                {
+                    receive_ended = true;
+                }
+            }
+        }
+    }
+    unsubmitted_ = 0;
+
+    ::close(pair[0]);
+    ::close(pair[1]);
+
+    if (!ok)
+    {
+        failure = "multishot receive is not supported";
+    }
+    return ok;
+}
+
+bool Ring::register_eventfd(std::string& failure)
+{
+    int fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd < 0)
+    {
+        failure = "eventfd failed: " + errno_code(errno).message();
+        return false;
+    }
+
+    events_ = std::make_unique<asio::posix::stream_descriptor>(context_);
+
+    std::error_code ec;
+    events_->assign(fd, ec);
+    if (ec)
+    {
+        ::close(fd);
+        events_.reset();
+        failure = "could not watch the eventfd: " + ec.message();
+        return false;
+    }
+
+    if (io_uring_register(fd_, IORING_REGISTER_EVENTFD, &fd, 1) != 0)
+    {
+        failure = "could not register the eventfd: " + errno_code(errno).message();
+        events_.reset();
+        return false;
+    }
+
+    wait_for_completions();
+    return true;
+}
+
+std::shared_ptr<IConnection> Ring::make_connection(int socket)
+{
+    return std::make_shared<IoUringConnection>(std::make_shared<UringSocket>(shared_from_this(), socket));
+}
+
+void Ring::open(asio::ip::tcp::resolver::iterator endpoints, IoUring::OpenCallback&& callback)
+{
+    // Tries each endpoint in turn, reporting the last failure if none
+    // will have us.
+    struct Connector : std::enable_shared_from_this<Connector>
+    {
+        Connector(std::shared_ptr<Ring> r, asio::ip::tcp::resolver::iterator e, IoUring::OpenCallback&& c)
+            : ring(std::move(r))
+            , next(std::move(e))
+            , callback(std::move(c))
+            , error(asio::error::not_found)
+        {}
+
+        void try_next()
+        {
+            if (next == asio::ip::tcp::resolver::iterator())
+            {
+                callback(nullptr, error);
+                return;
+            }
+
+            auto endpoint = next->endpoint();
+            ++next;
+
+            int fd = ::socket(endpoint.protocol().family(), SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+            if (fd < 0)
+            {
+                error = errno_code(errno);
+                try_next();
+                return;
+            }
+
+            auto socket = std::make_shared<UringSocket>(ring, fd);
+            socket->connect(endpoint, [self = shared_from_this(), socket](std::error_code ec, size_t)
+            {
+                if (!ec)
+                {
+                    self->callback(std::make_shared<IoUringConnection>(socket), ec);
+                    return;
+                }
+
+                socket->close();
+                self->error = ec;
+                if (ec == asio::error::operation_aborted)
+                {
+                    self->callback(nullptr, ec);
+                    return;
+                }
+                self->try_next();
+            });
+        }
+
+        std::shared_ptr<Ring> ring;
+        asio::ip::tcp::resolver::iterator next;
+        IoUring::OpenCallback callback;
+        std::error_code error;
+    };
+
+    std::make_shared<Connector>(shared_from_this(), std::move(endpoints), std::move(callback))->try_next();
+}
+
+std::shared_ptr<IoUringAcceptor> Ring::accept(int listener, IoUring::AcceptCallback&& callback)
+{
+    auto acceptor = std::make_shared<MultishotAcceptor>(shared_from_this(), listener, std::move(callback));
+    acceptor->start();
+    return acceptor;
+}
+
+template <typename Prepare>
+void Ring::submit(Operation& operation, Prepare&& prepare)
+{
+    if (shut_down_.load(std::memory_order_acquire))
+    {
+        operation.abandon();
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(submit_mutex_);
+
+    int error = ECANCELED;
+    io_uring_sqe* sqe = draining_ ? nullptr : claim_sqe(error);
+    if (sqe == nullptr)
+    {
+        refused_.push_back({ &operation, -error });
+    }
+    else
+    {
+        prepare(*sqe);
+        sqe->user_data = reinterpret_cast<uintptr_t>(&operation);
+        publish_sqe();
+        in_flight_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (!draining_)
+    {
+        post_flush();
+    }
+}
+
+io_uring_sqe* Ring::claim_sqe(int& error)
+{
+    if (next_tail_ - load_acquire(sq_head_) >= sq_entries_)
+    {
+        // Full: hand the kernel what is there now, rather than at the
+        // flush.
+        int result = enter(unsubmitted_, 0, 0);
+        if (result < 0)
+        {
+            error = -result;
+            return nullptr;
+        }
+        unsubmitted_ = 0;
+
+        if (next_tail_ - load_acquire(sq_head_) >= sq_entries_)
+        {
+            error = EBUSY;
+            return nullptr;
+        }
+    }
+
+    auto* sqe = &sqes_[next_tail_ & sq_mask_];
+    std::memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+void Ring::publish_sqe()
+{
+    ++next_tail_;
+    ++unsubmitted_;
+    store_release(sq_tail_, next_tail_);
+}
+
+void Ring::post_flush()
+{
+    if (flush_posted_)
+    {
+        return;
+    }
+
+    flush_posted_ = true;
+    asio::post(context_, [this]
+    {
+        flush();
+    });
+}
+
+int Ring::enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    for (;;)
+    {
+        int result = io_uring_enter(fd_, to_submit, min_complete, flags);
+        if (result >= 0 || errno != EINTR)
+        {
+            return result < 0 ? -errno : result;
+        }
+    }
+}
+
+void Ring::flush()
+{
+    bool submitted = false;
+
+    {
+        std::lock_guard<std::mutex> lock(submit_mutex_);
+        flush_posted_ = false;
+
+        if (unsubmitted_ > 0)
+        {
+            submitted = true;
+
+            int result = enter(unsubmitted_, 0, 0);
+            if (result >= 0)
+            {
+                unsubmitted_ -= std::min(unsubmitted_, static_cast<unsigned>(result));
+            }
+            else if (result != -EBUSY && result != -EAGAIN)
+            {
+                log::error("IoUring: io_uring_enter failed", log::StringValue("error", errno_code(-result).message()));
+            }
+
+            // The kernel takes everything unless it is short of memory or
+            // backed up with completions; either way, try again shortly.
+            if (unsubmitted_ > 0)
+            {
+                post_flush();
+            }
+        }
+    }
+
+    // Sends, and anything else the kernel could do straight away, have
+    // completed already; taking them now saves waiting on the eventfd.
+    if (submitted)
+    {
+        reap();
+    }
+
+    complete_refused();
+}
+
+void Ring::complete_refused()
+{
+    std::vector<Refused> refused;
+    {
+        std::lock_guard<std::mutex> lock(submit_mutex_);
+        refused.swap(refused_);
+    }
+
+    for (const auto& entry : refused)
+    {
+        entry.operation->complete(entry.result, 0);
+    }
+}
+
+void Ring::wait_for_completions()
+{
+    events_->async_read_some(asio::buffer(&event_count_, sizeof(event_count_)), [this, self = shared_from_this()](std::error_code ec, size_t)
+    {
+        if (ec)
+        {
+            if (ec != asio::error::operation_aborted)
+            {
+                log::error("IoUring: reading the eventfd failed", log::StringValue("error", ec.message()));
+            }
+            return;
+        }
+
+        reap();
+        wait_for_completions();
+    });
+}
+
+void Ring::reap()
+{
+    std::lock_guard<std::mutex> lock(reap_mutex_);
+
+    for (;;)
+    {
+        unsigned head = *cq_head_;
+        unsigned tail = load_acquire(cq_tail_);
+        if (head == tail)
+        {
+            // Completions that didn't fit are held by the kernel until
+            // asked for.
+            if ((load_acquire(sq_flags_) & IORING_SQ_CQ_OVERFLOW) != 0 && enter(0, 0, IORING_ENTER_GETEVENTS) >= 0)
+            {
+                if (load_acquire(cq_tail_) != head)
+                {
+                    continue;
+                }
+            }
+            return;
+        }
+
+        for (; head != tail; ++head)
+        {
+            const auto& cqe = cqes_[head & cq_mask_];
+            auto* operation = reinterpret_cast<Operation*>(static_cast<uintptr_t>(cqe.user_data));
+            int result = cqe.res;
+            uint32_t flags = cqe.flags;
+            store_release(cq_head_, head + 1);
+
+            if ((flags & IORING_CQE_F_MORE) == 0)
+            {
+                in_flight_.fetch_sub(1, std::memory_order_relaxed);
+            }
+            operation->complete(result, flags);
+        }
+    }
+}
+
+void Ring::shutdown()
+{
+    if (events_ == nullptr)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(submit_mutex_);
+        draining_ = true;
+
+        int error = 0;
+        if (in_flight_.load() > 0)
+        {
+            if (auto* sqe = claim_sqe(error))
+            {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY | IORING_ASYNC_CANCEL_ALL;
+                sqe->user_data = reinterpret_cast<uintptr_t>(static_cast<Operation*>(&ignored_operation));
+                publish_sqe();
+                in_flight_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    for (;;)
+    {
+        complete_refused();
+
+        unsigned to_submit = 0;
+        {
+            std::lock_guard<std::mutex> lock(submit_mutex_);
+            if (in_flight_.load() == 0 && refused_.empty())
+            {
+                break;
+            }
+            to_submit = unsubmitted_;
+            unsubmitted_ = 0;
+        }
+
+        if (in_flight_.load() > 0)
+        {
+            int result = enter(to_submit, 1, IORING_ENTER_GETEVENTS);
+            if (result < 0 && result != -EBUSY && result != -EAGAIN)
+            {
+                log::error("IoUring: could not wait for cancelled operations", log::StringValue("error", errno_code(-result).message()));
+                break;
+            }
+            reap();
+        }
+    }
+
+    shut_down_.store(true, std::memory_order_release);
+    events_.reset();
+}
+
+} // namespace
+
+std::unique_ptr<IoUring> IoUring::create(asio::io_context& context)
+{
+    auto ring = std::make_shared<Ring>(context);
+
+    std::string failure;
+    if (!ring->init(failure))
+    {
+        log::info("IoUring: not available, using the reactor", log::StringValue("reason", failure));
+        ring->shutdown();
+        return nullptr;
+    }
+    return std::make_unique<UringService>(std::move(ring));
+}
+
+#else
+
+std::unique_ptr<IoUring> IoUring::create(asio::io_context& /* context */)
+{
+    return nullptr;
+}
+
+#endif // AMA_HAS_IO_URING
+
+} // namespace ama
@@ -0,0 +1,99 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "core/IConnection.h"
+#include "core/InplaceFunction.h"
+
+#include <memory>
+#include <system_error>
+
+#include <asio.hpp>
+
+namespace ama {
+
+/**
+ * @brief Stops a listener that is accepting through io_uring.
+ */
+class IoUringAcceptor
+{
+public:
+    virtual ~IoUringAcceptor() noexcept = default;
+
+    /**
+     * @brief Stops accepting; sockets accepted from now on are closed.
+     *
+     * The listening socket is closed once the last operation on it has
+     * completed.
+     */
+    virtual void close() = 0;
+};
+
+// Drives sockets with io_uring rather than through asio's reactor, on
+// Linux kernels that support everything it relies on: multishot accept
+// and receive (6.0), and a ring of provided buffers for them to receive
+// into.  Elsewhere, or on older kernels, create() returns null and
+// sockets stay with asio.
+//
+// Operations are queued from any thread and handed to the kernel together,
+// in one io_uring_enter(2), from a handler posted to the context - so that
+// every operation started by a run of handlers costs one system call
+// between them.  Completions are reaped on the context too, whenever the
+// eventfd registered with the ring says there are any, and each callback
+// is posted from there as a handler of its own, as asio's would be.
+//
+// The ring must be destroyed after its context has stopped running and
+// before the context itself is, like anything else with work on it.
+class IoUring
+{
+public:
+    using OpenCallback = InplaceFunction<void(std::shared_ptr<IConnection>, std::error_code)>;
+    using AcceptCallback = InplaceFunction<void(int)>;
+
+    /**
+     * @brief Sets up a ring whose completions are reaped on @p context.
+     *
+     * Returns null, having logged why, if the kernel can't do everything
+     * the ring needs of it.
+     */
+    static std::unique_ptr<IoUring> create(asio::io_context& context);
+
+    virtual ~IoUring() noexcept = default;
+
+    /**
+     * @brief Takes ownership of a connected socket.
+     */
+    virtual std::shared_ptr<IConnection> make_connection(int socket) = 0;
+
+    /**
+     * @brief Connects to each of @p endpoints in turn until one accepts,
+     *        as asio::async_connect does.
+     */
+    virtual void open(asio::ip::tcp::resolver::iterator endpoints, OpenCallback&& callback) = 0;
+
+    /**
+     * @brief Accepts connections on @p listener until the returned acceptor
+     *        is closed, handing each one's socket to @p callback.
+     *
+     * The listener must already be listening; the acceptor takes
+     * ownership of it.
+     */
+    virtual std::shared_ptr<IoUringAcceptor> accept(int listener, AcceptCallback&& callback) = 0;
+};
+
+} // namespace ama
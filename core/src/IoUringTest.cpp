@@ -0,0 +1,392 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "IoUringTest.h"
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <sys/socket.h>
+
+#include <QtTest>
+
+#include "IoUring.h"
+
+using namespace ama;
+
+namespace {
+
+using tcp = asio::ip::tcp;
+
+struct Outcome
+{
+    std::error_code ec;
+    size_t bytes;
+};
+
+// A context running on a thread of its own, and a ring reaping on it,
+// torn down in the order that the ring needs.
+class Rig
+{
+public:
+    Rig()
+        : context()
+        , ring(IoUring::create(context))
+        , work_(asio::make_work_guard(context))
+        , runner_([this] { context.run(); })
+    {}
+
+    ~Rig()
+    {
+        work_.reset();
+        context.stop();
+        runner_.join();
+        ring.reset();
+    }
+
+    asio::io_context context;
+    std::unique_ptr<IoUring> ring;
+
+private:
+    asio::executor_work_guard<asio::io_context::executor_type> work_;
+    std::thread runner_;
+};
+
+// Returns a plain socket, and a connection to it on the ring.
+std::pair<tcp::socket, std::shared_ptr<IConnection>> connected_pair(Rig& rig, asio::io_context& plain)
+{
+    tcp::acceptor acceptor(plain, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+
+    tcp::socket near(plain);
+    near.connect(acceptor.local_endpoint());
+
+    tcp::socket far(plain);
+    acceptor.accept(far);
+
+    return { std::move(near), rig.ring->make_connection(far.release()) };
+}
+
+std::string read_exactly(tcp::socket& socket, size_t length)
+{
+    std::string data(length, '\0');
+    asio::read(socket, asio::buffer(data));
+    return data;
+}
+
+Outcome wait(std::future<Outcome> future)
+{
+    if (future.wait_for(std::chrono::seconds(5)) != std::future_status::ready)
+    {
+        return { std::make_error_code(std::errc::timed_out), 0 };
+    }
+    return future.get();
+}
+
+Outcome read_some(IConnection& connection, QByteArrayView buffer)
+{
+    auto done = std::make_shared<std::promise<Outcome>>();
+    connection.async_read(buffer, [done](std::error_code ec, size_t bytes) { done->set_value({ ec, bytes }); });
+    return wait(done->get_future());
+}
+
+Outcome write_all(IConnection& connection, const std::vector<QByteArrayView>& buffers)
+{
+    auto done = std::make_shared<std::promise<Outcome>>();
+    connection.async_writev(buffers, [done](std::error_code ec, size_t bytes) { done->set_value({ ec, bytes }); });
+    return wait(done->get_future());
+}
+
+std::string pattern(size_t length)
+{
+    std::string data(length, '\0');
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = static_cast<char>(i * 7 + i / 4096);
+    }
+    return data;
+}
+
+} // namespace
+
+#define REQUIRE_RING(rig) \
+    if ((rig).ring == nullptr) \
+    { \
+        QSKIP("io_uring is not available here"); \
+    }
+
+void IoUringTest::reads_and_writes()
+{
+    Rig rig;
+    REQUIRE_RING(rig);
+
+    asio::io_context plain;
+    auto [peer, connection] = connected_pair(rig, plain);
+
+    asio::write(peer, asio::buffer(std::string("ping")));
+    char buffer[16];
+    auto read = read_some(*connection, QByteArrayView(buffer, sizeof(buffer)));
+    QVERIFY(!read.ec);
+    QCOMPARE(std::string(buffer, read.bytes), std::string("ping"));
+
+    auto written = write_all(*connection, { QByteArrayView("pong") });
+    QVERIFY(!written.ec);
+    QCOMPARE(written.bytes, size_t{4});
+    QCOMPARE(read_exactly(peer, 4), std::string("pong"));
+
+    QVERIFY(connection->is_reusable());
+}
+
+void IoUringTest::writes_gathered_buffers()
+{
+    Rig rig;
+    REQUIRE_RING(rig);
+
+    asio::io_context plain;
+    auto [peer, connection] = connected_pair(rig, plain);
+
+    auto written = write_all(*connection, { QByteArrayView("GET / HTTP/1.1\r\n"), QByteArrayView(), QByteArrayView("Host: a\r\n\r\n") });
+    QVERIFY(!written.ec);
+    QCOMPARE(written.bytes, size_t{27});
+    QCOMPARE(read_exactly(peer, 27), std::string("GET / HTTP/1.1\r\nHost: a\r\n\r\n"));
+}
+
+void IoUringTest::transfers_more_than_is_buffered()
+{
+    Rig rig;
+    REQUIRE_RING(rig);
+
+    asio::io_context plain;
+    auto [peer, connection] = connected_pair(rig, plain);
+
+    // Far more than the socket buffers hold, so that sends come up short,
+    // and the receiving side has to stop and start again as it is read.
+    auto upload = pattern(8 * 1024 * 1024);
+    std::thread writer([&] { asio::write(peer, asio::buffer(upload)); });
+
+    // Let it fill everything up before reading any of it.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    std::string received;
+    std::string buffer(64 * 1024, '\0');
+    while (received.size() < upload.size())
+    {
+        auto read = read_some(*connection, QByteArrayView(buffer.data(), buffer.size()));
+        QVERIFY(!read.ec);
+        QVERIFY(read.bytes > 0);
+        received.append(buffer.data(), read.bytes);
+    }
+    writer.join();
+    QVERIFY(received == upload);
+
+    auto download = pattern(8 * 1024 * 1024 + 3);
+    std::string echoed;
+    std::thread reader([&] { echoed = read_exactly(peer, download.size()); });
+    auto written = write_all(*connection, { QByteArrayView(download.data(), 3), QByteArrayView(download.data() + 3, download.size() - 3) });
+    reader.join();
+    QVERIFY(!written.ec);
+    QCOMPARE(written.bytes, download.size());
+    QVERIFY(echoed == download);
+}
+
+void IoUringTest::waits_until_readable()
+{
+    Rig rig;
+    REQUIRE_RING(rig);
+
+    asio::io_context plain;
+    auto [peer, connection] = connected_pair(rig, plain);
+
+    auto done = std::make_shared<std::promise<Outcome>>();
+    connection->async_wait_readable([done](std::error_code ec, size_t bytes) { done->set_value({ ec, bytes }); });
+
+    auto future = done->get_future();
+    QVERIFY(future.wait_for(std::chrono::milliseconds(50)) == std::future_status::timeout);
+
+    asio::write(peer, asio::buffer(std::string("hello")));
+    auto readable = wait(std::move(future));
+    QVERIFY(!readable.ec);
+    QVERIFY(readable.bytes > 0);
+
+    // Waiting consumes nothing.
+    char buffer[16];
+    auto read = read_some(*connection, QByteArrayView(buffer, sizeof(buffer)));
+    QVERIFY(!read.ec);
+    QCOMPARE(std::string(buffer, read.bytes), std::string("hello"));
+}
+
+void IoUringTest::reports_end_of_stream()
+{
+    Rig rig;
+    REQUIRE_RING(rig);
+
+    asio::io_context plain;
+    auto [peer, connection] = connected_pair(rig, plain);
+
+    asio::write(peer, asio::buffer(std::string("bye")));
+    peer.close();
+
+    char buffer[16];
+    auto read = read_some(*connection, QByteArrayView(buffer, sizeof(buffer)));
+    QVERIFY(!read.ec);
+    QCOMPARE(std::string(buffer, read.bytes), std::string("bye"));
+
+    read = read_some(*connection, QByteArrayView(buffer, sizeof(buffer)));
+    QVERIFY(read.ec == asio::error::eof);
+    QVERIFY(!connection->is_reusable());
+
+    // Readable, with nothing to read, is how a wait reports the same.
+    auto done = std::make_shared<std::promise<Outcome>>();
+    connection->async_wait_readable([done](std::error_code ec, size_t bytes) { done->set_value({ ec, bytes }); });
+    auto readable = wait(done->get_future());
+    QVERIFY(!readable.ec);
+    QCOMPARE(readable.bytes, size_t{0});
+}
+
+void IoUringTest::close_aborts_pending_read()
+{
+    Rig rig;
+    REQUIRE_RING(rig);
+
+    asio::io_context plain;
+    auto [peer, connection] = connected_pair(rig, plain);
+
+    char buffer[16];
+    auto done = std::make_shared<std::promise<Outcome>>();
+    connection->async_read(QByteArrayView(buffer, sizeof(buffer)), [done](std::error_code ec, size_t bytes) { done->set_value({ ec, bytes }); });
+
+    std::error_code ec;
+    connection->close(ec);
+    QVERIFY(!ec);
+
+    auto read = wait(done->get_future());
+    QVERIFY(read.ec == asio::error::operation_aborted);
+    QVERIFY(!connection->is_reusable());
+
+    // The peer hears of it straight away.
+    char byte;
+    QCOMPARE(::recv(peer.native_handle(), &byte, 1, 0), ssize_t{0});
+}
+
+void IoUringTest::accepts_connections()
+{
+    Rig rig;
+    REQUIRE_RING(rig);
+
+    asio::io_context plain;
+    tcp::acceptor listener(plain, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    auto endpoint = listener.local_endpoint();
+
+    std::mutex mutex;
+    std::vector<std::shared_ptr<IConnection>> accepted;
+    auto acceptor = rig.ring->accept(listener.release(), [&](int socket)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        accepted.push_back(rig.ring->make_connection(socket));
+    });
+
+    std::vector<tcp::socket> clients;
+    for (int i = 0; i < 3; ++i)
+    {
+        clients.emplace_back(plain);
+        clients.back().connect(endpoint);
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (accepted.size() == clients.size() || std::chrono::steady_clock::now() > deadline)
+            {
+                break;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    QCOMPARE(accepted.size(), clients.size());
+
+    // Each connection accepted is one of the clients'.
+    for (auto& client : clients)
+    {
+        asio::write(client, asio::buffer(std::string("x")));
+    }
+    for (auto& connection : accepted)
+    {
+        char byte;
+        auto read = read_some(*connection, QByteArrayView(&byte, 1));
+        QVERIFY(!read.ec);
+        QCOMPARE(byte, 'x');
+    }
+
+    acceptor->close();
+    acceptor.reset();
+}
+
+void IoUringTest::opens_connections()
+{
+    Rig rig;
+    REQUIRE_RING(rig);
+
+    asio::io_context plain;
+    tcp::acceptor listener(plain, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+
+    tcp::resolver resolver(plain);
+    auto endpoints = resolver.resolve(tcp::resolver::query("127.0.0.1", std::to_string(listener.local_endpoint().port())));
+
+    std::promise<std::pair<std::shared_ptr<IConnection>, std::error_code>> opened;
+    rig.ring->open(endpoints, [&opened](std::shared_ptr<IConnection> connection, std::error_code ec)
+    {
+        opened.set_value({ std::move(connection), ec });
+    });
+
+    tcp::socket peer(plain);
+    listener.accept(peer);
+
+    auto future = opened.get_future();
+    QVERIFY(future.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    auto [connection, ec] = future.get();
+    QVERIFY(!ec);
+    QVERIFY(connection != nullptr);
+
+    auto written = write_all(*connection, { QByteArrayView("hello") });
+    QVERIFY(!written.ec);
+    QCOMPARE(read_exactly(peer, 5), std::string("hello"));
+
+    // Nothing listening: every endpoint is refused.
+    auto port = listener.local_endpoint().port();
+    listener.close();
+    endpoints = resolver.resolve(tcp::resolver::query("127.0.0.1", std::to_string(port)));
+
+    std::promise<std::pair<std::shared_ptr<IConnection>, std::error_code>> refused;
+    rig.ring->open(endpoints, [&refused](std::shared_ptr<IConnection> connection, std::error_code ec)
+    {
+        refused.set_value({ std::move(connection), ec });
+    });
+
+    future = refused.get_future();
+    QVERIFY(future.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    auto [none, error] = future.get();
+    QVERIFY(none == nullptr);
+    QVERIFY(error == std::errc::connection_refused);
+}
+
+QTEST_GUILESS_MAIN(IoUringTest)
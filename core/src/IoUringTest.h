@@ -0,0 +1,38 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <QObject>
+
+class IoUringTest : public QObject
+{
+    Q_OBJECT
+
+public:
+    IoUringTest() = default;
+
+private Q_SLOTS:
+    void reads_and_writes();
+    void writes_gathered_buffers();
+    void transfers_more_than_is_buffered();
+    void waits_until_readable();
+    void reports_end_of_stream();
+    void close_aborts_pending_read();
+    void accepts_connections();
+    void opens_connections();
+};
@@ -0,0 +1,253 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "core/KnownHeader.h"
+
+#include <cstddef>
+#include <string_view>
+
+namespace ama {
+
+namespace {
+
+// Indexed by KnownHeader.  Each name is spelled as Headers::canonicalize()
+// would spell it, so that Headers::names() reads the same whether or not a
+// header is a known one.
+constexpr std::string_view kNames[] = {
+    {},
+    "Accept",
+    "Accept-Charset",
+    "Accept-Encoding",
+    "Accept-Language",
+    "Accept-Patch",
+    "Accept-Ranges",
+    "Access-Control-Allow-Credentials",
+    "Access-Control-Allow-Headers",
+    "Access-Control-Allow-Methods",
+    "Access-Control-Allow-Origin",
+    "Access-Control-Expose-Headers",
+    "Access-Control-Max-Age",
+    "Access-Control-Request-Headers",
+    "Access-Control-Request-Method",
+    "Age",
+    "Allow",
+    "Alt-Svc",
+    "Authorization",
+    "Cache-Control",
+    "Connection",
+    "Content-Disposition",
+    "Content-Encoding",
+    "Content-Language",
+    "Content-Length",
+    "Content-Location",
+    "Content-Range",
+    "Content-Security-Policy",
+    "Content-Type",
+    "Cookie",
+    "Date",
+    "Dnt",
+    "Etag",
+    "Expect",
+    "Expires",
+    "Forwarded",
+    "From",
+    "Host",
+    "If-Match",
+    "If-Modified-Since",
+    "If-None-Match",
+    "If-Range",
+    "If-Unmodified-Since",
+    "Keep-Alive",
+    "Last-Modified",
+    "Link",
+    "Location",
+    "Max-Forwards",
+    "Origin",
+    "Pragma",
+    "Proxy-Authenticate",
+    "Proxy-Authorization",
+    "Proxy-Connection",
+    "Range",
+    "Referer",
+    "Referrer-Policy",
+    "Refresh",
+    "Retry-After",
+    "Sec-Fetch-Dest",
+    "Sec-Fetch-Mode",
+    "Sec-Fetch-Site",
+    "Sec-Fetch-User",
+    "Server",
+    "Set-Cookie",
+    "Strict-Transport-Security",
+    "Te",
+    "Trailer",
+    "Transfer-Encoding",
+    "Upgrade",
+    "Upgrade-Insecure-Requests",
+    "User-Agent",
+    "Vary",
+    "Via",
+    "Warning",
+    "Www-Authenticate",
+    "X-Content-Type-Options",
+    "X-Forwarded-For",
+    "X-Forwarded-Host",
+    "X-Forwarded-Proto",
+    "X-Frame-Options",
+    "X-Requested-With",
+    "X-Xss-Protection",
+};
+
+static_assert(sizeof(kNames) / sizeof(kNames[0]) == kKnownHeaderCount, "kNames must have one entry per KnownHeader");
+
+// known_header() hashes a name into one of kSlotCount slots, each holding
+// the id of the only known header that can hash there.  The seed was found
+// by searching for one under which no two known names collide, which
+// build_slots() verifies; adding a header means finding a new seed.
+constexpr uint32_t kSeed = 954458;
+constexpr size_t kSlotCount = 256;
+
+constexpr size_t kShortestName = 2;  // Te
+constexpr size_t kLongestName = 32;  // Access-Control-Allow-Credentials
+
+// FNV-1a, over bytes folded to lower case.  Folding with | 0x20 also
+// changes some punctuation, which is harmless: it only ever sends a name
+// to the wrong slot, where the comparison below rejects it.
+template <typename Char>
+constexpr uint32_t hash(const Char* name, size_t length)
+{
+    uint32_t h = kSeed ^ 2166136261u;
+    for (size_t i = 0; i < length; ++i)
+    {
+        h ^= static_cast<uint8_t>(name[i] | 0x20);
+        h *= 16777619u;
+    }
+    h ^= h >> 15;
+    return h;
+}
+
+struct Slots
+{
+    uint8_t ids[kSlotCount];
+    bool perfect;
+};
+
+constexpr Slots build_slots()
+{
+    Slots table{};
+    table.perfect = true;
+    for (size_t id = 1; id < kKnownHeaderCount; ++id)
+    {
+        auto& slot = table.ids[hash(kNames[id].data(), kNames[id].size()) % kSlotCount];
+        if (slot != 0)
+        {
+            table.perfect = false;
+        }
+        slot = static_cast<uint8_t>(id);
+    }
+    return table;
+}
+
+constexpr Slots kSlots = build_slots();
+
+static_assert(kSlots.perfect, "kSeed no longer separates every known header name; find a new one");
+
+constexpr bool is_canonical(std::string_view name)
+{
+    bool first = true;
+    for (char c : name)
+    {
+        bool upper = c >= 'A' && c <= 'Z';
+        bool lower = c >= 'a' && c <= 'z';
+        if ((upper || lower) && upper != first)
+        {
+            return false;
+        }
+        first = c == '-';
+    }
+    return true;
+}
+
+constexpr bool all_canonical()
+{
+    for (size_t id = 1; id < kKnownHeaderCount; ++id)
+    {
+        if (!is_canonical(kNames[id]) || kNames[id].size() < kShortestName || kNames[id].size() > kLongestName)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(all_canonical(), "known header names must be spelled as Headers canonicalizes them");
+
+template <typename Char>
+KnownHeader lookup(const Char* name, size_t length)
+{
+    if (length < kShortestName || length > kLongestName)
+    {
+        return KnownHeader::Unknown;
+    }
+
+    uint8_t id = kSlots.ids[hash(name, length) % kSlotCount];
+    if (id == 0 || kNames[id].size() != length)
+    {
+        return KnownHeader::Unknown;
+    }
+
+    const auto& candidate = kNames[id];
+    for (size_t i = 0; i < length; ++i)
+    {
+        auto actual = static_cast<uint32_t>(name[i]);
+        auto expected = static_cast<uint32_t>(static_cast<unsigned char>(candidate[i]));
+        if (actual == expected)
+        {
+            continue;
+        }
+
+        // Known names are ASCII, so a case difference can only be a letter
+        // differing in the 0x20 bit.
+        bool is_letter = (expected | 0x20) >= 'a' && (expected | 0x20) <= 'z';
+        if (!is_letter || (actual | 0x20) != (expected | 0x20))
+        {
+            return KnownHeader::Unknown;
+        }
+    }
+
+    return static_cast<KnownHeader>(id);
+}
+
+} // namespace
+
+KnownHeader known_header(QByteArrayView name)
+{
+    return lookup(name.data(), static_cast<size_t>(name.size()));
+}
+
+KnownHeader known_header(QStringView name)
+{
+    return lookup(name.utf16(), static_cast<size_t>(name.size()));
+}
+
+QByteArrayView known_header_name(KnownHeader header)
+{
+    const auto& name = kNames[static_cast<size_t>(header)];
+    return QByteArrayView(name.data(), static_cast<qsizetype>(name.size()));
+}
+
+} // namespace ama
@@ -0,0 +1,77 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "KnownHeaderTest.h"
+
+#include "core/KnownHeader.h"
+
+#include <QByteArray>
+#include <QString>
+#include <QtTest>
+
+using namespace ama;
+
+void KnownHeaderTest::every_name_is_found()
+{
+    for (size_t i = 1; i < kKnownHeaderCount; ++i)
+    {
+        auto id = static_cast<KnownHeader>(i);
+        auto name = known_header_name(id);
+
+        QVERIFY(!name.isEmpty());
+        QCOMPARE(known_header(name), id);
+        QCOMPARE(known_header(QString::fromLatin1(name)), id);
+    }
+}
+
+void KnownHeaderTest::lookup_ignores_case()
+{
+    QCOMPARE(known_header(QByteArrayView("content-length")), KnownHeader::ContentLength);
+    QCOMPARE(known_header(QByteArrayView("CONTENT-LENGTH")), KnownHeader::ContentLength);
+    QCOMPARE(known_header(QByteArrayView("tRaNsFeR-eNcOdInG")), KnownHeader::TransferEncoding);
+    QCOMPARE(known_header(QByteArrayView("TE")), KnownHeader::Te);
+    QCOMPARE(known_header(QString("WWW-Authenticate")), KnownHeader::WwwAuthenticate);
+}
+
+void KnownHeaderTest::other_names_are_unknown()
+{
+    QCOMPARE(known_header(QByteArrayView("")), KnownHeader::Unknown);
+    QCOMPARE(known_header(QByteArrayView("H")), KnownHeader::Unknown);
+    QCOMPARE(known_header(QByteArrayView("Hos")), KnownHeader::Unknown);
+    QCOMPARE(known_header(QByteArrayView("Hosts")), KnownHeader::Unknown);
+    QCOMPARE(known_header(QByteArrayView("X-Custom-Header")), KnownHeader::Unknown);
+
+    // Folding case with | 0x20 turns CR into '-', so this hashes to the
+    // same slot as Content-Length; only the comparison can reject it.
+    QCOMPARE(known_header(QByteArrayView("Content\rLength")), KnownHeader::Unknown);
+    QCOMPARE(known_header(QByteArrayView("Content_Length")), KnownHeader::Unknown);
+
+    // Only ASCII letters match case-insensitively.
+    QCOMPARE(known_header(QByteArrayView("Ho\xd3t")), KnownHeader::Unknown);
+    QCOMPARE(known_header(QString::fromUtf8("H\xc3\xb6st")), KnownHeader::Unknown);
+
+    QString wide("Host");
+    wide[1] = QChar(char16_t(0x016F));
+    QCOMPARE(known_header(wide), KnownHeader::Unknown);
+}
+
+void KnownHeaderTest::unknown_has_no_name()
+{
+    QVERIFY(known_header_name(KnownHeader::Unknown).isEmpty());
+}
+
+QTEST_GUILESS_MAIN(KnownHeaderTest)
@@ -0,0 +1,47 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "core/MessageArena.h"
+
+namespace ama {
+
+MessageArena::MessageArena(std::pmr::memory_resource* upstream)
+    : resource_(inline_, sizeof(inline_), upstream)
+{}
+
+MessageArena::~MessageArena() = default;
+
+std::pmr::memory_resource* MessageArena::resource() noexcept
+{
+    return &resource_;
+}
+
+void MessageArena::release()
+{
+    resource_.release();
+}
+
+std::pmr::memory_resource* MessageArena::pooled_upstream()
+{
+    // Arenas ask for blocks of 4 KiB and up, doubling as they grow; a
+    // transaction's bookkeeping never needs anything near the largest
+    // pooled size.  Never destroyed, as arenas may be torn down during exit.
+    static auto pool = new std::pmr::synchronized_pool_resource(std::pmr::pool_options{ 0, 64 * 1024 });
+    return pool;
+}
+
+} // namespace ama
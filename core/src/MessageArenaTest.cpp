@@ -0,0 +1,157 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "MessageArenaTest.h"
+
+#include <cstring>
+#include <memory_resource>
+#include <string>
+
+#include <QtTest>
+
+#include "core/HttpMessageParser.h"
+#include "core/HttpMessageView.h"
+#include "core/MessageArena.h"
+
+using namespace ama;
+
+namespace {
+
+// Counts the blocks an arena draws from it, and how many are outstanding.
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+    size_t allocations = 0;
+    size_t outstanding = 0;
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        allocations++;
+        outstanding++;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override
+    {
+        outstanding--;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+bool lies_within(const void* p, const MessageArena& arena)
+{
+    auto address = static_cast<const char*>(p);
+    auto begin = reinterpret_cast<const char*>(&arena);
+    return address >= begin && address < begin + sizeof(arena);
+}
+
+} // namespace
+
+void MessageArenaTest::allocates_inside_the_arena_first()
+{
+    CountingResource upstream;
+    MessageArena arena(&upstream);
+
+    std::pmr::string text(arena.resource());
+    text.assign(200, 'x');
+
+    QVERIFY(lies_within(text.data(), arena));
+    QCOMPARE(upstream.allocations, size_t{0});
+}
+
+void MessageArenaTest::draws_blocks_from_upstream_when_full()
+{
+    CountingResource upstream;
+    MessageArena arena(&upstream);
+
+    auto first = arena.resource()->allocate(MessageArena::kInlineSize / 2);
+    QVERIFY(lies_within(first, arena));
+
+    auto second = arena.resource()->allocate(MessageArena::kInlineSize);
+    QVERIFY(!lies_within(second, arena));
+    QCOMPARE(upstream.allocations, size_t{1});
+}
+
+void MessageArenaTest::release_returns_blocks_upstream()
+{
+    CountingResource upstream;
+    {
+        MessageArena arena(&upstream);
+        for (int i = 0; i < 16; ++i)
+        {
+            QVERIFY(arena.resource()->allocate(MessageArena::kInlineSize) != nullptr);
+        }
+        QVERIFY(upstream.outstanding > 0);
+
+        arena.release();
+        QCOMPARE(upstream.outstanding, size_t{0});
+
+        // Still usable, starting over in its own buffer.
+        QVERIFY(lies_within(arena.resource()->allocate(64), arena));
+
+        QVERIFY(arena.resource()->allocate(MessageArena::kInlineSize) != nullptr);
+        QVERIFY(upstream.outstanding > 0);
+    }
+    QCOMPARE(upstream.outstanding, size_t{0});
+}
+
+void MessageArenaTest::views_and_parsers_allocate_from_the_arena()
+{
+    // More headers than the view expects, so its field list has to grow
+    // past what fits in the arena itself.
+    std::string text = "GET http://example.com/ HTTP/1.1\r\nHost: example.com\r\n";
+    for (int i = 0; i < 100; ++i)
+    {
+        text += "X-Header-" + std::to_string(i) + ": value " + std::to_string(i) + "\r\n";
+    }
+    text += "\r\n";
+
+    CountingResource upstream;
+    MessageArena arena(&upstream);
+    {
+        HttpMessageView view(arena.resource());
+        auto buffer = view.prepare(static_cast<qsizetype>(text.size()));
+        std::memcpy(const_cast<char*>(buffer.data()), text.data(), text.size());
+        view.commit(static_cast<qsizetype>(text.size()));
+
+        HttpMessageParser parser(arena.resource());
+        parser.resetForRequest();
+
+        auto phase = ParsePhase::Start;
+        auto state = HttpMessageParser::Incomplete;
+        while (state == HttpMessageParser::Incomplete && view.parsed_size() != view.data().size())
+        {
+            state = parser.parse(view, phase);
+        }
+
+        QCOMPARE(state, HttpMessageParser::Valid);
+        QCOMPARE(view.header_count(), qsizetype{101});
+        QCOMPARE(view.header("X-Header-99"), QByteArrayView("value 99"));
+        QVERIFY(upstream.allocations > 0);
+    }
+
+    arena.release();
+    QCOMPARE(upstream.outstanding, size_t{0});
+}
+
+QTEST_GUILESS_MAIN(MessageArenaTest)
@@ -0,0 +1,34 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <QObject>
+
+class MessageArenaTest : public QObject
+{
+    Q_OBJECT
+
+public:
+    MessageArenaTest() = default;
+
+private Q_SLOTS:
+    void allocates_inside_the_arena_first();
+    void draws_blocks_from_upstream_when_full();
+    void release_returns_blocks_upstream();
+    void views_and_parsers_allocate_from_the_arena();
+};
@@ -0,0 +1,248 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// core_bench_object_pool: measures ObjectPool acquire/release throughput
+// as more threads share one pool, next to a pool built the way ObjectPool
+// used to be - one mutex around a stack, and a shared_ptr per lease.
+//
+// Usage: core_bench_object_pool [--json] [--filter TEXT] [--min-time SECONDS] [--max-threads N]
+//
+// Each case runs with 1, 2, 4, ... threads, up to --max-threads (the
+// number of hardware threads by default).  In the "loop" pattern a thread
+// returns each object before taking the next; in "burst" it takes 32 at a
+// time, more than fit in its magazine, then returns them all.  Options
+// and output are those of every benchmark; see
+// cmake/benchmark/BenchmarkHarness.h.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <stack>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/ObjectPool.h"
+
+#include "BenchmarkHarness.h"
+
+using namespace ama;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kBurstSize = 32;
+
+struct Block
+{
+    Block()
+    {}
+
+    char bytes[4096];
+};
+
+// ObjectPool as it was: every acquire and release takes the one mutex,
+// and every lease allocates a shared_ptr control block.
+template <typename T>
+class LockedPool
+{
+public:
+    using pool_ptr = std::shared_ptr<T>;
+
+    LockedPool()
+        : self_(std::make_shared<LockedPool*>(this))
+    {}
+
+    pool_ptr acquire()
+    {
+        std::weak_ptr<LockedPool*> self = self_;
+        auto deleter = [self](T* object)
+        {
+            if (auto pool = self.lock())
+            {
+                (*pool)->release(std::unique_ptr<T>(object));
+            }
+            else
+            {
+                delete object;
+            }
+        };
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!idle_.empty())
+            {
+                pool_ptr result(idle_.top().release(), deleter);
+                idle_.pop();
+                return result;
+            }
+        }
+        return pool_ptr(new T(), deleter);
+    }
+
+private:
+    void release(std::unique_ptr<T> object)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        idle_.push(std::move(object));
+    }
+
+    std::shared_ptr<LockedPool*> self_;
+    std::stack<std::unique_ptr<T>> idle_;
+    std::mutex mutex_;
+};
+
+// Runs one acquire/release pattern on every thread until min_time has
+// passed, checking the clock only between batches so that it stays out of
+// the measurement.
+template <typename Pool>
+void run(const std::string& name, bool burst, unsigned num_threads, BenchmarkHarness& harness)
+{
+    constexpr uint64_t kBatch = 4096;
+
+    Pool pool;
+    std::atomic<unsigned> ready{0};
+    std::atomic<bool> go{false};
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> operations{0};
+
+    auto work = [&]
+    {
+        std::vector<typename Pool::pool_ptr> held;
+        held.reserve(kBurstSize);
+
+        ready++;
+        while (!go.load(std::memory_order_acquire))
+        {
+            std::this_thread::yield();
+        }
+
+        uint64_t count = 0;
+        do
+        {
+            for (uint64_t i = 0; i < kBatch; i += kBurstSize)
+            {
+                if (burst)
+                {
+                    for (size_t j = 0; j < kBurstSize; ++j)
+                    {
+                        held.push_back(pool.acquire());
+                        held.back()->bytes[0] = static_cast<char>(j);
+                    }
+                    held.clear();
+                }
+                else
+                {
+                    for (size_t j = 0; j < kBurstSize; ++j)
+                    {
+                        auto object = pool.acquire();
+                        object->bytes[0] = static_cast<char>(j);
+                    }
+                }
+            }
+            count += kBatch;
+        }
+        while (!stop.load(std::memory_order_relaxed));
+
+        operations += count;
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back(work);
+    }
+    while (ready.load() < num_threads)
+    {
+        std::this_thread::yield();
+    }
+
+    auto start = Clock::now();
+    go.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::duration<double>(harness.min_time()));
+    stop.store(true);
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    double operations_per_second = seconds > 0 ? operations.load() / seconds : 0;
+    harness.add_result({
+        name,
+        num_threads,
+        operations.load(),
+        seconds,
+        operations_per_second,
+        operations_per_second / num_threads,
+    });
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    BenchmarkHarness harness("core_bench_object_pool");
+    harness.add_option("--max-threads", "N", [&max_threads](const char* value)
+    {
+        max_threads = static_cast<unsigned>(std::strtoul(value, nullptr, 10));
+        return max_threads > 0;
+    });
+    harness.set_columns({
+        { "case", "case", 20, 0, true },
+        { "threads", "threads", 8 },
+        { "operations", nullptr, 0 },
+        { "seconds", nullptr, 0 },
+        { "operations_per_second", "ops/s", 16 },
+        { nullptr, "ops/s/thread", 16 },
+    });
+
+    if (!harness.parse_args(argc, argv))
+    {
+        return 2;
+    }
+
+    for (bool burst : { false, true })
+    {
+        std::string suffix = burst ? "_burst" : "_loop";
+        for (unsigned threads = 1; ; threads = std::min(threads * 2, max_threads))
+        {
+            if (harness.selected("locked" + suffix))
+            {
+                run<LockedPool<Block>>("locked" + suffix, burst, threads, harness);
+            }
+            if (harness.selected("pool" + suffix))
+            {
+                run<ObjectPool<Block>>("pool" + suffix, burst, threads, harness);
+            }
+            if (threads == max_threads)
+            {
+                break;
+            }
+        }
+    }
+
+    harness.report();
+    return 0;
+}
@@ -0,0 +1,278 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "ObjectPoolTest.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <QtTest>
+
+#include "core/ObjectPool.h"
+
+using namespace ama;
+
+namespace {
+
+std::atomic<int> g_live{0};
+
+struct Counted
+{
+    Counted()
+    {
+        g_live++;
+    }
+
+    ~Counted()
+    {
+        g_live--;
+    }
+
+    int value = 0;
+};
+
+} // namespace
+
+void ObjectPoolTest::starts_with_min_idle()
+{
+    {
+        ObjectPool<Counted> pool(3);
+        QCOMPARE(pool.num_idle(), size_t{3});
+        QCOMPARE(pool.num_borrowed(), size_t{0});
+        QCOMPARE(g_live.load(), 3);
+    }
+    QCOMPARE(g_live.load(), 0);
+}
+
+void ObjectPoolTest::reuses_released_objects()
+{
+    ObjectPool<Counted> pool;
+
+    auto first = pool.acquire();
+    QCOMPARE(pool.num_borrowed(), size_t{1});
+    first->value = 42;
+    Counted* object = first.get();
+
+    first.reset();
+    QVERIFY(!first);
+    QCOMPARE(pool.num_borrowed(), size_t{0});
+    QCOMPARE(pool.num_idle(), size_t{1});
+
+    auto second = pool.acquire();
+    QCOMPARE(second.get(), object);
+    QCOMPARE((*second).value, 42);
+    QCOMPARE(pool.num_idle(), size_t{0});
+    QCOMPARE(g_live.load(), 1);
+}
+
+void ObjectPoolTest::frees_objects_over_max()
+{
+    {
+        ObjectPool<Counted> pool(0, 2);
+
+        std::vector<ObjectPool<Counted>::pool_ptr> handles;
+        for (int i = 0; i < 5; ++i)
+        {
+            handles.push_back(pool.acquire());
+        }
+        QCOMPARE(pool.num_borrowed(), size_t{5});
+        QCOMPARE(g_live.load(), 5);
+
+        handles.clear();
+        QCOMPARE(pool.num_borrowed(), size_t{0});
+        QCOMPARE(pool.num_idle(), size_t{2});
+        QCOMPARE(g_live.load(), 2);
+    }
+    QCOMPARE(g_live.load(), 0);
+}
+
+void ObjectPoolTest::moved_handles_are_empty()
+{
+    ObjectPool<Counted> pool;
+
+    auto first = pool.acquire();
+    Counted* object = first.get();
+
+    auto second = std::move(first);
+    QVERIFY(!first);
+    QCOMPARE(first.get(), static_cast<Counted*>(nullptr));
+    QCOMPARE(second.get(), object);
+
+    ObjectPool<Counted>::pool_ptr third;
+    third = std::move(second);
+    QVERIFY(!second);
+    QCOMPARE(third.get(), object);
+    QCOMPARE(pool.num_borrowed(), size_t{1});
+}
+
+void ObjectPoolTest::detached_handles_reattach()
+{
+    ObjectPool<Counted> pool;
+
+    auto handle = pool.acquire();
+    Counted* object = handle.get();
+
+    void* token = handle.detach();
+    QVERIFY(!handle);
+    QCOMPARE(pool.num_borrowed(), size_t{1});
+
+    auto again = ObjectPool<Counted>::pool_ptr::attach(token);
+    QCOMPARE(again.get(), object);
+
+    again.reset();
+    QCOMPARE(pool.num_borrowed(), size_t{0});
+    QCOMPARE(pool.num_idle(), size_t{1});
+}
+
+void ObjectPoolTest::handles_outlive_pool()
+{
+    ObjectPool<Counted>::pool_ptr survivor;
+    {
+        ObjectPool<Counted> pool(2);
+        survivor = pool.acquire();
+        QCOMPARE(g_live.load(), 2);
+    }
+
+    // The idle one went with the pool; the borrowed one is freed on return.
+    QCOMPARE(g_live.load(), 1);
+    survivor->value = 7;
+    survivor.reset();
+    QCOMPARE(g_live.load(), 0);
+}
+
+void ObjectPoolTest::magazine_overflows_to_shared_stack()
+{
+    ObjectPool<Counted> pool(0, ObjectPool<Counted>::default_pool_max, 2);
+
+    std::vector<ObjectPool<Counted>::pool_ptr> handles;
+    for (int i = 0; i < 10; ++i)
+    {
+        handles.push_back(pool.acquire());
+    }
+    handles.clear();
+    QCOMPARE(pool.num_idle(), size_t{10});
+
+    // Everything comes back out, from the magazine and the shared stack
+    // alike, before anything new is made.
+    for (int i = 0; i < 10; ++i)
+    {
+        handles.push_back(pool.acquire());
+    }
+    QCOMPARE(pool.num_idle(), size_t{0});
+    QCOMPARE(g_live.load(), 10);
+}
+
+void ObjectPoolTest::releases_across_threads()
+{
+    constexpr int kThreads = 4;
+    constexpr int kIterations = 20000;
+
+    {
+        ObjectPool<Counted> pool(0, 64);
+
+        // Each thread returns what the previous one acquired, so objects
+        // move between magazines and the shared stack in every direction.
+        std::vector<std::thread> threads;
+        for (int t = 0; t < kThreads; ++t)
+        {
+            threads.emplace_back([&pool]
+            {
+                std::vector<ObjectPool<Counted>::pool_ptr> held;
+                for (int i = 0; i < kIterations; ++i)
+                {
+                    auto handle = pool.acquire();
+                    handle->value++;
+                    held.push_back(std::move(handle));
+                    if (held.size() > static_cast<size_t>(i % 24))
+                    {
+                        held.clear();
+                    }
+                }
+            });
+        }
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        QCOMPARE(pool.num_borrowed(), size_t{0});
+        QVERIFY(pool.num_idle() <= 64);
+    }
+
+    // The threads' magazines were emptied as they exited.
+    QCOMPARE(g_live.load(), 0);
+}
+
+void ObjectPoolTest::pool_dies_while_threads_flush()
+{
+    constexpr int kThreads = 4;
+    constexpr int kRounds = 50;
+
+    for (int round = 0; round < kRounds; ++round)
+    {
+        auto pool = std::make_unique<ObjectPool<Counted>>(0, 4096);
+        std::atomic<int> ready{0};
+        std::atomic<bool> go{false};
+
+        // Each thread's handles fill its magazine and spill onto the shared
+        // stack.  Once the pool is going away, the threads give them back
+        // and exit, so that releases, magazine flushes and the pool's own
+        // drain all empty the stack at once.
+        std::vector<std::thread> threads;
+        for (int t = 0; t < kThreads; ++t)
+        {
+            threads.emplace_back([&]
+            {
+                std::vector<ObjectPool<Counted>::pool_ptr> held;
+                for (int i = 0; i < 512; ++i)
+                {
+                    held.push_back(pool->acquire());
+                }
+                for (int i = 0; i < 256; ++i)
+                {
+                    held.pop_back();
+                }
+
+                ready++;
+                while (!go.load())
+                {
+                    std::this_thread::yield();
+                }
+                held.clear();
+            });
+        }
+
+        while (ready.load() < kThreads)
+        {
+            std::this_thread::yield();
+        }
+        go.store(true);
+        pool.reset();
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    QCOMPARE(g_live.load(), 0);
+}
+
+QTEST_GUILESS_MAIN(ObjectPoolTest)
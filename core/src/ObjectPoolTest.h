@@ -0,0 +1,39 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <QObject>
+
+class ObjectPoolTest : public QObject
+{
+    Q_OBJECT
+
+public:
+    ObjectPoolTest() = default;
+
+private Q_SLOTS:
+    void starts_with_min_idle();
+    void reuses_released_objects();
+    void frees_objects_over_max();
+    void moved_handles_are_empty();
+    void detached_handles_reattach();
+    void handles_outlive_pool();
+    void magazine_overflows_to_shared_stack();
+    void releases_across_threads();
+    void pool_dies_while_threads_flush();
+};
@@ -24,11 +24,33 @@
 
 namespace ama {
 
+namespace {
+
+Qt::ConnectionType connection_type(Proxy::Dispatch dispatch)
+{
+    return dispatch == Proxy::Dispatch::IoThread ? Qt::DirectConnection : Qt::AutoConnection;
+}
+
+} // namespace
+
 Proxy::Proxy(const int port, QObject* parent)
+    : Proxy(port, 0, parent)
+{
+}
+
+Proxy::Proxy(const int port, const int num_threads, QObject* parent)
+    : Proxy(port, num_threads, IoBackend::Reactor, parent)
+{
+}
+
+Proxy::Proxy(const int port, const int num_threads, IoBackend backend, QObject* parent)
     : QObject(parent)
     , port_(port)
-    , server_(new Server(port, this))
+    , server_(new Server(port, num_threads, backend, this))
     , next_id_(1)
+    , dispatch_(Dispatch::OwnerThread)
+    , capture_policy_mutex_()
+    , capture_policy_()
 {
 }
 
@@ -44,7 +66,7 @@ void Proxy::disable()
 
 void Proxy::init()
 {
-    connect(server_, &Server::connection_established, this, &Proxy::on_client_connected);
+    connect(server_, &Server::connection_established, this, &Proxy::on_client_connected, connection_type(dispatch_));
 }
 
 void Proxy::deinit()
@@ -57,9 +79,53 @@ int Proxy::port() const
     return port_;
 }
 
+bool Proxy::uses_io_uring() const
+{
+    return server_->uses_io_uring();
+}
+
+void Proxy::set_dispatch(Dispatch dispatch)
+{
+    dispatch_ = dispatch;
+}
+
+Proxy::Dispatch Proxy::dispatch() const
+{
+    return dispatch_;
+}
+
+void Proxy::set_capture_policy(const CapturePolicy& policy)
+{
+    std::lock_guard<std::mutex> lock{capture_policy_mutex_};
+    capture_policy_ = policy;
+}
+
+CapturePolicy Proxy::capture_policy() const
+{
+    std::lock_guard<std::mutex> lock{capture_policy_mutex_};
+    return capture_policy_;
+}
+
 void Proxy::on_client_connected(const std::shared_ptr<IConnection>& conn)
+{
+    start_transaction(conn, QByteArray());
+}
+
+void Proxy::on_next_request_pending(const std::shared_ptr<IConnection>& conn, const QByteArray& pipelined)
+{
+    start_transaction(conn, pipelined);
+}
+
+void Proxy::start_transaction(const std::shared_ptr<IConnection>& conn, const QByteArray& pipelined)
 {
     auto tx = QSharedPointer<ama::Transaction>::create(next_id_++, server_->connection_pool(), conn);
+    tx->set_capture_policy(capture_policy());
+    tx->set_pipelined_input(pipelined);
+
+    // Each request on a persistent connection gets its own transaction,
+    // started the same way as the connection's first one.
+    connect(tx.get(), &Transaction::on_next_request_pending, this, &Proxy::on_next_request_pending, connection_type(dispatch_));
+
     emit transactionStarted(tx);
     tx->begin();
 }
@@ -0,0 +1,542 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// core_bench_proxy: drives an ama::Proxy with many concurrent keep-alive
+// clients, all over loopback, against a minimal origin server in the same
+// process, and reports the requests per second that make it through, how
+// long they took, and how many allocations each one cost.
+//
+// Usage: core_bench_proxy [--json] [--filter TEXT] [--min-time SECONDS]
+//                         [--connections N] [--port N]
+//                         [--io-backend reactor|io_uring]
+//
+// The numbers reflect whichever way the proxy's transactions are driven -
+// callbacks, or coroutines when configured with USE_COROUTINES - so
+// comparing the two means running a build of each on the same machine.
+// Sockets are driven with asio's reactor, or with io_uring given
+// --io-backend io_uring and a kernel that supports it; the report names
+// whichever did the work.  Options and output are otherwise those of
+// every benchmark; see cmake/benchmark/BenchmarkHarness.h.
+//
+// Allocations are counted through operator new across the whole process,
+// the clients' and origin's included; theirs are few, and the same from
+// one build to the next.  Qt allocates its containers with malloc, so
+// their buffers aren't counted.  Only warnings and errors are logged, as
+// formatting debug events would otherwise cost more than the proxying.
+
+#include <asio.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QMetaObject>
+
+#include "core/Proxy.h"
+#include "log/Log.h"
+
+#include "BenchmarkHarness.h"
+
+using namespace ama;
+
+namespace {
+
+std::atomic<uint64_t> allocations{0};
+
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using tcp = asio::ip::tcp;
+
+// Threads shared by the clients and the origin.  The proxy runs on its
+// own workers, as it would in the app.
+constexpr int kLoadThreads = 2;
+
+// How long a run may take past its min-time before it is given up as
+// stuck.
+constexpr std::chrono::seconds kStallTimeout{30};
+
+// Latencies are tallied in one-microsecond buckets, the last of which
+// takes everything slower.
+constexpr size_t kLatencyBuckets = 100000;
+
+struct Scenario
+{
+    const char* name;
+    size_t body_size;
+};
+
+const char* io_backend()
+{
+#if defined(ASIO_HAS_EPOLL)
+    return "epoll";
+#elif defined(ASIO_HAS_KQUEUE)
+    return "kqueue";
+#elif defined(ASIO_HAS_IOCP)
+    return "iocp";
+#else
+    return "select";
+#endif
+}
+
+const char* transaction_driver()
+{
+#if defined(AMA_USE_COROUTINES)
+    return "coroutines";
+#else
+    return "callbacks";
+#endif
+}
+
+// Answers every request on a connection with the same response, until the
+// client hangs up.
+class OriginSession : public std::enable_shared_from_this<OriginSession>
+{
+public:
+    OriginSession(tcp::socket socket, std::shared_ptr<const std::string> response)
+        : socket_(std::move(socket))
+        , response_(std::move(response))
+    {}
+
+    void read_request()
+    {
+        auto self = shared_from_this();
+        asio::async_read_until(socket_, asio::dynamic_buffer(buffer_), "\r\n\r\n", [self](std::error_code ec, size_t head_size)
+        {
+            if (ec)
+            {
+                return;
+            }
+
+            self->buffer_.erase(0, head_size);
+            asio::async_write(self->socket_, asio::buffer(*self->response_), [self](std::error_code ec, size_t)
+            {
+                if (!ec)
+                {
+                    self->read_request();
+                }
+            });
+        });
+    }
+
+private:
+    tcp::socket socket_;
+    std::shared_ptr<const std::string> response_;
+    std::string buffer_;
+};
+
+class Origin
+{
+public:
+    Origin(asio::io_context& context, size_t body_size)
+        : acceptor_(context, tcp::endpoint(asio::ip::address_v4::loopback(), 0))
+        , response_(std::make_shared<const std::string>(
+                        "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: application/octet-stream\r\n"
+                        "Content-Length: " + std::to_string(body_size) + "\r\n"
+                        "\r\n" + std::string(body_size, 'x')))
+    {
+        accept();
+    }
+
+    unsigned short port() const
+    {
+        return acceptor_.local_endpoint().port();
+    }
+
+private:
+    void accept()
+    {
+        acceptor_.async_accept([this](std::error_code ec, tcp::socket socket)
+        {
+            if (ec)
+            {
+                return;
+            }
+
+            std::make_shared<OriginSession>(std::move(socket), response_)->read_request();
+            accept();
+        });
+    }
+
+    tcp::acceptor acceptor_;
+    std::shared_ptr<const std::string> response_;
+};
+
+struct Load
+{
+    Clock::time_point deadline;
+    std::atomic<uint64_t> completed{0};
+    std::atomic<int> running{0};
+    std::atomic_bool failed{false};
+    std::promise<void> done;
+
+    // Allocated up front, so that recording a latency doesn't allocate.
+    std::unique_ptr<std::array<std::atomic<uint64_t>, kLatencyBuckets>> latencies{new std::array<std::atomic<uint64_t>, kLatencyBuckets>{}};
+
+    void record_latency(Clock::duration latency)
+    {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+        auto bucket = std::min(static_cast<size_t>(us), kLatencyBuckets - 1);
+        (*latencies)[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // The latency, in microseconds, that the given fraction of requests
+    // came in under.
+    uint64_t latency_percentile(double fraction) const
+    {
+        auto target = static_cast<uint64_t>(fraction * completed);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kLatencyBuckets; ++i)
+        {
+            seen += (*latencies)[i];
+            if (seen > target)
+            {
+                return i;
+            }
+        }
+        return kLatencyBuckets - 1;
+    }
+};
+
+// One keep-alive client, sending a request as soon as the previous
+// response is in, until the deadline has passed.
+class Client : public std::enable_shared_from_this<Client>
+{
+public:
+    Client(asio::io_context& context, const std::string& request, Load& load)
+        : socket_(context)
+        , request_(request)
+        , load_(load)
+    {}
+
+    void start(const tcp::endpoint& proxy)
+    {
+        auto self = shared_from_this();
+        socket_.async_connect(proxy, [self](std::error_code ec)
+        {
+            if (ec)
+            {
+                self->finish(ec);
+                return;
+            }
+
+            self->send_request();
+        });
+    }
+
+private:
+    void send_request()
+    {
+        sent_at_ = Clock::now();
+
+        auto self = shared_from_this();
+        asio::async_write(socket_, asio::buffer(request_), [self](std::error_code ec, size_t)
+        {
+            if (ec)
+            {
+                self->finish(ec);
+                return;
+            }
+
+            self->read_head();
+        });
+    }
+
+    void read_head()
+    {
+        auto self = shared_from_this();
+        asio::async_read_until(socket_, asio::dynamic_buffer(buffer_), "\r\n\r\n", [self](std::error_code ec, size_t head_size)
+        {
+            if (ec)
+            {
+                self->finish(ec);
+                return;
+            }
+
+            static const std::string kContentLength = "Content-Length: ";
+            auto at = self->buffer_.find(kContentLength);
+            if (at == std::string::npos || at > head_size)
+            {
+                self->finish(asio::error::invalid_argument);
+                return;
+            }
+
+            self->response_size_ = head_size + std::strtoull(self->buffer_.c_str() + at + kContentLength.size(), nullptr, 10);
+            self->read_body();
+        });
+    }
+
+    void read_body()
+    {
+        if (buffer_.size() >= response_size_)
+        {
+            response_received();
+            return;
+        }
+
+        auto self = shared_from_this();
+        asio::async_read(socket_, asio::dynamic_buffer(buffer_), asio::transfer_exactly(response_size_ - buffer_.size()),
+                         [self](std::error_code ec, size_t)
+        {
+            if (ec)
+            {
+                self->finish(ec);
+                return;
+            }
+
+            self->response_received();
+        });
+    }
+
+    void response_received()
+    {
+        buffer_.erase(0, response_size_);
+        load_.record_latency(Clock::now() - sent_at_);
+        load_.completed++;
+
+        if (Clock::now() < load_.deadline)
+        {
+            send_request();
+        }
+        else
+        {
+            finish({});
+        }
+    }
+
+    void finish(std::error_code ec)
+    {
+        if (ec)
+        {
+            std::cerr << "core_bench_proxy: client failed: " << ec.message() << std::endl;
+            load_.failed = true;
+        }
+
+        std::error_code ignored;
+        socket_.close(ignored);
+
+        if (--load_.running == 0)
+        {
+            load_.done.set_value();
+        }
+    }
+
+    tcp::socket socket_;
+    const std::string& request_;
+    Load& load_;
+    std::string buffer_;
+    size_t response_size_ = 0;
+    Clock::time_point sent_at_;
+};
+
+bool run(const Scenario& scenario, int connections, int port, BenchmarkHarness& harness)
+{
+    asio::io_context context;
+    Origin origin(context, scenario.body_size);
+
+    std::string authority = "127.0.0.1:" + std::to_string(origin.port());
+    std::string request =
+            "GET http://" + authority + "/ HTTP/1.1\r\n"
+            "Host: " + authority + "\r\n"
+            "\r\n";
+
+    Load load;
+    load.running = connections;
+    auto finished = load.done.get_future();
+
+    auto start = Clock::now();
+    load.deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(harness.min_time()));
+
+    tcp::endpoint proxy(asio::ip::address_v4::loopback(), static_cast<unsigned short>(port));
+    for (int i = 0; i < connections; ++i)
+    {
+        std::make_shared<Client>(context, request, load)->start(proxy);
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(kLoadThreads);
+
+    auto allocations_before = allocations.load();
+    for (int i = 0; i < kLoadThreads; ++i)
+    {
+        threads.emplace_back([&context] { context.run(); });
+    }
+
+    bool completed = finished.wait_until(load.deadline + kStallTimeout) == std::future_status::ready;
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    auto allocations_during = allocations.load() - allocations_before;
+
+    context.stop();
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    if (!completed)
+    {
+        std::cerr << "core_bench_proxy: " << scenario.name << " stalled" << std::endl;
+        return false;
+    }
+
+    if (load.failed)
+    {
+        return false;
+    }
+
+    uint64_t requests = load.completed;
+    double requests_per_second = seconds > 0 ? requests / seconds : 0;
+    harness.add_result({
+        scenario.name,
+        connections,
+        scenario.body_size,
+        requests,
+        seconds,
+        requests_per_second,
+        requests_per_second * scenario.body_size / 1e6,
+        allocations_during,
+        requests > 0 ? static_cast<double>(allocations_during) / requests : 0.0,
+        load.latency_percentile(0.50),
+        load.latency_percentile(0.99),
+    });
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    int connections = 64;
+    int port = 18480;
+    IoBackend backend = IoBackend::Reactor;
+
+    BenchmarkHarness harness("core_bench_proxy");
+    harness.add_option("--connections", "N", [&connections](const char* value)
+    {
+        connections = std::atoi(value);
+        return connections > 0;
+    });
+    harness.add_option("--port", "N", [&port](const char* value)
+    {
+        port = std::atoi(value);
+        return true;
+    });
+    harness.add_option("--io-backend", "reactor|io_uring", [&backend](const char* value)
+    {
+        std::string name(value);
+        if (name == "reactor")
+        {
+            backend = IoBackend::Reactor;
+            return true;
+        }
+        if (name == "io_uring")
+        {
+            backend = IoBackend::IoUring;
+            return true;
+        }
+        return false;
+    });
+    harness.set_columns({
+        { "scenario", "scenario", 20, 0, true },
+        { nullptr, "conns", 8 },
+        { "bytes", "bytes", 10 },
+        { "requests", "requests", 12 },
+        { "seconds", nullptr, 0 },
+        { "requests_per_second", "req/s", 14, 0 },
+        { "mb_per_second", "MB/s", 12, 1 },
+        { "allocations", nullptr, 0 },
+        { "allocations_per_request", "allocs/req", 12, 1 },
+        { "p50_us", "p50 us", 10 },
+        { "p99_us", "p99 us", 10 },
+    });
+
+    if (!harness.parse_args(argc, argv))
+    {
+        return 2;
+    }
+
+    log::set_min_severity(log::Severity::Warn);
+
+    // The proxy hands new connections and requests to the thread it lives
+    // on, as it does in the app, so that thread has to run an event loop.
+    QCoreApplication app(argc, argv);
+    Proxy proxy(port, 0, backend);
+    proxy.init();
+
+    harness.add_property("backend", proxy.uses_io_uring() ? "io_uring" : io_backend());
+    harness.add_property("transactions", transaction_driver());
+    harness.add_property("connections", connections);
+
+    const Scenario scenarios[] = {
+        { "small_response", 128 },
+        { "large_response", 64 * 1024 },
+    };
+
+    bool ok = true;
+
+    std::thread driver([&]
+    {
+        for (const auto& scenario : scenarios)
+        {
+            if (harness.selected(scenario.name))
+            {
+                ok = run(scenario, connections, port, harness) && ok;
+            }
+        }
+
+        QMetaObject::invokeMethod(QCoreApplication::instance(), [] { QCoreApplication::quit(); }, Qt::QueuedConnection);
+    });
+
+    app.exec();
+    driver.join();
+
+    harness.report();
+    return ok ? 0 : 1;
+}
@@ -17,9 +17,8 @@
 
 #include "core/Request.h"
 
-#include <QTextStream>
-
-#include <sstream>
+#include <string>
+#include <string_view>
 #include <utility>
 
 namespace ama {
@@ -36,37 +35,61 @@ Request::Request(HttpMessage &&message)
 
 const QByteArray Request::format() const noexcept
 {
-    QString result;
-    QTextStream ds(&result);
+    QByteArray result = format_head();
+
+    if (body().size() > 0)
+    {
+        result.append(body());
+    }
+
+    return result;
+}
+
+const QByteArray Request::format_head() const noexcept
+{
+    QByteArray result;
+    auto append = [&result](std::string_view bytes) {
+        result.append(bytes.data(), static_cast<qsizetype>(bytes.size()));
+    };
 
-    ds << method() << " " << uri() << " HTTP/" << message_.major_version() << "." << message_.minor_version() << "\r\n";
+    auto version = std::to_string(message_.major_version()) + "." + std::to_string(message_.minor_version());
 
-    auto hds = headers();
-    for (const auto& name : hds.names())
+    qsizetype size = 0;
+    for (const auto& field : headers())
     {
-        bool first = true;
-        ds << name << ": ";
-
-        for (const auto& value : hds.find_by_name(name))
-        {
-            if (!first)
-            {
-                ds << ", ";
-            }
-            ds << value;
-            first = false;
-        }
-
-        ds << "\r\n";
+        size += static_cast<qsizetype>(field.name.size() + field.value.size()) + 4;
     }
-    ds << "\r\n";
+    result.reserve(static_cast<qsizetype>(method_bytes().size() + uri_bytes().size() + version.size()) + 12 + size);
 
-    if (body().size() > 0)
+    append(method_bytes());
+    append(" ");
+    append(uri_bytes());
+    append(" HTTP/");
+    append(version);
+    append("\r\n");
+
+    for (const auto& field : headers())
     {
-        ds << body();
+        append(field.name);
+        append(": ");
+        append(field.value);
+        append("\r\n");
+    }
+    append("\r\n");
+
+    return result;
+}
+
+bool Request::expects_continue() const
+{
+    // RFC 7231 § 5.1.1: a server that receives 100-continue in an HTTP/1.0
+    // request MUST ignore it.
+    if (message_.major_version() == 1 && message_.minor_version() == 0)
+    {
+        return false;
     }
 
-    return result.toLatin1();
+    return headers().has_token(KnownHeader::Expect, "100-continue");
 }
 
 bool Request::can_persist() const
@@ -81,8 +104,7 @@ bool Request::can_persist() const
         return false;
     }
 
-    auto connectionOpts = headers().find_by_name(QStringLiteral("Connection"));
-    if (connectionOpts.contains(QStringLiteral("close")))
+    if (headers().has_token(KnownHeader::Connection, "close"))
     {
         return false;
     }
@@ -68,6 +68,59 @@ void RequestTest::format_simple_post()
 
     QCOMPARE(actual, expected);
 }
+void RequestTest::format_head_omits_body()
+{
+    Request request;
+    request.set_major_version(1);
+    request.set_minor_version(1);
+    request.set_method("PUT");
+    request.set_uri("http://www.google.com/upload_to_me_plz");
+    request.headers().insert("Host", "www.google.com");
+    request.headers().insert("Content-Length", "14");
+    request.set_body(QByteArray{R"({"foo": "bar"})"});
+
+    QByteArray expected = "PUT http://www.google.com/upload_to_me_plz HTTP/1.1\r\n"
+            "Host: www.google.com\r\n"
+            "Content-Length: 14\r\n"
+            "\r\n";
+
+    QCOMPARE(request.format_head(), expected);
+}
+
+void RequestTest::format_keeps_repeated_headers_apart()
+{
+    Request request;
+    request.set_major_version(1);
+    request.set_minor_version(1);
+    request.set_method("GET");
+    request.set_uri("http://example.com/");
+    request.headers().insert("Cookie", "a=1");
+    request.headers().insert("Host", "example.com");
+    request.headers().insert("cookie", "b=2");
+
+    QByteArray expected = "GET http://example.com/ HTTP/1.1\r\n"
+            "Cookie: a=1\r\n"
+            "Host: example.com\r\n"
+            "Cookie: b=2\r\n"
+            "\r\n";
+
+    QCOMPARE(request.format(), expected);
+}
+
+void RequestTest::expects_continue()
+{
+    Request request;
+    request.set_major_version(1);
+    request.set_minor_version(1);
+    QVERIFY(!request.expects_continue());
+
+    request.headers().insert("Expect", "100-Continue");
+    QVERIFY(request.expects_continue());
+
+    // HTTP/1.0 clients don't get interim responses.
+    request.set_minor_version(0);
+    QVERIFY(!request.expects_continue());
+}
 
 
 QTEST_GUILESS_MAIN(RequestTest)
@@ -29,4 +29,7 @@ public:
 private Q_SLOTS:
     void format_simple_get();
     void format_simple_post();
+    void format_head_omits_body();
+    void format_keeps_repeated_headers_apart();
+    void expects_continue();
 };
@@ -17,9 +17,52 @@
 
 #include "core/Response.h"
 
+#include <utility>
+
 using namespace ama;
 
 Response::Response()
 {
 
 }
+
+Response::Response(const HttpMessage& message)
+    : message_(message)
+{
+}
+
+Response::Response(HttpMessage&& message)
+    : message_(std::move(message))
+{
+}
+
+bool Response::can_persist() const
+{
+    if (headers().has_token(KnownHeader::Connection, "close"))
+    {
+        return false;
+    }
+
+    if (major_version() == 1 && minor_version() == 0 && !headers().has_token(KnownHeader::Connection, "keep-alive"))
+    {
+        // HTTP/1.0 servers close after every response unless they opt in.
+        return false;
+    }
+
+    // RFC 7230 § 3.3.3: responses to which these statuses apply never have
+    // a body, so their end is always known.
+    int status = status_code();
+    if ((status >= 100 && status < 200) || status == 204 || status == 304)
+    {
+        return true;
+    }
+
+    // Otherwise, the body must be self-delimiting; a response with neither
+    // a chunked encoding nor a length is terminated by closing the connection.
+    if (headers().has_token(KnownHeader::TransferEncoding, "chunked"))
+    {
+        return true;
+    }
+
+    return headers().contains(KnownHeader::ContentLength);
+}
@@ -0,0 +1,117 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "ResponseTest.h"
+
+#include <string>
+
+#include <QtTest>
+
+#include "core/HttpMessageParser.h"
+#include "core/Response.h"
+
+using namespace ama;
+
+namespace {
+
+Response parse_response(std::string text)
+{
+    Response response;
+    HttpMessageParser parser;
+    parser.resetForResponse();
+
+    auto begin = text.begin();
+    auto end = text.end();
+    parser.parse(response, begin, end);
+
+    return response;
+}
+
+} // namespace
+
+void ResponseTest::persists_with_content_length()
+{
+    auto response = parse_response(
+                "HTTP/1.1 200 OK\r\n"
+                "Content-Length: 5\r\n"
+                "\r\n"
+                "hello");
+
+    QVERIFY(response.can_persist());
+}
+
+void ResponseTest::persists_when_chunked()
+{
+    auto response = parse_response(
+                "HTTP/1.1 200 OK\r\n"
+                "Transfer-Encoding: gzip, Chunked\r\n"
+                "\r\n"
+                "0\r\n"
+                "\r\n");
+
+    QVERIFY(response.can_persist());
+}
+
+void ResponseTest::persists_without_body()
+{
+    auto response = parse_response(
+                "HTTP/1.1 304 Not Modified\r\n"
+                "ETag: \"abc\"\r\n"
+                "\r\n");
+
+    QVERIFY(response.can_persist());
+}
+
+void ResponseTest::closes_when_asked()
+{
+    auto response = parse_response(
+                "HTTP/1.1 200 OK\r\n"
+                "Connection: Close\r\n"
+                "Content-Length: 0\r\n"
+                "\r\n");
+
+    QVERIFY(!response.can_persist());
+}
+
+void ResponseTest::closes_when_body_is_unframed()
+{
+    auto response = parse_response(
+                "HTTP/1.1 200 OK\r\n"
+                "Content-Type: text/event-stream\r\n"
+                "\r\n");
+
+    QVERIFY(!response.can_persist());
+}
+
+void ResponseTest::http_1_0_requires_keep_alive()
+{
+    auto closing = parse_response(
+                "HTTP/1.0 200 OK\r\n"
+                "Content-Length: 0\r\n"
+                "\r\n");
+
+    auto persistent = parse_response(
+                "HTTP/1.0 200 OK\r\n"
+                "Connection: keep-alive\r\n"
+                "Content-Length: 0\r\n"
+                "\r\n");
+
+    QVERIFY(!closing.can_persist());
+    QVERIFY(persistent.can_persist());
+}
+
+QTEST_GUILESS_MAIN(ResponseTest)
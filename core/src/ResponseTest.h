@@ -0,0 +1,36 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <QObject>
+
+class ResponseTest : public QObject
+{
+    Q_OBJECT
+
+public:
+    ResponseTest() = default;
+
+private Q_SLOTS:
+    void persists_with_content_length();
+    void persists_when_chunked();
+    void persists_without_body();
+    void closes_when_asked();
+    void closes_when_body_is_unframed();
+    void http_1_0_requires_keep_alive();
+};
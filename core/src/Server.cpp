@@ -19,12 +19,26 @@
 
 #include <QDebug>
 
+#include "IoUring.h"
+
 namespace ama {
 
 Server::Server(const int port, QObject* parent)
+    : Server(port, 0, parent)
+{
+}
+
+Server::Server(const int port, const int num_threads, QObject* parent)
+    : Server(port, num_threads, IoBackend::Reactor, parent)
+{
+}
+
+Server::Server(const int port, const int num_threads, IoBackend backend, QObject* parent)
     : QObject(parent)
     , port_(port)
     , io_context_()
+    , io_uring_(backend == IoBackend::IoUring ? IoUring::create(io_context_) : nullptr)
+    , io_uring_acceptor_()
     , signals_(io_context_)
     , acceptor_(io_context_)
     , socket_(io_context_)
@@ -39,6 +53,10 @@ Server::Server(const int port, QObject* parent)
 
     signals_.async_wait([this](std::error_code /*ec*/, int /*signo*/) {
         acceptor_.close();
+        if (io_uring_acceptor_ != nullptr)
+        {
+            io_uring_acceptor_->close();
+        }
     });
 
     asio::ip::tcp::endpoint endpoint(asio::ip::tcp::v4(), port);
@@ -48,27 +66,47 @@ Server::Server(const int port, QObject* parent)
     acceptor_.bind(endpoint);
     acceptor_.listen();
 
-    connect(connection_pool_, &ConnectionPool::client_connected, this, &Server::connection_established);
+    // Relay the signal on the I/O thread; whoever listens to us decides
+    // whether to hop to another thread.
+    connect(connection_pool_, &ConnectionPool::client_connected, this, &Server::connection_established, Qt::DirectConnection);
 
-    do_accept();
+    if (io_uring_ != nullptr)
+    {
+        qDebug() << "Server: driving sockets with io_uring";
+
+        // The ring accepts on the listener from here on, and closes it.
+        connection_pool_->set_io_uring(io_uring_.get());
+        io_uring_acceptor_ = io_uring_->accept(acceptor_.release(), [this](int socket) {
+            connection_pool_->make_connection(socket);
+        });
+    }
+    else
+    {
+        do_accept();
+    }
 
     // We will multiplex running the io_context across multiple threads.
-    // The number of threads ideally will be one less than the STL's
-    // self-reported hardware_concurrency amount, so that the main thread
-    // remains free even if we're getting slammed with requests.  Practically
-    // speaking, the threads will be asleep 99% of the time, waiting on IO.
+    // Unless the caller chose how many, the number of threads ideally will
+    // be one less than the STL's self-reported hardware_concurrency amount,
+    // so that the main thread remains free even if we're getting slammed
+    // with requests.  Practically speaking, the threads will be asleep 99%
+    // of the time, waiting on IO.
     //
     // std::thread::hardware_concurrency() is documented to return 0 if it
     // cannot settle on a good number.  If it does, we'll assume a value of
     // four - dual-core with hyperthreading is a low bar to meet in 2017.
 
-    int numSupportedThreads = static_cast<int>(std::thread::hardware_concurrency());
-    if (numSupportedThreads == 0)
+    int numSupportedThreads = num_threads;
+    if (numSupportedThreads <= 0)
     {
-        numSupportedThreads = 4;
-    }
+        numSupportedThreads = static_cast<int>(std::thread::hardware_concurrency());
+        if (numSupportedThreads == 0)
+        {
+            numSupportedThreads = 4;
+        }
 
-    numSupportedThreads = std::max(numSupportedThreads - 1, 4);
+        numSupportedThreads = std::max(numSupportedThreads - 1, 4);
+    }
 
     for (int i = 0; i < numSupportedThreads; ++i)
     {
@@ -81,6 +119,10 @@ Server::~Server()
 {
     signals_.clear();
     acceptor_.close();
+    if (io_uring_acceptor_ != nullptr)
+    {
+        io_uring_acceptor_->close();
+    }
     io_context_.stop();
 
     for (auto& t : workers_)
@@ -92,6 +134,17 @@ Server::~Server()
     }
 
     workers_.clear();
+
+    // The pool's sockets belong to io_context_, so they have to go before
+    // it does rather than whenever QObject gets around to our children.
+    connection_pool_->shutdown();
+    delete connection_pool_;
+    connection_pool_ = nullptr;
+
+    // Likewise the ring, which waits here for whatever its sockets still
+    // have with the kernel.
+    io_uring_acceptor_.reset();
+    io_uring_.reset();
 }
 
 ConnectionPool* Server::connection_pool() const
@@ -99,6 +152,11 @@ ConnectionPool* Server::connection_pool() const
     return connection_pool_;
 }
 
+bool Server::uses_io_uring() const
+{
+    return io_uring_ != nullptr;
+}
+
 void Server::do_accept()
 {
     acceptor_.async_accept(socket_, [this] (asio::error_code ec) {
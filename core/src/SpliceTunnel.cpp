@@ -0,0 +1,247 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "SpliceTunnel.h"
+
+#include "log/Log.h"
+
+#if defined(__linux__)
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace ama {
+
+namespace {
+
+// How much is asked of each splice from a socket; a pipe holds 64 KiB by
+// default, so anything larger would only be cut short.
+constexpr std::size_t kSpliceSize = 64 * 1024;
+
+} // namespace
+
+SpliceTunnel::SpliceTunnel(std::shared_ptr<TcpConnection> client,
+                           std::shared_ptr<TcpConnection> remote,
+                           std::atomic<uint64_t>& bytes_to_remote,
+                           std::atomic<uint64_t>& bytes_to_client)
+    : client_(std::move(client))
+    , remote_(std::move(remote))
+    , upstream_{ client_->socket(), remote_->socket(), bytes_to_remote, -1, -1, 0 }
+    , downstream_{ remote_->socket(), client_->socket(), bytes_to_client, -1, -1, 0 }
+    , stopping_(false)
+    , running_(0)
+    , error_()
+    , done_()
+{}
+
+SpliceTunnel::~SpliceTunnel()
+{
+#if defined(__linux__)
+    for (int fd : { upstream_.pipe_read, upstream_.pipe_write, downstream_.pipe_read, downstream_.pipe_write })
+    {
+        if (fd != -1)
+        {
+            ::close(fd);
+        }
+    }
+#endif
+}
+
+std::shared_ptr<SpliceTunnel> SpliceTunnel::create(const std::shared_ptr<IConnection>& client,
+                                                   const std::shared_ptr<IConnection>& remote,
+                                                   std::atomic<uint64_t>& bytes_to_remote,
+                                                   std::atomic<uint64_t>& bytes_to_client)
+{
+#if defined(__linux__)
+    auto client_tcp = std::dynamic_pointer_cast<TcpConnection>(client);
+    auto remote_tcp = std::dynamic_pointer_cast<TcpConnection>(remote);
+    if (client_tcp == nullptr || remote_tcp == nullptr)
+    {
+        return nullptr;
+    }
+
+    std::shared_ptr<SpliceTunnel> tunnel(new SpliceTunnel(std::move(client_tcp), std::move(remote_tcp), bytes_to_remote, bytes_to_client));
+    if (!tunnel->open_pipes())
+    {
+        return nullptr;
+    }
+    return tunnel;
+#else
+    (void) client;
+    (void) remote;
+    (void) bytes_to_remote;
+    (void) bytes_to_client;
+    return nullptr;
+#endif
+}
+
+bool SpliceTunnel::open_pipes()
+{
+#if defined(__linux__)
+    for (Direction* direction : { &upstream_, &downstream_ })
+    {
+        int fds[2];
+        if (::pipe2(fds, O_CLOEXEC | O_NONBLOCK) != 0)
+        {
+            log::warn("SpliceTunnel: pipe2() failed", log::IntValue("errno", errno));
+            return false;
+        }
+        direction->pipe_read = fds[0];
+        direction->pipe_write = fds[1];
+    }
+
+    // The sockets are only ever spliced from here on, and splice() on a
+    // blocking socket blocks no matter what flags it is given.
+    std::error_code ec;
+    client_->socket().native_non_blocking(true, ec);
+    if (!ec)
+    {
+        remote_->socket().native_non_blocking(true, ec);
+    }
+    if (ec)
+    {
+        log::warn("SpliceTunnel: could not make sockets non-blocking", log::StringValue("ec", ec.message()));
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void SpliceTunnel::start(Callback&& done)
+{
+    done_ = std::move(done);
+    running_ = 2;
+
+    pump(upstream_);
+    pump(downstream_);
+}
+
+void SpliceTunnel::pump(Direction& direction)
+{
+#if defined(__linux__)
+    const int from = direction.from.native_handle();
+    const int to = direction.to.native_handle();
+
+    while (!stopping_)
+    {
+        if (direction.in_pipe == 0)
+        {
+            ssize_t num_read = ::splice(from, nullptr, direction.pipe_write, nullptr, kSpliceSize, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (num_read == 0)
+            {
+                // The peer closed its end.
+                stop({});
+                break;
+            }
+
+            if (num_read < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+
+                if (errno == EAGAIN)
+                {
+                    wait(direction, direction.from, asio::socket_base::wait_read);
+                    return;
+                }
+
+                stop(std::error_code(errno, std::system_category()));
+                break;
+            }
+
+            direction.in_pipe = static_cast<std::size_t>(num_read);
+        }
+
+        ssize_t num_written = ::splice(direction.pipe_read, nullptr, to, nullptr, direction.in_pipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (num_written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            if (errno == EAGAIN)
+            {
+                wait(direction, direction.to, asio::socket_base::wait_write);
+                return;
+            }
+
+            stop(std::error_code(errno, std::system_category()));
+            break;
+        }
+
+        direction.in_pipe -= static_cast<std::size_t>(num_written);
+        direction.bytes += static_cast<uint64_t>(num_written);
+    }
+#else
+    (void) direction;
+#endif
+
+    stopped();
+}
+
+void SpliceTunnel::wait(Direction& direction, asio::ip::tcp::socket& socket, asio::socket_base::wait_type type)
+{
+    auto self = shared_from_this();
+    socket.async_wait(type, [self, &direction](std::error_code ec)
+    {
+        if (ec)
+        {
+            // A wait cut short by the other direction stopping is no error
+            // of its own.
+            self->stop(ec == asio::error::operation_aborted ? std::error_code{} : ec);
+            self->stopped();
+            return;
+        }
+
+        self->pump(direction);
+    });
+}
+
+void SpliceTunnel::stop(std::error_code ec)
+{
+    if (stopping_.exchange(true))
+    {
+        return;
+    }
+
+    error_ = ec;
+
+    // Shutting the sockets down, rather than closing them, wakes whatever
+    // the other direction is waiting on without pulling a descriptor out
+    // from under a splice() in progress on another thread.
+    std::error_code ignored;
+    client_->socket().shutdown(asio::socket_base::shutdown_both, ignored);
+    remote_->socket().shutdown(asio::socket_base::shutdown_both, ignored);
+}
+
+void SpliceTunnel::stopped()
+{
+    if (--running_ == 0)
+    {
+        auto done = std::move(done_);
+        done_ = nullptr;
+        done(error_);
+    }
+}
+
+} // namespace ama
@@ -0,0 +1,106 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "AsioConnection.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <system_error>
+
+namespace ama {
+
+// Relays a CONNECT tunnel between two plain TCP connections without
+// bringing its bytes into user space: each direction is spliced from one
+// socket into a pipe, and from the pipe into the other socket.
+//
+// splice(2) is Linux-only.  Elsewhere, create() returns null and the
+// tunnel is relayed through the transaction's own buffers as before.
+
+class SpliceTunnel : public std::enable_shared_from_this<SpliceTunnel>
+{
+public:
+    using Callback = std::function<void(std::error_code)>;
+
+    /**
+     * @brief Prepares to splice between @p client and @p remote.
+     *
+     * Returns null when splicing isn't available here, when either end
+     * isn't a plain TCP connection, or when the pipes can't be created.
+     * The counters are updated as bytes reach the other end, and must
+     * stay valid until the tunnel's callback has been called.
+     */
+    static std::shared_ptr<SpliceTunnel> create(const std::shared_ptr<IConnection>& client,
+                                                const std::shared_ptr<IConnection>& remote,
+                                                std::atomic<uint64_t>& bytes_to_remote,
+                                                std::atomic<uint64_t>& bytes_to_client);
+
+    ~SpliceTunnel();
+
+    /**
+     * @brief Relays in both directions until either end closes or fails.
+     *
+     * Both sockets are then shut down, and once neither direction is
+     * touching them any longer, @p done is called - with no error if the
+     * tunnel ended because a peer closed it.
+     */
+    void start(Callback&& done);
+
+private:
+    struct Direction
+    {
+        asio::ip::tcp::socket& from;
+        asio::ip::tcp::socket& to;
+        std::atomic<uint64_t>& bytes;
+
+        int pipe_read;
+        int pipe_write;
+
+        // Bytes spliced into the pipe but not yet out of it.
+        std::size_t in_pipe;
+    };
+
+    SpliceTunnel(std::shared_ptr<TcpConnection> client,
+                 std::shared_ptr<TcpConnection> remote,
+                 std::atomic<uint64_t>& bytes_to_remote,
+                 std::atomic<uint64_t>& bytes_to_client);
+
+    bool open_pipes();
+
+    void pump(Direction& direction);
+    void wait(Direction& direction, asio::ip::tcp::socket& socket, asio::socket_base::wait_type type);
+
+    void stop(std::error_code ec);
+    void stopped();
+
+    std::shared_ptr<TcpConnection> client_;
+    std::shared_ptr<TcpConnection> remote_;
+
+    Direction upstream_;
+    Direction downstream_;
+
+    std::atomic_bool stopping_;
+    std::atomic_int running_;
+    std::error_code error_;
+    Callback done_;
+};
+
+} // namespace ama
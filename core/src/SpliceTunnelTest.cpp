@@ -0,0 +1,139 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "SpliceTunnelTest.h"
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <QtTest>
+
+#include "AsioConnection.h"
+#include "SpliceTunnel.h"
+
+using namespace ama;
+
+namespace {
+
+using tcp = asio::ip::tcp;
+
+// Returns both ends of a fresh loopback connection.
+std::pair<tcp::socket, tcp::socket> connected_pair(asio::io_context& context)
+{
+    tcp::acceptor acceptor(context, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+
+    tcp::socket near(context);
+    near.connect(acceptor.local_endpoint());
+
+    tcp::socket far(context);
+    acceptor.accept(far);
+
+    return { std::move(near), std::move(far) };
+}
+
+std::string read_exactly(tcp::socket& socket, size_t length)
+{
+    std::string data(length, '\0');
+    asio::read(socket, asio::buffer(data));
+    return data;
+}
+
+class FakeConnection : public IConnection
+{
+public:
+    void async_write(const QByteArrayView, Callback&&) override {}
+    void async_writev(const std::vector<QByteArrayView>&, Callback&&) override {}
+    void async_read(QByteArrayView, Callback&&) override {}
+    void async_wait_readable(Callback&&) override {}
+    bool is_reusable() override { return false; }
+    void close(std::error_code& ec) override { ec = {}; }
+};
+
+} // namespace
+
+void SpliceTunnelTest::relays_both_directions()
+{
+    asio::io_context context;
+    auto [client, client_end] = connected_pair(context);
+    auto [remote_end, remote] = connected_pair(context);
+
+    std::atomic<uint64_t> to_remote{0};
+    std::atomic<uint64_t> to_client{0};
+    auto tunnel = SpliceTunnel::create(std::make_shared<TcpConnection>(std::move(client_end)),
+                                       std::make_shared<TcpConnection>(std::move(remote_end)),
+                                       to_remote,
+                                       to_client);
+    if (tunnel == nullptr)
+    {
+        QSKIP("Tunnels can't be spliced on this platform");
+    }
+
+    std::promise<std::error_code> done;
+    tunnel->start([&done](std::error_code ec) { done.set_value(ec); });
+    tunnel.reset();
+
+    auto work = asio::make_work_guard(context);
+    std::thread runner([&context] { context.run(); });
+
+    // More than a pipe holds, so that the tunnel has to wait for the far
+    // end to catch up.
+    std::string upload(1024 * 1024, '\0');
+    for (size_t i = 0; i < upload.size(); ++i)
+    {
+        upload[i] = static_cast<char>(i * 7);
+    }
+
+    std::thread writer([&] { asio::write(client, asio::buffer(upload)); });
+    auto received = read_exactly(remote, upload.size());
+    writer.join();
+    QVERIFY(received == upload);
+
+    asio::write(remote, asio::buffer(std::string("pong")));
+    QCOMPARE(read_exactly(client, 4), std::string("pong"));
+
+    // The client hanging up ends the tunnel, which is no error.
+    client.close();
+    auto result = done.get_future();
+    QVERIFY(result.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    QVERIFY(!result.get());
+
+    QCOMPARE(to_remote.load(), uint64_t{upload.size()});
+    QCOMPARE(to_client.load(), uint64_t{4});
+
+    work.reset();
+    context.stop();
+    runner.join();
+}
+
+void SpliceTunnelTest::only_splices_plain_tcp()
+{
+    asio::io_context context;
+    auto [client, client_end] = connected_pair(context);
+
+    std::atomic<uint64_t> to_remote{0};
+    std::atomic<uint64_t> to_client{0};
+    auto tunnel = SpliceTunnel::create(std::make_shared<TcpConnection>(std::move(client_end)),
+                                       std::make_shared<FakeConnection>(),
+                                       to_remote,
+                                       to_client);
+    QVERIFY(tunnel == nullptr);
+}
+
+QTEST_GUILESS_MAIN(SpliceTunnelTest)
@@ -18,10 +18,16 @@
 #include "core/Transaction.h"
 
 #include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <locale>
 #include <sstream>
+#include <string_view>
+#include <tuple>
+#include <utility>
 
 #include <QDebug>
 #include <QPointer>
@@ -31,6 +37,9 @@
 #include "log/Log.h"
 
 #include "core/Errors.h"
+#include "core/KnownHeader.h"
+
+#include "SpliceTunnel.h"
 
 namespace ama {
 
@@ -108,25 +117,234 @@ private:
     ama::ParsePhase phase_;
 };
 
+// Message heads are read in chunks of this size, as are bodies that are
+// kept in memory.  Bodies that go to a sink, and tunnelled bytes, are read
+// into pooled buffers of the next size class up.
+constexpr qsizetype kReadSize = 8192;
+constexpr std::size_t kPooledReadSize = BufferPool::kMediumSize;
+
+// 1xx responses other than 101 Switching Protocols precede the real
+// response to a request (RFC 7231 § 6.2).
+bool is_interim_response(int code)
+{
+    return code >= 100 && code < 200 && code != 101;
+}
+
+// Requests that a server may see more than once to the same effect as once
+// (RFC 7231 § 4.2.2).
+bool is_idempotent(QByteArrayView method)
+{
+    return method == QByteArrayView("GET")
+            || method == QByteArrayView("HEAD")
+            || method == QByteArrayView("OPTIONS")
+            || method == QByteArrayView("TRACE")
+            || method == QByteArrayView("PUT")
+            || method == QByteArrayView("DELETE");
+}
+
+// The following mirror Request::expects_continue(), Request::can_persist()
+// and Response::can_persist(), for messages that haven't been copied out of
+// their receive buffers.
+
+bool expects_continue(const HttpMessageView& request)
+{
+    // RFC 7231 § 5.1.1: a server that receives 100-continue in an HTTP/1.0
+    // request MUST ignore it.
+    if (request.major_version() == 1 && request.minor_version() == 0)
+    {
+        return false;
+    }
+    return request.header_has_token(KnownHeader::Expect, "100-continue");
+}
+
+bool request_can_persist(const HttpMessageView& request)
+{
+    // RFC 7230 § 6.3: a proxy MUST NOT keep an HTTP/1.0 client's
+    // connection open.
+    if (request.major_version() == 1 && request.minor_version() == 0)
+    {
+        return false;
+    }
+    return !request.header_has_token(KnownHeader::Connection, "close");
+}
+
+bool response_can_persist(const HttpMessageView& response)
+{
+    if (response.header_has_token(KnownHeader::Connection, "close"))
+    {
+        return false;
+    }
+
+    if (response.major_version() == 1 && response.minor_version() == 0 && !response.header_has_token(KnownHeader::Connection, "keep-alive"))
+    {
+        return false;
+    }
+
+    int status = response.status_code();
+    if ((status >= 100 && status < 200) || status == 204 || status == 304)
+    {
+        return true;
+    }
+
+    return response.header_has_token(KnownHeader::TransferEncoding, "chunked")
+            || !response.header(KnownHeader::ContentLength).isNull();
+}
+
+// What we tell a client that sent "Expect: 100-continue" once the server
+// has the request head.
+constexpr char kContinue[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+// Our replies to a CONNECT request, for when the tunnel could and couldn't
+// be opened.
+constexpr char kTunnelEstablished[] = "HTTP/1.1 200 OK\r\n"
+                                      "Proxy-Agent: amanuensis 0.1.0\r\n"
+                                      "\r\n";
+constexpr char kTunnelFailed[] = "HTTP/1.1 400 Bad Request\r\n"
+                                 "Proxy-Agent: amanuensis 0.1.0\r\n"
+                                 "\r\n";
+
+// How often an open tunnel reports that bytes have moved through it.
+constexpr std::chrono::milliseconds kTunnelProgressInterval{500};
+
+int port_number(const std::string& port)
+{
+    return static_cast<int>(std::strtol(port.c_str(), nullptr, 10));
+}
+
+#if defined(AMA_USE_COROUTINES)
+
+// What an operation on a connection reports, as a coroutine receives it.
+// Failures come back as values rather than exceptions, just as they do
+// to a callback.
+struct IoResult
+{
+    std::error_code ec;
+    size_t size;
+};
+
+struct OpenResult
+{
+    std::shared_ptr<IConnection> connection;
+    std::error_code ec;
+};
+
+// Suspends the calling coroutine on an operation that reports to a
+// callback, and resumes it with the callback's arguments on its own
+// executor - for a transaction, its strand.
+template <typename Result, typename Start>
+asio::awaitable<Result> await_callback(Start start)
+{
+    return asio::async_initiate<const asio::use_awaitable_t<>&, void(Result)>([start = std::move(start)](auto handler) mutable
+    {
+        start([handler = std::move(handler)](auto... args) mutable
+        {
+            auto executor = asio::get_associated_executor(handler);
+            asio::dispatch(executor, [handler = std::move(handler), result = Result{std::move(args)...}]() mutable
+            {
+                handler(std::move(result));
+            });
+        });
+    }, asio::use_awaitable);
+}
+
+// In each of these, the connection must outlive the operation; the
+// coroutine awaiting it holds on to it.
+asio::awaitable<IoResult> await_read(IConnection& connection, QByteArrayView buffer)
+{
+    return await_callback<IoResult>([&connection, buffer](IConnection::Callback&& callback)
+    {
+        connection.async_read(buffer, std::move(callback));
+    });
+}
+
+asio::awaitable<IoResult> await_write(IConnection& connection, QByteArrayView data)
+{
+    return await_callback<IoResult>([&connection, data](IConnection::Callback&& callback)
+    {
+        connection.async_write(data, std::move(callback));
+    });
+}
+
+asio::awaitable<IoResult> await_writev(IConnection& connection, std::vector<QByteArrayView> buffers)
+{
+    return await_callback<IoResult>([&connection, buffers = std::move(buffers)](IConnection::Callback&& callback)
+    {
+        connection.async_writev(buffers, std::move(callback));
+    });
+}
+
+asio::awaitable<OpenResult> await_open(ConnectionPool& pool, std::string host, std::string port)
+{
+    return await_callback<OpenResult>([&pool, host = std::move(host), port = std::move(port)](ConnectionPool::OpenCallback&& callback)
+    {
+        pool.try_open(host, port, std::move(callback));
+    });
+}
+
+#endif // AMA_USE_COROUTINES
+
 } // namespace
 
+#if defined(AMA_USE_COROUTINES)
+
+// The coroutine flow runs the same steps as the callbacks do, in the same
+// order and on the same strand; only the sequencing differs.  The
+// transaction is kept alive by begin() for as long as run() is, and the
+// coroutines' frames come from asio's per-thread recycling allocator.
+class CoroutineFlow
+{
+public:
+    static asio::awaitable<void> run(Transaction& tx);
+    static asio::awaitable<void> run_tunnel(Transaction& tx);
+
+    // Relays one direction of a tunnel until either end closes.
+    static asio::awaitable<std::error_code> pump_tunnel(std::shared_ptr<IConnection> from,
+                                                        std::shared_ptr<IConnection> to,
+                                                        std::atomic<uint64_t>& relayed);
+};
+
+#endif // AMA_USE_COROUTINES
+
 Transaction::Transaction(int id, ConnectionPool* connectionPool, const std::shared_ptr<IConnection>& clientConnection, QObject* parent)
     : QObject{parent}
     , id_{id}
     , error_{}
     , client_{clientConnection}
     , remote_{}
+    , remote_host_{}
+    , remote_port_{}
+    , remote_is_pooled_{false}
     , connection_pool_{connectionPool}
-    , parser_{}
-    , read_buffer_{}
-    , remote_buffer_{nullptr}
-    , raw_input_{}
+    , arena_{}
+    , parser_{arena_.resource()}
+    , to_remote_buffer_{}
+    , to_client_buffer_{}
+    , tunnel_bytes_to_remote_{0}
+    , tunnel_bytes_to_client_{0}
+    , request_view_{arena_.resource()}
+    , response_view_{arena_.resource()}
+    , body_buffer_{}
+    , body_lease_{}
+    , capture_policy_{}
+    , request_sink_{}
+    , response_sink_{}
+    , pipelined_input_{}
+    , next_request_input_{}
+    , request_body_{}
+    , request_body_streamed_{false}
+    , continue_pending_{false}
+    , response_bytes_received_{0}
     , request_parse_phase_{ParsePhase::Start}
-    , request_{}
     , response_parse_phase_{ParsePhase::Start}
+    , request_{}
     , response_{}
+    , request_materialized_{false}
+    , response_materialized_{false}
+    , message_mutex_{}
     , notification_state_{NotificationState::None}
-    , mutex_{}
+    , complete_{false}
+    , strand_{asio::make_strand(connectionPool->context())}
+    , tunnel_progress_timer_{strand_}
 {}
 
 int Transaction::id() const
@@ -139,13 +357,25 @@ NotificationState Transaction::state() const
     return notification_state_;
 }
 
-Request& Transaction::request()
+Request Transaction::request()
 {
+    std::lock_guard<std::mutex> lock{message_mutex_};
+    if (!request_materialized_)
+    {
+        request_ = Request{request_view_.materialize()};
+        request_materialized_ = request_parse_phase_ == ParsePhase::ReceivedFullMessage;
+    }
     return request_;
 }
 
-Response& Transaction::response()
+Response Transaction::response()
 {
+    std::lock_guard<std::mutex> lock{message_mutex_};
+    if (!response_materialized_)
+    {
+        response_ = Response{response_view_.materialize()};
+        response_materialized_ = response_parse_phase_ == ParsePhase::ReceivedFullMessage;
+    }
     return response_;
 }
 
@@ -154,19 +384,119 @@ std::error_code Transaction::error() const
     return error_;
 }
 
+void Transaction::set_capture_policy(const CapturePolicy& policy)
+{
+    capture_policy_ = policy;
+}
+
+void Transaction::set_pipelined_input(const QByteArray& input)
+{
+    pipelined_input_ = input;
+}
+
+std::shared_ptr<BodySink> Transaction::request_body_sink() const
+{
+    return request_sink_;
+}
+
+std::shared_ptr<BodySink> Transaction::response_body_sink() const
+{
+    return response_sink_;
+}
+
+uint64_t Transaction::tunnel_bytes_to_remote() const
+{
+    return tunnel_bytes_to_remote_;
+}
+
+uint64_t Transaction::tunnel_bytes_to_client() const
+{
+    return tunnel_bytes_to_client_;
+}
+
+template <typename Handler>
+auto Transaction::on_strand(Handler&& handler)
+{
+    return [strand = strand_, handler = std::forward<Handler>(handler)](auto&&... args) mutable
+    {
+        asio::dispatch(strand, [handler = std::move(handler), args = std::make_tuple(std::forward<decltype(args)>(args)...)]() mutable
+        {
+            std::apply(handler, std::move(args));
+        });
+    };
+}
+
+template <typename Change>
+auto Transaction::change_messages(Change&& change)
+{
+    std::lock_guard<std::mutex> lock{message_mutex_};
+    return change();
+}
+
 void Transaction::begin()
 {
-    emit on_transaction_start(sharedFromThis());
-    raw_input_.clear();
+    // Called from whichever thread owns the proxy; everything from here
+    // on happens on the strand.
+    auto self = sharedFromThis();
+    asio::dispatch(strand_, [self]
+    {
+        emit self->on_transaction_start(self);
+        self->change_messages([&]
+        {
+            self->request_view_.clear();
+            self->response_view_.clear();
+        });
+        self->request_body_ = QByteArrayView();
+        self->request_body_streamed_ = false;
+        self->continue_pending_ = false;
+        self->response_bytes_received_ = 0;
+        self->parser_.resetForRequest();
+        self->request_sink_ = make_body_sink(self->capture_policy_);
+        self->parser_.set_body_sink(self->request_sink_);
+
+#if defined(AMA_USE_COROUTINES)
+        asio::co_spawn(self->strand_, CoroutineFlow::run(*self), [self](std::exception_ptr e)
+        {
+            if (e != nullptr)
+            {
+                log::error("Transaction::begin() (transaction threw)", log::IntValue("id", self->id_));
+                self->notify_failure(ProxyError::NetworkError);
+            }
+        });
+#else
+        if (self->take_pipelined_input())
+        {
+            self->parse_client_request();
+            return;
+        }
+
+        self->read_client_request();
+#endif
+    });
+}
+
+bool Transaction::take_pipelined_input()
+{
+    if (pipelined_input_.isEmpty())
+    {
+        return false;
+    }
 
-    read_client_request();
+    log::debug("Transaction::take_pipelined_input()", log::IntValue("id", id_), log::SizeValue("size", static_cast<size_t>(pipelined_input_.size())));
+    change_messages([this]
+    {
+        auto buffer = request_view_.prepare(pipelined_input_.size());
+        std::memcpy(const_cast<char*>(buffer.data()), pipelined_input_.constData(), static_cast<size_t>(pipelined_input_.size()));
+        request_view_.commit(pipelined_input_.size());
+    });
+    pipelined_input_.clear();
+    return true;
 }
 
 void Transaction::read_client_request()
 {
     log::debug("Transaction::read_client_request()", log::IntValue("id", id_));
 
-    std::lock_guard<std::mutex> lock{mutex_};
     if (client_ == nullptr)
     {
         log::error("Transaction::read_client_request(): local connection dropped before we could start?!", log::IntValue("id", id_));
@@ -175,7 +505,8 @@ void Transaction::read_client_request()
     }
 
     auto self = sharedFromThis();
-    client_->async_read(read_buffer_, [self](asio::error_code ec, size_t num_read)
+    auto buffer = change_messages([this] { return request_view_.prepare(kReadSize); });
+    client_->async_read(buffer, on_strand([self](asio::error_code ec, size_t num_read)
     {
         log::debug(
             "Transaction::read_client_request#async_read_some",
@@ -197,92 +528,175 @@ void Transaction::read_client_request()
             return;
         }
 
-        auto start = std::begin(self->read_buffer_);
-        auto stop = start + num_read;
-
-        auto current_phase = self->request_parse_phase_;
-        auto state = self->parser_.parse(self->request(), start, stop, self->request_parse_phase_);
-        while (state == HttpMessageParser::State::Incomplete && current_phase != self->request_parse_phase_)
-        {
-            log::debug(
-                "Transaction::read_client_request() (phase change)",
-                ParsePhaseValue("old", current_phase),
-                ParsePhaseValue("new", self->request_parse_phase_)
-            );
-
-            self->notify_phase_change(self->request_parse_phase_);
-
-            current_phase = self->request_parse_phase_;
-            state = self->parser_.parse(self->request(), start, stop, self->request_parse_phase_);
-        }
+        self->change_messages([&] { self->request_view_.commit(static_cast<qsizetype>(num_read)); });
+        self->parse_client_request();
+    }));
+}
 
-        if (state == HttpMessageParser::State::Incomplete)
-        {
-            log::debug("Transaction::read_client_request() (parse: Incomplete)", log::IntValue("id", self->id_));
-            self->read_client_request();
-            return;
-        }
-        else if (state == HttpMessageParser::State::Invalid)
+void Transaction::parse_client_request()
+{
+    auto state = parse_request_head();
+    if (state == HttpMessageParser::State::Incomplete && request_parse_phase_ < ParsePhase::ReceivedHeaders)
+    {
+        log::debug("Transaction::parse_client_request() (parse: Incomplete)", log::IntValue("id", id_));
+        read_client_request();
+        return;
+    }
+    else if (state == HttpMessageParser::State::Invalid)
+    {
+        log::debug("Transaction::parse_client_request() (parse: Invalid)", log::IntValue("id", id_));
+        notify_failure(ProxyError::MalformedRequest);
+    }
+    else if (state == HttpMessageParser::State::Incomplete)
+    {
+        // We have the headers, but not yet the whole body.  Start
+        // talking to the server now and stream the body through,
+        // rather than holding all of it before sending any.
+        log::debug("Transaction::parse_client_request() (do stream request body)", log::IntValue("id", id_));
+        open_remote_connection();
+    }
+    else if (state == HttpMessageParser::State::Valid)
+    {
+        log::debug("Transaction::parse_client_request() (parse: Valid)", log::IntValue("id", id_));
+        if (request_view_.method() == QByteArrayView("CONNECT"))
         {
-            log::debug("Transaction::read_client_request() (parse: Invalid)", log::IntValue("id", self->id_));
-            self->notify_failure(ProxyError::MalformedRequest);
+            log::debug("Transaction::parse_client_request() (do TLS tunnel)", log::IntValue("id", id_));
+            establish_tls_tunnel();
         }
-        else if (state == HttpMessageParser::State::Valid)
+        else
         {
-            log::debug("Transaction::read_client_request() (parse: Valid)", log::IntValue("id", self->id_));
-            if (self->request().method() == "CONNECT")
-            {
-                log::debug("Transaction::read_client_request() (do TLS tunnel)", log::IntValue("id", self->id_));
-                self->establish_tls_tunnel();
-            }
-            else
-            {
-                log::debug("Transaction::read_client_request() (do notify and relay request)", log::IntValue("id", self->id_));
-                self->do_notification(NotificationState::RequestComplete);
-                self->open_remote_connection();
-            }
+            log::debug("Transaction::parse_client_request() (do notify and relay request)", log::IntValue("id", id_));
+            request_complete();
+            open_remote_connection();
         }
-        else
+    }
+    else
+    {
+        // wtf, this isn't any status we recognize
+        notify_failure(ProxyError::NetworkError);
+    }
+}
+
+HttpMessageParser::State Transaction::parse_request_head()
+{
+    auto& view = request_view_;
+
+    qsizetype body_begin = 0;
+    bool has_body = false;
+    auto parse = [&]
+    {
+        return change_messages([&] { return parser_.parse(view, request_parse_phase_); });
+    };
+
+    auto current_phase = request_parse_phase_;
+    auto state = parse();
+    while (state == HttpMessageParser::State::Incomplete && current_phase != request_parse_phase_)
+    {
+        log::debug(
+            "Transaction::parse_client_request() (phase change)",
+            ParsePhaseValue("old", current_phase),
+            ParsePhaseValue("new", request_parse_phase_)
+        );
+
+        notify_phase_change(request_parse_phase_);
+
+        if (request_parse_phase_ == ParsePhase::ReceivedHeaders)
         {
-            // wtf, this isn't any status we recognize
-            self->notify_failure(ProxyError::NetworkError);
+            // Whatever follows the headers is body, to be relayed
+            // as-is once the request head has gone upstream.
+            body_begin = view.parsed_size();
+            has_body = true;
         }
-    });
+
+        current_phase = request_parse_phase_;
+        state = parse();
+    }
+
+    if (has_body)
+    {
+        request_body_ = view.data().sliced(body_begin, view.parsed_size() - body_begin);
+    }
+
+    if (state == HttpMessageParser::State::Incomplete && has_body && expects_continue(view))
+    {
+        // The client is waiting for our go-ahead; we give it ourselves
+        // once the server has the request head, so the server shouldn't
+        // be asked for one as well.
+        change_messages([&] { view.remove_header(KnownHeader::Expect); });
+        continue_pending_ = true;
+    }
+
+    return state;
+}
+
+void Transaction::request_complete()
+{
+    // A client that pipelines may already have sent some of its next
+    // request.
+    next_request_input_ = request_view_.unparsed().toByteArray();
+
+    do_notification(NotificationState::RequestComplete);
 }
 
 void Transaction::open_remote_connection()
 {
-    auto headerValues = request().headers().find_by_name("Host");
-    if (headerValues.empty())
+    if (!choose_remote_origin())
     {
-        log::warn("open_remote_connection(): Malformed request - no 'Host' header found!", log::IntValue("id", id_));
         notify_failure(ProxyError::MalformedRequest);
         return;
     }
 
-    QString host = headerValues[0];
-    QString port = "80";
+    if (lease_pooled_connection())
+    {
+        send_client_request_to_remote();
+        return;
+    }
+
+    connect_to_remote();
+}
 
-    size_t separator = host.indexOf(':');
-    if (separator != -1)
+bool Transaction::choose_remote_origin()
+{
+    auto hostHeader = request_view_.header(KnownHeader::Host);
+    if (hostHeader.isNull())
     {
-        try
-        {
-            port = host.sliced(separator + 1);
-            host = host.sliced(0, separator);
-        }
-        catch (std::out_of_range)
-        {
-            log::warn("open_remote_connection(): Malformed request - assuming port 80.", log::IntValue("id", id_));
-        }
-        catch (std::invalid_argument)
-        {
-            log::warn("open_remote_connection(): Malformed request - assuming port 80.", log::IntValue("id", id_));
-        }
+        log::warn("choose_remote_origin(): Malformed request - no 'Host' header found!", log::IntValue("id", id_));
+        return false;
     }
 
+    std::string_view host(hostHeader.data(), static_cast<size_t>(hostHeader.size()));
+    std::string_view port = "80";
+
+    auto separator = host.find(':');
+    if (separator != std::string_view::npos)
+    {
+        port = host.substr(separator + 1);
+        host = host.substr(0, separator);
+    }
+
+    remote_host_.assign(host);
+    remote_port_.assign(port);
+    return true;
+}
+
+bool Transaction::lease_pooled_connection()
+{
+    auto pooled = connection_pool_->find_open_connection(remote_host_, port_number(remote_port_));
+    if (pooled == nullptr)
+    {
+        return false;
+    }
+
+    log::debug("Transaction::lease_pooled_connection()", log::IntValue("id", id_));
+    remote_ = std::move(pooled);
+    remote_is_pooled_ = true;
+    return true;
+}
+
+void Transaction::connect_to_remote()
+{
     auto self = sharedFromThis();
-    connection_pool_->try_open(host.toStdString(), port.toStdString(), [self](auto conn, auto ec)
+    connection_pool_->try_open(remote_host_, remote_port_, on_strand([self](auto conn, auto ec)
     {
         if (ec)
         {
@@ -291,13 +705,56 @@ void Transaction::open_remote_connection()
         }
 
         self->remote_ = conn;
+        self->remote_is_pooled_ = false;
         self->send_client_request_to_remote();
-    });
+    }));
+}
+
+bool Transaction::retry_with_new_connection(bool request_written)
+{
+    if (!discard_stale_connection(request_written))
+    {
+        return false;
+    }
+
+    connect_to_remote();
+    return true;
+}
+
+bool Transaction::discard_stale_connection(bool request_written)
+{
+    // A pooled connection can be closed by the server at any moment while
+    // it sits idle.  If that happens before we've seen any of the response,
+    // nothing has been relayed yet and we can transparently start over -
+    // provided we still have everything we've sent so far.
+    if (!remote_is_pooled_ || request_body_streamed_ || response_bytes_received_ > 0)
+    {
+        return false;
+    }
+
+    // Once the whole request is out, the server may have acted on it before
+    // it dropped the connection; only a request that can safely be done
+    // twice is sent again (RFC 7230 § 6.3.1).
+    if (request_written && !is_idempotent(request_view_.method()))
+    {
+        log::debug("Transaction::discard_stale_connection(): not repeating a non-idempotent request", log::IntValue("id", id_));
+        return false;
+    }
+
+    log::debug("Transaction::discard_stale_connection()", log::IntValue("id", id_));
+
+    if (remote_ != nullptr)
+    {
+        std::error_code ec;
+        remote_->close(ec);
+        remote_.reset();
+    }
+    remote_is_pooled_ = false;
+    return true;
 }
 
 void Transaction::send_client_request_to_remote()
 {
-    std::lock_guard<std::mutex> lock{mutex_};
     if (client_ == nullptr || remote_ == nullptr)
     {
         log::error("Transaction::sent_client_request_to_remote(): client connection closed", log::IntValue("id", id_));
@@ -305,151 +762,413 @@ void Transaction::send_client_request_to_remote()
         return;
     }
 
+    // The head goes out straight from the buffer it was received in, less
+    // the lines that aren't forwarded; whatever of the body arrived with it
+    // follows in the same write, exactly as the client framed it.
+    auto segments = request_view_.request_head_segments();
+    if (!request_body_.isEmpty())
+    {
+        segments.push_back(request_body_);
+    }
+
     auto self = sharedFromThis();
-    auto formatted_request = std::make_shared<QByteArray>(request_.format());
-    remote_->async_write(QByteArrayView(*formatted_request),
-                         [self, formatted_request](auto ec, size_t num_bytes_written)
+    remote_->async_writev(segments, on_strand([self](auto ec, size_t num_bytes_written)
     {
         (void) num_bytes_written;
 
         if (ec)
         {
-            self->notify_failure(ec);
+            if (!self->retry_with_new_connection(false))
+            {
+                self->notify_failure(ec);
+            }
             return;
         }
 
-        self->raw_input_.clear();
-        self->parser_.resetForResponse();
-        self->read_remote_response();
-    });
+        self->request_body_sent();
+    }));
 }
 
-void Transaction::read_remote_response()
+void Transaction::send_request_body_to_remote()
 {
-    std::lock_guard<std::mutex> lock{mutex_};
+    if (request_body_.isEmpty())
+    {
+        request_body_sent();
+        return;
+    }
+
     if (client_ == nullptr || remote_ == nullptr)
     {
-        log::error("Transaction::read_remote_response(): client connection closed", log::IntValue("id", id_));
+        log::error("Transaction::send_request_body_to_remote(): client connection closed", log::IntValue("id", id_));
         notify_failure(ProxyError::ClientDisconnected);
         return;
     }
 
     auto self = sharedFromThis();
-    remote_->async_read(read_buffer_, [self](auto ec, size_t num_bytes_read)
+    remote_->async_write(request_body_, on_strand([self](auto ec, size_t num_bytes_written)
+    {
+        (void) num_bytes_written;
+
+        if (ec)
+        {
+            if (!self->retry_with_new_connection(false))
+            {
+                self->notify_failure(ec);
+            }
+            return;
+        }
+
+        self->request_body_sent();
+    }));
+}
+
+void Transaction::request_body_sent()
+{
+    release_body_buffer();
+
+    if (request_parse_phase_ == ParsePhase::ReceivedFullMessage)
+    {
+        begin_response();
+        read_remote_response();
+    }
+    else
+    {
+        read_request_body();
+    }
+}
+
+void Transaction::begin_response()
+{
+    response_bytes_received_ = 0;
+    parser_.resetForResponse(request_view_);
+    response_sink_ = make_body_sink(capture_policy_);
+    parser_.set_body_sink(response_sink_);
+}
+
+void Transaction::read_request_body()
+{
+    if (client_ == nullptr)
+    {
+        log::error("Transaction::read_request_body(): client connection closed", log::IntValue("id", id_));
+        notify_failure(ProxyError::ClientDisconnected);
+        return;
+    }
+
+    auto self = sharedFromThis();
+    if (continue_pending_)
+    {
+        continue_pending_ = false;
+
+        client_->async_write(QByteArrayView(kContinue), on_strand([self](auto ec, size_t num_bytes_written)
+        {
+            (void) num_bytes_written;
+
+            if (ec)
+            {
+                self->notify_failure(ec);
+                return;
+            }
+
+            self->read_request_body();
+        }));
+        return;
+    }
+
+    // From here on, the body continues in buffers that are only kept
+    // until they've been relayed, so the request can't be replayed on
+    // another connection.
+    request_body_streamed_ = true;
+
+    client_->async_read(prepare_body_buffer(request_sink_), on_strand([self](auto ec, size_t num_read)
     {
         if (ec == asio::error::eof)
         {
-            // unexpected disconnect
-            self->notify_failure(ProxyError::RemoteDisconnected);
+            self->notify_failure(ProxyError::ClientDisconnected);
             return;
         }
 
         if (ec)
         {
-            // some other error
             self->notify_failure(ec);
             return;
         }
 
-        auto begin = std::begin(self->read_buffer_);
-        auto end = begin + num_bytes_read;
+        if (self->parse_request_body(num_read) == HttpMessageParser::State::Invalid)
+        {
+            log::debug("Transaction::read_request_body() (parse: Invalid)", log::IntValue("id", self->id_));
+            self->notify_failure(ProxyError::MalformedRequest);
+            return;
+        }
+
+        self->send_request_body_to_remote();
+    }));
+}
+
+HttpMessageParser::State Transaction::parse_request_body(size_t num_read)
+{
+    qsizetype offset = 0;
+    auto end = static_cast<qsizetype>(num_read);
+
+    auto parse = [&]
+    {
+        return change_messages([&] { return parser_.parse(request_view_, body_buffer_, offset, end, request_parse_phase_); });
+    };
+
+    auto current_phase = request_parse_phase_;
+    auto state = parse();
+    while (state == HttpMessageParser::State::Incomplete && current_phase != request_parse_phase_)
+    {
+        notify_phase_change(request_parse_phase_);
+
+        current_phase = request_parse_phase_;
+        state = parse();
+    }
+
+    if (state == HttpMessageParser::State::Invalid)
+    {
+        return state;
+    }
+
+    if (state == HttpMessageParser::State::Valid)
+    {
+        next_request_input_ = QByteArray(body_buffer_.constData() + offset, end - offset);
+        do_notification(NotificationState::RequestComplete);
+    }
+
+    request_body_ = QByteArrayView(body_buffer_.constData(), offset);
+    return state;
+}
+
+QByteArrayView Transaction::prepare_body_buffer(const std::shared_ptr<BodySink>& sink)
+{
+    // Without a sink, the view keeps the buffers its body lies in, so each
+    // read needs a new one.  A sink copies what it keeps, so the read can
+    // borrow a pooled buffer until its bytes have been relayed.
+    if (sink == nullptr)
+    {
+        body_buffer_ = QByteArray(kReadSize, Qt::Uninitialized);
+    }
+    else if (!body_lease_)
+    {
+        body_lease_ = BufferPool::shared().acquire(kPooledReadSize);
+        body_buffer_ = QByteArray::fromRawData(body_lease_.data(), body_lease_.size());
+    }
+    return QByteArrayView(body_buffer_);
+}
+
+void Transaction::release_body_buffer()
+{
+    if (body_lease_)
+    {
+        // Nothing may be left pointing into the buffer once it's back in
+        // the pool.
+        body_buffer_ = QByteArray();
+        request_body_ = QByteArrayView();
+        body_lease_.reset();
+    }
+}
+
+QByteArrayView Transaction::prepare_response_buffer(bool reading_head)
+{
+    // The head is parsed where it lands in response_view_; the body is
+    // read into buffers of its own.
+    if (reading_head)
+    {
+        return change_messages([this] { return response_view_.prepare(kReadSize); });
+    }
+    return prepare_body_buffer(response_sink_);
+}
+
+void Transaction::read_remote_response()
+{
+    if (client_ == nullptr || remote_ == nullptr)
+    {
+        log::error("Transaction::read_remote_response(): client connection closed", log::IntValue("id", id_));
+        notify_failure(ProxyError::ClientDisconnected);
+        return;
+    }
+
+    bool reading_head = response_parse_phase_ < ParsePhase::ReceivedHeaders;
 
-        self->raw_input_.insert(self->raw_input_.end(), begin, end);
+    auto self = sharedFromThis();
+    remote_->async_read(prepare_response_buffer(reading_head), on_strand([self, reading_head](auto ec, size_t num_bytes_read)
+    {
+        if (ec && self->retry_with_new_connection(true))
+        {
+            return;
+        }
 
-        auto current_phase = self->response_parse_phase_;
-        auto state = self->parser_.parse(self->response(), begin, end, self->response_parse_phase_);
-        while (state == HttpMessageParser::State::Incomplete && current_phase != self->response_parse_phase_)
+        if (ec == asio::error::eof)
         {
-            log::debug("read_remote_response() (phase change)", ParsePhaseValue("old", current_phase), ParsePhaseValue("new", self->response_parse_phase_));
-            self->notify_phase_change(self->response_parse_phase_);
+            // Responses without a Content-Length or chunked encoding
+            // are terminated by the server closing the connection.
+            if (self->parser_.finish() == HttpMessageParser::State::Valid)
+            {
+                self->do_notification(NotificationState::ResponseComplete);
+                self->complete_transaction();
+                return;
+            }
 
-            current_phase = self->response_parse_phase_;
-            state = self->parser_.parse(self->response(), begin, end, self->response_parse_phase_);
+            // unexpected disconnect
+            self->notify_failure(ProxyError::RemoteDisconnected);
+            return;
         }
 
+        if (ec)
+        {
+            // some other error
+            self->notify_failure(ec);
+            return;
+        }
+
+        QByteArrayView consumed;
+        auto state = self->parse_response(reading_head, num_bytes_read, consumed);
         switch (state)
         {
         case HttpMessageParser::State::Incomplete:
-            self->read_remote_response();
+        case HttpMessageParser::State::Valid:
+            self->relay_response_to_client(consumed, state);
             break;
 
         case HttpMessageParser::State::Invalid:
             self->notify_failure(ProxyError::MalformedResponse);
             break;
 
-        case HttpMessageParser::Valid:
-            self->do_notification(NotificationState::ResponseComplete);
-
-            self->send_remote_response_to_client();
-            break;
-
         default:
             // wtf
             self->notify_failure(ProxyError::MalformedResponse);
             break;
         }
-    });
+    }));
+}
+
+HttpMessageParser::State Transaction::parse_response(bool reading_head, size_t num_bytes_read, QByteArrayView& consumed)
+{
+    response_bytes_received_ += num_bytes_read;
+
+    auto& view = response_view_;
+    auto begin = reading_head ? view.data().size() : qsizetype{0};
+    auto end = begin + static_cast<qsizetype>(num_bytes_read);
+    qsizetype offset = 0;
+    if (reading_head)
+    {
+        change_messages([&] { view.commit(static_cast<qsizetype>(num_bytes_read)); });
+    }
+
+    auto parse = [&]()
+    {
+        return change_messages([&]
+        {
+            return reading_head
+                    ? parser_.parse(view, response_parse_phase_)
+                    : parser_.parse(view, body_buffer_, offset, end, response_parse_phase_);
+        });
+    };
+
+    auto current_phase = response_parse_phase_;
+    auto state = parse();
+    while (true)
+    {
+        if (state == HttpMessageParser::State::Incomplete && current_phase != response_parse_phase_)
+        {
+            log::debug("parse_response() (phase change)", ParsePhaseValue("old", current_phase), ParsePhaseValue("new", response_parse_phase_));
+            notify_phase_change(response_parse_phase_);
+        }
+        else if (state == HttpMessageParser::State::Valid && is_interim_response(view.status_code()))
+        {
+            // Interim responses are passed along, but the one we're
+            // after is still to come.
+            log::debug("parse_response() (interim response)", log::IntValue("id", id_), log::IntValue("status", view.status_code()));
+            change_messages([&]
+            {
+                view.next_message();
+                response_parse_phase_ = ParsePhase::Start;
+                response_materialized_ = false;
+            });
+            parser_.resetForResponse(request_view_);
+            response_sink_ = make_body_sink(capture_policy_);
+            parser_.set_body_sink(response_sink_);
+        }
+        else
+        {
+            break;
+        }
+
+        current_phase = response_parse_phase_;
+        state = parse();
+    }
+
+    // Anything the server sent past the end of the response is not
+    // ours to relay.
+    consumed = reading_head
+            ? view.data().sliced(begin, view.parsed_size() - begin)
+            : QByteArrayView(body_buffer_.constData(), offset);
+
+    return state;
 }
 
-void Transaction::send_remote_response_to_client()
+void Transaction::relay_response_to_client(QByteArrayView data, HttpMessageParser::State state)
 {
-    std::lock_guard<std::mutex> lock{mutex_};
     if (client_ == nullptr)
     {
-        log::error("Transaction::send_remote_response_to_client(): client connection closed", log::IntValue("id", id_));
+        log::error("Transaction::relay_response_to_client(): client connection closed", log::IntValue("id", id_));
         notify_failure(ProxyError::ClientDisconnected);
         return;
     }
 
+    // The next read from the server isn't started until the client has
+    // accepted this one, so a slow client slows the server down rather
+    // than making us buffer on its behalf.
     auto self = sharedFromThis();
-    client_->async_write(raw_input_, [self](auto ec, size_t num_bytes_written)
+    client_->async_write(data, on_strand([self, state](auto ec, size_t num_bytes_written)
     {
         (void) num_bytes_written;
 
-        if (ec == asio::error::eof)
+        self->release_body_buffer();
+
+        if (ec)
         {
             self->notify_failure(ec);
             return;
         }
 
-        if (ec)
+        if (state == HttpMessageParser::State::Incomplete)
         {
-            self->notify_failure(ec);
+            self->read_remote_response();
             return;
         }
 
         // We're done!
+        self->do_notification(NotificationState::ResponseComplete);
         self->complete_transaction();
-    });
+    }));
 }
 
-void Transaction::establish_tls_tunnel()
+void Transaction::parse_tunnel_origin(std::string& host, std::string& port)
 {
-    QString host = request().uri();
-    QString port = "443";
+    auto uri = request_view_.uri();
+    std::string_view authority(uri.data(), static_cast<size_t>(uri.size()));
+    std::string_view tunnel_port = "443";
 
-    auto separator = host.indexOf(':');
-    if (separator != -1)
+    auto separator = authority.find(':');
+    if (separator != std::string_view::npos)
     {
-        try
-        {
-            port = host.sliced(separator + 1);
-            host = host.sliced(0, separator);
-        }
-        catch (std::out_of_range)
-        {
-            log::warn("establish_tls_tunnel(): Malformed request - assuming port 443.", log::IntValue("id", id_));
-        }
-        catch (std::invalid_argument)
-        {
-            log::warn("establish_tls_tunnel(): Malformed request - assuming port 443.", log::IntValue("id", id_));
-        }
+        tunnel_port = authority.substr(separator + 1);
+        authority = authority.substr(0, separator);
     }
 
-    //asio::ip::tcp::resolver::query query(host.toStdString(), port.toStdString());
+    host.assign(authority);
+    port.assign(tunnel_port);
+}
+
+void Transaction::establish_tls_tunnel()
+{
+    std::string host;
+    std::string port;
+    parse_tunnel_origin(host, port);
 
     auto self = sharedFromThis();
-    connection_pool_->try_open(host.toStdString(), port.toStdString(), [self](auto conn, auto ec)
+    connection_pool_->try_open(host, port, on_strand([self](auto conn, auto ec)
     {
         bool success = true;
         if (ec)
@@ -457,19 +1176,10 @@ void Transaction::establish_tls_tunnel()
             success = false;
         }
 
-        std::string responseText;
         if (success) {
             self->remote_ = conn;
-            responseText = "HTTP/1.1 200 OK\r\n"
-                           "Proxy-Agent: amanuensis 0.1.0\r\n"
-                           "\r\n";
-        } else {
-            responseText = "HTTP/1.1 400 Bad Request\r\n"
-                           "Proxy-Agent: amanuensis 0.1.0\r\n"
-                           "\r\n";
         }
 
-        std::lock_guard<std::mutex> lock{self->mutex_};
         if (self->client_ == nullptr)
         {
             log::error("Transaction::establish_tls_tunnel()<try_open>: client connection closed", log::IntValue("id", self->id_));
@@ -477,9 +1187,9 @@ void Transaction::establish_tls_tunnel()
             return;
         }
 
-        auto responseBuffer = std::make_shared<std::string>(responseText);
-        self->client_->async_write(*responseBuffer,
-                                   [self, ec, success, responseBuffer]
+        QByteArrayView reply(success ? kTunnelEstablished : kTunnelFailed);
+        self->client_->async_write(reply, self->on_strand(
+                                   [self, ec, success]
                                    (auto ec2, auto num_bytes_written)
         {
             (void) num_bytes_written;
@@ -495,141 +1205,561 @@ void Transaction::establish_tls_tunnel()
             if (localSuccess)
             {
                 // Time to start acting like a dumb pipe.
-                // We'll need a second buffer.
-                self->remote_buffer_ = std::make_unique<std::array<uint8_t, 8192>>();
-
-                self->send_client_request_via_tunnel();
-                self->send_server_response_via_tunnel();
+                self->relay_tunnel();
             }
             else
             {
                 // Failed to establish a remote tunnel, so fail.
                 self->notify_failure(ec);
             }
-        });
-    });
+        }));
+    }));
+}
+
+#if defined(AMA_USE_COROUTINES)
+
+asio::awaitable<void> CoroutineFlow::run(Transaction& tx)
+{
+    bool have_input = tx.take_pipelined_input();
+
+    // Read until we have the request head, and maybe some of its body.
+    auto state = HttpMessageParser::State::Incomplete;
+    while (true)
+    {
+        if (have_input)
+        {
+            state = tx.parse_request_head();
+            if (state != HttpMessageParser::State::Incomplete || tx.request_parse_phase_ >= ParsePhase::ReceivedHeaders)
+            {
+                break;
+            }
+        }
+
+        if (tx.client_ == nullptr)
+        {
+            log::error("CoroutineFlow::run(): local connection dropped before we could start?!", log::IntValue("id", tx.id_));
+            tx.notify_failure(ProxyError::ClientDisconnected);
+            co_return;
+        }
+
+        auto buffer = tx.change_messages([&] { return tx.request_view_.prepare(kReadSize); });
+        auto read = co_await await_read(*tx.client_, buffer);
+        if (read.ec == asio::error::eof)
+        {
+            tx.notify_failure(ProxyError::ClientDisconnected);
+            co_return;
+        }
+
+        if (read.ec)
+        {
+            tx.notify_failure(read.ec);
+            co_return;
+        }
+
+        tx.change_messages([&] { tx.request_view_.commit(static_cast<qsizetype>(read.size)); });
+        have_input = true;
+    }
+
+    if (state == HttpMessageParser::State::Invalid)
+    {
+        log::debug("CoroutineFlow::run() (parse: Invalid)", log::IntValue("id", tx.id_));
+        tx.notify_failure(ProxyError::MalformedRequest);
+        co_return;
+    }
+
+    if (state == HttpMessageParser::State::Valid)
+    {
+        if (tx.request_view_.method() == QByteArrayView("CONNECT"))
+        {
+            co_await run_tunnel(tx);
+            co_return;
+        }
+
+        tx.request_complete();
+    }
+    else if (state != HttpMessageParser::State::Incomplete)
+    {
+        tx.notify_failure(ProxyError::NetworkError);
+        co_return;
+    }
+
+    if (!tx.choose_remote_origin())
+    {
+        tx.notify_failure(ProxyError::MalformedRequest);
+        co_return;
+    }
+
+    tx.lease_pooled_connection();
+
+    // Each time round is one attempt at the exchange; we only go round
+    // again when a pooled connection turns out to have gone stale.
+    while (true)
+    {
+        if (tx.remote_ == nullptr)
+        {
+            auto opened = co_await await_open(*tx.connection_pool_, tx.remote_host_, tx.remote_port_);
+            if (opened.ec)
+            {
+                tx.notify_failure(opened.ec);
+                co_return;
+            }
+
+            tx.remote_ = opened.connection;
+            tx.remote_is_pooled_ = false;
+        }
+
+        auto segments = tx.request_view_.request_head_segments();
+        if (!tx.request_body_.isEmpty())
+        {
+            segments.push_back(tx.request_body_);
+        }
+
+        auto sent = co_await await_writev(*tx.remote_, std::move(segments));
+        if (sent.ec)
+        {
+            if (tx.discard_stale_connection(false))
+            {
+                continue;
+            }
+
+            tx.notify_failure(sent.ec);
+            co_return;
+        }
+
+        while (tx.request_parse_phase_ != ParsePhase::ReceivedFullMessage)
+        {
+            if (tx.continue_pending_)
+            {
+                tx.continue_pending_ = false;
+
+                auto written = co_await await_write(*tx.client_, QByteArrayView(kContinue));
+                if (written.ec)
+                {
+                    tx.notify_failure(written.ec);
+                    co_return;
+                }
+            }
+
+            tx.request_body_streamed_ = true;
+
+            auto read = co_await await_read(*tx.client_, tx.prepare_body_buffer(tx.request_sink_));
+            if (read.ec == asio::error::eof)
+            {
+                tx.notify_failure(ProxyError::ClientDisconnected);
+                co_return;
+            }
+
+            if (read.ec)
+            {
+                tx.notify_failure(read.ec);
+                co_return;
+            }
+
+            if (tx.parse_request_body(read.size) == HttpMessageParser::State::Invalid)
+            {
+                log::debug("CoroutineFlow::run() (request body: Invalid)", log::IntValue("id", tx.id_));
+                tx.notify_failure(ProxyError::MalformedRequest);
+                co_return;
+            }
+
+            if (!tx.request_body_.isEmpty())
+            {
+                auto written = co_await await_write(*tx.remote_, tx.request_body_);
+                if (written.ec)
+                {
+                    tx.notify_failure(written.ec);
+                    co_return;
+                }
+            }
+            tx.release_body_buffer();
+        }
+
+        tx.begin_response();
+
+        while (true)
+        {
+            bool reading_head = tx.response_parse_phase_ < ParsePhase::ReceivedHeaders;
+            auto read = co_await await_read(*tx.remote_, tx.prepare_response_buffer(reading_head));
+            if (read.ec && tx.discard_stale_connection(true))
+            {
+                break;
+            }
+
+            if (read.ec == asio::error::eof)
+            {
+                // Responses without a Content-Length or chunked encoding
+                // are terminated by the server closing the connection.
+                if (tx.parser_.finish() == HttpMessageParser::State::Valid)
+                {
+                    tx.do_notification(NotificationState::ResponseComplete);
+                    tx.complete_transaction();
+                    co_return;
+                }
+
+                tx.notify_failure(ProxyError::RemoteDisconnected);
+                co_return;
+            }
+
+            if (read.ec)
+            {
+                tx.notify_failure(read.ec);
+                co_return;
+            }
+
+            QByteArrayView consumed;
+            auto response_state = tx.parse_response(reading_head, read.size, consumed);
+            if (response_state != HttpMessageParser::State::Incomplete && response_state != HttpMessageParser::State::Valid)
+            {
+                tx.notify_failure(ProxyError::MalformedResponse);
+                co_return;
+            }
+
+            auto written = co_await await_write(*tx.client_, consumed);
+            tx.release_body_buffer();
+            if (written.ec)
+            {
+                tx.notify_failure(written.ec);
+                co_return;
+            }
+
+            if (response_state == HttpMessageParser::State::Valid)
+            {
+                tx.do_notification(NotificationState::ResponseComplete);
+                tx.complete_transaction();
+                co_return;
+            }
+        }
+    }
+}
+
+asio::awaitable<void> CoroutineFlow::run_tunnel(Transaction& tx)
+{
+    std::string host;
+    std::string port;
+    tx.parse_tunnel_origin(host, port);
+
+    auto opened = co_await await_open(*tx.connection_pool_, std::move(host), std::move(port));
+    if (!opened.ec)
+    {
+        tx.remote_ = opened.connection;
+    }
+
+    if (tx.client_ == nullptr)
+    {
+        log::error("CoroutineFlow::run_tunnel(): client connection closed", log::IntValue("id", tx.id_));
+        tx.notify_failure(ProxyError::ClientDisconnected);
+        co_return;
+    }
+
+    QByteArrayView reply(opened.ec ? kTunnelFailed : kTunnelEstablished);
+    auto written = co_await await_write(*tx.client_, reply);
+    if (written.ec)
+    {
+        log::warn("Failed to send CONNECT reply to client", log::StringValue("what", written.ec.message()));
+    }
+
+    if (opened.ec || written.ec)
+    {
+        tx.notify_failure(opened.ec ? opened.ec : written.ec);
+        co_return;
+    }
+
+    // Time to start acting like a dumb pipe.
+    tx.relay_tunnel();
+}
+
+asio::awaitable<std::error_code> CoroutineFlow::pump_tunnel(std::shared_ptr<IConnection> from,
+                                                            std::shared_ptr<IConnection> to,
+                                                            std::atomic<uint64_t>& relayed)
+{
+    while (true)
+    {
+        // Leased for one read and the write that relays it.
+        auto buffer = BufferPool::shared().acquire(kPooledReadSize);
+
+        auto read = co_await await_read(*from, QByteArrayView(buffer.data(), buffer.size()));
+        if (read.ec == asio::error::eof || (!read.ec && read.size == 0))
+        {
+            co_return std::error_code{};
+        }
+
+        if (read.ec)
+        {
+            co_return read.ec;
+        }
+
+        auto written = co_await await_write(*to, QByteArrayView(buffer.data(), static_cast<qsizetype>(read.size)));
+        if (written.ec)
+        {
+            co_return written.ec;
+        }
+
+        if (written.size != read.size)
+        {
+            co_return make_error_code(ProxyError::NetworkError);
+        }
+
+        relayed += written.size;
+    }
 }
 
-void Transaction::send_client_request_via_tunnel()
+#endif // AMA_USE_COROUTINES
+
+void Transaction::relay_tunnel()
 {
-    std::lock_guard<std::mutex> lock{mutex_};
     if (client_ == nullptr || remote_ == nullptr)
     {
-        log::error("Transaction::send_client_request_via_tunnel(): One end of the tunnel has closed", log::IntValue("id", id_));
+        log::error("Transaction::relay_tunnel(): One end of the tunnel has closed", log::IntValue("id", id_));
+        return;
+    }
+
+    auto self = sharedFromThis();
+
+    notification_state_ = NotificationState::TLSTunnel;
+    emit on_tunnel_progress(self);
+    report_tunnel_progress();
+
+    // Where the kernel can move the bytes from one socket to the other
+    // by itself, they needn't pass through here at all.
+    auto tunnel = SpliceTunnel::create(client_, remote_, tunnel_bytes_to_remote_, tunnel_bytes_to_client_);
+    if (tunnel != nullptr)
+    {
+        log::debug("Transaction::relay_tunnel() (splice)", log::IntValue("id", id_));
+
+        tunnel->start([self](std::error_code ec)
+        {
+            self->end_tunnel(ec);
+        });
         return;
     }
 
+    // Each direction leases buffers of its own and holds on to its own
+    // references to the connections, so the two don't need the strand,
+    // and run concurrently.
+#if defined(AMA_USE_COROUTINES)
+    auto& context = connection_pool_->context();
+    auto done = [self](std::exception_ptr, std::error_code ec)
+    {
+        self->end_tunnel(ec);
+    };
+    asio::co_spawn(context, CoroutineFlow::pump_tunnel(client_, remote_, tunnel_bytes_to_remote_), done);
+    asio::co_spawn(context, CoroutineFlow::pump_tunnel(remote_, client_, tunnel_bytes_to_client_), done);
+#else
+    send_client_request_via_tunnel(client_, remote_);
+    send_server_response_via_tunnel(remote_, client_);
+#endif
+}
+
+void Transaction::send_client_request_via_tunnel(const std::shared_ptr<IConnection>& client, const std::shared_ptr<IConnection>& remote)
+{
     auto self = sharedFromThis();
-    client_->async_read(read_buffer_, [self](auto ec, size_t num_bytes_read)
+    to_remote_buffer_ = BufferPool::shared().acquire(kPooledReadSize);
+    client->async_read(QByteArrayView(to_remote_buffer_.data(), to_remote_buffer_.size()), [self, client, remote](auto ec, size_t num_bytes_read)
     {
         if (ec == asio::error::eof || num_bytes_read == 0)
         {
             // finished normally?
-            self->release_connections();
+            self->to_remote_buffer_.reset();
+            self->end_tunnel({});
             return;
         }
 
         if (ec)
         {
             // finish abnormally.
-            self->notify_failure(ec);
+            self->to_remote_buffer_.reset();
+            self->end_tunnel(ec);
             return;
         }
 
-        std::lock_guard<std::mutex> lock{self->mutex_};
-        if (self->remote_ == nullptr)
+        QByteArrayView sendBuffer(self->to_remote_buffer_.data(), num_bytes_read);
+        remote->async_write(sendBuffer, [self, client, remote, num_bytes_read](auto ec, size_t num_bytes_written)
         {
-            log::error("Transaction::send_client_request_via_tunnel(): tunnel is closed", log::IntValue("id", self->id_));
-            return;
-        }
+            self->to_remote_buffer_.reset();
 
-        QByteArrayView sendBuffer(self->read_buffer_.data(), num_bytes_read);
-        self->remote_->async_write(sendBuffer, [self, num_bytes_read](auto ec, size_t num_bytes_written)
-        {
             if (ec)
             {
                 // Fail
-                self->notify_failure(ec);
+                self->end_tunnel(ec);
                 return;
             }
 
             if (num_bytes_read != num_bytes_written)
             {
-                self->notify_failure(ProxyError::NetworkError);
+                self->end_tunnel(ProxyError::NetworkError);
                 return;
             }
 
+            self->tunnel_bytes_to_remote_ += num_bytes_written;
+
             // loop
-            self->send_client_request_via_tunnel();
+            self->send_client_request_via_tunnel(client, remote);
         });
     });
 }
 
-void Transaction::send_server_response_via_tunnel()
+void Transaction::send_server_response_via_tunnel(const std::shared_ptr<IConnection>& remote, const std::shared_ptr<IConnection>& client)
 {
-    std::lock_guard<std::mutex> lock{mutex_};
-    if (client_ == nullptr || remote_ == nullptr)
-    {
-        log::error("Transaction::send_server_response_via_tunnel(): One end of the tunnel is closed", log::IntValue("id", id_));
-        return;
-    }
-
     auto self = sharedFromThis();
-    remote_->async_read(*remote_buffer_, [self](auto ec, size_t num_bytes_read)
+    to_client_buffer_ = BufferPool::shared().acquire(kPooledReadSize);
+    remote->async_read(QByteArrayView(to_client_buffer_.data(), to_client_buffer_.size()), [self, remote, client](auto ec, size_t num_bytes_read)
     {
         if (ec == asio::error::eof || num_bytes_read == 0)
         {
             // finished normally?
-            self->release_connections();
+            self->to_client_buffer_.reset();
+            self->end_tunnel({});
             return;
         }
 
         if (ec)
         {
             // finish abnormally.
-            self->notify_failure(ec);
+            self->to_client_buffer_.reset();
+            self->end_tunnel(ec);
             return;
         }
 
-        std::lock_guard<std::mutex> lock{self->mutex_};
-        if (self->client_ == nullptr)
+        QByteArrayView sendBuffer(self->to_client_buffer_.data(), num_bytes_read);
+        client->async_write(sendBuffer, [self, remote, client, num_bytes_read](auto ec, size_t num_bytes_written)
         {
-            log::error("Transaction::send_server_response_via_tunnel(): tunnel is closed", log::IntValue("id", self->id_));
-            return;
-        }
+            self->to_client_buffer_.reset();
 
-        QByteArrayView sendBuffer(self->remote_buffer_->data(), num_bytes_read);
-        self->client_->async_write(sendBuffer, [self, num_bytes_read](auto ec, size_t num_bytes_written)
-        {
             if (ec)
             {
                 // Fail
-                self->notify_failure(ec);
+                self->end_tunnel(ec);
                 return;
             }
 
             if (num_bytes_read != num_bytes_written)
             {
-                self->notify_failure(ProxyError::NetworkError);
+                self->end_tunnel(ProxyError::NetworkError);
                 return;
             }
 
+            self->tunnel_bytes_to_client_ += num_bytes_written;
+
             // loop
-            self->send_server_response_via_tunnel();
+            self->send_server_response_via_tunnel(remote, client);
         });
     });
 }
 
+void Transaction::report_tunnel_progress()
+{
+    auto self = sharedFromThis();
+    auto to_remote = tunnel_bytes_to_remote_.load();
+    auto to_client = tunnel_bytes_to_client_.load();
+
+    tunnel_progress_timer_.expires_after(kTunnelProgressInterval);
+    tunnel_progress_timer_.async_wait([self, to_remote, to_client](std::error_code ec)
+    {
+        if (ec || self->complete_)
+        {
+            return;
+        }
+
+        if (self->tunnel_bytes_to_remote_ != to_remote || self->tunnel_bytes_to_client_ != to_client)
+        {
+            emit self->on_tunnel_progress(self);
+        }
+
+        self->report_tunnel_progress();
+    });
+}
+
+void Transaction::end_tunnel(std::error_code ec)
+{
+    // Both directions of a tunnel end up here, from whichever threads they
+    // were on - the second usually with the error from the first having
+    // closed the connections.  Back on the strand, only the first counts.
+    auto self = sharedFromThis();
+    asio::dispatch(strand_, [self, ec]
+    {
+        if (self->client_ == nullptr && self->remote_ == nullptr)
+        {
+            return;
+        }
+
+        self->tunnel_progress_timer_.cancel();
+
+        if (ec)
+        {
+            self->notify_failure(ec);
+            return;
+        }
+
+        self->complete_transaction();
+    });
+}
+
 void Transaction::complete_transaction()
 {
+    if (complete_)
+    {
+        return;
+    }
+    complete_ = true;
+
+    std::shared_ptr<IConnection> client;
+    if (can_persist())
+    {
+        client = std::move(client_);
+        connection_pool_->release_connection(remote_host_, port_number(remote_port_), "http", std::move(remote_));
+    }
+
     release_connections();
+    release_body_buffer();
     emit on_transaction_complete(sharedFromThis());
+
+    if (client != nullptr)
+    {
+        if (!next_request_input_.isEmpty())
+        {
+            // The next request has already begun to arrive; there's
+            // nothing to wait for.
+            log::debug("Transaction::complete_transaction() (pipelined request pending)", log::IntValue("id", id_));
+            emit on_next_request_pending(client, std::exchange(next_request_input_, QByteArray()));
+        }
+        else
+        {
+            wait_for_next_request(client);
+        }
+    }
 }
 
-void Transaction::release_connections()
+bool Transaction::can_persist() const
+{
+    return notification_state_ == NotificationState::ResponseComplete
+            && request_can_persist(request_view_)
+            && response_can_persist(response_view_);
+}
+
+void Transaction::wait_for_next_request(const std::shared_ptr<IConnection>& client)
 {
-    std::lock_guard<std::mutex> lock{mutex_};
+    log::debug("Transaction::wait_for_next_request()", log::IntValue("id", id_));
+
+    auto self = sharedFromThis();
+    client->async_wait_readable(on_strand([self, client](auto ec, size_t num_available)
+    {
+        if (ec || num_available == 0)
+        {
+            // The client hung up instead of sending another request, which
+            // is how persistent connections normally end.
+            log::debug("Transaction::wait_for_next_request() (client closed)", log::IntValue("id", self->id_));
+
+            std::error_code ignored;
+            client->close(ignored);
+            return;
+        }
 
+        emit self->on_next_request_pending(client, QByteArray());
+    }));
+}
+
+void Transaction::release_connections()
+{
     if (client_ != nullptr)
     {
         std::error_code ec;
@@ -720,8 +1850,9 @@ void Transaction::do_notification(NotificationState ns)
             // nothing
             break;
         case NotificationState::ResponseComplete:
+            // on_transaction_complete follows from complete_transaction(),
+            // once the connections are dealt with.
             emit on_response_read(self);
-            emit on_transaction_complete(self);
             break;
         case NotificationState::TLSTunnel:
             // nothing
@@ -736,6 +1867,11 @@ void Transaction::do_notification(NotificationState ns)
 
 void Transaction::notify_failure(std::error_code ec)
 {
+    if (complete_)
+    {
+        return;
+    }
+
     release_connections();
 
     error_ = ec;
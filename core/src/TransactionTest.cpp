@@ -0,0 +1,188 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "TransactionTest.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include <QSharedPointer>
+#include <QtTest>
+
+#include <asio.hpp>
+
+#include "core/ConnectionPool.h"
+#include "core/Transaction.h"
+
+using namespace ama;
+
+using tcp = asio::ip::tcp;
+
+namespace {
+
+// An origin that hangs up on the first request it is sent, without
+// answering, as a server timing out an idle connection just as a request
+// arrives would.  Requests on later connections get an empty response.
+class DroppingOrigin
+{
+public:
+    explicit DroppingOrigin(asio::io_context& context)
+        : acceptor_(context, tcp::endpoint(asio::ip::address_v4::loopback(), 0))
+    {
+        accept();
+    }
+
+    int port() const
+    {
+        return acceptor_.local_endpoint().port();
+    }
+
+    int requests = 0;
+
+private:
+    struct Session
+    {
+        explicit Session(tcp::socket&& s) : socket(std::move(s)) {}
+
+        tcp::socket socket;
+        std::string received;
+        char buffer[1024];
+    };
+
+    void accept()
+    {
+        acceptor_.async_accept([this](std::error_code ec, tcp::socket socket)
+        {
+            if (ec)
+            {
+                return;
+            }
+
+            read(std::make_shared<Session>(std::move(socket)));
+            accept();
+        });
+    }
+
+    void read(std::shared_ptr<Session> session)
+    {
+        session->socket.async_read_some(asio::buffer(session->buffer), [this, session](std::error_code ec, size_t n)
+        {
+            if (ec)
+            {
+                return;
+            }
+
+            session->received.append(session->buffer, n);
+            if (session->received.find("\r\n\r\n") == std::string::npos)
+            {
+                read(session);
+                return;
+            }
+
+            if (requests++ == 0)
+            {
+                session->socket.close();
+                return;
+            }
+
+            static const char kResponse[] = "HTTP/1.1 204 No Content\r\n\r\n";
+            asio::async_write(session->socket, asio::buffer(kResponse, sizeof(kResponse) - 1), [session](std::error_code, size_t) {});
+        });
+    }
+
+    tcp::acceptor acceptor_;
+};
+
+struct Outcome
+{
+    bool failed = false;
+    bool completed = false;
+};
+
+// Proxies @p request to @p origin over a connection that was sitting in the
+// pool, and runs the exchange to its end.
+Outcome proxy_over_pooled_connection(asio::io_context& context, ConnectionPool& pool, DroppingOrigin& origin, const std::string& request)
+{
+    tcp::acceptor listener(context, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    tcp::socket client(context);
+    client.connect(listener.local_endpoint());
+    auto client_connection = pool.make_connection(listener.accept());
+
+    tcp::socket idle(context);
+    idle.connect(tcp::endpoint(asio::ip::address_v4::loopback(), static_cast<unsigned short>(origin.port())));
+    pool.release_connection("127.0.0.1", origin.port(), "http", pool.make_connection(std::move(idle)));
+
+    asio::write(client, asio::buffer(request));
+
+    Outcome outcome;
+    auto tx = QSharedPointer<Transaction>::create(1, &pool, client_connection);
+    QObject::connect(tx.get(), &Transaction::on_transaction_failed, [&outcome](const QSharedPointer<Transaction>&)
+    {
+        outcome.failed = true;
+    });
+    QObject::connect(tx.get(), &Transaction::on_transaction_complete, [&outcome, &context](const QSharedPointer<Transaction>&)
+    {
+        outcome.completed = true;
+        context.stop();
+    });
+
+    tx->begin();
+    context.run_for(std::chrono::seconds(5));
+    return outcome;
+}
+
+std::string make_request(const std::string& method, int port)
+{
+    auto host = "127.0.0.1:" + std::to_string(port);
+    return method + " http://" + host + "/ HTTP/1.1\r\n"
+            "Host: " + host + "\r\n"
+            "Content-Length: 2\r\n"
+            "\r\n"
+            "hi";
+}
+
+} // namespace
+
+void TransactionTest::idempotent_request_is_retried_on_a_new_connection()
+{
+    asio::io_context context;
+    ConnectionPool pool(context);
+    DroppingOrigin origin(context);
+
+    auto outcome = proxy_over_pooled_connection(context, pool, origin, make_request("PUT", origin.port()));
+    QVERIFY(outcome.completed);
+    QVERIFY(!outcome.failed);
+    QCOMPARE(origin.requests, 2);
+}
+
+void TransactionTest::post_is_not_replayed_on_a_new_connection()
+{
+    asio::io_context context;
+    ConnectionPool pool(context);
+    DroppingOrigin origin(context);
+
+    // The origin may have acted on the request before it hung up, so it
+    // mustn't see it a second time.
+    auto outcome = proxy_over_pooled_connection(context, pool, origin, make_request("POST", origin.port()));
+    QVERIFY(outcome.completed);
+    QVERIFY(outcome.failed);
+    QCOMPARE(origin.requests, 1);
+}
+
+QTEST_GUILESS_MAIN(TransactionTest)
@@ -0,0 +1,214 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "DaemonConfig.h"
+
+#include <QCommandLineOption>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QSettings>
+
+#include <memory>
+
+namespace ama {
+
+namespace {
+
+bool parse_int(const QString& text, int min, int max, int& result)
+{
+    bool ok = false;
+    int value = text.toInt(&ok);
+    if (!ok || value < min || value > max)
+    {
+        return false;
+    }
+
+    result = value;
+    return true;
+}
+
+bool parse_mode(const QString& text, CapturePolicy::Mode& mode)
+{
+    auto name = text.toLower();
+    if (name == QStringLiteral("memory"))
+    {
+        mode = CapturePolicy::Mode::Memory;
+    }
+    else if (name == QStringLiteral("count"))
+    {
+        mode = CapturePolicy::Mode::Count;
+    }
+    else if (name == QStringLiteral("hash"))
+    {
+        mode = CapturePolicy::Mode::Hash;
+    }
+    else if (name == QStringLiteral("spill"))
+    {
+        mode = CapturePolicy::Mode::Spill;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+bool parse_backend(const QString& text, IoBackend& backend)
+{
+    auto name = text.toLower();
+    if (name == QStringLiteral("reactor"))
+    {
+        backend = IoBackend::Reactor;
+    }
+    else if (name == QStringLiteral("io_uring"))
+    {
+        backend = IoBackend::IoUring;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+bool parse_severity(const QString& text, log::Severity& severity)
+{
+    auto name = text.toLower();
+    if (name == QStringLiteral("verbose"))
+    {
+        severity = log::Severity::Verbose;
+    }
+    else if (name == QStringLiteral("debug"))
+    {
+        severity = log::Severity::Debug;
+    }
+    else if (name == QStringLiteral("info"))
+    {
+        severity = log::Severity::Info;
+    }
+    else if (name == QStringLiteral("warn"))
+    {
+        severity = log::Severity::Warn;
+    }
+    else if (name == QStringLiteral("error"))
+    {
+        severity = log::Severity::Error;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+bool load_config(const QCoreApplication& app, DaemonConfig& config, QString& error)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Runs the Amanuensis proxy without a UI, streaming what passes through it to a file.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+
+    QCommandLineOption configOption({"c", "config"}, "Read settings from the INI file <file>.", "file");
+    QCommandLineOption portOption({"p", "port"}, "Listen on <port> (default 9998).", "port");
+    QCommandLineOption threadsOption({"t", "threads"}, "Run I/O on <n> threads (default: one fewer than the hardware has, but at least four).", "n");
+    QCommandLineOption backendOption("io-backend", "Drive sockets with asio's reactor, or with io_uring where the kernel supports it: reactor or io_uring (default reactor).", "backend");
+    QCommandLineOption captureOption("capture", "Keep bodies in memory, count them, hash them, or spill large ones to temporary files: memory, count, hash or spill (default count).", "policy");
+    QCommandLineOption spillOption("spill-threshold", "With --capture spill, move bodies larger than <bytes> to temporary files (default 1048576).", "bytes");
+    QCommandLineOption outputOption({"o", "output"}, "Write each transaction to <file> as a line of JSON.", "file");
+    QCommandLineOption logOption("log-level", "Log at <level> and above: verbose, debug, info, warn or error (default info).", "level");
+
+    parser.addOptions({configOption, portOption, threadsOption, backendOption, captureOption, spillOption, outputOption, logOption});
+    parser.process(app);
+
+    std::unique_ptr<QSettings> settings;
+    if (parser.isSet(configOption))
+    {
+        auto path = parser.value(configOption);
+        if (!QFileInfo(path).isReadable())
+        {
+            error = QString("cannot read config file %1").arg(path);
+            return false;
+        }
+
+        settings = std::make_unique<QSettings>(path, QSettings::IniFormat);
+        if (settings->status() != QSettings::NoError)
+        {
+            error = QString("cannot parse config file %1").arg(path);
+            return false;
+        }
+    }
+
+    // The command line, then the file, then the default.
+    auto setting = [&](const QCommandLineOption& option, const QString& key) {
+        if (parser.isSet(option))
+        {
+            return parser.value(option);
+        }
+        return settings != nullptr ? settings->value(key).toString() : QString();
+    };
+
+    if (auto text = setting(portOption, "Proxy/port"); !text.isEmpty() && !parse_int(text, 1, 65535, config.port))
+    {
+        error = QString("invalid port: %1").arg(text);
+        return false;
+    }
+
+    if (auto text = setting(threadsOption, "Proxy/threads"); !text.isEmpty() && !parse_int(text, 0, 1024, config.threads))
+    {
+        error = QString("invalid thread count: %1").arg(text);
+        return false;
+    }
+
+    if (auto text = setting(backendOption, "Proxy/io_backend"); !text.isEmpty() && !parse_backend(text, config.io_backend))
+    {
+        error = QString("invalid I/O backend: %1").arg(text);
+        return false;
+    }
+
+    if (auto text = setting(captureOption, "Capture/policy"); !text.isEmpty() && !parse_mode(text, config.capture.mode))
+    {
+        error = QString("invalid capture policy: %1").arg(text);
+        return false;
+    }
+
+    if (auto text = setting(spillOption, "Capture/spill_threshold"); !text.isEmpty())
+    {
+        bool ok = false;
+        auto threshold = text.toLongLong(&ok);
+        if (!ok || threshold <= 0)
+        {
+            error = QString("invalid spill threshold: %1").arg(text);
+            return false;
+        }
+        config.capture.spill_threshold = threshold;
+    }
+
+    config.output = setting(outputOption, "Capture/output");
+
+    if (auto text = setting(logOption, "Log/level"); !text.isEmpty() && !parse_severity(text, config.log_level))
+    {
+        error = QString("invalid log level: %1").arg(text);
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace ama
@@ -0,0 +1,63 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "core/BodySink.h"
+#include "core/Server.h"
+
+#include "log/Log.h"
+
+#include <QString>
+
+class QCoreApplication;
+
+namespace ama {
+
+/**
+ * @brief How amanuensisd runs, read from its command line and, optionally,
+ *        an INI file; where both give a setting, the command line wins.
+ */
+struct DaemonConfig
+{
+    int port = 9998;
+
+    // Zero means as many as the hardware suggests.
+    int threads = 0;
+
+    IoBackend io_backend = IoBackend::Reactor;
+
+    CapturePolicy capture = CapturePolicy{CapturePolicy::Mode::Count};
+
+    // Where captures are written, one JSON object per line; nothing is
+    // written if empty.
+    QString output;
+
+    log::Severity log_level = log::Severity::Info;
+};
+
+/**
+ * @brief Reads the configuration of @p app into @p config.
+ *
+ * Exits the process after printing help or the version, if either was
+ * asked for, as QCommandLineParser does.
+ *
+ * @return false, with a description in @p error, if a setting is invalid.
+ */
+bool load_config(const QCoreApplication& app, DaemonConfig& config, QString& error);
+
+} // namespace ama
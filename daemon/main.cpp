@@ -0,0 +1,130 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "DaemonConfig.h"
+
+#include "core/CaptureWriter.h"
+#include "core/Proxy.h"
+#include "core/Transaction.h"
+
+#include "log/Log.h"
+#include "log/StderrLogWriter.h"
+
+#include <QCoreApplication>
+#include <QSharedPointer>
+
+#include <asio.hpp>
+
+#include <csignal>
+#include <iostream>
+#include <memory>
+#include <system_error>
+
+using namespace ama;
+
+namespace {
+
+/**
+ * @brief Writes @p tx to @p captures once it has finished, one way or another.
+ */
+void capture_when_complete(const QSharedPointer<Transaction>& tx, CaptureWriter& captures)
+{
+    QObject::connect(tx.get(), &Transaction::on_transaction_complete, tx.get(), [&captures](const QSharedPointer<Transaction>& tx) {
+        captures.write(CaptureRecord::of(*tx));
+    }, Qt::DirectConnection);
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication::setOrganizationName("Amanuensis");
+    QCoreApplication::setOrganizationDomain("bendb.com");
+    QCoreApplication::setApplicationName("amanuensisd");
+    QCoreApplication::setApplicationVersion("0.1.0");
+
+    // The application object gives us arguments and settings; we never
+    // run its event loop, as everything the proxy does happens on its
+    // own I/O threads.
+    QCoreApplication app(argc, argv);
+
+    DaemonConfig config;
+    QString error;
+    if (!load_config(app, config, error))
+    {
+        std::cerr << "amanuensisd: " << error.toStdString() << std::endl;
+        return 2;
+    }
+
+    log::register_log_writer(std::make_shared<log::StderrLogWriter>());
+    log::set_min_severity(config.log_level);
+
+    // Listen for signals before the proxy starts, so that none can slip
+    // by unnoticed.  The proxy's own server hears them too, and stops.
+    asio::io_context signal_context;
+    asio::signal_set stop_signals(signal_context, SIGINT, SIGTERM);
+    stop_signals.async_wait([](const std::error_code&, int number) {
+        log::info("amanuensisd: stopping", log::IntValue("signal", number));
+    });
+
+    // Outlives the proxy, so that no transaction can be captured after it closes.
+    CaptureWriter captures;
+    if (!config.output.isEmpty())
+    {
+        if (auto ec = captures.open(config.output))
+        {
+            std::cerr << "amanuensisd: cannot write to " << config.output.toStdString() << ": " << ec.message() << std::endl;
+            return 1;
+        }
+    }
+
+    try
+    {
+        Proxy proxy(config.port, config.threads, config.io_backend);
+        proxy.set_dispatch(Proxy::Dispatch::IoThread);
+        proxy.set_capture_policy(config.capture);
+
+        if (captures.is_open())
+        {
+            QObject::connect(&proxy, &Proxy::transactionStarted, &proxy, [&captures](const QSharedPointer<Transaction>& tx) {
+                capture_when_complete(tx, captures);
+            }, Qt::DirectConnection);
+        }
+
+        proxy.init();
+
+        log::info("amanuensisd: listening", log::IntValue("port", config.port));
+
+        signal_context.run();
+    }
+    catch (const std::system_error& e)
+    {
+        std::cerr << "amanuensisd: cannot run the proxy on port " << config.port << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    captures.close();
+
+    if (auto ec = captures.error())
+    {
+        std::cerr << "amanuensisd: cannot write to " << config.output.toStdString() << ": " << ec.message() << std::endl;
+        return 1;
+    }
+
+    log::info("amanuensisd: stopped", log::U64Value("records", captures.records()));
+    return 0;
+}
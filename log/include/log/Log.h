@@ -203,6 +203,12 @@ public:
 
 void register_log_writer(std::shared_ptr<ILogWriter>&& writer);
 
+/**
+ * @brief Sets the least severe level that is logged; events below it are
+ *        dropped before anything is formatted.  The default is Debug.
+ */
+void set_min_severity(Severity severity);
+
 /**
  * @brief is_trace_enabled
  * @param severity
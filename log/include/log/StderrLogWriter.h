@@ -0,0 +1,36 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "log/Log.h"
+
+namespace ama::log {
+
+/**
+ * @brief Writes each event as a line on standard error, for processes
+ *        without a UI or a platform log to send them to.
+ */
+class StderrLogWriter : public ILogWriter
+{
+public:
+    StderrLogWriter();
+
+    void write(Severity severity, const char* message, const ILogValue& value) override;
+};
+
+}
@@ -74,6 +74,11 @@ void register_log_writer(std::shared_ptr<ILogWriter>&& writer)
     g_writer = std::move(writer);
 }
 
+void set_min_severity(Severity severity)
+{
+    g_min_severity = severity;
+}
+
 bool is_enabled_for_severity(Severity severity)
 {
     return g_min_severity <= severity;
@@ -0,0 +1,59 @@
+// Amanuensis - Web Traffic Inspector
+//
+// Copyright (C) 2022 Benjamin Bader
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "log/StderrLogWriter.h"
+
+#include "log/StringStreamLogValueVisitor.h"
+
+#include <cstdio>
+#include <string>
+
+namespace ama::log {
+
+namespace {
+
+const char* severity_label(Severity severity)
+{
+    switch (severity)
+    {
+    case Severity::Verbose: return "V";
+    case Severity::Debug:   return "D";
+    case Severity::Info:    return "I";
+    case Severity::Warn:    return "W";
+    case Severity::Error:   return "E";
+    case Severity::Fatal:   return "F";
+    }
+    return "?";
+}
+
+}
+
+StderrLogWriter::StderrLogWriter()
+{
+}
+
+void StderrLogWriter::write(Severity severity, const char *message, const ILogValue &value)
+{
+    StringStreamLogValueVisitor visitor;
+    value.accept(visitor);
+
+    // One call per event, so that lines from different threads don't
+    // interleave; the visitor ends the line.
+    std::fprintf(stderr, "%s %s %s", severity_label(severity), message, visitor.str().c_str());
+}
+
+} // ama::log